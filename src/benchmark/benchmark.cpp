@@ -0,0 +1,658 @@
+#include "openclhelper.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "potential.h"
+#include "cubicgrid.h"
+#include "clparser.h"
+#include "world.h"
+#include "rand.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QStringList>
+#include <QDateTime>
+#include <QFile>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+
+#if __cplusplus >= 201103L
+#define LANGMUIR_THROW_BAD_ALLOC
+#define LANGMUIR_NO_THROW noexcept
+#else
+#define LANGMUIR_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define LANGMUIR_NO_THROW throw()
+#endif
+
+using namespace Langmuir;
+
+// Every heap allocation in the process goes through here, so a benchmark can
+// report allocations per operation.  The benchmarks run on the main thread only.
+static unsigned long long allocationCount = 0;
+
+void* operator new(std::size_t size) LANGMUIR_THROW_BAD_ALLOC
+{
+    ++allocationCount;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if (p == 0)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size) LANGMUIR_THROW_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) LANGMUIR_NO_THROW
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) LANGMUIR_NO_THROW
+{
+    std::free(p);
+}
+
+// Results are summed here so the compiler can not discard the work
+static volatile double benchmarkSink = 0;
+
+/**
+ * @brief A single microbenchmark
+ *
+ * setUp() is called before every repetition and is not timed.  run() performs
+ * operations() operations and is timed.
+ */
+class Benchmark
+{
+public:
+    Benchmark(const QString& name) : m_name(name)
+    {
+    }
+
+    virtual ~Benchmark()
+    {
+    }
+
+    virtual void setUp()
+    {
+    }
+
+    virtual void run() = 0;
+
+    virtual int operations() = 0;
+
+    const QString& name() const
+    {
+        return m_name;
+    }
+
+    const QStringList& config() const
+    {
+        return m_config;
+    }
+
+    void addConfig(const QString& key, double value)
+    {
+        m_config.push_back(QString("\"%1\": %2").arg(key).arg(value));
+    }
+
+protected:
+    QString m_name;
+    QStringList m_config;
+};
+
+/**
+ * @brief Timings collected for one Benchmark
+ */
+struct BenchmarkResult
+{
+    QString name;
+    QStringList config;
+    int operations;
+    QList<double> nsPerOp;
+    QList<double> allocsPerOp;
+};
+
+static double mean(const QList<double>& values)
+{
+    double sum = 0;
+    foreach (double value, values)
+    {
+        sum += value;
+    }
+    return values.size() > 0 ? sum / values.size() : 0;
+}
+
+static double stddev(const QList<double>& values)
+{
+    if (values.size() < 2)
+    {
+        return 0;
+    }
+    double m = mean(values);
+    double sum = 0;
+    foreach (double value, values)
+    {
+        sum += (value - m) * (value - m);
+    }
+    return sqrt(sum / (values.size() - 1));
+}
+
+static double median(QList<double> values)
+{
+    if (values.size() == 0)
+    {
+        return 0;
+    }
+    qSort(values);
+    int n = values.size();
+    if (n % 2 == 0)
+    {
+        return 0.5 * (values.at(n / 2 - 1) + values.at(n / 2));
+    }
+    return values.at(n / 2);
+}
+
+static double minimum(const QList<double>& values)
+{
+    if (values.size() == 0)
+    {
+        return 0;
+    }
+    return *std::min_element(values.begin(), values.end());
+}
+
+static BenchmarkResult measure(Benchmark& benchmark, int repeats)
+{
+    BenchmarkResult result;
+    result.name = benchmark.name();
+    result.config = benchmark.config();
+    result.operations = benchmark.operations();
+
+    // Warm up caches and lazily allocated buffers
+    benchmark.setUp();
+    benchmark.run();
+
+    for (int i = 0; i < repeats; i++)
+    {
+        benchmark.setUp();
+
+        unsigned long long allocations = allocationCount;
+        QElapsedTimer timer;
+        timer.start();
+
+        benchmark.run();
+
+        qint64 elapsed = timer.nsecsElapsed();
+        allocations = allocationCount - allocations;
+
+        result.nsPerOp.push_back(double(elapsed) / result.operations);
+        result.allocsPerOp.push_back(double(allocations) / result.operations);
+    }
+
+    qDebug("langmuir: %-32s %-48s %14.2f ns/op %10.3f allocs/op",
+           qPrintable(result.name),
+           qPrintable(result.config.join(", ").remove('"')),
+           median(result.nsPerOp),
+           mean(result.allocsPerOp));
+
+    return result;
+}
+
+static QVector<int> randomSites(World& world, int count)
+{
+    QVector<int> sites(count);
+    for (int i = 0; i < count; i++)
+    {
+        sites[i] = world.randomNumberGenerator().integer(0, world.electronGrid().volume() - 1);
+    }
+    return sites;
+}
+
+class NeighborsSiteBenchmark : public Benchmark
+{
+public:
+    NeighborsSiteBenchmark(World& world, int hoppingRange, int count)
+        : Benchmark("grid.neighborsSite"), m_world(world), m_hoppingRange(hoppingRange)
+    {
+        m_sites = randomSites(world, count);
+        addConfig("hopping.range", hoppingRange);
+    }
+
+    virtual void run()
+    {
+        int sum = 0;
+        for (int i = 0; i < m_sites.size(); i++)
+        {
+            sum += m_world.electronGrid().neighborsSite(m_sites[i], m_hoppingRange).size();
+        }
+        benchmarkSink += sum;
+    }
+
+    virtual int operations()
+    {
+        return m_sites.size();
+    }
+
+private:
+    World& m_world;
+    int m_hoppingRange;
+    QVector<int> m_sites;
+};
+
+class GetIndexBenchmark : public Benchmark
+{
+public:
+    GetIndexBenchmark(World& world, int count)
+        : Benchmark("grid.getIndexXYZ"), m_world(world)
+    {
+        m_sites = randomSites(world, count);
+    }
+
+    virtual void run()
+    {
+        Grid& grid = m_world.electronGrid();
+        int sum = 0;
+        for (int i = 0; i < m_sites.size(); i++)
+        {
+            sum += grid.getIndexX(m_sites[i]) + grid.getIndexY(m_sites[i]) + grid.getIndexZ(m_sites[i]);
+        }
+        benchmarkSink += sum;
+    }
+
+    virtual int operations()
+    {
+        return m_sites.size();
+    }
+
+private:
+    World& m_world;
+    QVector<int> m_sites;
+};
+
+class PotentialBenchmark : public Benchmark
+{
+public:
+    PotentialBenchmark(World& world, bool gauss, int count)
+        : Benchmark(gauss ? "potential.gaussE" : "potential.coulombE"), m_world(world), m_gauss(gauss)
+    {
+        m_sites = randomSites(world, count);
+        addConfig("carriers", world.numElectronAgents());
+        addConfig("electrostatic.cutoff", world.parameters().electrostaticCutoff);
+    }
+
+    virtual void run()
+    {
+        double sum = 0;
+        if (m_gauss)
+        {
+            for (int i = 0; i < m_sites.size(); i++)
+            {
+                sum += m_world.potential().gaussE(m_sites[i]);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < m_sites.size(); i++)
+            {
+                sum += m_world.potential().coulombE(m_sites[i]);
+            }
+        }
+        benchmarkSink += sum;
+    }
+
+    virtual int operations()
+    {
+        return m_sites.size();
+    }
+
+private:
+    World& m_world;
+    bool m_gauss;
+    QVector<int> m_sites;
+};
+
+class RandomIntegerBenchmark : public Benchmark
+{
+public:
+    RandomIntegerBenchmark(World& world, int high, int count)
+        : Benchmark("random.integer"), m_world(world), m_high(high), m_count(count)
+    {
+        addConfig("high", high);
+    }
+
+    virtual void run()
+    {
+        int sum = 0;
+        for (int i = 0; i < m_count; i++)
+        {
+            sum += m_world.randomNumberGenerator().integer(0, m_high);
+        }
+        benchmarkSink += sum;
+    }
+
+    virtual int operations()
+    {
+        return m_count;
+    }
+
+private:
+    World& m_world;
+    int m_high;
+    int m_count;
+};
+
+class MetropolisBenchmark : public Benchmark
+{
+public:
+    MetropolisBenchmark(World& world, int count)
+        : Benchmark("random.metropolisWithCoupling"), m_world(world)
+    {
+        m_energies.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            m_energies[i] = world.randomNumberGenerator().range(-0.1, 0.1);
+        }
+    }
+
+    virtual void run()
+    {
+        double inverseKT = m_world.parameters().inverseKT;
+        double coupling = m_world.couplingConstants()[1][0][0];
+        int sum = 0;
+        for (int i = 0; i < m_energies.size(); i++)
+        {
+            sum += m_world.randomNumberGenerator().metropolisWithCoupling(m_energies[i], inverseKT, coupling);
+        }
+        benchmarkSink += sum;
+    }
+
+    virtual int operations()
+    {
+        return m_energies.size();
+    }
+
+private:
+    World& m_world;
+    QVector<double> m_energies;
+};
+
+class DecideFutureBenchmark : public Benchmark
+{
+public:
+    DecideFutureBenchmark(World& world)
+        : Benchmark("chargeagent.decideFuture"), m_world(world)
+    {
+        addConfig("carriers", world.numElectronAgents());
+        addConfig("hopping.range", world.parameters().hoppingRange);
+    }
+
+    virtual void setUp()
+    {
+        // Propose new sites; completeTick is never called, so nothing moves
+        foreach (ChargeAgent *charge, m_world.electrons())
+        {
+            charge->chooseFuture();
+        }
+    }
+
+    virtual void run()
+    {
+        foreach (ChargeAgent *charge, m_world.electrons())
+        {
+            charge->decideFuture();
+        }
+    }
+
+    virtual int operations()
+    {
+        return qMax(m_world.numElectronAgents(), 1);
+    }
+
+private:
+    World& m_world;
+};
+
+class CoulombKernel2Benchmark : public Benchmark
+{
+public:
+    CoulombKernel2Benchmark(World& world, int launches)
+        : Benchmark(world.parameters().coulombGaussianSigma > 0 ?
+                    "opencl.launchGaussKernel2" : "opencl.launchCoulombKernel2"),
+          m_world(world), m_launches(launches)
+    {
+        addConfig("carriers", world.numChargeAgents());
+        addConfig("electrostatic.cutoff", world.parameters().electrostaticCutoff);
+        addConfig("work.size", world.parameters().workSize);
+    }
+
+    virtual void setUp()
+    {
+        foreach (ChargeAgent *charge, m_world.electrons())
+        {
+            charge->chooseFuture();
+        }
+    }
+
+    virtual void run()
+    {
+        for (int i = 0; i < m_launches; i++)
+        {
+            if (m_world.parameters().coulombGaussianSigma > 0)
+            {
+                m_world.opencl().launchGaussKernel2();
+            }
+            else
+            {
+                m_world.opencl().launchCoulombKernel2();
+            }
+        }
+        benchmarkSink += m_world.opencl().getOutputHost(0);
+    }
+
+    virtual int operations()
+    {
+        return m_launches;
+    }
+
+private:
+    World& m_world;
+    int m_launches;
+};
+
+static SimulationParameters benchmarkParameters(int carriers, int cutoff, double sigma, int seed)
+{
+    SimulationParameters par;
+    par.outputIsOn = false;
+    par.randomSeed = seed;
+    par.gridX = 128;
+    par.gridY = 128;
+    par.gridZ = 4;
+    par.voltageRight = 1.0;
+    par.coulombCarriers = true;
+    par.coulombGaussianSigma = sigma;
+    par.electrostaticCutoff = cutoff;
+    par.electronPercentage = double(carriers) / double(par.gridX * par.gridY * par.gridZ);
+    par.seedCharges = 1.0;
+    return par;
+}
+
+static bool selected(const QString& name, const QString& filter)
+{
+    return filter.isEmpty() || name.contains(filter);
+}
+
+static QString jsonString(QString value)
+{
+    value.replace("\\", "\\\\").replace("\"", "\\\"");
+    return QString("\"%1\"").arg(value);
+}
+
+static void writeJSON(const QString& fileName, const QString& label, bool okCL,
+                      const QList<BenchmarkResult>& results)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+    QTextStream stream(&handle);
+    stream.setRealNumberPrecision(10);
+
+    stream << "{\n";
+    stream << "  \"context\": {\n";
+    stream << "    \"label\": " << jsonString(label) << ",\n";
+    stream << "    \"date\": " << jsonString(QDateTime::currentDateTime().toString(Qt::ISODate)) << ",\n";
+    stream << "    \"qt\": " << jsonString(qVersion()) << ",\n";
+    stream << "    \"threads\": " << QThreadPool::globalInstance()->maxThreadCount() << ",\n";
+    stream << "    \"opencl\": " << (okCL ? "true" : "false") << "\n";
+    stream << "  },\n";
+    stream << "  \"benchmarks\": [";
+    for (int i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& result = results.at(i);
+        QStringList samples;
+        foreach (double value, result.nsPerOp)
+        {
+            samples.push_back(QString::number(value, 'g', 10));
+        }
+        stream << (i > 0 ? ",\n" : "\n");
+        stream << "    {\n";
+        stream << "      \"name\": " << jsonString(result.name) << ",\n";
+        stream << "      \"config\": {" << result.config.join(", ") << "},\n";
+        stream << "      \"operations\": " << result.operations << ",\n";
+        stream << "      \"repeats\": " << result.nsPerOp.size() << ",\n";
+        stream << "      \"ns_per_op\": {"
+               << "\"median\": " << median(result.nsPerOp) << ", "
+               << "\"mean\": " << mean(result.nsPerOp) << ", "
+               << "\"stddev\": " << stddev(result.nsPerOp) << ", "
+               << "\"min\": " << minimum(result.nsPerOp) << ", "
+               << "\"samples\": [" << samples.join(", ") << "]},\n";
+        stream << "      \"allocs_per_op\": " << mean(result.allocsPerOp) << "\n";
+        stream << "    }";
+    }
+    stream << "\n  ]\n}\n";
+    stream.flush();
+    handle.close();
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("langmuir microbenchmarks");
+    clparser.add("--output", "output", "JSON file to write (benchmark.json)");
+    clparser.add("--repeats", "repeats", "number of timed repetitions (10)");
+    clparser.add("--seed", "seed", "random.seed used for every world (1)");
+    clparser.add("--filter", "filter", "only run benchmarks whose name contains this string");
+    clparser.add("--label", "label", "label stored with the results, e.g. a commit id");
+    clparser.addBool("--quick", "quick", "use fewer carriers and operations");
+    clparser.parse(args);
+
+    QString output = clparser.get<QString>("output", "benchmark.json");
+    QString filter = clparser.get<QString>("filter", "");
+    QString label = clparser.get<QString>("label", "");
+    int repeats = qMax(clparser.get<int>("repeats", 10), 1);
+    int seed = clparser.get<int>("seed", 1);
+    bool quick = clparser.get<bool>("quick", false);
+
+    QList<int> carriers;
+    QList<int> cutoffs;
+    int count = 100000;
+    if (quick)
+    {
+        carriers << 256;
+        cutoffs << 10;
+        count = 10000;
+    }
+    else
+    {
+        carriers << 256 << 1024 << 4096;
+        cutoffs << 10 << 50;
+    }
+
+    QList<BenchmarkResult> results;
+    bool okCL = false;
+
+    // Grid and Random
+    {
+        SimulationParameters par = benchmarkParameters(carriers.first(), cutoffs.first(), 0.0, seed);
+        World world(par, 1);
+
+        if (selected("grid.neighborsSite", filter))
+        {
+            NeighborsSiteBenchmark b1(world, 1, count);
+            results.push_back(measure(b1, repeats));
+            NeighborsSiteBenchmark b2(world, 2, count);
+            results.push_back(measure(b2, repeats));
+        }
+
+        if (selected("grid.getIndexXYZ", filter))
+        {
+            GetIndexBenchmark b(world, count * 10);
+            results.push_back(measure(b, repeats));
+        }
+
+        if (selected("random.integer", filter))
+        {
+            RandomIntegerBenchmark b1(world, 5, count * 10);
+            results.push_back(measure(b1, repeats));
+            RandomIntegerBenchmark b2(world, 17, count * 10);
+            results.push_back(measure(b2, repeats));
+        }
+
+        if (selected("random.metropolisWithCoupling", filter))
+        {
+            MetropolisBenchmark b(world, count * 10);
+            results.push_back(measure(b, repeats));
+        }
+    }
+
+    // Potential, ChargeAgent and OpenClHelper at several carrier counts and cutoffs
+    foreach (int n, carriers)
+    {
+        foreach (int cutoff, cutoffs)
+        {
+            for (int gauss = 0; gauss < 2; gauss++)
+            {
+                SimulationParameters par = benchmarkParameters(n, cutoff, gauss ? 1.0 : 0.0, seed);
+                World world(par, 1);
+                okCL = okCL || world.parameters().okCL;
+
+                QString name = gauss ? "potential.gaussE" : "potential.coulombE";
+                if (selected(name, filter))
+                {
+                    PotentialBenchmark b(world, gauss, qMax(count / n, 16));
+                    results.push_back(measure(b, repeats));
+                }
+
+                if (!gauss && cutoff == cutoffs.first() && selected("chargeagent.decideFuture", filter))
+                {
+                    DecideFutureBenchmark b(world);
+                    results.push_back(measure(b, repeats));
+                }
+
+                name = gauss ? "opencl.launchGaussKernel2" : "opencl.launchCoulombKernel2";
+                if (world.parameters().okCL && selected(name, filter))
+                {
+                    CoulombKernel2Benchmark b(world, quick ? 5 : 20);
+                    results.push_back(measure(b, repeats));
+                }
+            }
+        }
+    }
+
+    writeJSON(output, label, okCL, results);
+    qDebug("langmuir: wrote %d benchmarks to %s", results.size(), qPrintable(output));
+
+    return 0;
+}
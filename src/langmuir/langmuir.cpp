@@ -6,6 +6,7 @@
 #include "nodefileparser.h"
 #include "parameters.h"
 #include "clparser.h"
+#include "mpiengine.h"
 
 #include <QApplication>
 
@@ -13,6 +14,9 @@ using namespace Langmuir;
 
 int main (int argc, char *argv[])
 {
+    // Start MPI (a no-op unless built with LANGMUIR_MPI)
+    MpiEngine::initialize(&argc, &argv);
+
     // Get the current time
     QDateTime begin = QDateTime::currentDateTime();
     QString dateFMT = "MM/dd/yyyy";
@@ -31,6 +35,9 @@ int main (int argc, char *argv[])
     CommandLineParser clparser;
     clparser.add("-n", "cores", "the number of cores to use");
     clparser.add("--gpu", "gpu", "index of gpu to use");
+    clparser.add("--platform", "platform", "index of OpenCL platform to use");
+    clparser.add("--device-type", "type", "type of OpenCL device to use (gpu, cpu, accelerator, default, all)");
+    clparser.addBool("--calibrate", "calibrate", "time the CPU and OpenCL paths to set opencl.threshold");
     clparser.addPositional("input", "input file");
     clparser.parse(args);
 
@@ -38,18 +45,35 @@ int main (int argc, char *argv[])
     int cores = clparser.get<int>("cores", -1);
     int gpuID = clparser.get<int>("gpu", -1);
 
+    // Get the OpenCL device selection
+    QStringList overrides;
+    int platform = clparser.get<int>("platform", -1);
+    if (platform >= 0) {
+        overrides << QString("opencl.platform = %1").arg(platform);
+    }
+    QString deviceType = clparser.get<QString>("type", "");
+    if (!deviceType.isEmpty()) {
+        overrides << QString("opencl.device.type = %1").arg(deviceType);
+    }
+    if (clparser.get<bool>("calibrate", false)) {
+        overrides << "opencl.calibrate = true";
+    }
+
     // Get the input file
     QString inputFile = clparser.get<QString>("input", "sim.inp");
 
     // Create the world
-    World world(inputFile, cores, gpuID);
+    World world(inputFile, overrides, cores, gpuID);
     world.logger().initialize();
 
     // Get the simulation Parameters
     SimulationParameters &par = world.parameters();
 
-    // Save the parameters
-    world.keyValueParser().save("%stub.parm");
+    // Save the parameters (once, on rank 0)
+    if (MpiEngine::rank() == 0)
+    {
+        world.keyValueParser().save("%stub.parm");
+    }
 
     // Create the simulation
     Simulation sim(world);
@@ -109,5 +133,7 @@ int main (int argc, char *argv[])
                     << flush;
     }
 
+    MpiEngine::finalize();
+
     qDebug("langmuir: exited successfully");
 }
@@ -0,0 +1,571 @@
+#include "simulation.h"
+#include "parameters.h"
+#include "clparser.h"
+#include "world.h"
+
+#include <QCoreApplication>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QStringList>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace Langmuir;
+
+/**
+ * @brief One point in the benchmark sweep
+ */
+struct BenchCase
+{
+    QString deck;
+    int edge;
+    double fraction;
+    bool coulomb;
+    int hoppingRange;
+    int threads;
+
+    QString key() const
+    {
+        return QString("%1/%2/%3/%4/%5/%6")
+                .arg(QFileInfo(deck).baseName())
+                .arg(edge)
+                .arg(fraction)
+                .arg(coulomb ? 1 : 0)
+                .arg(hoppingRange)
+                .arg(threads);
+    }
+};
+
+/**
+ * @brief Measurements for one BenchCase
+ */
+struct BenchResult
+{
+    BenchCase bench;
+    int steps;
+    double startup;
+    double stepsPerSecond;
+    double hopsPerSecond;
+    double peakRSS;
+    double efficiency;
+};
+
+static QStringList split(const QString& value)
+{
+    return value.split(",", QString::SkipEmptyParts);
+}
+
+static QList<int> toIntList(const QString& value)
+{
+    QList<int> result;
+    foreach (QString item, split(value))
+    {
+        bool ok = false;
+        result.push_back(item.trimmed().toInt(&ok));
+        if (!ok)
+        {
+            qFatal("langmuir: can not convert %s to int", qPrintable(item));
+        }
+    }
+    return result;
+}
+
+static QList<double> toDoubleList(const QString& value)
+{
+    QList<double> result;
+    foreach (QString item, split(value))
+    {
+        bool ok = false;
+        result.push_back(item.trimmed().toDouble(&ok));
+        if (!ok)
+        {
+            qFatal("langmuir: can not convert %s to double", qPrintable(item));
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Peak resident set size in MB since the last resetPeakRSS()
+ *
+ * On Linux VmHWM can be reset by writing 5 to /proc/self/clear_refs, so each
+ * case gets its own peak.  Elsewhere this falls back to getrusage, which is the
+ * peak over the life of the process.
+ */
+static double peakRSS()
+{
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream stream(&status);
+        QString line = stream.readLine();
+        while (!line.isNull())
+        {
+            if (line.startsWith("VmHWM:"))
+            {
+                QStringList tokens = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+                if (tokens.size() >= 2)
+                {
+                    return tokens.at(1).toDouble() / 1024.0;
+                }
+            }
+            line = stream.readLine();
+        }
+    }
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef Q_OS_MAC
+        return usage.ru_maxrss / 1024.0 / 1024.0;
+#else
+        return usage.ru_maxrss / 1024.0;
+#endif
+    }
+#endif
+    return 0;
+}
+
+static void resetPeakRSS()
+{
+    QFile handle("/proc/self/clear_refs");
+    if (handle.open(QIODevice::WriteOnly))
+    {
+        handle.write("5");
+        handle.close();
+    }
+}
+
+/**
+ * @brief Read the [Parameters] section of an input deck
+ */
+static QStringList readParameters(const QString& fileName)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+
+    QStringList lines;
+    bool inParameters = false;
+    QTextStream stream(&handle);
+    QString line = stream.readLine();
+    while (!line.isNull())
+    {
+        QString trimmed = line.trimmed();
+        if (trimmed.startsWith("["))
+        {
+            inParameters = (trimmed.toLower() == "[parameters]");
+        }
+        else if (trimmed.toLower() == "end")
+        {
+            inParameters = false;
+        }
+        else if (inParameters)
+        {
+            lines.push_back(trimmed);
+        }
+        line = stream.readLine();
+    }
+    return lines;
+}
+
+static double deckValue(const QStringList& lines, const QString& key, double defaultValue)
+{
+    double value = defaultValue;
+    foreach (QString line, lines)
+    {
+        line.replace(QRegExp("\\s*#.*$"), "");
+        QStringList tokens = line.split("=");
+        if (tokens.size() == 2 && tokens.at(0).trimmed().toLower() == key)
+        {
+            value = tokens.at(1).trimmed().toDouble();
+        }
+    }
+    return value;
+}
+
+/**
+ * @brief Run one case
+ *
+ * The deck's parameters are written to a temporary input file followed by the
+ * overrides for this case; the KeyValueParser keeps the last value of a key.
+ */
+static BenchResult run(const BenchCase& bench, const QStringList& deck, const QStringList& extra, int seed,
+                       int warmup, int steps, bool useOpenCL, int idealThreads)
+{
+    QStringList overrides;
+    overrides << "grid.x = " + QString::number(bench.edge)
+              << "grid.y = " + QString::number(bench.edge)
+              << "electron.percentage = " + QString::number(bench.fraction, 'g', 10)
+              << "coulomb.carriers = " + QString(bench.coulomb ? "true" : "false")
+              << "hopping.range = " + QString::number(bench.hoppingRange)
+              << "seed.charges = 1.0"
+              << "random.seed = " + QString::number(seed)
+              << "current.step = 0"
+              << "output.is.on = false"
+              << "output.coulomb = 0"
+              << "image.traps = false"
+              << "image.defects = false"
+              << "image.carriers = 0"
+              << "use.opencl = " + QString(useOpenCL ? "true" : "false");
+
+    // Decks with holes get the same fraction of holes
+    if (deckValue(deck, "hole.percentage", 0.0) > 0)
+    {
+        overrides << "hole.percentage = " + QString::number(bench.fraction, 'g', 10);
+    }
+
+    // --set comes last, so it wins
+    overrides += extra;
+
+    QTemporaryFile input(QDir::tempPath() + "/langmuir-bench-XXXXXX.inp");
+    if (!input.open())
+    {
+        qFatal("langmuir: can not open temporary file");
+    }
+    {
+        QTextStream stream(&input);
+        stream << "[Parameters]\n";
+        foreach (QString line, deck + overrides)
+        {
+            stream << line << "\n";
+        }
+        stream << "end\n";
+        stream.flush();
+    }
+    input.flush();
+
+    // World::alterMaxThreads refuses more threads than the pool currently
+    // allows, and the previous case may have lowered the limit
+    QThreadPool::globalInstance()->setMaxThreadCount(idealThreads);
+
+    resetPeakRSS();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    World world(input.fileName(), bench.threads);
+    Simulation simulation(world);
+
+    BenchResult result;
+    result.bench = bench;
+    result.steps = steps;
+    result.startup = timer.nsecsElapsed() * 1e-9;
+    result.efficiency = 1.0;
+
+    simulation.performIterations(warmup);
+
+    // Every carrier attempts one hop per step
+    qint64 hops = 0;
+    timer.restart();
+    for (int i = 0; i < steps; i++)
+    {
+        hops += world.numChargeAgents();
+        simulation.performIterations(1);
+    }
+    double elapsed = timer.nsecsElapsed() * 1e-9;
+
+    result.stepsPerSecond = elapsed > 0 ? steps / elapsed : 0;
+    result.hopsPerSecond = elapsed > 0 ? hops / elapsed : 0;
+    result.peakRSS = peakRSS();
+
+    qDebug("langmuir: %-40s %12.2f steps/s %14.0f hops/s %10.1f MB %8.3f s startup",
+           qPrintable(bench.key()), result.stepsPerSecond, result.hopsPerSecond,
+           result.peakRSS, result.startup);
+
+    return result;
+}
+
+static const char *csvHeader =
+        "deck,edge,fraction,coulomb,hopping.range,threads,steps,"
+        "startup.s,steps.per.s,hops.per.s,peak.rss.mb,efficiency";
+
+static void writeCSV(const QString& fileName, const QList<BenchResult>& results)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+    QTextStream stream(&handle);
+    stream.setRealNumberPrecision(10);
+    stream << csvHeader << "\n";
+    foreach (const BenchResult& r, results)
+    {
+        stream << QFileInfo(r.bench.deck).baseName() << ","
+               << r.bench.edge << ","
+               << r.bench.fraction << ","
+               << (r.bench.coulomb ? 1 : 0) << ","
+               << r.bench.hoppingRange << ","
+               << r.bench.threads << ","
+               << r.steps << ","
+               << r.startup << ","
+               << r.stepsPerSecond << ","
+               << r.hopsPerSecond << ","
+               << r.peakRSS << ","
+               << r.efficiency << "\n";
+    }
+}
+
+static void writeJSON(const QString& fileName, const QString& label, const QList<BenchResult>& results)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+    QTextStream stream(&handle);
+    stream.setRealNumberPrecision(10);
+    stream << "{\n";
+    stream << "  \"label\": \"" << QString(label).replace("\"", "\\\"") << "\",\n";
+    stream << "  \"date\": \"" << QDateTime::currentDateTime().toString(Qt::ISODate) << "\",\n";
+    stream << "  \"qt\": \"" << qVersion() << "\",\n";
+    stream << "  \"results\": [";
+    for (int i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results.at(i);
+        stream << (i > 0 ? ",\n" : "\n")
+               << "    {\"deck\": \"" << QFileInfo(r.bench.deck).baseName() << "\", "
+               << "\"edge\": " << r.bench.edge << ", "
+               << "\"fraction\": " << r.bench.fraction << ", "
+               << "\"coulomb\": " << (r.bench.coulomb ? "true" : "false") << ", "
+               << "\"hopping.range\": " << r.bench.hoppingRange << ", "
+               << "\"threads\": " << r.bench.threads << ", "
+               << "\"steps\": " << r.steps << ", "
+               << "\"startup.s\": " << r.startup << ", "
+               << "\"steps.per.s\": " << r.stepsPerSecond << ", "
+               << "\"hops.per.s\": " << r.hopsPerSecond << ", "
+               << "\"peak.rss.mb\": " << r.peakRSS << ", "
+               << "\"efficiency\": " << r.efficiency << "}";
+    }
+    stream << "\n  ]\n}\n";
+}
+
+/**
+ * @brief Compare against a CSV written by a previous run
+ *
+ * A case fails if its throughput dropped, or its peak memory grew, by more
+ * than the tolerance.  Cases missing from either file are reported but do
+ * not fail.
+ */
+static bool compare(const QString& fileName, const QList<BenchResult>& results, double tolerance)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+
+    QMap<QString, QStringList> baseline;
+    QTextStream stream(&handle);
+    QString line = stream.readLine();
+    if (line.trimmed() != csvHeader)
+    {
+        qFatal("langmuir: %s is not a langmuir-bench csv file", qPrintable(fileName));
+    }
+    line = stream.readLine();
+    while (!line.isNull())
+    {
+        QStringList tokens = line.trimmed().split(",");
+        if (tokens.size() == 12)
+        {
+            QString key = QStringList(tokens.mid(0, 6)).join("/");
+            baseline[key] = tokens;
+        }
+        line = stream.readLine();
+    }
+
+    int passed = 0;
+    int failed = 0;
+    int missing = 0;
+    foreach (const BenchResult& r, results)
+    {
+        QString key = r.bench.key();
+        if (!baseline.contains(key))
+        {
+            qDebug("langmuir: %-40s missing from baseline", qPrintable(key));
+            missing++;
+            continue;
+        }
+        double oldRate = baseline[key].at(8).toDouble();
+        double oldRSS = baseline[key].at(10).toDouble();
+        double rate = oldRate > 0 ? r.stepsPerSecond / oldRate - 1.0 : 0.0;
+        double rss = oldRSS > 0 ? r.peakRSS / oldRSS - 1.0 : 0.0;
+        bool ok = (rate >= -tolerance) && (rss <= tolerance);
+        qDebug("langmuir: %-40s %s steps/s %+7.1f%% rss %+7.1f%%",
+               qPrintable(key), ok ? "PASS" : "FAIL", 100 * rate, 100 * rss);
+        if (ok)
+        {
+            passed++;
+        }
+        else
+        {
+            failed++;
+        }
+        baseline.remove(key);
+    }
+    missing += baseline.size();
+
+    qDebug("langmuir: compare: %d passed, %d failed, %d missing (tolerance %.1f%%)",
+           passed, failed, missing, 100 * tolerance);
+    return failed == 0;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    int idealThreads = QThreadPool::globalInstance()->maxThreadCount();
+
+    CommandLineParser clparser;
+    clparser.setDescription("langmuir end-to-end benchmarks; lists are comma separated");
+    clparser.add("--examples", "examples", "directory of *.inp decks (examples)");
+    clparser.add("--decks", "decks", "list of decks, overrides --examples");
+    clparser.add("--sizes", "sizes", "list of grid edges (64,128,256,512)");
+    clparser.add("--fractions", "fractions", "list of carrier fractions (0.001,0.01,0.05)");
+    clparser.add("--coulomb", "coulomb", "list of coulomb.carriers values (1,0)");
+    clparser.add("--ranges", "ranges", "list of hopping.range values (1,2)");
+    clparser.add("--threads", "threads", "list of thread counts (1,2,4,...,max)");
+    clparser.add("--steps", "steps", "timed steps per case (100)");
+    clparser.add("--warmup", "warmup", "untimed steps per case (10)");
+    clparser.add("--seed", "seed", "random.seed for every case (1)");
+    clparser.add("--output", "output", "csv file to write (langmuir-bench.csv)");
+    clparser.add("--json", "json", "also write results as json");
+    clparser.add("--label", "label", "label stored in the json file");
+    clparser.add("--compare", "compare", "baseline csv file to compare against");
+    clparser.add("--tolerance", "tolerance", "allowed relative regression (0.10)");
+    clparser.add("--set", "set", "list of key=value parameters for every case, e.g. grid.layout=tiled");
+    clparser.addBool("--opencl", "opencl", "set use.opencl = true");
+    clparser.addBool("--quick", "quick", "small sweep for a quick check");
+    clparser.parse(args);
+
+    QString examples = clparser.get<QString>("examples", "examples");
+    QString output = clparser.get<QString>("output", "langmuir-bench.csv");
+    QString json = clparser.get<QString>("json", "");
+    QString label = clparser.get<QString>("label", "");
+    QString baseline = clparser.get<QString>("compare", "");
+    int steps = clparser.get<int>("steps", 100);
+    int warmup = clparser.get<int>("warmup", 10);
+    int seed = clparser.get<int>("seed", 1);
+    float tolerance = clparser.get<float>("tolerance", 0.10f);
+    bool useOpenCL = clparser.get<bool>("opencl", false);
+    bool quick = clparser.get<bool>("quick", false);
+
+    QString threadDefault;
+    for (int t = 1; t < idealThreads; t *= 2)
+    {
+        threadDefault += QString::number(t) + ",";
+    }
+    threadDefault += QString::number(idealThreads);
+
+    QStringList extra = split(clparser.get<QString>("set", ""));
+
+    QStringList decks = split(clparser.get<QString>("decks", ""));
+    if (decks.isEmpty())
+    {
+        QDir dir(examples);
+        foreach (QString name, dir.entryList(QStringList() << "*.inp", QDir::Files, QDir::Name))
+        {
+            decks.push_back(dir.filePath(name));
+        }
+    }
+    if (decks.isEmpty())
+    {
+        qFatal("langmuir: no decks found; use --examples or --decks");
+    }
+
+    QList<int> sizes = toIntList(clparser.get<QString>("sizes", quick ? "64" : "64,128,256,512"));
+    QList<double> fractions = toDoubleList(clparser.get<QString>("fractions", quick ? "0.01" : "0.001,0.01,0.05"));
+    QList<int> coulomb = toIntList(clparser.get<QString>("coulomb", "1,0"));
+    QList<int> ranges = toIntList(clparser.get<QString>("ranges", quick ? "1" : "1,2"));
+    QList<int> threads = toIntList(clparser.get<QString>("threads", threadDefault));
+    if (quick)
+    {
+        steps = qMin(steps, 20);
+        warmup = qMin(warmup, 2);
+    }
+
+    foreach (int t, threads)
+    {
+        if (t < 1 || t > idealThreads)
+        {
+            qFatal("langmuir: thread count %d must be between 1 and %d", t, idealThreads);
+        }
+    }
+
+    QList<BenchResult> results;
+    foreach (QString deck, decks)
+    {
+        QStringList parameters = readParameters(deck);
+        foreach (int edge, sizes)
+        {
+            foreach (double fraction, fractions)
+            {
+                foreach (int c, coulomb)
+                {
+                    foreach (int range, ranges)
+                    {
+                        // Parallel efficiency is relative to the first thread count
+                        double base = 0;
+                        int baseThreads = 0;
+                        foreach (int t, threads)
+                        {
+                            BenchCase bench;
+                            bench.deck = deck;
+                            bench.edge = edge;
+                            bench.fraction = fraction;
+                            bench.coulomb = (c != 0);
+                            bench.hoppingRange = range;
+                            bench.threads = t;
+
+                            BenchResult result = run(bench, parameters, extra, seed, warmup, steps,
+                                                     useOpenCL, idealThreads);
+                            if (baseThreads == 0)
+                            {
+                                base = result.stepsPerSecond;
+                                baseThreads = t;
+                            }
+                            if (base > 0)
+                            {
+                                result.efficiency = (result.stepsPerSecond / base) *
+                                        (double(baseThreads) / double(t));
+                            }
+                            results.push_back(result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    writeCSV(output, results);
+    qDebug("langmuir: wrote %d results to %s", results.size(), qPrintable(output));
+
+    if (!json.isEmpty())
+    {
+        writeJSON(json, label, results);
+        qDebug("langmuir: wrote %d results to %s", results.size(), qPrintable(json));
+    }
+
+    if (!baseline.isEmpty())
+    {
+        if (!compare(baseline, results, tolerance))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "calibration.h"
+#include "openclhelper.h"
+#include "vectorcoulomb.h"
+#include "chargeagent.h"
+#include "workerpool.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <QElapsedTimer>
+
+#include <cmath>
+
+namespace Langmuir
+{
+
+// time each measurement for at least this long (ns), and at most this many repeats
+static const qint64 MIN_TIME = 50000000;
+static const int MAX_REPEATS = 100;
+
+// the electrons of a scratch World from begin to end, for WorkerPool::run()
+static void coulombCPU(void *world, int begin, int end)
+{
+    QList<ChargeAgent*> &electrons = static_cast<World *>(world)->electrons();
+    for (int i = begin; i < end; i++)
+    {
+        electrons[i]->coulombCPU();
+    }
+}
+
+static void coulombGPU(void *world, int begin, int end)
+{
+    QList<ChargeAgent*> &electrons = static_cast<World *>(world)->electrons();
+    for (int i = begin; i < end; i++)
+    {
+        electrons[i]->coulombGPU();
+    }
+}
+
+Calibration::Calibration(World &world, QObject *parent)
+    : QObject(parent), m_world(world)
+{
+}
+
+void Calibration::run()
+{
+    SimulationParameters& par = m_world.parameters();
+
+    // the largest count worth timing is the most carriers this run can hold
+    int volume = m_world.electronGrid().volume();
+    int limit = qMin(m_world.maxChargeAgents(), volume / 2);
+    QVector<int> counts;
+    for (int count = 32; count <= limit; count *= 2)
+    {
+        counts.push_back(count);
+    }
+    if (counts.isEmpty())
+    {
+        qDebug("langmuir: too few carriers to calibrate, opencl.threshold = %d", par.openclThreshold);
+        return;
+    }
+
+    if (par.openclCalibrateWork)
+    {
+        tuneWorkSize(counts.last());
+
+        // work.x/y/z only shape coulomb1 and gauss1, which are summed on the host with opencl.precision = single
+        if (par.outputCoulomb > 0 && par.openclPrecision.toLower() != "single")
+        {
+            tuneWorkXYZ(counts.last());
+        }
+    }
+
+    QVector<double> cpu;
+    QVector<double> gpu;
+    foreach (int count, counts)
+    {
+        SimulationParameters scratchPar = scratchParameters(count);
+        World scratch(scratchPar, m_world);
+        cpu.push_back(timeCPU(scratch));
+        gpu.push_back(timeOpenCL(scratch));
+        qDebug("langmuir: calibrate %6d carriers: cpu %.3e s, opencl %.3e s",
+               scratch.numChargeAgents(), cpu.last(), gpu.last());
+    }
+
+    par.openclThreshold = crossover(counts, cpu, gpu, qMax(m_world.maxChargeAgents(), 1));
+    qDebug("langmuir: calibrated opencl.threshold = %d, work.size = %d, work.x/y/z = %d/%d/%d",
+           par.openclThreshold, par.workSize, par.workX, par.workY, par.workZ);
+}
+
+SimulationParameters Calibration::scratchParameters(int count)
+{
+    SimulationParameters par = m_world.parameters();
+    par.outputIsOn = false;
+    par.openclCalibrate = false;
+    par.openclEngine = false;
+    par.useOpenCL = true;
+    par.currentStep = 0;
+    par.electronPercentage = double(count) / double(m_world.electronGrid().volume());
+    par.holePercentage = 0;
+    par.seedCharges = 1.0;
+    return par;
+}
+
+double Calibration::timeCPU(World& world)
+{
+    QList<ChargeAgent*> &electrons = world.electrons();
+    foreach (ChargeAgent *charge, electrons)
+    {
+        charge->chooseFuture();
+    }
+
+    int repeats = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do
+    {
+        if (world.vectorCoulomb().isOn())
+        {
+            world.vectorCoulomb().compute();
+        }
+        else
+        {
+            world.workerPool().run(coulombCPU, &world, electrons.size());
+        }
+        repeats++;
+    }
+    while (timer.nsecsElapsed() < MIN_TIME && repeats < MAX_REPEATS);
+    return timer.nsecsElapsed() * 1e-9 / repeats;
+}
+
+double Calibration::timeOpenCL(World& world)
+{
+    QList<ChargeAgent*> &electrons = world.electrons();
+    foreach (ChargeAgent *charge, electrons)
+    {
+        charge->chooseFuture();
+    }
+
+    bool gauss = world.parameters().coulombGaussianSigma > 0;
+
+    // the first launch builds the kernels and uploads every carrier
+    if (gauss)
+    {
+        world.opencl().launchGaussKernel2();
+    }
+    else
+    {
+        world.opencl().launchCoulombKernel2();
+    }
+
+    int repeats = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do
+    {
+        // as if every carrier moved, the most a step can send to the device
+        foreach (ChargeAgent *charge, electrons)
+        {
+            world.opencl().moveCarrier(charge->getOpenCLID(), charge->getCurrentSite());
+        }
+        if (gauss)
+        {
+            world.opencl().launchGaussKernel2();
+        }
+        else
+        {
+            world.opencl().launchCoulombKernel2();
+        }
+        world.workerPool().run(coulombGPU, &world, electrons.size());
+        repeats++;
+    }
+    while (timer.nsecsElapsed() < MIN_TIME && repeats < MAX_REPEATS);
+    return timer.nsecsElapsed() * 1e-9 / repeats;
+}
+
+double Calibration::timeKernel1(World& world)
+{
+    bool gauss = world.parameters().coulombGaussianSigma > 0;
+
+    // the first launch builds the kernels, and kernel1 is slow, so time a single launch after it
+    if (gauss)
+    {
+        world.opencl().launchGaussKernel1();
+    }
+    else
+    {
+        world.opencl().launchCoulombKernel1();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (gauss)
+    {
+        world.opencl().launchGaussKernel1();
+    }
+    else
+    {
+        world.opencl().launchCoulombKernel1();
+    }
+    return timer.nsecsElapsed() * 1e-9;
+}
+
+void Calibration::tuneWorkSize(int count)
+{
+    SimulationParameters& par = m_world.parameters();
+
+    double best = -1;
+    int bestSize = par.workSize;
+    for (int size = 32; size <= 1024; size *= 2)
+    {
+        SimulationParameters scratchPar = scratchParameters(count);
+        scratchPar.workSize = size;
+        World scratch(scratchPar, m_world);
+
+        // the device may have lowered it; that size was timed already
+        if (scratch.parameters().workSize != size)
+        {
+            break;
+        }
+
+        double time = timeOpenCL(scratch);
+        qDebug("langmuir: calibrate work.size = %4d: %.3e s", size, time);
+        if (best < 0 || time < best)
+        {
+            best = time;
+            bestSize = size;
+        }
+    }
+    par.workSize = bestSize;
+}
+
+void Calibration::tuneWorkXYZ(int count)
+{
+    SimulationParameters& par = m_world.parameters();
+
+    // x, y, z; z > 1 only helps if the grid has layers
+    int candidates[][3] = {
+        { 4, 4, 4 }, { 8, 8, 1 }, { 16, 16, 1 }, { 8, 8, 4 }, { 16, 4, 4 }
+    };
+    int numCandidates = sizeof(candidates) / sizeof(candidates[0]);
+
+    double best = -1;
+    int bestXYZ[3] = { par.workX, par.workY, par.workZ };
+    for (int i = 0; i < numCandidates; i++)
+    {
+        if (candidates[i][2] > 1 && par.gridZ == 1)
+        {
+            continue;
+        }
+
+        SimulationParameters scratchPar = scratchParameters(count);
+        scratchPar.workX = candidates[i][0];
+        scratchPar.workY = candidates[i][1];
+        scratchPar.workZ = candidates[i][2];
+        World scratch(scratchPar, m_world);
+
+        double time = timeKernel1(scratch);
+        qDebug("langmuir: calibrate work.x/y/z = %d/%d/%d: %.3e s",
+               scratch.parameters().workX, scratch.parameters().workY, scratch.parameters().workZ, time);
+        if (best < 0 || time < best)
+        {
+            best = time;
+            bestXYZ[0] = scratch.parameters().workX;
+            bestXYZ[1] = scratch.parameters().workY;
+            bestXYZ[2] = scratch.parameters().workZ;
+        }
+    }
+    par.workX = bestXYZ[0];
+    par.workY = bestXYZ[1];
+    par.workZ = bestXYZ[2];
+}
+
+int Calibration::crossover(const QVector<int>& counts, const QVector<double>& cpu, const QVector<double>& gpu,
+                           int never)
+{
+    for (int i = 0; i < counts.size(); i++)
+    {
+        if (gpu[i] < cpu[i])
+        {
+            if (i == 0)
+            {
+                return 1;
+            }
+
+            // log(cpu / gpu) goes from <= 0 to > 0 between the two counts
+            double r0 = log(cpu[i - 1] / gpu[i - 1]);
+            double r1 = log(cpu[i] / gpu[i]);
+            double t = r0 / (r0 - r1);
+            double n = exp(log(double(counts[i - 1])) + t * (log(double(counts[i])) - log(double(counts[i - 1]))));
+            return qMax(1, int(n + 0.5));
+        }
+    }
+
+    // the CPU always won
+    return never;
+}
+
+}
@@ -0,0 +1,276 @@
+#include "carriersorter.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "workerpool.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <QVector>
+#include <QPair>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Langmuir
+{
+
+// a page of SiteStore words (4 KB, two 32-bit words per site); carriers further apart are a far jump
+static const int PAGE_SITES = 512;
+
+// longest interval the adaption goes to
+static const int MAX_INTERVAL = 1 << 20;
+
+// spread the low 21 bits of v out to every third bit
+static quint64 spread(quint64 v)
+{
+    v &= Q_UINT64_C(0x1fffff);
+    v = (v | v << 32) & Q_UINT64_C(0x1f00000000ffff);
+    v = (v | v << 16) & Q_UINT64_C(0x1f0000ff0000ff);
+    v = (v | v << 8)  & Q_UINT64_C(0x100f00f00f00f00f);
+    v = (v | v << 4)  & Q_UINT64_C(0x10c30c30c30c30c3);
+    v = (v | v << 2)  & Q_UINT64_C(0x1249249249249249);
+    return v;
+}
+
+CarrierSorter::CarrierSorter(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_sorts(0), m_unsorted(0), m_sorted(0),
+      m_lastMisses(0), m_unsortedMisses(-1), m_carrierSteps(0)
+{
+    const SimulationParameters& par = m_world.parameters();
+    m_on = (par.carrierSort > 0);
+    m_interval = qMax(1, par.carrierSort);
+    m_next = par.currentStep + m_interval;
+
+    if (!m_on)
+    {
+        return;
+    }
+
+    // a counter only counts its own thread; the workers already run, so they open theirs themselves
+    WorkerPool& pool = m_world.workerPool();
+    int threads = pool.size() > 1 ? pool.size() + 1 : 1;
+    m_counters.fill(-1, threads);
+    m_counters[0] = openCounter();
+    if (threads > 1)
+    {
+        pool.run(CarrierSorter::openWorkerCounters, this, pool.size());
+    }
+    if (m_counters.contains(-1))
+    {
+        qDebug("langmuir: can not count cache misses (perf_event_open), only far jumps are reported");
+        foreach (int counter, m_counters)
+        {
+            if (counter >= 0)
+            {
+#ifdef Q_OS_LINUX
+                close(counter);
+#endif
+            }
+        }
+        m_counters.clear();
+    }
+}
+
+CarrierSorter::~CarrierSorter()
+{
+#ifdef Q_OS_LINUX
+    foreach (int counter, m_counters)
+    {
+        close(counter);
+    }
+#endif
+}
+
+int CarrierSorter::openCounter()
+{
+#ifdef Q_OS_LINUX
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    return -1;
+#endif
+}
+
+void CarrierSorter::openWorkerCounters(void *self, int begin, int end)
+{
+    CarrierSorter& sorter = *static_cast<CarrierSorter *>(self);
+    for (int k = begin; k < end; k++)
+    {
+        sorter.m_counters[k + 1] = openCounter();
+    }
+}
+
+bool CarrierSorter::isOn() const
+{
+    return m_on;
+}
+
+int CarrierSorter::interval() const
+{
+    return m_interval;
+}
+
+void CarrierSorter::sortIfDue()
+{
+    if (!m_on)
+    {
+        return;
+    }
+    m_carrierSteps += m_world.numChargeAgents();
+    if (m_world.parameters().currentStep >= m_next)
+    {
+        sort();
+    }
+}
+
+void CarrierSorter::sort()
+{
+    double before = farJumps();
+    double misses = missRate();
+    sortList(m_world.electrons());
+    sortList(m_world.holes());
+    double after = farJumps();
+
+    // adapt the interval to how much of the last sort's gain is gone
+    int previous = m_interval;
+    if (m_sorts == 0)
+    {
+        m_unsorted = before;
+        m_unsortedMisses = misses;
+    }
+    else
+    {
+        m_unsorted = qMax(m_unsorted, before);
+        double gain = m_unsorted - m_sorted;
+        double lost = gain > 0 ? (before - m_sorted) / gain : 0.0;
+        if (lost > 0.5)
+        {
+            m_interval = qMax(1, m_interval / 2);
+        }
+        else if (lost < 0.25)
+        {
+            m_interval = qMin(MAX_INTERVAL, m_interval * 2);
+        }
+    }
+    m_sorted = after;
+    m_sorts += 1;
+    m_next = m_world.parameters().currentStep + m_interval;
+
+    if (m_sorts == 1 || m_interval != previous)
+    {
+        qDebug("langmuir: carrier sort at step %u: far jumps %.1f%% -> %.1f%% (unsorted %.1f%%), next in %d steps",
+               m_world.parameters().currentStep, 100 * before, 100 * after, 100 * m_unsorted, m_interval);
+        if (misses >= 0)
+        {
+            qDebug("langmuir:     cache misses per carrier step %.2f (unsorted %.2f)", misses, m_unsortedMisses);
+        }
+    }
+}
+
+void CarrierSorter::completeTicks(QList<ChargeAgent*>& charges)
+{
+    // only the carriers that change the grid depend on the order
+    QVector<ChargeAgent*> moving;
+    foreach (ChargeAgent *charge, charges)
+    {
+        if (charge->removed() || charge->getFutureSite() != charge->getCurrentSite())
+        {
+            moving.push_back(charge);
+        }
+    }
+
+    // Fisher-Yates, so every order of them is as likely
+    Random& random = m_world.randomNumberGenerator();
+    for (int i = moving.size() - 1; i > 0; i--)
+    {
+        qSwap(moving[i], moving[random.integer(0, i)]);
+    }
+    foreach (ChargeAgent *charge, moving)
+    {
+        charge->completeTick();
+    }
+}
+
+double CarrierSorter::farJumps()
+{
+    int jumps = 0;
+    int pairs = 0;
+    countJumps(m_world.electrons(), jumps, pairs);
+    countJumps(m_world.holes(), jumps, pairs);
+    return pairs > 0 ? double(jumps) / pairs : 0.0;
+}
+
+void CarrierSorter::sortList(QList<ChargeAgent*>& charges)
+{
+    // Morton keys, with the old position to break ties
+    QVector<QPair<quint64, int> > keys(charges.size());
+    for (int i = 0; i < charges.size(); i++)
+    {
+        Grid& grid = charges[i]->getGrid();
+        int site = charges[i]->getCurrentSite();
+        quint64 key = spread(grid.getIndexX(site)) |
+                      spread(grid.getIndexY(site)) << 1 |
+                      spread(grid.getIndexZ(site)) << 2;
+        keys[i] = qMakePair(key, i);
+    }
+    qSort(keys);
+
+    QList<ChargeAgent*> sorted;
+    sorted.reserve(charges.size());
+    for (int i = 0; i < keys.size(); i++)
+    {
+        sorted.push_back(charges[keys[i].second]);
+    }
+    charges = sorted;
+}
+
+void CarrierSorter::countJumps(QList<ChargeAgent*>& charges, int& jumps, int& pairs)
+{
+    for (int i = 1; i < charges.size(); i++)
+    {
+        if (qAbs(charges[i]->getCurrentSite() - charges[i - 1]->getCurrentSite()) >= PAGE_SITES)
+        {
+            jumps += 1;
+        }
+        pairs += 1;
+    }
+}
+
+double CarrierSorter::missRate()
+{
+    double rate = -1;
+#ifdef Q_OS_LINUX
+    quint64 count = 0;
+    bool ok = !m_counters.isEmpty();
+    foreach (int counter, m_counters)
+    {
+        quint64 value = 0;
+        ok = ok && read(counter, &value, sizeof(value)) == ssize_t(sizeof(value));
+        count += value;
+    }
+    if (ok)
+    {
+        if (m_carrierSteps > 0)
+        {
+            rate = double(count - m_lastMisses) / m_carrierSteps;
+        }
+        m_lastMisses = count;
+    }
+#endif
+    m_carrierSteps = 0;
+    return rate;
+}
+
+}
@@ -5,6 +5,10 @@
 #include "simulation.h"
 #include "potential.h"
 #include "cubicgrid.h"
+#include "hopproposals.h"
+#include "trapbasins.h"
+#include "skipahead.h"
+#include "sitestore.h"
 #include "world.h"
 #include "rand.h"
 
@@ -19,13 +23,28 @@ ChargeAgent::ChargeAgent(Agent::Type type, World &world, Grid &grid, int site,QO
     m_lifetime = 0;
     m_pathlength = 0;
     m_openClID = 0;
+    m_storeID = m_world.siteStore().addCarrier(this);
     m_de = 0;
+    m_proposals = 0;
+    m_proposalSite = -1;
+    m_basin = -1;
+    m_basinSteps = 0;
+    m_wakeStep = 0;
+    m_sleepStep = 0;
+    m_exitSite = -1;
+    m_basinHops = 0;
+    m_skipWake = 0;
+    m_skipFrom = 0;
+    m_skipSite = -1;
+    m_skipChance = 0;
+    m_skipChecked = false;
 }
 
 ElectronAgent::ElectronAgent(World &world, int site, QObject *parent)
     : ChargeAgent(Agent::Electron, world, world.electronGrid(), site, parent)
 {
     m_charge = -1;
+    m_openClID = m_world.opencl().addCarrier(m_site, m_charge);
     m_grid.registerAgent(this);
 }
 
@@ -33,11 +52,22 @@ HoleAgent::HoleAgent(World &world, int site, QObject *parent)
     : ChargeAgent(Agent::Hole, world, world.holeGrid(), site, parent)
 {
     m_charge = +1;
+    m_openClID = m_world.opencl().addCarrier(m_site, m_charge);
     m_grid.registerAgent(this);
 }
 
 ChargeAgent::~ChargeAgent()
 {
+    if (m_skipWake != 0)
+    {
+        m_world.skipAhead().unpark(this, m_skipWake);
+    }
+    if (m_wakeStep != 0)
+    {
+        m_world.trapBasins().removeSleeper(m_basin);
+    }
+    m_world.opencl().removeCarrier(m_openClID);
+    m_world.siteStore().removeCarrier(m_storeID);
 }
 
 int ChargeAgent::charge()
@@ -60,6 +90,16 @@ int ChargeAgent::pathlength()
     return m_pathlength;
 }
 
+void ChargeAgent::setLifetime(int lifetime)
+{
+    m_lifetime = lifetime;
+}
+
+void ChargeAgent::setPathlength(int pathlength)
+{
+    m_pathlength = pathlength;
+}
+
 void ChargeAgent::setOpenCLID(int id)
 {
     m_openClID = id;
@@ -70,11 +110,43 @@ int ChargeAgent::getOpenCLID()
     return m_openClID;
 }
 
+quint32 ChargeAgent::getStoreID()
+{
+    return m_storeID;
+}
+
 void ChargeAgent::chooseFuture()
 {
-    // Select a proposed transport site at random
-    m_fSite = m_neighbors[m_world.randomNumberGenerator().integer(0, m_neighbors.size()-1)];
+    chooseFuture(m_world.randomNumberGenerator());
+}
+
+void ChargeAgent::chooseFuture(Random &random)
+{
     m_de = 0;
+
+    // Asleep in a trap basin (see TrapBasins), or parked (see SkipAhead)
+    if (m_wakeStep != 0 || m_skipWake != 0)
+    {
+        m_fSite = m_site;
+        return;
+    }
+
+    // Select a site in proportion to its coupling, or stay put
+    HopProposals& proposals = m_world.hopProposals();
+    if (proposals.isOn())
+    {
+        if (m_proposalSite != m_site)
+        {
+            m_proposals = proposals.table(m_grid, m_site);
+            m_proposalSite = m_site;
+        }
+        int i = proposals.choose(m_proposals, random);
+        m_fSite = i < m_neighbors.size() ? m_neighbors[i] : m_site;
+        return;
+    }
+
+    // Select a proposed transport site at random
+    m_fSite = m_neighbors[random.integer(0, m_neighbors.size()-1)];
 }
 
 Grid& ChargeAgent::getGrid()
@@ -88,6 +160,11 @@ void ChargeAgent::setRemoved(const bool &status)
 }
 
 void ChargeAgent::decideFuture()
+{
+    decideFuture(m_world.randomNumberGenerator());
+}
+
+void ChargeAgent::decideFuture(Random &random)
 {
     // Increase lifetime in existance
     m_lifetime += 1;
@@ -104,14 +181,18 @@ void ChargeAgent::decideFuture()
         // Don't worry, it's zero if coulomb interactions are off
         pd += m_de;
 
-        // Calculate the coupling constant...
-        int dx = m_grid.xDistancei(m_site, m_fSite);
-        int dy = m_grid.yDistancei(m_site, m_fSite);
-        int dz = m_grid.zDistancei(m_site, m_fSite);
-        double coupling = m_world.couplingConstants()[dx][dy][dz];
+        // Calculate the coupling constant (weighted proposals have accounted for it already)...
+        double coupling = 1.0;
+        if (!m_world.hopProposals().isOn())
+        {
+            int dx = m_grid.xDistancei(m_site, m_fSite);
+            int dy = m_grid.yDistancei(m_site, m_fSite);
+            int dz = m_grid.zDistancei(m_site, m_fSite);
+            coupling = m_world.couplingConstants()[dx][dy][dz];
+        }
 
         // Metropolis criterion
-        if(m_world.randomNumberGenerator().metropolisWithCoupling(
+        if(random.metropolisWithCoupling(
                  pd,
                  m_world.parameters().inverseKT,
                  coupling))
@@ -134,7 +215,7 @@ void ChargeAgent::decideFuture()
         DrainAgent *drain = dynamic_cast<DrainAgent*>(m_grid.agentAddress(m_fSite));
         if(drain)
         {
-            if(drain->tryToAccept(this))
+            if(drain->tryToAccept(this, random))
             {
                 m_pathlength += 1;
                 break;
@@ -160,11 +241,21 @@ void ChargeAgent::decideFuture()
     return;
 }
 
-void ChargeAgent::completeTick()
+void ChargeAgent::completeTick(bool recordMove)
 {
     // If the charge was removed by some other means (recombination)...
     if (m_removed)
     {
+        if (m_skipWake != 0)
+        {
+            m_world.skipAhead().unpark(this, m_skipWake);
+            m_skipWake = 0;
+        }
+        if (m_wakeStep != 0)
+        {
+            m_world.trapBasins().removeSleeper(m_basin);
+            m_wakeStep = 0;
+        }
         m_grid.unregisterAgent(this);
         return;
     }
@@ -175,12 +266,13 @@ void ChargeAgent::completeTick()
         // If the future site is empty move along
         if(m_grid.agentType(m_fSite)== Agent::Empty)
         {            
-            // Leave old site
-            m_grid.unregisterAgent(this);
-
-            // Enter new site
-            m_site = m_fSite;
-            m_grid.registerAgent(this);
+            // Leave old site and enter new site
+            m_grid.moveAgent(this, m_fSite);
+            m_skipChecked = false;
+            if (recordMove)
+            {
+                m_world.opencl().moveCarrier(m_openClID, m_site);
+            }
             return;
         }
 
@@ -198,6 +290,127 @@ void ChargeAgent::completeTick()
     }
 }
 
+void ChargeAgent::trapBasinStep()
+{
+    TrapBasins& basins = m_world.trapBasins();
+    quint32 step = m_world.parameters().currentStep;
+
+    // Asleep; Grid wakes it early if something comes close (see TrapBasins::siteChanged)
+    if (m_wakeStep != 0)
+    {
+        // Time to leave
+        if (step >= m_wakeStep)
+        {
+            basins.removeSleeper(m_basin);
+            m_wakeStep = 0;
+            m_basinSteps = 0;
+            if (m_grid.agentType(m_exitSite) == Agent::Empty)
+            {
+                m_fSite = m_exitSite;
+                m_pathlength += m_basinHops + 1;
+            }
+        }
+        return;
+    }
+
+    // Count the steps in a row spent in one basin
+    int basin = basins.basin(m_site);
+    if (basin < 0 || basin != m_basin)
+    {
+        m_basin = basin;
+        m_basinSteps = (basin < 0) ? 0 : 1;
+        return;
+    }
+    m_basinSteps += 1;
+
+    // Only from rest, so the sampled exit starts from the current site
+    if (m_basinSteps < m_world.parameters().trapBasinSteps || m_fSite != m_site ||
+        !basins.isolated(basin, this))
+    {
+        return;
+    }
+
+    TrapBasins::Exit exit = basins.sample(basin, m_site, m_charge);
+    m_sleepStep = step;
+    m_wakeStep = step + exit.steps;
+    m_exitSite = exit.site;
+    m_basinHops = exit.hops;
+    basins.addSleeper(basin, this);
+}
+
+void ChargeAgent::wakeInBasin()
+{
+    // The hops drawn are spread evenly over the sleep; keep the share of the steps slept
+    quint32 slept = m_world.parameters().currentStep - m_sleepStep;
+    quint32 planned = m_wakeStep - m_sleepStep;
+    m_pathlength += int(double(m_basinHops) * qMin(slept, planned) / planned + 0.5);
+    m_wakeStep = 0;
+    m_basinSteps = 0;
+}
+
+quint32 ChargeAgent::basinWakeStep() const
+{
+    return m_wakeStep;
+}
+
+void ChargeAgent::skipAheadStep()
+{
+    // Only from rest, and once until something changes
+    if (m_skipWake != 0 || m_fSite != m_site || m_skipChecked)
+    {
+        return;
+    }
+    m_skipChecked = true;
+
+    SkipAhead& skip = m_world.skipAhead();
+    QVector<double> chance;
+    double total = skip.chances(this, chance);
+    if (total >= m_world.parameters().hoppingSkip)
+    {
+        return;
+    }
+
+    m_skipFrom = m_world.parameters().currentStep;
+    m_skipWake = m_skipFrom + skip.steps(total);
+    m_skipSite = (total > 0) ? m_neighbors[skip.pick(chance, total)] : m_site;
+    m_skipChance = total;
+    skip.park(this, m_skipWake);
+}
+
+void ChargeAgent::wake()
+{
+    SkipAhead& skip = m_world.skipAhead();
+    quint32 step = m_world.parameters().currentStep;
+    bool due = (step >= m_skipWake);
+
+    // The steps sat out were all turned down
+    skip.creditDrains(this, m_skipChance, (due ? m_skipWake - 1 : step) - m_skipFrom);
+    m_skipWake = 0;
+    m_skipChecked = false;
+    if (!due || m_skipSite == m_site)
+    {
+        return;
+    }
+
+    // Hop as decideFuture() would have
+    m_fSite = m_skipSite;
+    m_pathlength += 1;
+    if (m_grid.agentType(m_fSite) == Agent::Drain)
+    {
+        DrainAgent *drain = dynamic_cast<DrainAgent*>(m_grid.agentAddress(m_fSite));
+        if (!drain)
+        {
+            qFatal("langmuir: can not cast pointer to DrainAgent");
+        }
+        drain->addCounts(1, 1);
+    }
+}
+
+quint32 ChargeAgent::skipWakeStep() const
+{
+    return m_skipWake;
+}
+
 double ChargeAgent::coulombInteraction()
 {
     if(m_world.parameters().useOpenCL)
@@ -214,6 +427,28 @@ double ChargeAgent::coulombInteraction()
 
 void ChargeAgent::coulombCPU()
 {
+    (this->*m_world.stepKernels().coulombCPU)();
+}
+
+StepKernels::Coulomb ChargeAgent::chooseCoulombCPU(const SimulationParameters& par)
+{
+    if (par.coulombGaussianSigma > 0)
+    {
+        return par.defectsCharge != 0 ? &ChargeAgent::coulombSum<true, true> : &ChargeAgent::coulombSum<true, false>;
+    }
+    return par.defectsCharge != 0 ? &ChargeAgent::coulombSum<false, true> : &ChargeAgent::coulombSum<false, false>;
+}
+
+template <bool Gauss, bool Defects>
+void ChargeAgent::coulombSum()
+{
+    // Staying put (see HopProposals) needs no energy change
+    if (m_fSite == m_site)
+    {
+        m_de = 0;
+        return;
+    }
+
     double p1 = 0;
     double p2 = 0;
 
@@ -224,7 +459,7 @@ void ChargeAgent::coulombCPU()
     double self = m_world.sI()[1][0][0] * m_charge;
 
     // Gaussian charges
-    if (m_world.parameters().coulombGaussianSigma > 0)
+    if (Gauss)
     {
         // Electrons
         p1 += m_world.potential().gaussE(m_site);
@@ -235,7 +470,7 @@ void ChargeAgent::coulombCPU()
         p2 += m_world.potential().gaussH(m_fSite);
 
         // Charged defects
-        if(m_world.parameters().defectsCharge != 0)
+        if (Defects)
         {
             p1 += m_world.potential().gaussD(m_site);
             p2 += m_world.potential().gaussD(m_fSite);
@@ -253,7 +488,7 @@ void ChargeAgent::coulombCPU()
         p2 += m_world.potential().coulombH(m_fSite);
 
         // Charged defects
-        if(m_world.parameters().defectsCharge != 0)
+        if (Defects)
         {
             p1 += m_world.potential().coulombD(m_site);
             p2 += m_world.potential().coulombD(m_fSite);
@@ -272,12 +507,15 @@ void ChargeAgent::coulombCPU()
 
 void ChargeAgent::coulombGPU()
 {
-    double p1 = 0;
-    double p2 = 0;
-
     // Assuming the GPU calculation output was copied to the CPU already
-    p1 += m_world.opencl().getOutputHost(m_openClID);
-    p2 += m_world.opencl().getOutputHostFuture(m_openClID);
+    setCoulombPotentials(m_world.opencl().getOutputHost(m_openClID),
+                         m_world.opencl().getOutputHostFuture(m_openClID));
+}
+
+void ChargeAgent::setCoulombPotentials(double current, double future)
+{
+    double p1 = current;
+    double p2 = future;
 
     // Compute self interaction
     //int dx = m_grid.xDistancei(m_site, m_fSite);
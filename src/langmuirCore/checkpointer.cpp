@@ -1,5 +1,6 @@
 #include "checkpointer.h"
 #include "chargeagent.h"
+#include "cubicgrid.h"
 #include "output.h"
 #include "world.h"
 #include "rand.h"
@@ -19,7 +20,7 @@ CheckPointer::CheckPointer(World &world, QObject *parent) :
 {
 }
 
-void CheckPointer::load(const QString &fileName, ConfigurationInfo &configInfo)
+void CheckPointer::load(const QString &fileName, ConfigurationInfo &configInfo, const QStringList &overrides)
 {
     // Unzip the input file
     bool wasZipped = false;
@@ -139,6 +140,13 @@ void CheckPointer::load(const QString &fileName, ConfigurationInfo &configInfo)
         }
     }
 
+    // Parameters given on the command line win over the input file
+    foreach (QString line, overrides)
+    {
+        qDebug("langmuir: override: %s", qPrintable(line));
+        m_world.keyValueParser().parse(line);
+    }
+
     // Seed the random number generator correctly
     if (m_world.parameters().randomSeed > 0)
     {
@@ -484,7 +492,7 @@ std::ostream& CheckPointer::saveElectrons(std::ostream &stream)
     stream << '\n' << m_world.electrons().size();
     foreach(ChargeAgent* charge, m_world.electrons())
     {
-        stream << '\n' << charge->getCurrentSite();
+        stream << '\n' << charge->getGrid().canonicalSite(charge->getCurrentSite());
     }
 
     // Return the stream
@@ -503,7 +511,7 @@ std::ostream& CheckPointer::saveHoles(std::ostream &stream)
     stream << '\n' << m_world.holes().size();
     foreach(ChargeAgent* charge, m_world.holes())
     {
-        stream << '\n' << charge->getCurrentSite();
+        stream << '\n' << charge->getGrid().canonicalSite(charge->getCurrentSite());
     }
 
     // Return the stream
@@ -522,7 +530,7 @@ std::ostream& CheckPointer::saveDefects(std::ostream &stream)
     stream << '\n' << m_world.defectSiteIDs().size();
     foreach(int site, m_world.defectSiteIDs())
     {
-        stream << '\n' << site;
+        stream << '\n' << m_world.electronGrid().canonicalSite(site);
     }
 
     // Return the stream
@@ -541,7 +549,7 @@ std::ostream& CheckPointer::saveTraps(std::ostream &stream)
     stream << '\n' << m_world.trapSiteIDs().size();
     foreach(int site, m_world.trapSiteIDs())
     {
-        stream << '\n' << site;
+        stream << '\n' << m_world.electronGrid().canonicalSite(site);
     }
 
     // Return the stream
@@ -1,4 +1,9 @@
 #include "cubicgrid.h"
+#include "chargeagent.h"
+#include "freesites.h"
+#include "recombinationpairs.h"
+#include "skipahead.h"
+#include "trapbasins.h"
 #include <cmath>
 #include "world.h"
 #include "parameters.h"
@@ -6,8 +11,8 @@
 
 namespace Langmuir
 {
-Grid::Grid(World &world, QObject *parent)
-    : QObject(parent), m_world(world)
+Grid::Grid(World &world, SiteStore::Layer layer, QObject *parent)
+    : QObject(parent), m_world(world), m_sites(world.siteStore()), m_layer(layer)
 {
     m_xSize = m_world.parameters().gridX;
     m_ySize = m_world.parameters().gridY;
@@ -20,9 +25,54 @@ Grid::Grid(World &world, QObject *parent)
                m_world.parameters().gridZ;
     m_specialAgentCount = 0;
     m_specialAgentReserve = 5*7;
-    m_agents.fill(0, m_volume+m_specialAgentReserve);
-    m_potentials.fill(0.0, m_volume+m_specialAgentReserve);
-    m_agentType.fill(Agent::Empty, m_volume+m_specialAgentReserve);
+
+    m_tiled = (m_world.parameters().gridLayout == "tiled");
+    m_tileShift = 0;
+    m_yShift = 0;
+    m_zShift = 0;
+    if (m_tiled)
+    {
+        while ((1 << m_tileShift) < m_world.parameters().gridTile)
+        {
+            m_tileShift++;
+        }
+
+        // bits needed for each coordinate
+        int xBits = 0, yBits = 0, zBits = 0;
+        while ((1 << xBits) < m_xSize) xBits++;
+        while ((1 << yBits) < m_ySize) yBits++;
+        while ((1 << zBits) < m_zSize) zBits++;
+        if (xBits + yBits + zBits > 31)
+        {
+            qFatal("langmuir: grid.layout = tiled, yet the grid is too large to pack x, y and z in 31 bits");
+        }
+        m_yShift = xBits;
+        m_zShift = xBits + yBits;
+
+        // the hole grid shares the electron grid's table (QVector is implicitly shared)
+        if (m_layer == SiteStore::Holes)
+        {
+            m_coordinates = m_world.electronGrid().m_coordinates;
+        }
+    }
+    if (m_tiled && m_coordinates.isEmpty())
+    {
+        m_coordinates.resize(m_volume);
+        for (int k = 0; k < m_zSize; k++)
+        {
+            for (int j = 0; j < m_ySize; j++)
+            {
+                for (int i = 0; i < m_xSize; i++)
+                {
+                    m_coordinates[getIndexS(i, j, k)] =
+                            quint32(i) | (quint32(j) << m_yShift) | (quint32(k) << m_zShift);
+                }
+            }
+        }
+    }
+
+    m_specialSites.fill(0, m_specialAgentReserve);
+    m_specialTypes.fill(Agent::Empty, m_specialAgentReserve);
     m_specialAgents.reserve(m_specialAgentReserve);
     for(int i = 0; i < 7; i++)
     {
@@ -30,10 +80,13 @@ Grid::Grid(World &world, QObject *parent)
         m_specialAgents.push_back(qlist);
         m_specialAgents[i].reserve(5);
     }
+    m_freeFaces.fill(0, Grid::NoFace);
+    m_freeFaceCount = 0;
 }
 
 Grid::~Grid()
 {
+    qDeleteAll(m_freeFaces);
 }
 
 int Grid::xSize()
@@ -131,16 +184,28 @@ int Grid::zImageDistancei(int site1, int site2)
 
 int Grid::getIndexX(int site)
 {
+    if (m_tiled && site < m_volume)
+    {
+        return m_coordinates.at(site) & ((quint32(1) << m_yShift) - 1);
+    }
     return site % m_xSize;
 }
 
 int Grid::getIndexY(int site)
 {
+    if (m_tiled && site < m_volume)
+    {
+        return (m_coordinates.at(site) >> m_yShift) & ((quint32(1) << (m_zShift - m_yShift)) - 1);
+    }
     return(site / m_xSize -(site / m_xyPlaneArea)* m_ySize);
 }
 
 int Grid::getIndexZ(int site)
 {
+    if (m_tiled && site < m_volume)
+    {
+        return m_coordinates.at(site) >> m_zShift;
+    }
     return site /(m_xyPlaneArea);
 }
 
@@ -161,9 +226,51 @@ double Grid::getPositionZ(int site)
 
 int Grid::getIndexS(int xIndex, int yIndex, int zIndex)
 {
+    if (m_tiled)
+    {
+        // corner of the tile, and its size (smaller on the far edges)
+        int mask = ~((1 << m_tileShift) - 1);
+        int x0 = xIndex & mask;
+        int y0 = yIndex & mask;
+        int z0 = zIndex & mask;
+        int wx = tileWidth(xIndex, m_xSize);
+        int wy = tileWidth(yIndex, m_ySize);
+        int wz = tileWidth(zIndex, m_zSize);
+
+        // sites in the tiles before this one, then the position inside it
+        return m_xyPlaneArea * z0 + wz * (m_xSize * y0 + wy * x0) +
+               (xIndex - x0) + wx * ((yIndex - y0) + wy * (zIndex - z0));
+    }
     return(m_xSize *(yIndex + zIndex*m_ySize)+ xIndex);
 }
 
+int Grid::tileWidth(int index, int size)
+{
+    int tile = 1 << m_tileShift;
+    return qMin(tile, size - (index & ~(tile - 1)));
+}
+
+int Grid::canonicalSite(int site)
+{
+    if (!m_tiled || site >= m_volume)
+    {
+        return site;
+    }
+    return getIndexX(site) + m_xSize * (getIndexY(site) + m_ySize * getIndexZ(site));
+}
+
+int Grid::siteFromCanonical(int canonical)
+{
+    if (!m_tiled || canonical >= m_volume)
+    {
+        return canonical;
+    }
+    int z = canonical / m_xyPlaneArea;
+    int y = canonical / m_xSize - z * m_ySize;
+    int x = canonical % m_xSize;
+    return getIndexS(x, y, z);
+}
+
 QVector<int> Grid::sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf)
 {
     int ndx_rev = 0;
@@ -218,7 +325,7 @@ QVector<int> Grid::neighborsSite(int site, int hoppingRange)
 //                           .arg(x,3)
 //                           .arg(y,3)
 //                           .arg(z,3)
-//                           .arg(Agent::toQString(m_agentType[site])));
+//                           .arg(Agent::toQString(agentType(site))));
     switch (hoppingRange)
     {
         case 1:
@@ -527,27 +634,40 @@ QVector<int> Grid::neighborsFace(Grid::CubeFace cubeFace)
 
 Agent * Grid::agentAddress(int site)
 {
-    return m_agents[site];
+    if (site >= m_volume)
+    {
+        return m_specialSites[site - m_volume];
+    }
+    return m_sites.agentAddress(m_layer, site);
 }
 
 Agent::Type Grid::agentType(int site)
 {
-    return m_agentType[site];
+    if (site >= m_volume)
+    {
+        return m_specialTypes[site - m_volume];
+    }
+    return m_sites.agentType(m_layer, site);
 }
 
 void Grid::setPotential(int site, double potential)
 {
-    m_potentials[site] = potential;
+    m_sites.setPotential(site, potential);
 }
 
 void Grid::addToPotential(int site, double potential)
 {
-    m_potentials[site] = m_potentials[site] + potential;
+    m_sites.addToPotential(site, potential);
 }
 
 double Grid::potential(int site)
 {
-    return m_potentials[site];
+    // sources and drains have no background potential
+    if (site >= m_volume)
+    {
+        return 0;
+    }
+    return m_sites.potential(site);
 }
 
 QList<Agent *>& Grid::getSpecialAgentList(Grid::CubeFace cubeFace)
@@ -571,10 +691,10 @@ void Grid::registerSpecialAgent(Agent *agent, Grid::CubeFace cubeFace)
     specialAgents.push_back(agent);
 
     int site = m_volume+m_specialAgentCount;
-    if(m_agents[site] == 0 && m_agentType[site] == Agent::Empty)
+    if(m_specialSites[m_specialAgentCount] == 0 && m_specialTypes[m_specialAgentCount] == Agent::Empty)
     {
-        m_agents[site] = agent;
-        m_agentType[site] = agent->getType();
+        m_specialSites[m_specialAgentCount] = agent;
+        m_specialTypes[m_specialAgentCount] = agent->getType();
     }
     else
     {
@@ -598,23 +718,24 @@ void Grid::unregisterSpecialAgent(Agent *agent, Grid::CubeFace cubeFace)
     specialAgents.removeOne(agent);
 
     int site = agent->getCurrentSite();
-    if(!(m_agents[site] == agent))
+    if(!(agentAddress(site) == agent))
     {
         qFatal("langmuir: can not unregister special agent! pointers do not match");
     }
 
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    m_specialTypes[site - m_volume] = Agent::Empty;
+    m_specialSites[site - m_volume] = 0;
     --m_specialAgentCount;
 }
 
 void Grid::registerAgent(Agent *agent)
 {
     int site = agent->getCurrentSite();
-    if((m_agents[site] == 0) && (m_agentType[site] == Agent::Empty))
+    if(site < m_volume && m_sites.agentType(m_layer, site) == Agent::Empty &&
+       agent->getType() == (m_layer == SiteStore::Electrons ? Agent::Electron : Agent::Hole))
     {
-        m_agents[site] = agent;
-        m_agentType[site] = agent->getType();
+        m_sites.setCarrier(m_layer, site, static_cast<ChargeAgent *>(agent)->getStoreID());
+        updateFreeFaces(site);
     }
     else
     {
@@ -622,25 +743,59 @@ void Grid::registerAgent(Agent *agent)
     }
     QVector<int> neighbors = neighborsSite(site, m_world.parameters().hoppingRange);
     agent->setNeighbors(neighbors);
+    m_world.recombinationPairs().carrierArrived(agent);
+    m_world.skipAhead().siteChanged(*this, site);
+    m_world.trapBasins().siteChanged(*this, site);
 }
 
 void Grid::unregisterAgent(Agent *agent)
 {
     int site = agent->getCurrentSite();
-    if(!(m_agents[site] == agent))
+    if(!(agentAddress(site) == agent))
     {
         qFatal("langmuir: can not unregister agent! pointers do not match");
     }
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    m_sites.clear(m_layer, site);
+    updateFreeFaces(site);
+    m_world.recombinationPairs().carrierLeft(agent);
+    m_world.skipAhead().siteChanged(*this, site);
+    m_world.trapBasins().siteChanged(*this, site);
+}
+
+void Grid::moveAgent(Agent *agent, int site)
+{
+    int from = agent->getCurrentSite();
+    if(!(agentAddress(from) == agent))
+    {
+        qFatal("langmuir: can not move agent! pointers do not match");
+    }
+    if(!(site < m_volume && m_sites.agentType(m_layer, site) == Agent::Empty))
+    {
+        qFatal("langmuir: can not move agent: site %d is invalid", site);
+    }
+    m_world.recombinationPairs().carrierLeft(agent);
+    m_sites.moveCarrier(m_layer, from, site);
+    updateFreeFaces(from);
+    updateFreeFaces(site);
+    m_world.skipAhead().siteChanged(*this, from);
+    m_world.trapBasins().siteChanged(*this, from);
+
+    agent->setCurrentSite(site);
+    QVector<int> neighbors = neighborsSite(site, m_world.parameters().hoppingRange);
+    agent->setNeighbors(neighbors);
+    m_world.recombinationPairs().carrierArrived(agent);
+    m_world.skipAhead().siteChanged(*this, site);
+    m_world.trapBasins().siteChanged(*this, site);
 }
 
 void Grid::registerDefect(int site)
 {
-    if(m_agents[site] == 0 && m_agentType[site] == Agent::Empty)
+    if(agentType(site) == Agent::Empty)
     {
-        m_agents[site] = 0;
-        m_agentType[site] = Agent::Defect;
+        m_sites.setDefect(m_layer, site);
+        updateFreeFaces(site);
+        m_world.skipAhead().siteChanged(*this, site);
+        m_world.trapBasins().siteChanged(*this, site);
     }
     else
     {
@@ -650,12 +805,84 @@ void Grid::registerDefect(int site)
 
 void Grid::unregisterDefect(int site)
 {
-    if(m_agentType[site] != Agent::Defect || m_agents[site] != 0)
+    if(agentType(site) != Agent::Defect)
     {
         qFatal("langmuir: can not unregister defect! type does not match");
     }
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    m_sites.clear(m_layer, site);
+    updateFreeFaces(site);
+    m_world.skipAhead().siteChanged(*this, site);
+    m_world.trapBasins().siteChanged(*this, site);
+}
+
+const FreeSites *Grid::freeSites(Grid::CubeFace cubeFace)
+{
+    if (cubeFace == Grid::NoFace)
+    {
+        return 0;
+    }
+    if (m_freeFaces[cubeFace] == 0)
+    {
+        QVector<int> sites = neighborsFace(cubeFace);
+        m_freeFaces[cubeFace] = new FreeSites(sites.size());
+        ++m_freeFaceCount;
+        foreach (int site, sites)
+        {
+            if (agentType(site) == Agent::Empty)
+            {
+                m_freeFaces[cubeFace]->insert(faceKey(getIndexX(site), getIndexY(site), getIndexZ(site), cubeFace),
+                                              site);
+            }
+        }
+    }
+    return m_freeFaces[cubeFace];
+}
+
+int Grid::faceKey(int x, int y, int z, Grid::CubeFace cubeFace)
+{
+    switch (cubeFace)
+    {
+    case Grid::Left:   return x == 0           ? y + m_ySize * z : -1;
+    case Grid::Right:  return x == m_xSize - 1 ? y + m_ySize * z : -1;
+    case Grid::Top:    return y == 0           ? x + m_xSize * z : -1;
+    case Grid::Bottom: return y == m_ySize - 1 ? x + m_xSize * z : -1;
+    case Grid::Front:  return z == m_zSize - 1 ? x + m_xSize * y : -1;
+    case Grid::Back:   return z == 0           ? x + m_xSize * y : -1;
+    default:           return -1;
+    }
+}
+
+void Grid::updateFreeFaces(int site)
+{
+    if (m_freeFaceCount == 0)
+    {
+        return;
+    }
+
+    int x = getIndexX(site);
+    int y = getIndexY(site);
+    int z = getIndexZ(site);
+    bool empty = m_sites.agentType(m_layer, site) == Agent::Empty;
+    for (int face = 0; face < m_freeFaces.size(); face++)
+    {
+        if (m_freeFaces[face] == 0)
+        {
+            continue;
+        }
+        int key = faceKey(x, y, z, Grid::CubeFace(face));
+        if (key < 0)
+        {
+            continue;
+        }
+        if (empty)
+        {
+            m_freeFaces[face]->insert(key, site);
+        }
+        else
+        {
+            m_freeFaces[face]->remove(key);
+        }
+    }
 }
 
 int Grid::specialAgentCount()
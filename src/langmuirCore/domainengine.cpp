@@ -0,0 +1,204 @@
+#include "domainengine.h"
+#include "openclhelper.h"
+#include "chargeagent.h"
+#include "sourceagent.h"
+#include "fluxagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "workerpool.h"
+#include "writer.h"
+#include "world.h"
+#include "rand.h"
+
+#include <climits>
+
+namespace Langmuir
+{
+
+DomainEngine::DomainEngine(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_phase(0), m_numElectrons(0), m_numHoles(0)
+{
+    const SimulationParameters& par = m_world.parameters();
+    int slabs = par.domainSlabs;
+    int sizeX = m_world.electronGrid().xSize();
+
+    // one pair of draws from the host generator per slab, so random.seed still picks the run
+    Random& random = m_world.randomNumberGenerator();
+    m_slabOfX.resize(sizeX);
+    for (int k = 0; k < slabs; k++)
+    {
+        Domain domain;
+        domain.xBegin = int(qint64(k) * sizeX / slabs);
+        domain.xEnd = int(qint64(k + 1) * sizeX / slabs);
+        quint64 seed = (quint64(random.integer(0, INT_MAX)) << 32) ^ quint64(random.integer(1, INT_MAX));
+        domain.random = new Random(seed);
+        domain.removed = 0;
+        for (int x = domain.xBegin; x < domain.xEnd; x++)
+        {
+            m_slabOfX[x] = k;
+        }
+        m_phases[k % 2].push_back(domain);
+    }
+    qDebug("langmuir: %d domain slabs of %d or more sites along x", slabs, sizeX / slabs);
+}
+
+DomainEngine::~DomainEngine()
+{
+    for (int phase = 0; phase < 2; phase++)
+    {
+        for (int i = 0; i < m_phases[phase].size(); i++)
+        {
+            delete m_phases[phase][i].random;
+        }
+    }
+}
+
+void DomainEngine::performIterations(int nIterations)
+{
+    m_numElectrons = adopt(m_world.electrons(), m_numElectrons);
+    m_numHoles = adopt(m_world.holes(), m_numHoles);
+    for (int i = 0; i < nIterations; i++)
+    {
+        step();
+    }
+}
+
+DomainEngine::Domain& DomainEngine::domainOf(ChargeAgent *charge)
+{
+    int k = m_slabOfX[charge->getGrid().getIndexX(charge->getCurrentSite())];
+    return m_phases[k % 2][k / 2];
+}
+
+int DomainEngine::adopt(QList<ChargeAgent*>& charges, int known)
+{
+    // the lists only shrink in dropRemoved(), which keeps the count
+    for (int i = qMin(known, charges.size()); i < charges.size(); i++)
+    {
+        domainOf(charges[i]).carriers.push_back(charges[i]);
+    }
+    return charges.size();
+}
+
+void DomainEngine::dropRemoved(QList<ChargeAgent*>& charges)
+{
+    bool report = m_world.parameters().outputIdsOnDelete;
+    QList<ChargeAgent*> kept;
+    kept.reserve(charges.size());
+    foreach (ChargeAgent *charge, charges)
+    {
+        if (charge->removed())
+        {
+            if (report)
+            {
+                m_world.logger().reportCarrier(*charge);
+            }
+            delete charge;
+        }
+        else
+        {
+            kept.push_back(charge);
+        }
+    }
+    charges = kept;
+}
+
+void DomainEngine::step()
+{
+    //Store fluxAgent states
+    foreach (FluxAgent* flux, m_world.fluxes())
+    {
+        flux->storeLast();
+    }
+
+    // Even slabs, then odd slabs; the slabs of a phase share no sites
+    for (int phase = 0; phase < 2; phase++)
+    {
+        m_phase = phase;
+        m_world.workerPool().run(DomainEngine::runDomains, this, m_phases[phase].size());
+    }
+
+    // Hand over the carriers that changed slab, and tell OpenClHelper where everyone went
+    int removed = 0;
+    for (int phase = 0; phase < 2; phase++)
+    {
+        for (int i = 0; i < m_phases[phase].size(); i++)
+        {
+            Domain& domain = m_phases[phase][i];
+            foreach (ChargeAgent *charge, domain.moved)
+            {
+                m_world.opencl().moveCarrier(charge->getOpenCLID(), charge->getCurrentSite());
+            }
+            foreach (ChargeAgent *charge, domain.leaving)
+            {
+                domainOf(charge).carriers.push_back(charge);
+            }
+            removed += domain.removed;
+        }
+    }
+
+    // Delete the carriers that left through a drain
+    if (removed > 0)
+    {
+        dropRemoved(m_world.electrons());
+        dropRemoved(m_world.holes());
+    }
+    m_numElectrons = m_world.electrons().size();
+    m_numHoles = m_world.holes().size();
+
+    // Perform charge injection at the source
+    m_world.electronSourceAgentLeft().tryToInject();
+    m_world.electronSourceAgentRight().tryToInject();
+    m_world.holeSourceAgentLeft().tryToInject();
+    m_world.holeSourceAgentRight().tryToInject();
+    m_numElectrons = adopt(m_world.electrons(), m_numElectrons);
+    m_numHoles = adopt(m_world.holes(), m_numHoles);
+
+    m_world.parameters().currentStep += 1;
+}
+
+void DomainEngine::run(Domain& domain)
+{
+    domain.moved.clear();
+    domain.leaving.clear();
+    domain.removed = 0;
+
+    int kept = 0;
+    for (int i = 0; i < domain.carriers.size(); i++)
+    {
+        ChargeAgent *charge = domain.carriers[i];
+        int site = charge->getCurrentSite();
+        charge->chooseFuture(*domain.random);
+        charge->decideFuture(*domain.random);
+        charge->completeTick(false);
+
+        if (charge->removed())
+        {
+            domain.removed += 1;
+            continue;
+        }
+        if (charge->getCurrentSite() != site)
+        {
+            domain.moved.push_back(charge);
+            int x = charge->getGrid().getIndexX(charge->getCurrentSite());
+            if (x < domain.xBegin || x >= domain.xEnd)
+            {
+                domain.leaving.push_back(charge);
+                continue;
+            }
+        }
+        domain.carriers[kept] = charge;
+        kept++;
+    }
+    domain.carriers.resize(kept);
+}
+
+void DomainEngine::runDomains(void *self, int begin, int end)
+{
+    DomainEngine& engine = *static_cast<DomainEngine *>(self);
+    for (int i = begin; i < end; i++)
+    {
+        engine.run(engine.m_phases[engine.m_phase][i]);
+    }
+}
+
+}
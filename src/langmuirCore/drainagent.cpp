@@ -13,17 +13,6 @@ DrainAgent::DrainAgent(World &world, Grid &grid, QObject *parent)
 {
 }
 
-ElectronDrainAgent::ElectronDrainAgent(World &world, int site, QObject *parent)
-    : DrainAgent(world, world.electronGrid(), parent)
-{
-    initializeSite(site);
-    QString name;
-    QTextStream stream(&name);
-    stream << "e" << m_type << site;
-    stream.flush();
-    setObjectName(name);
-}
-
 ElectronDrainAgent::ElectronDrainAgent(World &world, Grid::CubeFace cubeFace, QObject *parent)
     : DrainAgent(world, world.electronGrid(), parent)
 {
@@ -35,17 +24,6 @@ ElectronDrainAgent::ElectronDrainAgent(World &world, Grid::CubeFace cubeFace, QO
     setObjectName(name);
 }
 
-HoleDrainAgent::HoleDrainAgent(World &world, int site, QObject *parent)
-    : DrainAgent(world, world.holeGrid(), parent)
-{
-    initializeSite(site);
-    QString name;
-    QTextStream stream(&name);
-    stream << "h" << m_type << site;
-    stream.flush();
-    setObjectName(name);
-}
-
 HoleDrainAgent::HoleDrainAgent(World &world, Grid::CubeFace cubeFace, QObject *parent)
     : DrainAgent(world, world.holeGrid(), parent)
 {
@@ -91,6 +69,18 @@ bool DrainAgent::tryToAccept(ChargeAgent *charge)
     return false;
 }
 
+bool DrainAgent::tryToAccept(ChargeAgent *charge, Random &random)
+{
+    Q_UNUSED(charge);
+    m_attempts += 1;
+    if(random.chooseYes(m_probability))
+    {
+        m_successes += 1;
+        return true;
+    }
+    return false;
+}
+
 double ElectronDrainAgent::energyChange(int site)
 {
     double p1 = m_potential;
@@ -17,13 +17,6 @@ FluxAgent::FluxAgent(Agent::Type type, World &world, Grid &grid, QObject *parent
     storeLast();
 }
 
-void FluxAgent::initializeSite(int site)
-{
-    m_site = site;
-    m_fSite = site;
-    m_grid.registerAgent(this);
-}
-
 void FluxAgent::initializeSite(Grid::CubeFace cubeFace)
 {
     m_grid.registerSpecialAgent(this, cubeFace);
@@ -189,6 +182,12 @@ void FluxAgent::setSuccesses(unsigned long int value)
     storeLast();
 }
 
+void FluxAgent::addCounts(unsigned long int attempts, unsigned long int successes)
+{
+    m_attempts += attempts;
+    m_successes += successes;
+}
+
 double FluxAgent::potential()const
 {
     return m_potential;
@@ -0,0 +1,67 @@
+#include "freesites.h"
+
+namespace Langmuir
+{
+
+FreeSites::FreeSites(int keys)
+{
+    m_position.fill(-1, keys);
+    m_sites.reserve(keys);
+    m_keys.reserve(keys);
+}
+
+void FreeSites::insert(int key, int site)
+{
+    if (m_position[key] >= 0)
+    {
+        return;
+    }
+    m_position[key] = m_sites.size();
+    m_sites.push_back(site);
+    m_keys.push_back(key);
+}
+
+void FreeSites::remove(int key)
+{
+    int i = m_position[key];
+    if (i < 0)
+    {
+        return;
+    }
+
+    // fill the hole with the last entry
+    int last = m_sites.size() - 1;
+    m_sites[i] = m_sites[last];
+    m_keys[i] = m_keys[last];
+    m_position[m_keys[i]] = i;
+    m_sites.pop_back();
+    m_keys.pop_back();
+    m_position[key] = -1;
+}
+
+bool FreeSites::contains(int key) const
+{
+    return m_position[key] >= 0;
+}
+
+int FreeSites::size() const
+{
+    return m_sites.size();
+}
+
+int FreeSites::keys() const
+{
+    return m_position.size();
+}
+
+int FreeSites::site(int i) const
+{
+    return m_sites[i];
+}
+
+double FreeSites::bytes() const
+{
+    return (m_sites.capacity() + m_keys.capacity() + m_position.size()) * double(sizeof(int));
+}
+
+}
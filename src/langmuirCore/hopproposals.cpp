@@ -0,0 +1,130 @@
+#include "hopproposals.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+namespace Langmuir
+{
+
+HopProposals::HopProposals(World &world, QObject *parent)
+    : QObject(parent), m_world(world)
+{
+    m_on = (m_world.parameters().hoppingProposal == "weighted");
+    if (m_on)
+    {
+        // each axis has (range + 1)^2 shapes, and there are two grids
+        int axis = (m_world.parameters().hoppingRange + 1) * (m_world.parameters().hoppingRange + 1);
+        m_tables.fill(0, 2 * axis * axis * axis);
+    }
+}
+
+HopProposals::~HopProposals()
+{
+    qDeleteAll(m_tables);
+}
+
+bool HopProposals::isOn() const
+{
+    return m_on;
+}
+
+int HopProposals::shape(Grid &grid, int site)
+{
+    int range = m_world.parameters().hoppingRange;
+    int x = grid.getIndexX(site);
+    int y = grid.getIndexY(site);
+    int z = grid.getIndexZ(site);
+    int sx = qMin(x, range) + (range + 1) * qMin(grid.xSize() - 1 - x, range);
+    int sy = qMin(y, range) + (range + 1) * qMin(grid.ySize() - 1 - y, range);
+    int sz = qMin(z, range) + (range + 1) * qMin(grid.zSize() - 1 - z, range);
+    int axis = (range + 1) * (range + 1);
+    return sx + axis * (sy + axis * sz);
+}
+
+const HopProposals::Table *HopProposals::table(Grid &grid, int site)
+{
+    int index = 2 * shape(grid, site) + (&grid == &m_world.holeGrid() ? 1 : 0);
+    if (m_tables[index] == 0)
+    {
+        m_tables[index] = build(grid, site);
+    }
+    return m_tables[index];
+}
+
+HopProposals::Table *HopProposals::build(Grid &grid, int site)
+{
+    QVector<int> neighbors = grid.neighborsSite(site, m_world.parameters().hoppingRange);
+    int n = neighbors.size();
+
+    Table *table = new Table;
+    if (n == 0)
+    {
+        table->probability.fill(1.0, 1);
+        table->alias.fill(0, 1);
+        return table;
+    }
+
+    // the weights add up to n, the last one being the chance of staying put
+    QVector<double> weight(n + 1);
+    double total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int other = neighbors[i];
+        if (other >= grid.volume())
+        {
+            weight[i] = 1.0;
+        }
+        else
+        {
+            weight[i] = m_world.couplingConstants()[grid.xDistancei(site, other)]
+                                                   [grid.yDistancei(site, other)]
+                                                   [grid.zDistancei(site, other)];
+        }
+        total += weight[i];
+    }
+    weight[n] = qMax(0.0, n - total);
+
+    // Vose's alias method: split the entries into those below and above the mean
+    table->probability.fill(1.0, n + 1);
+    table->alias.resize(n + 1);
+    QVector<int> small;
+    QVector<int> large;
+    QVector<double> scaled(n + 1);
+    for (int i = 0; i <= n; i++)
+    {
+        table->alias[i] = i;
+        scaled[i] = weight[i] * (n + 1) / n;
+        if (scaled[i] < 1.0)
+        {
+            small.push_back(i);
+        }
+        else
+        {
+            large.push_back(i);
+        }
+    }
+    while (!small.isEmpty() && !large.isEmpty())
+    {
+        int s = small.last();
+        small.pop_back();
+        int l = large.last();
+        table->probability[s] = scaled[s];
+        table->alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    return table;
+}
+
+int HopProposals::choose(const Table *table, Random &random)
+{
+    int i = random.integer(0, table->probability.size() - 1);
+    return random.random() < table->probability[i] ? i : table->alias[i];
+}
+
+}
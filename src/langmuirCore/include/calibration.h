@@ -0,0 +1,87 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <QObject>
+#include <QVector>
+
+namespace Langmuir
+{
+
+class World;
+struct SimulationParameters;
+
+/**
+ * @brief Times the CPU and OpenCL coulomb paths to choose SimulationParameters::openclThreshold
+ *
+ * Each carrier count is timed in a scratch World seeded with that many electrons, so
+ * the real World is left alone apart from the parameters that are chosen.  Those end up
+ * in the .parm file like any other parameter.
+ */
+class Calibration : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(Calibration)
+
+public:
+    /**
+     * @brief Create the Calibration
+     * @param world reference to the World whose parameters are tuned
+     * @param parent QObject this belongs to
+     */
+    Calibration(World &world, QObject *parent=0);
+
+    /**
+     * @brief Pick work.size (and work.x/y/z) if asked to, then fit opencl.threshold
+     */
+    void run();
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief Parameters for a scratch World with a number of electrons and no output
+     */
+    SimulationParameters scratchParameters(int count);
+
+    /**
+     * @brief Seconds per step spent on coulomb interactions by the CPU path (VectorCoulomb unless cpu.simd = off)
+     */
+    double timeCPU(World& world);
+
+    /**
+     * @brief Seconds per step spent on coulomb interactions by the OpenCL path
+     */
+    double timeOpenCL(World& world);
+
+    /**
+     * @brief Seconds spent by coulomb1 / gauss1, which is only used for output.coulomb
+     */
+    double timeKernel1(World& world);
+
+    /**
+     * @brief Choose the fastest work.size for coulomb2 / gauss2 at a carrier count
+     */
+    void tuneWorkSize(int count);
+
+    /**
+     * @brief Choose the fastest work.x/y/z for coulomb1 / gauss1 at a carrier count
+     */
+    void tuneWorkXYZ(int count);
+
+    /**
+     * @brief Carrier count where OpenCL starts to win, interpolated in log space
+     * @param counts carrier counts timed, increasing
+     * @param cpu seconds per step on the CPU at each count
+     * @param gpu seconds per step with OpenCL at each count
+     * @param never returned if the CPU always wins
+     */
+    static int crossover(const QVector<int>& counts, const QVector<double>& cpu, const QVector<double>& gpu,
+                         int never);
+};
+
+}
+#endif // CALIBRATION_H
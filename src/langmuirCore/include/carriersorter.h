@@ -0,0 +1,178 @@
+#ifndef CARRIERSORTER_H
+#define CARRIERSORTER_H
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+
+namespace Langmuir
+{
+
+class World;
+class ChargeAgent;
+
+/**
+ * @brief Puts World::electrons() and World::holes() back in the order of their sites, every so often
+ *
+ * Used when SimulationParameters::carrierSort is on.  Carriers are injected, drained and moved
+ * in no particular order, so after a while the lists jump all over the Grid and most carriers the
+ * step visits miss the cache in the SiteStore.  sortIfDue() sorts both lists by the Morton
+ * (Z-order) key of the carriers' x, y and z, so carriers that are next to each other in a list are
+ * mostly next to each other on the Grid.  Only the order changes: each carrier keeps its OpenCL
+ * slot, and the logger still knows it by its address.  The sort breaks ties by the old order, so
+ * a run still only depends on its parameters and random.seed; it does not match the same run
+ * without sorting, as the carriers draw in a different order.
+ *
+ * In a sorted list, the carrier first in Morton order (lower x, y and z) would always take a site
+ * two carriers want, and would always leave a site before the carrier behind it tries to move in,
+ * as Simulation::nextTick() moves them in list order, so the carriers would drift that way.  So
+ * while sorting is on, completeTicks() moves the carriers that hop or leave in a fresh random
+ * order every step: a site any number of carriers want goes to each of them with the same odds,
+ * and a carrier moving into a site another one leaves follows it as often as in an unsorted list.
+ * The carriers that stay put, most of them, are not touched.
+ *
+ * The interval starts at SimulationParameters::carrierSort steps and adapts to how fast the order
+ * decays: the share of carriers whose site is a page of sites or more away from the one before
+ * them (far jumps) is measured before and after each sort.  If more than half of the last sort's
+ * gain is gone by the next one, the interval halves; if less than a quarter is, it doubles.
+ * On Linux the cache misses of the main thread and of each WorkerPool worker are also counted with
+ * perf_event_open(), where the kernel allows it, and reported per carrier and step against the
+ * unsorted start.
+ */
+class CarrierSorter : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(CarrierSorter)
+
+public:
+    /**
+     * @brief Plan the first sort, and start the cache miss counters
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     */
+    CarrierSorter(World &world, QObject *parent=0);
+
+    /**
+     * @brief Stop the cache miss counters
+     */
+    ~CarrierSorter();
+
+    /**
+     * @brief False if SimulationParameters::carrierSort is 0
+     */
+    bool isOn() const;
+
+    /**
+     * @brief Sort the carriers if the interval is up, between two steps
+     */
+    void sortIfDue();
+
+    /**
+     * @brief Sort the carriers now
+     */
+    void sort();
+
+    /**
+     * @brief Call ChargeAgent::completeTick() for the carriers of a list that hop or were removed, in a random order
+     *
+     * Draws one number from World::randomNumberGenerator() per such carrier but the last.
+     */
+    void completeTicks(QList<ChargeAgent*>& charges);
+
+    /**
+     * @brief The steps between sorts right now
+     */
+    int interval() const;
+
+    /**
+     * @brief The share of far jumps in World::electrons() and World::holes()
+     */
+    double farJumps();
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief True if SimulationParameters::carrierSort > 0
+     */
+    bool m_on;
+
+    /**
+     * @brief The steps between sorts
+     */
+    int m_interval;
+
+    /**
+     * @brief The step of the next sort
+     */
+    quint32 m_next;
+
+    /**
+     * @brief The number of sorts so far
+     */
+    int m_sorts;
+
+    /**
+     * @brief farJumps() before the first sort, the unsorted level
+     */
+    double m_unsorted;
+
+    /**
+     * @brief farJumps() right after the last sort
+     */
+    double m_sorted;
+
+    /**
+     * @brief perf_event_open() file descriptors, the main thread's then one per worker; empty if not counting
+     */
+    QVector<int> m_counters;
+
+    /**
+     * @brief The count at the last sort, summed over the threads
+     */
+    quint64 m_lastMisses;
+
+    /**
+     * @brief Cache misses per carrier and step before the first sort, or -1
+     */
+    double m_unsortedMisses;
+
+    /**
+     * @brief Carriers summed over the steps since the last sort, for the miss rate
+     */
+    double m_carrierSteps;
+
+    /**
+     * @brief Sort one list by Morton key
+     */
+    void sortList(QList<ChargeAgent*>& charges);
+
+    /**
+     * @brief Add the far jumps in one list
+     * @param jumps incremented by the far jumps
+     * @param pairs incremented by the neighboring pairs looked at
+     */
+    void countJumps(QList<ChargeAgent*>& charges, int& jumps, int& pairs);
+
+    /**
+     * @brief Cache misses per carrier and step since the last sort, or -1 if not counting
+     */
+    double missRate();
+
+    /**
+     * @brief Open a cache miss counter for the calling thread, or return -1
+     */
+    static int openCounter();
+
+    /**
+     * @brief Opens the counters of workers begin to end (not included), on the workers
+     */
+    static void openWorkerCounters(void *self, int begin, int end);
+};
+
+}
+#endif // CARRIERSORTER_H
@@ -2,11 +2,14 @@
 #define CHARGEAGENT_H
 
 #include "agent.h"
+#include "stepkernels.h"
+#include "hopproposals.h"
 
 namespace Langmuir
 {
 
 class Grid;
+class Random;
 struct SimulationParameters;
 
 //! A class to represent moving charged particles
@@ -30,14 +33,41 @@ public:
     //! Get the charge of the ChargeAgent
     int charge();
 
-    //! Propose a random site to move to
+    //! Propose a random site to move to (or, with weighted proposals, maybe the current site)
     void chooseFuture();
 
+    //! chooseFuture() with the numbers drawn from a given generator (see DomainEngine)
+    void chooseFuture(Random &random);
+
     //! Decide what should happen, called after chooseFuture
     void decideFuture();
 
+    //! decideFuture() with the numbers drawn from a given generator (see DomainEngine)
+    void decideFuture(Random &random);
+
+    //! Fall asleep in, or leave, a trap basin (see TrapBasins), called after decideFuture
+    void trapBasinStep();
+
+    //! Wake where it is in its trap basin, crediting the hops of the steps slept; the caller has forgotten the sleeper
+    void wakeInBasin();
+
+    //! The step a ChargeAgent asleep in a trap basin hops out, or 0 if it is not asleep
+    quint32 basinWakeStep() const;
+
+    //! Park the ChargeAgent until its hop if it is unlikely to move (see SkipAhead), called after decideFuture
+    void skipAheadStep();
+
+    //! Leave SkipAhead, taking the hop drawn if it is due; the caller has taken it out of the queue
+    void wake();
+
+    //! The step a parked ChargeAgent hops, or 0 if it is not parked
+    quint32 skipWakeStep() const;
+
     //! Perform action, called after decideFuture
-    void completeTick();
+    /*!
+      \param recordMove if false, the caller tells OpenClHelper::moveCarrier() about a move later (see DomainEngine)
+     */
+    void completeTick(bool recordMove=true);
 
     //! True if decideFuture removed the charge from the grid
     bool removed();
@@ -48,6 +78,12 @@ public:
     //! Number of sites ChargeAgent has traversed
     int pathlength();
 
+    //! Set the number of steps ChargeAgent has existed (see OpenClEngine)
+    void setLifetime(int lifetime);
+
+    //! Set the number of sites ChargeAgent has traversed (see OpenClEngine)
+    void setPathlength(int pathlength);
+
     //! Set the ChargeAgent OpenCL identifier
     /*!
       \see OpenClHelper
@@ -60,6 +96,12 @@ public:
      */
     int getOpenCLID();
 
+    //! Get the index of the ChargeAgent in the SiteStore
+    /*!
+      \see SiteStore::addCarrier
+     */
+    quint32 getStoreID();
+
     //! Perform coulombCPU() or coulombGPU()
     /*!
       depends upon SimulationParameters::useOpenCL and SimulationParameters::okCL
@@ -70,9 +112,13 @@ public:
     //! Calculate the Coulomb potential on the CPU
     /*!
       \note The result is stored in m_de
+      \see StepKernels::coulombCPU
      */
     void coulombCPU();
 
+    //! The coulombSum() specialization for a set of parameters, see StepKernels
+    static StepKernels::Coulomb chooseCoulombCPU(const SimulationParameters& par);
+
     //! \b Retrieve the Coulomb potential from the GPU
     /*!
       \note The result is stored in m_de
@@ -82,6 +128,15 @@ public:
      */
     void coulombGPU();
 
+    //! Finish the Coulomb energy change from potentials summed elsewhere
+    /*!
+      \param current potential from the other charges at the current site
+      \param future potential from the other charges at the future site
+      \note The result is stored in m_de
+      \see coulombGPU(), VectorCoulomb
+     */
+    void setCoulombPotentials(double current, double future);
+
     //! compare results for CPU and GPU Coulomb (assumes kernel was called)
     void compareCoulomb();
 
@@ -108,6 +163,15 @@ public:
 
 protected:
 
+    //! Sum the Coulomb potentials with the Potential loops
+    /*!
+      \tparam Gauss SimulationParameters::coulombGaussianSigma > 0
+      \tparam Defects SimulationParameters::defectsCharge != 0
+      \note The result is stored in m_de
+     */
+    template <bool Gauss, bool Defects>
+    void coulombSum();
+
     //! Calculate the exciton binding energy
     /*!
       \param site the site to check in other Grid
@@ -132,11 +196,53 @@ protected:
     //! The Grid the ChargeAgent lives in
     Grid &m_grid;
 
-    //! The index of the Charge in the OpenCL vectors (see OpenClHelper)
+    //! The slot of the Charge in the OpenCL buffers, kept until it is deleted (see OpenClHelper::addCarrier)
     int m_openClID;
 
+    //! The index of the Charge in the SiteStore, kept until it is deleted (see SiteStore::addCarrier)
+    quint32 m_storeID;
+
     //! The difference in Coulomb potential between ChargeAgent::m_site and ChargeAgent::m_fSite
     double m_de;
+
+    //! The HopProposals table for ChargeAgent::m_proposalSite
+    const HopProposals::Table *m_proposals;
+
+    //! The site ChargeAgent::m_proposals was looked up for, or -1
+    int m_proposalSite;
+
+    //! The trap basin ChargeAgent::m_site was in last step, or -1
+    int m_basin;
+
+    //! Steps in a row spent in ChargeAgent::m_basin
+    int m_basinSteps;
+
+    //! The step the ChargeAgent hops out of its trap basin, or 0 if it is not asleep
+    quint32 m_wakeStep;
+
+    //! The step the ChargeAgent fell asleep in its trap basin
+    quint32 m_sleepStep;
+
+    //! The site the ChargeAgent hops out to
+    int m_exitSite;
+
+    //! Hops inside the trap basin to add to the path length when it leaves
+    int m_basinHops;
+
+    //! The step the parked ChargeAgent hops, or 0 if it is not parked (see SkipAhead)
+    quint32 m_skipWake;
+
+    //! The step the ChargeAgent was parked
+    quint32 m_skipFrom;
+
+    //! The site the parked ChargeAgent hops to
+    int m_skipSite;
+
+    //! The chance the parked ChargeAgent had of hopping in a step
+    double m_skipChance;
+
+    //! True if SkipAhead has looked at the ChargeAgent since it last moved or woke
+    bool m_skipChecked;
 };
 
 //! A class to represent moving negative charges
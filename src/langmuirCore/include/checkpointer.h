@@ -2,6 +2,7 @@
 #define CHECKPOINTER_H
 
 #include <QObject>
+#include <QStringList>
 #include <QMap>
 
 #include "parameters.h"
@@ -49,8 +50,9 @@ public:
      * @brief load simulation information
      * @param fileName name of input file
      * @param configInfo temporary storage for electrons, holes, etc
+     * @param overrides key = value lines parsed after the input file, before seeding
      */
-    void load(const QString& fileName, ConfigurationInfo &configInfo);
+    void load(const QString& fileName, ConfigurationInfo &configInfo, const QStringList& overrides = QStringList());
 
     /**
      * @brief save simulation information
@@ -2,6 +2,7 @@
 #define CUBICGRID_H
 
 #include "agent.h"
+#include "sitestore.h"
 
 #include <QTextStream>
 #include <QVector>
@@ -13,6 +14,7 @@ namespace Langmuir
 {
 
 class World;
+class FreeSites;
 
 /**
  * @brief A class to hold Agents, calculate their positions, and store the background potential
@@ -71,9 +73,10 @@ public:
     /**
      * @brief Create a grid
      * @param world reference to the world object
+     * @param layer which half of World::siteStore() this grid uses
      * @param parent QObject this belongs to
      */
-    Grid(World &world, QObject *parent = 0);
+    Grid(World &world, SiteStore::Layer layer, QObject *parent = 0);
 
     /**
      * @brief Destroy the grid
@@ -227,6 +230,22 @@ public:
      */
     int getIndexS(int xIndex, int yIndex, int zIndex = 0);
 
+    /**
+     * @brief Get the canonical site ID of a site
+     * @param site the "s-site ID"
+     *
+     * The canonical site ID is x + y * xSize + z * xyPlaneArea, whatever SimulationParameters::gridLayout
+     * is, and is what checkpoint files and output store.  Special sites are returned unchanged.
+     */
+    int canonicalSite(int site);
+
+    /**
+     * @brief Get the "s-site ID" of a canonical site ID
+     * @param canonical the canonical site ID
+     * @see canonicalSite
+     */
+    int siteFromCanonical(int canonical);
+
     /**
      * @brief Get the "y-site ID" from the "s-site ID"
      * @param site the "s-site ID"
@@ -302,6 +321,7 @@ public:
      * @brief Add some value to the background potential at a site
      * @param site the "s-site ID"
      * @param potential the value to add
+     * @warning the potential is shared with the other Grid (see SiteStore), so only add it once
      */
     void addToPotential(int site, double potential);
 
@@ -309,6 +329,7 @@ public:
      * @brief Set the background potential at a site to some value
      * @param site the "s-site ID"
      * @param potential the value to set
+     * @warning the potential is shared with the other Grid (see SiteStore)
      */
     void setPotential(int site, double potential);
 
@@ -347,6 +368,8 @@ public:
      * @param agent a pointer to the Agent
      * @warning uses Agent::getCurrentSite()
      * @warning site must be Agent::Empty
+     * @warning agent must be a ChargeAgent of this Grid's carrier type; sources and
+     * drains go through registerSpecialAgent()
      *
      * Makes sure the site is empty first.  After assigning the Agent to the site,
      * calculates and assigns the neighbors to the Agent.
@@ -369,6 +392,17 @@ public:
      */
     void unregisterAgent(Agent *agent);
 
+    /**
+     * @brief Move an Agent to an empty site, as unregisterAgent() then registerAgent() would
+     * @param agent a pointer to the Agent
+     * @param site the "s-site ID" to move to
+     * @warning site must be Agent::Empty
+     *
+     * Sets Agent::getCurrentSite() and the neighbors of the Agent.  Moves the word in the
+     * SiteStore, so the carrier keeps its index there (see SiteStore::moveCarrier()).
+     */
+    void moveAgent(Agent *agent, int site);
+
     /**
      * @brief Remove an Agent from the special list of Agents in the Grid
      * @param agent a pointer to the Agent
@@ -388,6 +422,16 @@ public:
      */
     void registerDefect(int site);
 
+    /**
+     * @brief The sites of a face that are Agent::Empty, keyed by their place on the face
+     * @param cubeFace the face of the Grid
+     *
+     * The set is made the first time a face is asked for, and from then on is kept up to date
+     * by registerAgent(), unregisterAgent(), registerDefect() and unregisterDefect().
+     * NULL for Grid::NoFace.
+     */
+    const FreeSites *freeSites(Grid::CubeFace cubeFace);
+
     /**
      * @brief The total number of special Agents
      */
@@ -406,30 +450,26 @@ protected:
     World &m_world;
 
     /**
-     * @brief 1D list of Agent pointers, the size of which is the volume of the Grid + the max number of special Agents.
-     * @warning some of these may be NULL
+     * @brief The Agents, types and potentials of the sites, shared with the other Grid
      *
-     * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
-     * to calculate the serial site ID needed to index this list.
+     * Use getIndexS() to calculate the serial site ID needed to index it.
      */
-    QVector<Agent *> m_agents;
+    SiteStore &m_sites;
 
     /**
-     * @brief 1D list of site potentials, the size of which is the volume of the Grid + the max number of special Agents.
-     *
-     * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
-     * to calculate the serial site ID needed to index this list.
+     * @brief Which half of m_sites belongs to this Grid
      */
-    QVector<double> m_potentials;
+    SiteStore::Layer m_layer;
 
     /**
-     * @brief 1D list of Agent types, the size of which is the volume of the Grid + the max number of special Agents.
-     * @warning some of these may be Agent::Empty
-     *
-     * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
-     * to calculate the serial site ID needed to index this list.
+     * @brief Agent pointers of the special sites, volume() and up
+     */
+    QVector<Agent *> m_specialSites;
+
+    /**
+     * @brief Agent types of the special sites, volume() and up
      */
-    QVector<Agent::Type> m_agentType;
+    QVector<Agent::Type> m_specialTypes;
 
     /**
      * @brief A list of lists of special agents, where each sub-list is for a different Grid::CubeFace
@@ -480,6 +520,71 @@ protected:
      * @brief The total number of sites
      */
     int m_volume;
+
+    /**
+     * @brief True if the sites are stored tile by tile (SimulationParameters::gridLayout)
+     *
+     * The sites of a grid.tile sized cube are neighbors in memory, so hops along y and z and the
+     * coulomb sums stay within a few cache lines.  The tiles, and the sites inside a tile, are in
+     * x-fastest order, and the tiles on the far edges are cut down to fit, so the site IDs are
+     * still 0 to volume() - 1.
+     */
+    bool m_tiled;
+
+    /**
+     * @brief log2 of SimulationParameters::gridTile
+     */
+    int m_tileShift;
+
+    /**
+     * @brief x, y and z of every site packed into one integer, when m_tiled
+     *
+     * x is in the low bits, y starts at bit m_yShift and z at bit m_zShift.  The hole Grid
+     * shares the electron Grid's copy, so it is only read with at(), which does not detach.
+     */
+    QVector<quint32> m_coordinates;
+
+    /**
+     * @brief The bit y starts at in m_coordinates
+     */
+    int m_yShift;
+
+    /**
+     * @brief The bit z starts at in m_coordinates
+     */
+    int m_zShift;
+
+    /**
+     * @brief The number of sites along one axis of the tile holding a coordinate
+     * @param index the x, y, or z-site ID
+     * @param size the number of sites along that axis
+     */
+    int tileWidth(int index, int size);
+
+    /**
+     * @brief The free sites of each Grid::CubeFace, or NULL if nobody asked for that face
+     */
+    QVector<FreeSites *> m_freeFaces;
+
+    /**
+     * @brief The number of non-NULL entries in m_freeFaces
+     */
+    int m_freeFaceCount;
+
+    /**
+     * @brief The key of a site in the free sites of a face, or -1 if it is not on the face
+     * @param x the x-site ID
+     * @param y the y-site ID
+     * @param z the z-site ID
+     * @param cubeFace the face of the Grid
+     */
+    int faceKey(int x, int y, int z, Grid::CubeFace cubeFace);
+
+    /**
+     * @brief Add a site to or remove it from the free sites of the faces it is on
+     * @param site the "s-site ID"
+     */
+    void updateFreeFaces(int site);
 };
 
 /**
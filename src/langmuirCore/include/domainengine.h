@@ -0,0 +1,158 @@
+#ifndef DOMAINENGINE_H
+#define DOMAINENGINE_H
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+
+namespace Langmuir
+{
+
+class World;
+class Random;
+class ChargeAgent;
+
+/**
+ * @brief Runs whole Monte Carlo steps on the WorkerPool, the slabs of the Grid shared out over its workers
+ *
+ * Used when SimulationParameters::domainSlabs is on.  The Grid is cut into that many slabs
+ * along x, each at least 2 * SimulationParameters::hoppingRange sites wide, and each slab
+ * owns the carriers on its sites.  A step runs the even slabs in parallel and then the odd
+ * ones.  A carrier only reads and writes sites within hopping range of its own, and two
+ * slabs of the same parity are a whole slab apart, so the slabs running at once never touch
+ * the same site, drain or flux counter.  Nor do they share anything else in the SiteStore:
+ * a carrier keeps its index in the store from its creation to its deletion, both on the main
+ * thread, and a hop only moves its word (SiteStore::moveCarrier()), which is why the storage
+ * must be dense.  A carrier that hops into another slab is handed to it at the end of the
+ * step, so it moves at most once per step.
+ *
+ * The step differs from Simulation::performIterations() in a few ways:
+ * - the carriers of a slab move one after another (choose, decide and complete each), so a
+ *   carrier can move onto a site another one left earlier in the same step
+ * - each slab draws from its own generator, seeded once from World::randomNumberGenerator(),
+ *   so a run depends on random.seed and domain.slabs, but not on the number of threads
+ *
+ * Only transistor simulations without coulomb interactions between carriers are supported.
+ * The serial part of a step is the injection, the hand-over of carriers between slabs and
+ * dropping the carriers that left through a drain from World::electrons() and World::holes().
+ */
+class DomainEngine : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(DomainEngine)
+
+public:
+    /**
+     * @brief Cut the Grid into slabs and seed their generators
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     */
+    DomainEngine(World &world, QObject *parent=0);
+
+    /**
+     * @brief Free the generators
+     */
+    ~DomainEngine();
+
+    /**
+     * @brief Run the steps
+     * @param nIterations number of steps
+     *
+     * Advances SimulationParameters::currentStep.  Carriers added to World::electrons() or
+     * World::holes() since the last call are given to their slabs first.
+     */
+    void performIterations(int nIterations);
+
+private:
+    /**
+     * @brief A slab of the Grid and the carriers on it
+     */
+    struct Domain
+    {
+        //! first x of the slab
+        int xBegin;
+
+        //! one past the last x of the slab
+        int xEnd;
+
+        //! the generator of the slab
+        Random *random;
+
+        //! the carriers the slab owns
+        QVector<ChargeAgent*> carriers;
+
+        //! carriers that moved this step, for OpenClHelper::moveCarrier()
+        QVector<ChargeAgent*> moved;
+
+        //! carriers that moved out of the slab this step
+        QVector<ChargeAgent*> leaving;
+
+        //! number of carriers that left through a drain this step
+        int removed;
+    };
+
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief The even slabs, then the odd slabs, in order of x
+     */
+    QVector<Domain> m_phases[2];
+
+    /**
+     * @brief The phase runDomains() runs
+     */
+    int m_phase;
+
+    /**
+     * @brief The slab of each x, as phase + 2 * index into m_phases
+     */
+    QVector<int> m_slabOfX;
+
+    /**
+     * @brief The part of World::electrons() the slabs know about
+     */
+    int m_numElectrons;
+
+    /**
+     * @brief The part of World::holes() the slabs know about
+     */
+    int m_numHoles;
+
+    /**
+     * @brief One step
+     */
+    void step();
+
+    /**
+     * @brief The slab a carrier is in
+     */
+    Domain& domainOf(ChargeAgent *charge);
+
+    /**
+     * @brief Give the carriers added to the end of a list since it was last adopted to their slabs
+     * @return the new size of the list
+     */
+    int adopt(QList<ChargeAgent*>& charges, int known);
+
+    /**
+     * @brief Delete the carriers that were removed, keeping the order of the rest
+     */
+    void dropRemoved(QList<ChargeAgent*>& charges);
+
+    /**
+     * @brief Move the carriers of one slab
+     */
+    void run(Domain& domain);
+
+    /**
+     * @brief Runs the slabs from begin to end (not included) of phase m_phase, for WorkerPool::run()
+     */
+    static void runDomains(void *self, int begin, int end);
+};
+
+}
+#endif // DOMAINENGINE_H
@@ -7,6 +7,7 @@ namespace Langmuir
 {
 
 class ChargeAgent;
+class Random;
 
 /**
  * @brief A class to remove charges
@@ -28,6 +29,14 @@ public:
      * @brief accept charge with constant probability
      */
     virtual bool tryToAccept(ChargeAgent *charge);
+
+    /**
+     * @brief accept charge with constant probability, drawing from a given generator
+     *
+     * Makes the same draw as tryToAccept() does through FluxAgent::shouldTransport(), so
+     * ChargeAgent::decideFuture() can hand in the generator of its DomainEngine slab.
+     */
+    bool tryToAccept(ChargeAgent *charge, Random &random);
 };
 
 /**
@@ -36,11 +45,6 @@ public:
 class ElectronDrainAgent : public DrainAgent
 {
 public:
-    /**
-     * @brief create an ElectronDrainAgent at a specific site
-     */
-    ElectronDrainAgent(World &world, int site, QObject *parent = 0);
-
     /**
      * @brief create a ElectronDrainAgent at a specific Grid::CubeFace
      */
@@ -62,11 +66,6 @@ protected:
 class HoleDrainAgent : public DrainAgent
 {
 public:
-    /**
-     * @brief create an HoleDrainAgent at a specific site
-     */
-    HoleDrainAgent(World &world, int site, QObject *parent = 0);
-
     /**
      * @brief create a HoleDrainAgent at a specific Grid::CubeFace
      */
@@ -81,6 +81,15 @@ public:
      */
     void setSuccesses(unsigned long int value);
 
+    /**
+     * @brief add to the FluxAgent's attempt and success counters
+     * @param attempts added to the attempt counter
+     * @param successes added to the success counter
+     *
+     * Unlike setAttempts() and setSuccesses(), this does not call storeLast().
+     */
+    void addCounts(unsigned long int attempts, unsigned long int successes);
+
     /**
      * @brief get the FluxAgent's success counter
      */
@@ -155,12 +164,6 @@ public:
     Grid& grid()const;
 
 protected:
-    /**
-     * @brief assign the FluxAgent to a specific site in the grid
-     * @param site the site in the grid
-     */
-    void initializeSite(int site);
-
     /**
      * @brief assign the FluxAgent to a specific Grid::CubeFace
      * @param cubeFace the face of a cubic grid; for example Grid::Left
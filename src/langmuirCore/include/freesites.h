@@ -0,0 +1,84 @@
+#ifndef FREESITES_H
+#define FREESITES_H
+
+#include <QVector>
+
+namespace Langmuir
+{
+
+/**
+ * @brief A set of free sites that can be sampled uniformly in constant time
+ *
+ * The sites are kept in an array, and each one's place in it is kept in a second array
+ * indexed by a key: the site itself for the bulk, or its position on a face of the Grid.
+ * Removing a site moves the last one into its place.  The number of keys is the number of
+ * sites the set is drawn from, so size() / keys() is the chance a site picked from all of
+ * them would have been free.
+ */
+class FreeSites
+{
+public:
+    /**
+     * @brief Create an empty set
+     * @param keys the number of keys (sites that could be free)
+     */
+    FreeSites(int keys = 0);
+
+    /**
+     * @brief Add a site, if its key is not in the set already
+     * @param key the key of the site, 0 to keys() - 1
+     * @param site the "s-site ID"
+     */
+    void insert(int key, int site);
+
+    /**
+     * @brief Remove a site, if its key is in the set
+     * @param key the key of the site, 0 to keys() - 1
+     */
+    void remove(int key);
+
+    /**
+     * @brief True if the site with this key is in the set
+     */
+    bool contains(int key) const;
+
+    /**
+     * @brief The number of free sites
+     */
+    int size() const;
+
+    /**
+     * @brief The number of keys
+     */
+    int keys() const;
+
+    /**
+     * @brief The i-th free site, in no particular order
+     * @param i 0 to size() - 1
+     */
+    int site(int i) const;
+
+    /**
+     * @brief Bytes used by the set
+     */
+    double bytes() const;
+
+private:
+    /**
+     * @brief The free sites
+     */
+    QVector<int> m_sites;
+
+    /**
+     * @brief The key of each entry of m_sites
+     */
+    QVector<int> m_keys;
+
+    /**
+     * @brief Where each key is in m_sites, or -1
+     */
+    QVector<int> m_position;
+};
+
+}
+#endif // FREESITES_H
@@ -0,0 +1,109 @@
+#ifndef HOPPROPOSALS_H
+#define HOPPROPOSALS_H
+
+#include <QObject>
+#include <QVector>
+
+namespace Langmuir
+{
+
+class World;
+class Grid;
+class Random;
+
+/**
+ * @brief Alias tables to propose hops in proportion to their coupling constant
+ *
+ * With SimulationParameters::hoppingProposal = weighted, ChargeAgent::chooseFuture() picks
+ * neighbor i of a site with probability c_i / n, where n is the number of neighbors and c_i
+ * the coupling constant (World::couplingConstants(), or 1 for a drain), and proposes to stay
+ * put with the remaining probability.  ChargeAgent::decideFuture() then leaves the coupling
+ * out of the metropolis criterion, so each hop is as likely as with uniform proposals, but
+ * the hops the coupling would have turned down are never proposed, and the carrier's future
+ * site needs no coulomb sum.
+ *
+ * The neighbor list of a site only depends on how close it is to each edge of the Grid (up
+ * to SimulationParameters::hoppingRange away), so a table is built the first time a site
+ * with that shape is asked for and shared by all sites with the same shape.
+ */
+class HopProposals : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(HopProposals)
+
+public:
+    /**
+     * @brief An alias table over a neighbor list and one more entry for staying put
+     */
+    struct Table
+    {
+        //! chance of keeping the entry drawn
+        QVector<double> probability;
+
+        //! entry to take instead
+        QVector<int> alias;
+    };
+
+    /**
+     * @brief Create the (empty) cache of tables
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     * @warning Potential::updateCouplingConstants() must have been called
+     */
+    HopProposals(World &world, QObject *parent=0);
+
+    /**
+     * @brief Free the tables
+     */
+    ~HopProposals();
+
+    /**
+     * @brief False if SimulationParameters::hoppingProposal is uniform
+     */
+    bool isOn() const;
+
+    /**
+     * @brief The table for the neighbor list of a site
+     * @param grid the Grid the neighbor list (Grid::neighborsSite()) is in
+     * @param site the "s-site ID"
+     */
+    const Table *table(Grid &grid, int site);
+
+    /**
+     * @brief Draw an entry from a table
+     * @param table the table
+     * @param random the generator to draw from
+     * @return an index into the neighbor list, or its size to stay put
+     */
+    int choose(const Table *table, Random &random);
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief True if SimulationParameters::hoppingProposal is weighted
+     */
+    bool m_on;
+
+    /**
+     * @brief The tables built so far, by shape, electron Grid then hole Grid; NULL if not built
+     */
+    QVector<Table *> m_tables;
+
+    /**
+     * @brief The shape of a site: its distance from each edge, up to SimulationParameters::hoppingRange
+     */
+    int shape(Grid &grid, int site);
+
+    /**
+     * @brief Build the table for the neighbor list of a site
+     */
+    Table *build(Grid &grid, int site);
+};
+
+}
+#endif // HOPPROPOSALS_H
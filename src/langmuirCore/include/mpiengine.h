@@ -0,0 +1,291 @@
+#ifndef MPIENGINE_H
+#define MPIENGINE_H
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+
+namespace Langmuir
+{
+
+class World;
+class ChargeAgent;
+
+/**
+ * @brief Runs whole Monte Carlo steps with the Grid split into slabs across MPI ranks
+ *
+ * Used when langmuir is built with LANGMUIR_MPI and started on more than one rank.  Every
+ * rank builds the same World (the same random.seed, so the same traps, defects and first
+ * carriers), then keeps the carriers in its own slab along x.  With grid.storage = paged, the
+ * rank's SiteStore then drops the traps and defects outside the slab and its halo
+ * (SiteStore::keepOnly()), so the sites a rank stores scale with its slab.  What does not scale:
+ * the World is built whole first (for paged storage, that is the traps, defects and first
+ * carriers of the whole device, not its volume), every rank keeps the lists of all traps and
+ * defects for the output, and rank 0 holds every carrier while output is written.  With
+ * grid.storage = dense, every rank stores the potential of every site.
+ *
+ * Each rank also holds ghosts: copies of the neighboring ranks' carriers within the halo,
+ * SimulationParameters::hoppingRange sites wide, or SimulationParameters::electrostaticCutoff
+ * with coulomb.carriers on.  Ghosts fill their sites and add to the coulomb sums, but never move.
+ * A step has two sub-steps, for the even ranks and then the odd ones.  The ranks that move
+ * together are a whole slab apart, so their carriers can not reach the same site.  At the end
+ * of each sub-step, the carriers that hopped into a neighboring slab are handed to its rank
+ * and the ghosts are sent again.  A carrier an even rank hands over is only moved by the odd
+ * rank from the next step on, so every carrier moves, and ages, once per step.
+ *
+ * The step differs from Simulation::performIterations() in a few ways:
+ * - the carriers of a rank move one after another, as in DomainEngine
+ * - the ranks draw from different generators, each seeded from the shared setup
+ * - the coulomb sums see the carriers of the other ranks as they were at the last sub-step
+ *
+ * The left sources and drains are on rank 0 and the right ones on the last rank.
+ * electron.percentage and hole.percentage cap the carriers of all ranks together, ghosts left
+ * out: the owned carriers are summed over the ranks before each injection.  Both ends inject at
+ * the same time, so on each step one of them (left on even steps, right on odd) leaves room for
+ * the carrier the other may inject.
+ *
+ * Rank 0 writes all of the output.  At the end of performIterations(), the flux counts are
+ * summed on rank 0, every rank drops its ghosts, and rank 0 gathers copies of the other ranks'
+ * carriers, so the output and checkpoints see every carrier once.  The copies are dropped and
+ * the ghosts sent again when the next performIterations() starts.  output.ids.on.delete is not
+ * supported, as the carriers that leave on other ranks are not seen by rank 0.
+ *
+ * Without LANGMUIR_MPI, there is one rank and the static functions do nothing.
+ */
+class MpiEngine : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(MpiEngine)
+
+public:
+    /**
+     * @brief Start MPI, before anything else
+     */
+    static void initialize(int *argc, char ***argv);
+
+    /**
+     * @brief Stop MPI, after everything else
+     */
+    static void finalize();
+
+    /**
+     * @brief This rank, 0 without MPI
+     */
+    static int rank();
+
+    /**
+     * @brief The number of ranks, 1 without MPI
+     */
+    static int size();
+
+    /**
+     * @brief This rank among the ranks on its host, 0 without MPI
+     */
+    static int localRank();
+
+    /**
+     * @brief The number of ranks on this host, 1 without MPI
+     */
+    static int localSize();
+
+    /**
+     * @brief Rank 0's value of a seed, so every rank builds the same World
+     */
+    static quint64 broadcastSeed(quint64 seed);
+
+    /**
+     * @brief Keep this rank's slab of the carriers and swap ghosts with the neighbors
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     * @warning every rank must create it at the same point
+     */
+    MpiEngine(World &world, QObject *parent=0);
+
+    /**
+     * @brief Run the steps, then sum the flux counts and gather the carriers on rank 0
+     * @param nIterations number of steps
+     *
+     * Advances SimulationParameters::currentStep on every rank.
+     */
+    void performIterations(int nIterations);
+
+    /**
+     * @brief True if the electrons of all ranks are at World::maxElectronAgents() (see World::atMaxElectrons())
+     */
+    bool atMaxElectrons() const;
+
+    /**
+     * @brief True if the holes of all ranks are at World::maxHoleAgents() (see World::atMaxHoles())
+     */
+    bool atMaxHoles() const;
+
+    /**
+     * @brief The carriers this rank moves (World::electrons() and World::holes() also hold the ghosts)
+     */
+    const QVector<ChargeAgent*>& owned() const;
+
+    /**
+     * @brief First x of this rank's slab
+     */
+    int xBegin() const;
+
+    /**
+     * @brief One past the last x of this rank's slab
+     */
+    int xEnd() const;
+
+    /**
+     * @brief Width of the halo along x, on each side of the slab
+     */
+    int halo() const;
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief This rank
+     */
+    int m_rank;
+
+    /**
+     * @brief The number of ranks
+     */
+    int m_size;
+
+    /**
+     * @brief First x of the slab
+     */
+    int m_xBegin;
+
+    /**
+     * @brief One past the last x of the slab
+     */
+    int m_xEnd;
+
+    /**
+     * @brief Width of the halo
+     */
+    int m_halo;
+
+    /**
+     * @brief The carriers this rank moves
+     */
+    QVector<ChargeAgent*> m_owned;
+
+    /**
+     * @brief Copies of the neighbors' carriers within the halo
+     */
+    QVector<ChargeAgent*> m_ghosts;
+
+    /**
+     * @brief Carriers that hopped out of the slab in the last sub-step
+     */
+    QVector<ChargeAgent*> m_leaving;
+
+    /**
+     * @brief Carriers handed over in the even sub-step, owned from the end of the odd one
+     */
+    QVector<ChargeAgent*> m_arrived;
+
+    /**
+     * @brief Copies of the other ranks' carriers, on rank 0 between performIterations() calls
+     */
+    QVector<ChargeAgent*> m_visitors;
+
+    /**
+     * @brief The owned electrons of all ranks, at the last injection
+     */
+    int m_numElectrons;
+
+    /**
+     * @brief The owned holes of all ranks, at the last injection
+     */
+    int m_numHoles;
+
+    /**
+     * @brief Room left for the other end's sources while this rank injects, 0 or 1
+     */
+    int m_reserve;
+
+    /**
+     * @brief Flux attempts and successes already summed on rank 0, by FluxAgent
+     */
+    QVector<unsigned long> m_reported;
+
+    /**
+     * @brief One step
+     */
+    void step();
+
+    /**
+     * @brief Move the carriers of this rank once each
+     */
+    void move();
+
+    /**
+     * @brief Inject at the sources on this rank
+     */
+    void inject();
+
+    /**
+     * @brief Hand over the carriers that left the slab, then send the ghosts again
+     * @param arrivals where the carriers handed to this rank go, m_arrived or m_owned
+     */
+    void exchange(QVector<ChargeAgent*>& arrivals);
+
+    /**
+     * @brief Sum the flux counts since the last call on rank 0
+     */
+    void reduceFluxes();
+
+    /**
+     * @brief Sum the owned carriers over the ranks, on every rank
+     */
+    void countCarriers();
+
+    /**
+     * @brief Drop the ghosts, and copy every other rank's carriers to rank 0 for the output
+     */
+    void gather();
+
+    /**
+     * @brief Drop the copies gather() made, and send the ghosts again
+     */
+    void release();
+
+    /**
+     * @brief Take a carrier off the Grid and mark it for compact()
+     */
+    void discard(ChargeAgent *charge);
+
+    /**
+     * @brief Delete the removed carriers from World::electrons() and World::holes()
+     * @param report log the carriers that left through a drain
+     */
+    void compact(bool report);
+
+    /**
+     * @brief Add a carrier to the end of a message: sign, site, lifetime and path length
+     */
+    static void pack(QVector<int>& message, ChargeAgent *charge);
+
+    /**
+     * @brief Create the carriers in a message
+     * @param message from pack()
+     * @param list where to keep them
+     */
+    void unpack(const QVector<int>& message, QVector<ChargeAgent*>& list);
+
+    /**
+     * @brief Send to the right and left neighbors, and receive from the left and right ones
+     */
+    void shift(const QVector<int>& toRight, QVector<int>& fromLeft,
+               const QVector<int>& toLeft, QVector<int>& fromRight);
+};
+
+}
+#endif // MPIENGINE_H
@@ -123,6 +123,11 @@ public:
      */
     const QString& hostName();
 
+    /**
+     * @brief get the path to the GPUFILE (empty if there is none)
+     */
+    const QString& gpuFile();
+
 private:
     //! list of cpu names
     QStringList m_names;
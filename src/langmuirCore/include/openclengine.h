@@ -0,0 +1,268 @@
+#ifndef OPENCLENGINE_H
+#define OPENCLENGINE_H
+#define __CL_ENABLE_EXCEPTIONS
+
+#ifdef LANGMUIR_OPEN_CL
+#include "cl.hpp"
+#endif
+
+#include <QObject>
+#include <QVector>
+
+namespace Langmuir
+{
+
+class World;
+
+/**
+ * @brief Runs whole Monte Carlo steps on the OpenCL device
+ *
+ * Used when SimulationParameters::openclEngine is on.  The carriers, occupancy and
+ * flux counters stay on the device for a batch of steps, and the host lists and grids
+ * are brought up to date once per batch (usually SimulationParameters::iterationsPrint steps).
+ *
+ * The step differs from Simulation::performIterations() in a few ways:
+ * - every carrier decides at once, so a carrier can not move onto a site that
+ *   another carrier leaves in the same step, and the lowest slot wins when two
+ *   carriers accept a move onto the same site
+ * - the random numbers come from a counter based generator on the device,
+ *   seeded once from World::randomNumberGenerator()
+ *
+ * Only transistor simulations with hopping.range = 1 are supported.
+ */
+class OpenClEngine : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(OpenClEngine)
+
+public:
+    /**
+     * @brief Create the kernels and device buffers
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     * @warning OpenClHelper::initializeOpenCL() must have succeeded
+     */
+    OpenClEngine(World &world, QObject *parent=0);
+
+    /**
+     * @brief Waits for the device
+     */
+    ~OpenClEngine();
+
+    /**
+     * @brief Upload the carriers, run the steps and rebuild the host carriers from the result
+     * @param nIterations number of steps
+     *
+     * Advances SimulationParameters::currentStep.  Flux counts since FluxAgent::storeLast()
+     * cover the whole batch.
+     */
+    void performIterations(int nIterations);
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+#ifdef LANGMUIR_OPEN_CL
+    /**
+     * @brief The engine's own queue, in order, so steps need no events between them
+     */
+    cl::CommandQueue m_queue;
+
+    /**
+     * @brief Proposes a neighbor or drain for every carrier
+     */
+    cl::Kernel m_chooseK;
+
+    /**
+     * @brief coulomb2 or gauss2, with its own arguments
+     */
+    cl::Kernel m_coulombK;
+
+    /**
+     * @brief Index of the woffset argument of m_coulombK
+     */
+    int m_offsetArg;
+
+    /**
+     * @brief Accepts or rejects every proposal
+     */
+    cl::Kernel m_decideK;
+
+    /**
+     * @brief Moves the winners and removes the drained carriers
+     */
+    cl::Kernel m_completeK;
+
+    /**
+     * @brief Clears the claims made in m_decideK
+     */
+    cl::Kernel m_releaseK;
+
+    /**
+     * @brief Runs the sources
+     */
+    cl::Kernel m_injectK;
+
+    /**
+     * @brief Seed of the device random numbers
+     */
+    cl_ulong m_seed;
+
+    /**
+     * @brief Number of slots; max.electrons + max.holes, so the sources never run out
+     */
+    int m_slots;
+
+    /**
+     * @brief Number of charged defects in front of the slots in m_sDevice and m_qDevice
+     */
+    int m_numDefects;
+
+    /**
+     * @brief Number of sites in a grid
+     */
+    int m_volume;
+
+    /**
+     * @brief Site-ids, the charged defects followed by the slots
+     */
+    QVector<int> m_sHost;
+
+    /**
+     * @brief Charges, the charged defects followed by the slots
+     */
+    QVector<int> m_qHost;
+
+    /**
+     * @brief Steps each slot has been alive
+     */
+    QVector<int> m_lifetimeHost;
+
+    /**
+     * @brief Moves each slot has made
+     */
+    QVector<int> m_pathlengthHost;
+
+    /**
+     * @brief 1 if the slot holds the carrier uploaded at the start of the batch, 0 if it was injected (or is free)
+     */
+    QVector<int> m_aliveHost;
+
+    /**
+     * @brief Free slots, used as a stack
+     */
+    QVector<int> m_freeHost;
+
+    /**
+     * @brief Occupancy of the electron grid followed by the hole grid
+     */
+    QVector<int> m_occHost;
+
+    /**
+     * @brief Background potential of the electron grid followed by the hole grid
+     */
+    QVector<double> m_vHost;
+
+    /**
+     * @brief Drain and source counters, the carrier counts and the top of the free stack
+     */
+    QVector<cl_uint> m_countersHost;
+
+    /**
+     * @brief Site-ids on the device, laid out as m_sHost
+     */
+    cl::Buffer m_sDevice;
+
+    /**
+     * @brief Charges on the device, laid out as m_qHost
+     */
+    cl::Buffer m_qDevice;
+
+    /**
+     * @brief Proposed site of each slot
+     */
+    cl::Buffer m_fDevice;
+
+    /**
+     * @brief coulomb2 / gauss2 output, the current sites followed by the proposed sites
+     */
+    cl::Buffer m_oDevice;
+
+    /**
+     * @brief Lowest slot that accepted a move onto each site this step, INT_MAX if none
+     */
+    cl::Buffer m_claimDevice;
+
+    /**
+     * @brief Occupancy on the device, laid out as m_occHost
+     */
+    cl::Buffer m_occDevice;
+
+    /**
+     * @brief Background potential on the device, laid out as m_vHost
+     */
+    cl::Buffer m_vDevice;
+
+    /**
+     * @brief Coupling constants for |dx|, |dy|, |dz| up to 1
+     */
+    cl::Buffer m_couplingDevice;
+
+    /**
+     * @brief Drain rates: electron left, electron right, hole left, hole right
+     */
+    cl::Buffer m_drainDevice;
+
+    /**
+     * @brief Source rates, in the same order as m_drainDevice
+     */
+    cl::Buffer m_sourceDevice;
+
+    /**
+     * @brief Lifetime of each slot
+     */
+    cl::Buffer m_lifetimeDevice;
+
+    /**
+     * @brief Pathlength of each slot
+     */
+    cl::Buffer m_pathlengthDevice;
+
+    /**
+     * @brief Alive flag of each slot, see m_aliveHost
+     */
+    cl::Buffer m_aliveDevice;
+
+    /**
+     * @brief Free slot stack
+     */
+    cl::Buffer m_freeDevice;
+
+    /**
+     * @brief Counters on the device, laid out as m_countersHost
+     */
+    cl::Buffer m_countersDevice;
+
+    /**
+     * @brief Copy the host carriers, occupancy, potentials and flux rates to the device
+     */
+    void upload();
+
+    /**
+     * @brief Enqueue the kernels of one step
+     */
+    void enqueueStep(int step);
+
+    /**
+     * @brief Read the device state back and rebuild the host carriers and flux counts
+     */
+    void download();
+#endif // LANGMUIR_OPEN_CL
+
+};
+}
+
+#endif // OPENCLENGINE_H
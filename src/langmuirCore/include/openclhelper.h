@@ -9,6 +9,11 @@
 #include <QObject>
 #include <QVector>
 
+#ifdef LANGMUIR_OPEN_CL
+#include <functional>
+#include <queue>
+#endif
+
 namespace Langmuir
 {
 
@@ -33,8 +38,17 @@ public:
      */
     OpenClHelper(World &world, QObject *parent=0);
 
+    /**
+     * @brief Waits for any prefetched work still writing to host memory
+     */
+    ~OpenClHelper();
+
     /**
      * @brief Perform the tedious boilerplate code to initialize OpenCL
+     *
+     * Only the platform and device are chosen here, which sets SimulationParameters::okCL.
+     * The context, program and buffers are created by the first kernel launch, so runs
+     * that never need the device don't pay for the build.
      */
     void initializeOpenCL(int gpuID = -1);
 
@@ -64,22 +78,52 @@ public:
     void launchGaussKernel2();
 
     /**
-     * @brief Does exactly what it says (host means the memory on the CPU)
-     * @param index position in host vectors
+     * @brief Start coulomb2 for the current sites without waiting for it
+     *
+     * Called at the end of a step when SimulationParameters::openclPipeline is on.  The next
+     * launchCoulombKernel2() then only computes the future sites, unless carriers changed
+     * in between, and waits for both.  Host output is not valid until then.
+     */
+    void prefetchCoulombKernel2();
+
+    /**
+     * @brief Start gauss2 for the current sites without waiting for it
+     * @see prefetchCoulombKernel2()
+     */
+    void prefetchGaussKernel2();
+
+    /**
+     * @brief Give a new carrier a slot in the site and charge buffers
      * @param site serial site-id
      * @param charge charge of carrier
+     * @return the slot, used as the carrier's OpenCL id until it is removed
+     *
+     * Slots are reused lowest first, so the occupied slots stay packed at the front.
+     */
+    int addCarrier(int site, int charge);
+
+    /**
+     * @brief Record that the carrier in a slot moved
+     * @param slot slot returned by addCarrier()
+     * @param site serial site-id
      */
-    void copySiteAndChargeToHostVector(int index, int site, int charge = -1);
+    void moveCarrier(int slot, int site);
+
+    /**
+     * @brief Free the slot of a carrier that is being deleted
+     * @param slot slot returned by addCarrier()
+     */
+    void removeCarrier(int slot);
 
     /**
      * @brief Get the result stored in host memory (for current site)
-     * @param index position in host vectors
+     * @param index slot of the carrier (Kernel2) or site-id (Kernel1)
      */
     double getOutputHost(int index) const;
 
     /**
      * @brief Get the result stored in host memory (for future site)
-     * @param index position in host vectors
+     * @param index slot of the carrier
      *
      * There is a fixed offset in the host memory between the current and future site results
      */
@@ -99,6 +143,23 @@ public:
      */
     bool toggleOpenCL(bool on);
 
+#ifdef LANGMUIR_OPEN_CL
+    /**
+     * @brief The context created by initializeOpenCL()
+     */
+    cl::Context& context();
+
+    /**
+     * @brief The device chosen by initializeOpenCL()
+     */
+    cl::Device& device();
+
+    /**
+     * @brief The program built from kernel.cl, for making more kernels (see OpenClEngine)
+     */
+    cl::Program& program();
+#endif // LANGMUIR_OPEN_CL
+
 private:
     /**
      * @brief Reference to World object
@@ -123,9 +184,58 @@ private:
 
     /**
      * @brief A Queue to store a bunch of commands to OpenCL to execute (in our case, the queue is in serial mode)
+     *
+     * Carrier uploads, Kernel1 and the current sites of Kernel2 go here.
      */
     cl::CommandQueue m_queue;
 
+    /**
+     * @brief A second queue for the future sites of Kernel2, so they can overlap the current sites
+     */
+    cl::CommandQueue m_futureQueue;
+
+    /**
+     * @brief Signaled when the last scatter of changed slots is done; the future sites wait on it
+     */
+    cl::Event m_sourcesReady;
+
+    /**
+     * @brief Signaled when the current site output has been read back to the host
+     */
+    cl::Event m_currentReady;
+
+    /**
+     * @brief Signaled when the future site output has been read back to the host
+     */
+    cl::Event m_futureReady;
+
+    /**
+     * @brief The Kernel2 whose current sites are in flight from a prefetch, or NULL
+     */
+    cl::Kernel *m_prefetched;
+
+    /**
+     * @brief Number of slots the current sites were computed for
+     */
+    int m_currentSlots;
+
+    /**
+     * @brief The program built from kernel.cl
+     */
+    cl::Program m_program;
+
+    /**
+     * @brief True once initializeDevice() has run
+     */
+    bool m_initialized;
+
+    /**
+     * @brief True for opencl.precision = single, where only table2 and scatter are built
+     *
+     * The device then writes float output to m_oSingle, and coulomb1 / gauss1 are summed on the host.
+     */
+    bool m_single;
+
     /**
      * @brief Coulomb Kernel 1
      */
@@ -147,28 +257,114 @@ private:
     cl::Kernel m_guass2K;
 
     /**
-     * @brief Memory on the host (CPU) to store site-ids
+     * @brief Kernel 2 with the interactions looked up in m_tableDevice (opencl.precision = table or single)
+     */
+    cl::Kernel m_table2K;
+
+    /**
+     * @brief Scatter Kernel, applies the carrier changes to the device buffers
+     */
+    cl::Kernel m_scatterK;
+
+    /**
+     * @brief Site-id of the carrier in each slot, or -1 if the slot is free
+     *
+     * This mirrors the slots in m_sDevice.  Carriers keep their slot for their whole lifetime,
+     * so after the initial upload only the slots that changed since the last launch are sent
+     * to the device (see flushCarriers()).
+     */
+    QVector<int> m_slotSite;
+
+    /**
+     * @brief Charge of the carrier in each slot, or 0 if the slot is free
+     */
+    QVector<int> m_slotCharge;
+
+    /**
+     * @brief Free slots, smallest on top
+     */
+    std::priority_queue<int, std::vector<int>, std::greater<int> > m_freeSlots;
+
+    /**
+     * @brief One past the largest occupied slot; kernels only look at slots below this
+     */
+    int m_slotsUsed;
+
+    /**
+     * @brief Slots changed since the last upload, each listed once
+     */
+    QVector<int> m_changeSlot;
+
+    /**
+     * @brief Position of each slot in m_changeSlot, or -1 if it has not changed
+     */
+    QVector<int> m_changeIndex;
+
+    /**
+     * @brief Changed slots as they are sent to the device
+     *
+     * The writes do not block, so there are two sets of staging vectors used in turn;
+     * one can be refilled while the other may still be in flight.
+     */
+    QVector<int> m_stageSlot[2];
+
+    /**
+     * @brief Site-ids of the changed slots, in the order of m_stageSlot
+     */
+    QVector<int> m_stageSite[2];
+
+    /**
+     * @brief Charges of the changed slots, in the order of m_stageSlot
+     */
+    QVector<int> m_stageCharge[2];
+
+    /**
+     * @brief The staging vectors to fill next
+     */
+    int m_stage;
+
+    /**
+     * @brief True if the device buffers must be recreated and uploaded in full
+     */
+    bool m_fullUpload;
+
+    /**
+     * @brief Number of charged defects in front of the carrier slots in the device buffers
+     */
+    int m_numDefects;
+
+    /**
+     * @brief Memory on the host (CPU) to store site-ids for a full upload
      *
-     * This is extremely annoying and ineffcient, but site-ids have to be copied here first,
-     * before they are copied to the GPU.  The same goes for the charges, and the output.
-     * OpenCL requires that data to be copied to/from the device (GPU) must be continuous
-     * in memory on the host (CPU).  So, that means its impossible to copy data directly from
-     * a set of ChargeAgents.  Theres got to be a way around this, copying things \b twice
-     * is slow.  You would think that the ChargeAgent's data is continuous in memory, but
-     * offset by some amount between instances, for a particular member.
+     * The layout is the charged defects (which never move) followed by the carrier slots.
      */
     QVector<int> m_sHost;
 
     /**
-     * @brief Memory on the host (CPU) to store charge values
+     * @brief Memory on the host (CPU) to store charge values for a full upload
      */
     QVector<int> m_qHost;
 
+    /**
+     * @brief Memory on the host (CPU) to store future site-ids, by slot
+     */
+    QVector<int> m_fHost;
+
     /**
      * @brief Memory on the host (CPU) to store output values
      */
     QVector<double> m_oHost;
 
+    /**
+     * @brief Memory on the host (CPU) to store output values, in place of m_oHost when m_single
+     */
+    QVector<float> m_oSingle;
+
+    /**
+     * @brief True if runHostKernel1() sums with erf, as gauss1
+     */
+    bool m_hostGauss;
+
     /**
      * @brief Memory on the device (GPU) to store site-ids. It is in the global memory of the device
      */
@@ -179,18 +375,163 @@ private:
      */
     cl::Buffer m_qDevice;
 
+    /**
+     * @brief Memory on the device (GPU) to store future site-ids, by slot
+     */
+    cl::Buffer m_fDevice;
+
     /**
      * @brief Memory on the device (GPU) to store output values. It is in the global memory of the device
      */
     cl::Buffer m_oDevice;
 
+    /**
+     * @brief Memory on the device (GPU) for the changed slots
+     */
+    cl::Buffer m_cSlotDevice;
+
+    /**
+     * @brief Memory on the device (GPU) for the site-ids of the changed slots
+     */
+    cl::Buffer m_cSiteDevice;
+
+    /**
+     * @brief Memory on the device (GPU) for the charges of the changed slots
+     */
+    cl::Buffer m_cChargeDevice;
+
+    /**
+     * @brief Memory on the device (GPU) for the interaction table of m_table2K
+     *
+     * It holds Potential::interactionTable() as double or (opencl.precision = single) float.
+     */
+    cl::Buffer m_tableDevice;
+
     /**
      * @brief Offset between current and future output values in m_oDevice or m_oHost.
      *
-     * For example, if the output for current sites starts at index 0 and runs up to \b offset.
-     * Then, the output for future sites starts at \b offset and runs up to \b 2 \b offset.
+     * The output for the current site of slot i is at i, and for the future site at i + \b offset.
+     * It is the number of slots.
      */
     int m_offset;
+
+    /**
+     * @brief Print every platform and device found
+     */
+    void listDevices(const std::vector<cl::Platform>& platforms);
+
+    /**
+     * @brief Clamp work.size and work.x/y/z to what the device (and compiled kernels) allow
+     * @param kernelMax the max work group size of the compiled kernels, if known
+     */
+    void setWorkSizes(size_t kernelMax = size_t(-1));
+
+    /**
+     * @brief Build the program for the current work sizes and create the kernels
+     * @param lines kernel source
+     */
+    void buildKernels(const QByteArray& lines);
+
+    /**
+     * @brief Create the context, queues, program, kernels and buffers, the first time only
+     */
+    void initializeDevice();
+
+    /**
+     * @brief Where program binaries are cached, $LANGMUIR_KERNEL_CACHE or ~/.langmuir/kernels
+     */
+    QString cacheDirectory();
+
+    /**
+     * @brief Hash of the kernel source, build options, device and driver, naming a cached binary
+     */
+    QString cacheKey(const QByteArray& lines, const QString& options);
+
+    /**
+     * @brief Build the program from a cached binary
+     * @return false if there is no usable binary
+     */
+    bool loadBinary(const QString& fileName, const QString& options, cl::Program& program);
+
+    /**
+     * @brief Write the binary of a built program to the cache
+     */
+    void saveBinary(const QString& fileName, cl::Program& program);
+
+    /**
+     * @brief The smallest CL_KERNEL_WORK_GROUP_SIZE of the kernels
+     */
+    size_t kernelWorkGroupSize();
+
+    /**
+     * @brief Add free slots, the device buffers are recreated at the next launch
+     * @param capacity new number of slots
+     */
+    void growSlots(int capacity);
+
+    /**
+     * @brief Mark a slot as changed
+     */
+    void recordChange(int slot);
+
+    /**
+     * @brief (Re)create the device buffers and upload the defects and every slot
+     */
+    void uploadCarriers();
+
+    /**
+     * @brief Bring the device buffers up to date, uploading only the changed slots
+     */
+    void flushCarriers();
+
+    /**
+     * @brief Create m_tableDevice and point m_table2K at it
+     */
+    void uploadTable();
+
+    /**
+     * @brief Run coulomb1 or gauss1 for the carriers on the device
+     */
+    void runKernel1(cl::Kernel& kernel);
+
+    /**
+     * @brief Fill the Kernel1 output for every site on the host, for opencl.precision = single
+     * @param gauss true for gauss1, false for coulomb1
+     *
+     * The sums are the Potential ones, in double, shared out over World::workerPool().
+     */
+    void runHostKernel1(bool gauss);
+
+    /**
+     * @brief Fills runHostKernel1() in for the sites from begin to end
+     */
+    static void sumSites(void *self, int begin, int end);
+
+    /**
+     * @brief Bytes per output value on the device
+     */
+    size_t outputSize() const;
+
+    /**
+     * @brief Where an output value goes on the host
+     */
+    void *outputHost(int index);
+
+    /**
+     * @brief Run coulomb2, gauss2 or table2 for the current and future sites of the carriers
+     * @param offsetArg index of the kernel's woffset argument (ooffset follows it)
+     */
+    void runKernel2(cl::Kernel& kernel, int offsetArg);
+
+    /**
+     * @brief Enqueue Kernel2 for the current sites and a non-blocking read of the output
+     */
+    void enqueueCurrent(cl::Kernel& kernel, int offsetArg);
+
+    /**
+     * @brief Upload the future sites, enqueue Kernel2 for them and a non-blocking read of the output
+     */
+    void enqueueFuture(cl::Kernel& kernel, int offsetArg);
 #endif // LANGMUIR_OPEN_CL
 
 };
@@ -4,13 +4,14 @@
 #include <QDateTime>
 #include <QFileInfo>
 #include <QDebug>
+#include <climits>
 #include <cmath>
 #include <QDir>
 
 namespace Langmuir
 {
 
-//! A struct to temporarily store site IDs
+//! A struct to temporarily store site IDs, which are canonical (see Grid::canonicalSite)
 struct ConfigurationInfo
 {
     //! a list of current electron site IDs
@@ -59,6 +60,21 @@ struct SimulationParameters
     //! the number of sites along the device length, at least one
     qint32 gridX;
 
+    //! how sites are ordered in memory: (\b\c "linear", x fastest, then y, then z), (\b\c "tiled", by cubes of SimulationParameters::gridTile sites)
+    QString gridLayout;
+
+    //! the length of a tile when SimulationParameters::gridLayout is tiled, a power of 2
+    qint32 gridTile;
+
+    //! precision of the background potential stored for every site: (\b\c "double"), (\b\c "single")
+    QString gridPrecision;
+
+    //! how site data is allocated: (\b\c "dense", every page up front), (\b\c "paged", pages on first use and potentials worked out when needed)
+    QString gridStorage;
+
+    //! the number of sites in a page of site data, a power of 2
+    qint32 gridPage;
+
     //! turn on Coulomb interactions between ChargeAgents
     bool coulombCarriers;
 
@@ -152,6 +168,18 @@ struct SimulationParameters
     //! the percent of the traps to be placed and grown upon to form islands
     qreal seedPercentage;
 
+    //! if true, a lone carrier stuck in a small cluster of traps jumps straight to the step it leaves (see TrapBasins)
+    bool trapAccelerate;
+
+    //! the most sites a cluster of traps can have and still be jumped out of
+    qint32 trapBasinSize;
+
+    //! the steps in a row a carrier must spend in a cluster of traps before it jumps out
+    qint32 trapBasinSteps;
+
+    //! the sites around a cluster of traps that must be free of other charges while a carrier jumps out
+    qint32 trapBasinClearance;
+
     //! the potential on the right side of the grid, used in setting up an electric field
     qreal voltageRight;
 
@@ -218,9 +246,33 @@ struct SimulationParameters
     //! the minimum number of charges that must be present to use OpenCL
     qint32 openclThreshold;
 
-    //! the device to choose if there are multiple
+    //! the device to choose if there are multiple (index into the devices of SimulationParameters::openclDeviceType)
     qint32 openclDeviceID;
 
+    //! the OpenCL platform (vendor runtime) to use, by index
+    qint32 openclPlatform;
+
+    //! the type of OpenCL device to use: gpu, cpu, accelerator, default or all
+    QString openclDeviceType;
+
+    //! compute the next step's current-site potentials while the host finishes this step
+    bool openclPipeline;
+
+    //! how Kernel2 finds the interactions: double (computed), table (looked up) or single (looked up, float sums)
+    QString openclPrecision;
+
+    //! time the CPU and OpenCL paths at startup and set SimulationParameters::openclThreshold from the crossover
+    bool openclCalibrate;
+
+    //! let the calibration also choose SimulationParameters::workSize (and workX/Y/Z if SimulationParameters::outputCoulomb)
+    bool openclCalibrateWork;
+
+    //! reuse compiled OpenCL kernels from $LANGMUIR_KERNEL_CACHE (or ~/.langmuir/kernels)
+    bool openclCache;
+
+    //! run whole steps on the OpenCL device, syncing with the host every SimulationParameters::iterationsPrint steps
+    bool openclEngine;
+
     //! physical constant, the boltzmann constant
     qreal boltzmannConstant;
 
@@ -257,6 +309,12 @@ struct SimulationParameters
     //! the number of sites away from a given site used when calculating neighboring sites
     qint32 hoppingRange;
 
+    //! how hops are proposed: uniform (any neighbor, then the coupling in the acceptance) or weighted (in proportion to the coupling, see HopProposals)
+    QString hoppingProposal;
+
+    //! park carriers whose chance of hopping in a step is below this until their hop is due (see SkipAhead); 0 is off
+    qreal hoppingSkip;
+
     //! slope of potential along z direction when there are multiple layers (as if there were a gate electrode)
     qreal slopeZ;
 
@@ -278,9 +336,21 @@ struct SimulationParameters
     //! for SimulationParameters::simulationType == "solarcell", multiply SimulationParameters::sourceRate by (Grid::xyPlaneArea)/(SimulationParameters::sourceScaleArea); if <= 0, does not scale rate
     qreal sourceScaleArea;
 
-    //! max threads allowed for QThreadPool - if its <= 0 then the QThread::idealThreadCount is used; note that Qt ignores PBS and SGE so when this isn't set Qt will use all the cores on a node
+    //! max threads allowed for QThreadPool and the WorkerPool - if its <= 0 then the QThread::idealThreadCount is used; note that Qt ignores PBS and SGE so when this isn't set Qt will use all the cores on a node
     qint32 maxThreads;
 
+    //! pin the WorkerPool threads to CPUs: none, compact (fill a NUMA node first) or scatter (take the nodes in turn)
+    QString threadPinning;
+
+    //! instruction set for the coulomb sums on the CPU: auto, avx512, avx2, scalar, or off for the Potential loops
+    QString cpuSimd;
+
+    //! run whole steps on the host threads, with the grid cut into this many slabs along x (see DomainEngine); 0 is off
+    qint32 domainSlabs;
+
+    //! sort World::electrons() and World::holes() by site every this many steps, adapting the interval (see CarrierSorter); 0 is off
+    qint32 carrierSort;
+
     SimulationParameters() :
 
         simulationType         ("transistor"),
@@ -289,6 +359,11 @@ struct SimulationParameters
         gridZ                  (1),
         gridY                  (128),
         gridX                  (128),
+        gridLayout             ("linear"),
+        gridTile               (8),
+        gridPrecision          ("double"),
+        gridStorage            ("dense"),
+        gridPage               (4096),
 
         coulombCarriers        (false),
         coulombGaussianSigma   (0.0),
@@ -326,6 +401,10 @@ struct SimulationParameters
         trapPotential          (0.10),
         gaussianStdev          (0.00),
         seedPercentage         (1.0),
+        trapAccelerate         (false),
+        trapBasinSize          (16),
+        trapBasinSteps         (100),
+        trapBasinClearance     (2),
 
         voltageRight           (0.00),
         voltageLeft            (0.00),
@@ -353,6 +432,14 @@ struct SimulationParameters
         workSize               (256),
         openclThreshold        (256),
         openclDeviceID         (0),
+        openclPlatform         (0),
+        openclDeviceType       ("gpu"),
+        openclPipeline         (false),
+        openclPrecision        ("double"),
+        openclCalibrate        (false),
+        openclCalibrateWork    (false),
+        openclCache            (true),
+        openclEngine           (false),
 
         boltzmannConstant      (1.3806504e-23),
         dielectricConstant     (3.5),
@@ -366,6 +453,8 @@ struct SimulationParameters
         currentStep            (0),
         simulationStart        (QDateTime::currentDateTime()),
         hoppingRange           (1),
+        hoppingProposal        ("uniform"),
+        hoppingSkip            (0.0),
         slopeZ                 (0.00),
         sourceMetropolis       (false),
         sourceCoulomb          (false),
@@ -373,7 +462,11 @@ struct SimulationParameters
         recombinationRange     (0),
         outputIdsOnEncounter   (false),
         sourceScaleArea        (65536),
-        maxThreads             (-1)
+        maxThreads             (-1),
+        threadPinning          ("none"),
+        cpuSimd                ("auto"),
+        domainSlabs            (0),
+        carrierSort            (0)
     {
     }
 
@@ -412,6 +505,40 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: grid.z(%d) >= 1",par.gridZ);
     }
 
+    if (!(QStringList()<<"linear"<<"tiled").contains(par.gridLayout))
+    {
+        qFatal("langmuir: grid.layout(%s) must be linear or tiled",qPrintable(par.gridLayout));
+    }
+    if (par.gridTile < 1 || (par.gridTile & (par.gridTile - 1)) != 0)
+    {
+        qFatal("langmuir: grid.tile(%d) must be a power of 2",par.gridTile);
+    }
+    if (!(QStringList()<<"double"<<"single").contains(par.gridPrecision))
+    {
+        qFatal("langmuir: grid.precision(%s) must be double or single",qPrintable(par.gridPrecision));
+    }
+    if (!(QStringList()<<"dense"<<"paged").contains(par.gridStorage))
+    {
+        qFatal("langmuir: grid.storage(%s) must be dense or paged",qPrintable(par.gridStorage));
+    }
+    if (par.gridPage < 1 || (par.gridPage & (par.gridPage - 1)) != 0 || par.gridPage > (1 << 24))
+    {
+        qFatal("langmuir: grid.page(%d) must be a power of 2, at most 2^24",par.gridPage);
+    }
+
+    // site IDs are 32-bit, and the grids keep 35 special sites past the end
+    qint64 volume = qint64(par.gridX) * qint64(par.gridY) * qint64(par.gridZ);
+    if (volume > qint64(INT_MAX) - 35)
+    {
+        qFatal("langmuir: grid.x * grid.y * grid.z(%lld) is more sites than 32-bit site IDs allow",volume);
+    }
+    qint64 potentialBytes = volume * (par.gridPrecision == "single" ? 4 : 8);
+    if (par.gridStorage == "dense" && potentialBytes > qint64(INT_MAX))
+    {
+        qFatal("langmuir: grid.storage = dense can not hold the potential of %lld sites; use grid.storage = paged",
+               volume);
+    }
+
     // output
     if (par.iterationsPrint <= 0 )
     {
@@ -564,6 +691,44 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: hopping.range(%d) < 0 || > 2",par.hoppingRange);
     }
 
+    if (par.trapAccelerate)
+    {
+        if (par.trapBasinSize < 1)
+        {
+            qFatal("langmuir: trap.basin.size(%d) < 1", par.trapBasinSize);
+        }
+        if (par.trapBasinSteps < 1)
+        {
+            qFatal("langmuir: trap.basin.steps(%d) < 1", par.trapBasinSteps);
+        }
+        if (par.trapBasinClearance < qMax(par.hoppingRange, par.recombinationRange))
+        {
+            qFatal("langmuir: trap.basin.clearance(%d) < hopping.range and recombination.range", par.trapBasinClearance);
+        }
+    }
+
+    if (par.hoppingProposal != "uniform" && par.hoppingProposal != "weighted")
+    {
+        qFatal("langmuir: hopping.proposal must be uniform or weighted");
+    }
+
+    if (par.hoppingSkip < 0.0 || par.hoppingSkip > 1.0)
+    {
+        qFatal("langmuir: hopping.skip(%f) < 0 || > 1", par.hoppingSkip);
+    }
+
+    if (par.hoppingSkip > 0.0)
+    {
+        if (par.coulombCarriers)
+        {
+            qFatal("langmuir: hopping.skip > 0, yet coulomb.carriers == true");
+        }
+        if (par.trapAccelerate)
+        {
+            qFatal("langmuir: hopping.skip > 0, yet trap.accelerate == true");
+        }
+    }
+
     if (!par.sourceMetropolis)
     {
         if (par.sourceCoulomb)
@@ -620,6 +785,134 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: opencl.device.id must be >= 0");
     }
 
+    if (par.openclPlatform < 0)
+    {
+        qFatal("langmuir: opencl.platform must be >= 0");
+    }
+
+    if (!(QStringList()<<"gpu"<<"cpu"<<"accelerator"<<"default"<<"all").contains(par.openclDeviceType.toLower()))
+    {
+        qFatal("langmuir: opencl.device.type(%s) must be gpu, cpu, accelerator, default or all",
+               qPrintable(par.openclDeviceType));
+    }
+
+    if (!(QStringList()<<"auto"<<"avx512"<<"avx2"<<"scalar"<<"off").contains(par.cpuSimd.toLower()))
+    {
+        qFatal("langmuir: cpu.simd(%s) must be auto, avx512, avx2, scalar or off",
+               qPrintable(par.cpuSimd));
+    }
+
+    if (!(QStringList()<<"none"<<"compact"<<"scatter").contains(par.threadPinning))
+    {
+        qFatal("langmuir: threads.pinning(%s) must be none, compact or scatter",
+               qPrintable(par.threadPinning));
+    }
+
+    if (par.carrierSort < 0)
+    {
+        qFatal("langmuir: carrier.sort(%d) < 0", par.carrierSort);
+    }
+
+    if (par.carrierSort > 0 && par.domainSlabs > 0)
+    {
+        qFatal("langmuir: carrier.sort > 0, yet domain.slabs > 0");
+    }
+
+    if (par.domainSlabs < 0)
+    {
+        qFatal("langmuir: domain.slabs(%d) < 0", par.domainSlabs);
+    }
+
+    if (par.domainSlabs > 0)
+    {
+        if (par.domainSlabs < 2)
+        {
+            qFatal("langmuir: domain.slabs(%d) < 2", par.domainSlabs);
+        }
+        if (par.gridX / par.domainSlabs < 2 * par.hoppingRange)
+        {
+            qFatal("langmuir: domain.slabs(%d) leaves slabs narrower than 2 * hopping.range", par.domainSlabs);
+        }
+        if (par.simulationType != "transistor")
+        {
+            qFatal("langmuir: domain.slabs > 0, yet simulation.type != transistor");
+        }
+        if (par.coulombCarriers)
+        {
+            qFatal("langmuir: domain.slabs > 0, yet coulomb.carriers == true");
+        }
+        if (par.hoppingProposal != "uniform")
+        {
+            qFatal("langmuir: domain.slabs > 0, yet hopping.proposal != uniform");
+        }
+        if (par.hoppingSkip > 0.0 || par.trapAccelerate)
+        {
+            qFatal("langmuir: domain.slabs > 0, yet hopping.skip > 0 or trap.accelerate == true");
+        }
+        if (par.gridStorage != "dense")
+        {
+            qFatal("langmuir: domain.slabs > 0, yet grid.storage != dense");
+        }
+    }
+
+    if (!(QStringList()<<"double"<<"table"<<"single").contains(par.openclPrecision.toLower()))
+    {
+        qFatal("langmuir: opencl.precision(%s) must be double, table or single",
+               qPrintable(par.openclPrecision));
+    }
+
+    if (par.openclEngine)
+    {
+        if (par.simulationType != "transistor")
+        {
+            qFatal("langmuir: opencl.engine == true, yet simulation.type != transistor");
+        }
+        if (par.hoppingRange != 1)
+        {
+            qFatal("langmuir: opencl.engine == true, yet hopping.range != 1");
+        }
+        if (par.hoppingProposal != "uniform")
+        {
+            qFatal("langmuir: opencl.engine == true, yet hopping.proposal != uniform");
+        }
+        if (par.trapAccelerate)
+        {
+            qFatal("langmuir: opencl.engine == true, yet trap.accelerate == true");
+        }
+        if (par.hoppingSkip > 0.0)
+        {
+            qFatal("langmuir: opencl.engine == true, yet hopping.skip > 0");
+        }
+        if (par.domainSlabs > 0)
+        {
+            qFatal("langmuir: opencl.engine == true, yet domain.slabs > 0");
+        }
+        if (par.carrierSort > 0)
+        {
+            qFatal("langmuir: opencl.engine == true, yet carrier.sort > 0");
+        }
+        if (par.gridLayout != "linear")
+        {
+            qFatal("langmuir: opencl.engine == true, yet grid.layout != linear");
+        }
+        if (qint64(par.gridX) * par.gridY * par.gridZ > (1 << 27))
+        {
+            qFatal("langmuir: opencl.engine == true, yet the grid has more than 2^27 sites");
+        }
+        if (par.sourceMetropolis)
+        {
+            qFatal("langmuir: opencl.engine == true, yet source.metropolis == true");
+        }
+        if (par.openclPrecision.toLower() == "single")
+        {
+            qFatal("langmuir: opencl.engine == true, yet opencl.precision == single");
+        }
+        if (par.outputIdsOnDelete)
+        {
+            qFatal("langmuir: opencl.engine == true, yet output.ids.on.delete == true");
+        }
+    }
+
     if (par.balanceCharges && par.simulationType != "solarcell")
     {
         qFatal("langmuir: balance.charges == true, yet simulation.type != solarcell");
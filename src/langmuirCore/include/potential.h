@@ -3,6 +3,7 @@
 #define BOOST_DISABLE_ASSERTS
 
 #include <QObject>
+#include <QVector>
 
 #ifndef Q_MOC_RUN
 
@@ -72,6 +73,14 @@ public:
      */
     void precalculateArrays();
 
+    /**
+     * @brief the interaction (prefactor * iR * eR) at every |dx|, |dy|, |dz| inside the cutoff
+     * @param table filled with zeros at and beyond the cutoff, indexed by ( dx * shape[1] + dy ) * shape[2] + dz
+     * @param shape set to the extent along x, y and z, the cutoff or the grid size if that is smaller
+     * @warning precalculateArrays() must have been called
+     */
+    void interactionTable(QVector<double>& table, int shape[3]);
+
     /**
      * @brief pre-calculates coupling constants
      */
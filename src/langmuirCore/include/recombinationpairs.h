@@ -0,0 +1,94 @@
+#ifndef RECOMBINATIONPAIRS_H
+#define RECOMBINATIONPAIRS_H
+
+#include <QObject>
+#include <QVector>
+#include <QMap>
+#include <QList>
+
+namespace Langmuir
+{
+
+class World;
+class Agent;
+class ChargeAgent;
+
+/**
+ * @brief Keeps the electrons that have a hole within SimulationParameters::recombinationRange
+ *
+ * For each such electron it counts the holes in range of its site (its own site included).
+ * Grid tells it whenever a carrier is registered or unregistered, so the counts only change
+ * around carriers that were injected, moved or removed, and Simulation::performRecombinations()
+ * only has to call RecombinationAgent::tryToAccept() for the electrons counted here; every
+ * other electron would find no partner there anyway.
+ */
+class RecombinationPairs : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(RecombinationPairs)
+
+public:
+    /**
+     * @brief Create an empty list
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     *
+     * It is on for solar cells with SimulationParameters::recombinationRate > 0, the only
+     * case where recombinations are tried.
+     */
+    RecombinationPairs(World &world, QObject *parent=0);
+
+    /**
+     * @brief False if recombinations are never tried, and nothing is kept
+     */
+    bool isOn() const;
+
+    /**
+     * @brief Count a carrier Grid has just placed at its current site
+     */
+    void carrierArrived(Agent *agent);
+
+    /**
+     * @brief Forget a carrier Grid has just taken off its current site
+     */
+    void carrierLeft(Agent *agent);
+
+    /**
+     * @brief The electrons with a hole in range, in a uniformly random order
+     *
+     * Electrons that compete for one hole are tried in this order, so it must not favour any site.
+     */
+    QList<ChargeAgent *> electrons();
+
+    /**
+     * @brief The number of electrons with a hole in range
+     */
+    int size() const;
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief True if the counts are kept
+     */
+    bool m_on;
+
+    /**
+     * @brief The number of holes in range of each electron site that has any, in order of site
+     */
+    QMap<int, int> m_holesInRange;
+
+    /**
+     * @brief The sites within SimulationParameters::recombinationRange of a carrier's site, not counting it
+     *
+     * The carrier's own neighbor list if the ranges are the same, as RecombinationAgent does.
+     */
+    QVector<int> sitesInRange(Agent *agent);
+};
+
+}
+#endif // RECOMBINATIONPAIRS_H
@@ -3,6 +3,8 @@
 
 #include <QObject>
 
+#include "stepkernels.h"
+
 namespace Langmuir
 {
 
@@ -43,16 +45,31 @@ public:
      */
     virtual void performIterations(int nIterations);
 
+    /**
+     * @brief The step() specialization for a set of parameters, see StepKernels
+     */
+    static StepKernels::Step chooseStep(const SimulationParameters& par);
+
 protected:
 
+    /**
+     * @brief One Monte Carlo step on the host
+     * @tparam Coulomb SimulationParameters::coulombCarriers
+     * @tparam SolarCell SimulationParameters::simulationType == "solarcell"
+     */
+    template <bool Coulomb, bool SolarCell>
+    void step();
+
     /**
      * @brief Recombine holes and electrons (in solarcell simulations only)
      */
+    template <bool SolarCell>
     void performRecombinations();
 
     /**
      * @brief Tell sources to inject charges
      */
+    template <bool SolarCell>
     void performInjections();
 
     /**
@@ -70,18 +87,18 @@ protected:
     void nextTick();
 
     /**
-     * @brief A method needed to call ChargeAgent::coulombCPU() in parallel
+     * @brief Call ChargeAgent::coulombCPU() for a share of the electrons then holes, on the WorkerPool
      */
-    static void chargeAgentCoulombInteractionQtConcurrentCPU(ChargeAgent * chargeAgent);
+    static void coulombCPU(void *self, int begin, int end);
 
     /**
-     * @brief A method needed to call ChargeAgent::coulombGPU() in parallel
+     * @brief Call ChargeAgent::coulombGPU() for a share of the electrons then holes, on the WorkerPool
      *
      * Does not perform GPU calcuations.  The coulomb kernel in OpenCLHelper is used to do that.
      * This function copies the GPU results from OpenCLHelper to each ChargeAgent. It is assumed
      * that the coulomb kernel was launched beforehand.
      */
-    static void chargeAgentCoulombInteractionQtConcurrentGPU(ChargeAgent * chargeAgent);
+    static void coulombGPU(void *self, int begin, int end);
 
     /**
      * @brief Reference to World object
@@ -0,0 +1,307 @@
+#ifndef SITESTORE_H
+#define SITESTORE_H
+
+#include "agent.h"
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+
+namespace Langmuir
+{
+
+class World;
+class FreeSites;
+
+/**
+ * @brief The per site storage shared by the electron and hole Grid
+ *
+ * Each site has one 32-bit word per layer (electrons, holes), stored next to each other so a
+ * single cache line answers for both grids.  The top 2 bits of a word say whether the site is
+ * empty, holds the layer's carrier, or is a defect; the low 30 bits index a table of carrier
+ * pointers.  Each carrier keeps its index from addCarrier() in its constructor to removeCarrier()
+ * in its destructor, so a hop (moveCarrier()) only moves the word and leaves the table alone;
+ * the DomainEngine relies on this to move carriers of different slabs at the same time.  The
+ * background potential is the same for both grids, so it is stored once, in
+ * double or single precision (SimulationParameters::gridPrecision).
+ *
+ * The words are kept in pages of SimulationParameters::gridPage sites.  With
+ * SimulationParameters::gridStorage = paged, a page is only allocated when something is put
+ * on one of its sites and is freed when it empties again, and the potential is not stored at
+ * all: it is the linear and gate terms, worked out from the site's x and z, plus a hash of
+ * the sites (traps) that differ from them.  A mostly empty device then costs memory for its
+ * carriers and defects rather than for its volume.
+ *
+ * For solar cells with dense storage the store also keeps the sites that are empty in both
+ * layers (freeSites()), which is where the ExcitonSourceAgent may inject.
+ *
+ * With dense storage, the pages and the potentials are first written by the WorkerPool, so with
+ * SimulationParameters::threadPinning each NUMA node holds the share of the sites its workers get.
+ *
+ * Sites past the end of the grid (sources and drains) are kept by Grid itself.
+ */
+class SiteStore : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(SiteStore)
+
+public:
+    /**
+     * @brief The two grids that share the store
+     */
+    enum Layer
+    {
+        //! the electron Grid
+        Electrons = 0,
+
+        //! the hole Grid
+        Holes     = 1
+    };
+
+    /**
+     * @brief Create an empty store the size of the grid
+     * @param world reference to World object
+     * @param parent QObject this belongs to
+     */
+    SiteStore(World &world, QObject *parent = 0);
+
+    /**
+     * @brief Free the pages
+     */
+    ~SiteStore();
+
+    /**
+     * @brief The sites empty in both layers, keyed by site
+     * @warning NULL unless SimulationParameters::simulationType is solarcell and the storage is dense
+     */
+    const FreeSites *freeSites() const;
+
+    /**
+     * @brief The type of Agent at a site in one layer
+     * @param layer the layer (grid)
+     * @param site the "s-site ID"
+     */
+    Agent::Type agentType(Layer layer, int site) const;
+
+    /**
+     * @brief The carrier at a site in one layer
+     * @param layer the layer (grid)
+     * @param site the "s-site ID"
+     * @warning NULL if the site is empty or a defect
+     */
+    Agent *agentAddress(Layer layer, int site) const;
+
+    /**
+     * @brief Give a new carrier its index in the table of carrier pointers
+     * @param agent an ElectronAgent or a HoleAgent
+     * @return the index, to pass to setCarrier() and removeCarrier()
+     */
+    quint32 addCarrier(Agent *agent);
+
+    /**
+     * @brief Free the index of a carrier that is being deleted
+     * @param index the index addCarrier() returned
+     */
+    void removeCarrier(quint32 index);
+
+    /**
+     * @brief Put the layer's carrier at a site
+     * @param layer the layer (grid)
+     * @param site the "s-site ID"
+     * @param index the carrier's index from addCarrier(); an ElectronAgent for Electrons, a HoleAgent for Holes
+     */
+    void setCarrier(Layer layer, int site, quint32 index);
+
+    /**
+     * @brief Move the layer's carrier from one site to an empty one
+     * @param layer the layer (grid)
+     * @param from the "s-site ID" of the carrier
+     * @param to the "s-site ID" of an empty site
+     *
+     * With dense storage, only the two words are written, so carriers whose sites are
+     * far apart may move at the same time.
+     */
+    void moveCarrier(Layer layer, int from, int to);
+
+    /**
+     * @brief Mark a site as a defect in one layer
+     * @param layer the layer (grid)
+     * @param site the "s-site ID"
+     */
+    void setDefect(Layer layer, int site);
+
+    /**
+     * @brief Empty a site in one layer; a carrier keeps its index
+     * @param layer the layer (grid)
+     * @param site the "s-site ID"
+     */
+    void clear(Layer layer, int site);
+
+    /**
+     * @brief The background potential at a site
+     * @param site the "s-site ID"
+     */
+    double potential(int site) const;
+
+    /**
+     * @brief Set the background potential at a site
+     * @param site the "s-site ID"
+     * @param potential the value to set
+     */
+    void setPotential(int site, double potential);
+
+    /**
+     * @brief Add to the background potential at a site
+     * @param site the "s-site ID"
+     * @param potential the value to add
+     */
+    void addToPotential(int site, double potential);
+
+    /**
+     * @brief Set the background potential of every site to zero
+     */
+    void clearPotentials();
+
+    /**
+     * @brief Add slopeX * (x + 0.5) + offset + slopeZ * (z + 0.5) to the potential of every site
+     *
+     * With paged storage this only changes the formula that potential() works out.
+     */
+    void addPotentialSlopes(double slopeX, double offset, double slopeZ);
+
+    /**
+     * @brief Drop the defects and potentials of the sites outside x = xBegin to xEnd (not included)
+     * @param xBegin first x to keep
+     * @param xEnd one past the last x to keep
+     *
+     * Used by MpiEngine, so a rank only stores its slab and halo.  Does nothing with dense storage.
+     * Sites outside look empty, with the linear and gate terms for their potential, from then on.
+     * @warning there must be no carriers outside
+     */
+    void keepOnly(int xBegin, int xEnd);
+
+    /**
+     * @brief The sites with a word or a potential of their own, in order; empty with dense storage
+     */
+    QVector<int> storedSites() const;
+
+    /**
+     * @brief Bytes in use per site right now, to compare with the two full grids it replaces
+     */
+    double bytesPerSite() const;
+
+private:
+    /**
+     * @brief What the top 2 bits of a word mean
+     */
+    enum Code
+    {
+        EmptyCode   = 0,
+        CarrierCode = 1,
+        DefectCode  = 2
+    };
+
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief The number of sites in the grid
+     */
+    int m_volume;
+
+    /**
+     * @brief True if pages are allocated on first use and the potential is not stored
+     */
+    bool m_paged;
+
+    /**
+     * @brief log2 of the number of sites per page
+     */
+    int m_pageShift;
+
+    /**
+     * @brief Pages of two words per site, the Electrons layer then the Holes layer; NULL if not allocated
+     */
+    QVector<quint32 *> m_pages;
+
+    /**
+     * @brief Number of non-empty words in each page, to free it when it empties; only kept if m_paged
+     */
+    QVector<int> m_pageCounts;
+
+    /**
+     * @brief Carrier pointers, indexed by the low bits of a word
+     */
+    QVector<Agent *> m_carriers;
+
+    /**
+     * @brief Unused indices of m_carriers
+     */
+    QVector<quint32> m_freeCarriers;
+
+    /**
+     * @brief Sites empty in both layers, or NULL if not kept
+     */
+    FreeSites *m_free;
+
+    /**
+     * @brief True if the potentials are stored as float
+     */
+    bool m_single;
+
+    /**
+     * @brief Potentials, if !m_single and !m_paged; NULL otherwise
+     */
+    double *m_potentialDouble;
+
+    /**
+     * @brief Potentials, if m_single and !m_paged; NULL otherwise
+     */
+    float *m_potentialSingle;
+
+    /**
+     * @brief Slope of the potential along x, if m_paged
+     */
+    double m_slopeX;
+
+    /**
+     * @brief Constant term of the potential, if m_paged
+     */
+    double m_offset;
+
+    /**
+     * @brief Slope of the potential along z, if m_paged
+     */
+    double m_slopeZ;
+
+    /**
+     * @brief Potential of each site on top of the slopes, if m_paged and not zero
+     */
+    QHash<int, double> m_sparse;
+
+    /**
+     * @brief The word of a site, or NULL if its page is not allocated
+     */
+    const quint32 *word(Layer layer, int site) const;
+
+    /**
+     * @brief Replace the word of a site, allocating or freeing its page as needed
+     */
+    void setWord(Layer layer, int site, quint32 value);
+
+    /**
+     * @brief The slopes at a site, if m_paged
+     */
+    double slopes(int site) const;
+
+    /**
+     * @brief Allocate and zero a range of dense pages, on the WorkerPool
+     */
+    static void allocatePages(void *self, int begin, int end);
+};
+
+}
+#endif // SITESTORE_H
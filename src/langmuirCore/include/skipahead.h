@@ -0,0 +1,124 @@
+#ifndef SKIPAHEAD_H
+#define SKIPAHEAD_H
+
+#include <QObject>
+#include <QVector>
+#include <QMultiMap>
+
+namespace Langmuir
+{
+
+class World;
+class Grid;
+class ChargeAgent;
+
+/**
+ * @brief A wake-up queue for carriers that are unlikely to hop (SimulationParameters::hoppingSkip)
+ *
+ * Without coulomb interactions, the chance that a carrier hops in a step only depends on its
+ * own site and on what is on its neighbors: neighbor j is proposed with probability 1/n and
+ * accepted with c_j * min(1, exp(-q (V_j - V_i) / kT)) if it is empty, or with the rate of the
+ * drain if it is one.  While none of the neighbors fill or empty, every step is the same coin
+ * flip, so the steps until the hop are geometric and the hop goes to j in proportion to its
+ * chance.  ChargeAgent::skipAheadStep() draws both at once for a carrier that stayed put and
+ * whose total chance is below SimulationParameters::hoppingSkip, and parks it here under the
+ * step of its hop.  Parked carriers propose nothing and draw no random numbers.  Grid wakes the
+ * parked carriers next to a site whenever it fills or empties; as the coin flips have no memory,
+ * they carry on from there as if they had never been parked.
+ */
+class SkipAhead : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(SkipAhead)
+
+public:
+    /**
+     * @brief Create the (empty) queue
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     */
+    SkipAhead(World &world, QObject *parent=0);
+
+    /**
+     * @brief False if SimulationParameters::hoppingSkip is 0
+     */
+    bool isOn() const;
+
+    /**
+     * @brief The number of parked carriers
+     */
+    int parked() const;
+
+    /**
+     * @brief The chance of hopping to each neighbor of a carrier in one step
+     * @param charge the carrier
+     * @param chance filled in the order of Agent::getNeighbors()
+     * @return the total
+     */
+    double chances(ChargeAgent *charge, QVector<double>& chance);
+
+    /**
+     * @brief Draw the number of steps until the hop, this one not counted
+     * @param chance the chance of hopping in a step
+     */
+    quint32 steps(double chance);
+
+    /**
+     * @brief Draw a neighbor in proportion to its chance
+     * @param chance the chances from chances()
+     * @param total their sum
+     * @return an index into chance
+     */
+    int pick(const QVector<double>& chance, double total);
+
+    /**
+     * @brief Add the drain attempts a carrier turned down while it was parked to its drains
+     * @param charge the carrier
+     * @param chance its chance of hopping in a step
+     * @param steps the steps it sat out without hopping
+     */
+    void creditDrains(ChargeAgent *charge, double chance, quint32 steps);
+
+    /**
+     * @brief Park a carrier until a step
+     */
+    void park(ChargeAgent *charge, quint32 step);
+
+    /**
+     * @brief Take a carrier parked until a step out of the queue, without waking it
+     */
+    void unpark(ChargeAgent *charge, quint32 step);
+
+    /**
+     * @brief Wake the carriers whose hop is due by this step
+     * @param step SimulationParameters::currentStep
+     */
+    void wakeDue(quint32 step);
+
+    /**
+     * @brief Wake the parked carriers next to a site that filled or emptied
+     * @param grid the Grid the site is in
+     * @param site the "s-site ID"
+     */
+    void siteChanged(Grid &grid, int site);
+
+private:
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief True if SimulationParameters::hoppingSkip > 0
+     */
+    bool m_on;
+
+    /**
+     * @brief The parked carriers, by the step they hop
+     */
+    QMultiMap<quint32, ChargeAgent *> m_queue;
+};
+
+}
+#endif // SKIPAHEAD_H
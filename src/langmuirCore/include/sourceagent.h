@@ -6,6 +6,8 @@
 namespace Langmuir
 {
 
+class FreeSites;
+
 /**
  * @brief A class to inject charges
  */
@@ -44,9 +46,25 @@ public:
      * This is the main transport method of a SourceAgent.  This function uses
      * chooseSite(), shouldTransport() and validToInject() to inject the charge.
      * It is not garunteed that a charge will be injected.
+     *
+     * If the free sites are known (m_freeSites), the attempt fails outright with the
+     * chance chooseSite() would have hit an occupied site, and otherwise a free site
+     * is drawn, so a nearly full electrode costs no more than an empty one.
      */
     bool tryToInject();
 
+    /**
+     * @brief attempt to inject a carrier at a free site
+     *
+     * Like tryToInject(), but without the chance of hitting an occupied site: the site is
+     * drawn from the free sites straight away, so it only fails if there are none or
+     * shouldTransport() says no.  Simulation::balanceCharges() uses it, so that a crowded
+     * electrode still balances.  The tries tryToInject() would have spent on occupied sites
+     * are drawn from a geometric distribution and counted as attempts, so successProbability()
+     * is unchanged.  Without the free sites (m_freeSites) it is tryToInject().
+     */
+    bool injectFree();
+
 protected:
     /**
      * @brief choose a site to inject to
@@ -94,6 +112,14 @@ protected:
      * @brief choose a random site ID from the neighborlist.
      */
     int randomNeighborSiteID();
+
+    /**
+     * @brief The free sites among those chooseSite() picks from, or NULL if not kept
+     *
+     * A face of the Grid (Grid::freeSites()) for sources on a face, the whole grid
+     * (SiteStore::freeSites()) for the ExcitonSourceAgent.
+     */
+    const FreeSites *m_freeSites;
 };
 
 /**
@@ -102,11 +128,6 @@ protected:
 class ElectronSourceAgent : public SourceAgent
 {
 public:
-    /**
-     * @brief create an ElectronSourceAgent at a specific site
-     */
-    ElectronSourceAgent(World &world, int site, QObject *parent = 0);
-
     /**
      * @brief create an ElectronSourceAgent at a specific Grid::CubeFace
      */
@@ -134,11 +155,6 @@ protected:
 class HoleSourceAgent : public SourceAgent
 {
 public:
-    /**
-     * @brief create a HoleSourceAgent at a specific site
-     */
-    HoleSourceAgent(World &world, int site, QObject *parent = 0);
-
     /**
      * @brief create a HoleSourceAgent at a specific Grid::CubeFace
      */
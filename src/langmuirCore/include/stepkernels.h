@@ -0,0 +1,39 @@
+#ifndef STEPKERNELS_H
+#define STEPKERNELS_H
+
+namespace Langmuir
+{
+
+class Simulation;
+class ChargeAgent;
+struct SimulationParameters;
+
+/**
+ * @brief The compiled versions of the step functions that fit a set of parameters
+ *
+ * Simulation::step() and ChargeAgent::coulombSum() are templates on the switches they
+ * would otherwise test every step or for every carrier, so each version is compiled without
+ * the branches it can not take.  World::initialize() picks the versions once.
+ */
+struct StepKernels
+{
+    //! a Simulation::step() specialization
+    typedef void (Simulation::*Step)();
+
+    //! a ChargeAgent::coulombSum() specialization
+    typedef void (ChargeAgent::*Coulomb)();
+
+    //! one Monte Carlo step, specialized on coulomb.carriers and simulation.type
+    Step step;
+
+    //! ChargeAgent::coulombCPU(), specialized on coulomb.gaussian.sigma > 0 and defects.charge != 0
+    Coulomb coulombCPU;
+
+    StepKernels() : step(0), coulombCPU(0)
+    {
+    }
+};
+
+}
+
+#endif // STEPKERNELS_H
@@ -0,0 +1,244 @@
+#ifndef TRAPBASINS_H
+#define TRAPBASINS_H
+
+#include <QObject>
+#include <QVector>
+#include <QHash>
+
+namespace Langmuir
+{
+
+class World;
+class Grid;
+class ChargeAgent;
+
+/**
+ * @brief Small clusters of traps a lone carrier can leave in one jump (SimulationParameters::trapAccelerate)
+ *
+ * A basin is a connected cluster of trap sites (World::trapSiteIDs(), joined by
+ * SimulationParameters::hoppingRange) of at most SimulationParameters::trapBasinSize sites, away
+ * from the drains.  With no other charge in reach, a carrier in a basin is a Markov chain whose
+ * per-step moves are those of ChargeAgent::decideFuture(): hop to neighbor j of site i with
+ * probability c_ij / n_i * min(1, exp(-q (V_j - V_i) / kT)), else stay.  The sites next to the basin
+ * absorb it.  Solving (I - Q) x = b for the basin part Q of the chain gives, for each start site,
+ * the mean number of steps to leave, the mean number of hops made inside the basin, and the
+ * chance of leaving to each site next to it.
+ *
+ * ChargeAgent::trapBasinStep() puts a carrier that has spent SimulationParameters::trapBasinSteps
+ * steps in a row in one basin to sleep, when nothing is within SimulationParameters::trapBasinClearance
+ * sites of the basin.  The steps until it leaves are drawn from a geometric distribution with the
+ * mean above, which is the exit time of a basin that mixes much faster than it is left (the mean
+ * itself is exact), and the exit site from the exit chances.  The carrier then stays on its site,
+ * ageing a step at a time, until that step, when it hops to the exit site with the hops it made inside
+ * added to its path length.  The coulomb pull of charges further out is left out of the chain.
+ *
+ * Like SkipAhead, the basins keep their sleepers, and Grid tells them whenever a site fills or
+ * empties; a change within the clearance of a basin wakes its sleeper where it is, with the share
+ * of its hops inside the basin for the steps it slept added to its path length.
+ */
+class TrapBasins : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(TrapBasins)
+
+public:
+    /**
+     * @brief How a sleeping carrier leaves its basin
+     */
+    struct Exit
+    {
+        //! steps from now until it hops out
+        int steps;
+
+        //! the site it hops to
+        int site;
+
+        //! hops inside the basin before that
+        int hops;
+    };
+
+    /**
+     * @brief Create the (empty) list of basins
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     */
+    TrapBasins(World &world, QObject *parent=0);
+
+    /**
+     * @brief Find the basins, if SimulationParameters::trapAccelerate is on
+     * @warning the traps must be placed and Potential::updateCouplingConstants() called
+     */
+    void findBasins();
+
+    /**
+     * @brief False if SimulationParameters::trapAccelerate is off, and there are no basins
+     */
+    bool isOn() const;
+
+    /**
+     * @brief The number of basins
+     */
+    int count() const;
+
+    /**
+     * @brief The basin a site is in, or -1
+     * @param site the "s-site ID"
+     */
+    int basin(int site) const;
+
+    /**
+     * @brief The sites of a basin
+     */
+    const QVector<int>& sites(int basin) const;
+
+    /**
+     * @brief The sites next to a basin, in the order exitProbabilities() uses
+     */
+    const QVector<int>& exits(int basin) const;
+
+    /**
+     * @brief True if no charge but one is within SimulationParameters::trapBasinClearance sites of a basin
+     * @param basin the basin
+     * @param charge the carrier in the basin
+     */
+    bool isolated(int basin, ChargeAgent *charge);
+
+    /**
+     * @brief The mean number of steps a carrier needs to leave a basin
+     * @param basin the basin
+     * @param site the site it starts on
+     * @param charge its charge (-1 or +1)
+     */
+    double meanSteps(int basin, int site, int charge);
+
+    /**
+     * @brief The mean number of hops a carrier makes inside a basin before it leaves
+     * @param basin the basin
+     * @param site the site it starts on
+     * @param charge its charge (-1 or +1)
+     */
+    double meanHops(int basin, int site, int charge);
+
+    /**
+     * @brief The chance of leaving to each site of exits()
+     * @param basin the basin
+     * @param site the site it starts on
+     * @param charge its charge (-1 or +1)
+     */
+    QVector<double> exitProbabilities(int basin, int site, int charge);
+
+    /**
+     * @brief Draw when and where a carrier leaves a basin
+     * @param basin the basin
+     * @param site the site it starts on
+     * @param charge its charge (-1 or +1)
+     */
+    Exit sample(int basin, int site, int charge);
+
+    /**
+     * @brief Keep a carrier that fell asleep in a basin, until it is woken or leaves
+     */
+    void addSleeper(int basin, ChargeAgent *charge);
+
+    /**
+     * @brief Forget the sleeper of a basin, without waking it
+     */
+    void removeSleeper(int basin);
+
+    /**
+     * @brief The number of sleeping carriers
+     */
+    int sleepers() const;
+
+    /**
+     * @brief Wake the sleepers of the basins whose clearance holds a site that filled or emptied
+     * @param grid the Grid the site is in
+     * @param site the "s-site ID"
+     */
+    void siteChanged(Grid &grid, int site);
+
+private:
+    /**
+     * @brief The absorbing chain of a basin solved for every start site, for one sign of charge
+     */
+    struct Solution
+    {
+        //! mean steps to leave, by start site
+        QVector<double> steps;
+
+        //! mean hops inside the basin before leaving, by start site
+        QVector<double> hops;
+
+        //! chance of leaving to each exit, start site major
+        QVector<double> exits;
+    };
+
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief True if SimulationParameters::trapAccelerate is on
+     */
+    bool m_on;
+
+    /**
+     * @brief The basin of each trap site that is in one
+     */
+    QHash<int, int> m_basinOfSite;
+
+    /**
+     * @brief The sites of each basin
+     */
+    QVector< QVector<int> > m_sites;
+
+    /**
+     * @brief The sites next to each basin
+     */
+    QVector< QVector<int> > m_exits;
+
+    /**
+     * @brief The sites within SimulationParameters::trapBasinClearance of each basin, the basin included
+     */
+    QVector< QVector<int> > m_halos;
+
+    /**
+     * @brief The basins whose halo holds a site, for the sites in any halo
+     */
+    QHash<int, QVector<int> > m_basinsNear;
+
+    /**
+     * @brief The carrier asleep in each basin, or NULL
+     */
+    QVector<ChargeAgent *> m_sleepers;
+
+    /**
+     * @brief The number of non-NULL m_sleepers
+     */
+    int m_asleep;
+
+    /**
+     * @brief The solved chains, 2 * basin for electrons and 2 * basin + 1 for holes; empty until needed
+     */
+    QVector<Solution> m_solutions;
+
+    /**
+     * @brief Group the trap sites into basins
+     */
+    void groupTraps();
+
+    /**
+     * @brief The solved chain of a basin for a sign of charge, solving it the first time
+     */
+    const Solution& solution(int basin, int charge);
+
+    /**
+     * @brief Solve the absorbing chain of a basin for a sign of charge
+     */
+    void solve(int basin, int charge, Solution& solution);
+};
+
+}
+#endif // TRAPBASINS_H
@@ -0,0 +1,169 @@
+#ifndef VECTORCOULOMB_H
+#define VECTORCOULOMB_H
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+
+namespace Langmuir
+{
+
+class World;
+class ChargeAgent;
+
+/**
+ * @brief Sums the coulomb potentials at the carriers' current and future sites with SIMD instructions
+ *
+ * This is the CPU counterpart of Kernel2 (see OpenClHelper).  The carriers and charged defects
+ * are copied each step into structure-of-arrays x, y, z and charge vectors, and every current and
+ * future site is summed against them with integer distances and a table lookup
+ * (Potential::interactionTable()), so there is no division or multi_array indexing per pair.
+ *
+ * The work is split into blocks of carriers, shared out on the WorkerPool, and each block walks the
+ * charges a tile at a time so the tile stays in cache while the block's sites are summed.
+ * The widest instruction set the CPU has is chosen when the program runs (see SimulationParameters::cpuSimd).
+ */
+class VectorCoulomb : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(VectorCoulomb)
+
+public:
+    /**
+     * @brief Instruction sets, narrowest first
+     */
+    enum Isa
+    {
+        Off,
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    /**
+     * @brief Choose the instruction set and build the interaction table
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     * @warning Potential::precalculateArrays() must have been called
+     */
+    VectorCoulomb(World &world, QObject *parent=0);
+
+    /**
+     * @brief False if SimulationParameters::cpuSimd is off, and the Potential loops are used instead
+     */
+    bool isOn() const;
+
+    /**
+     * @brief Name of the instruction set in use, as in SimulationParameters::cpuSimd
+     */
+    QString isaName() const;
+
+    /**
+     * @brief Sum the potentials at every carrier's current and future site and set their energy changes
+     *
+     * Does the work of ChargeAgent::coulombCPU() for all carriers, so call it after
+     * ChargeAgent::chooseFuture() where that would be mapped over the carriers.
+     */
+    void compute();
+
+    /**
+     * @brief Potential at the current site of a carrier from the last compute()
+     * @param index position in World::electrons(), followed by World::holes()
+     */
+    double getOutputCurrent(int index) const;
+
+    /**
+     * @brief Potential at the future site of a carrier from the last compute()
+     * @param index position in World::electrons(), followed by World::holes()
+     */
+    double getOutputFuture(int index) const;
+
+private:
+    /**
+     * @brief A range of carriers summed together
+     */
+    struct Block
+    {
+        int begin;
+        int end;
+    };
+
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief The instruction set in use
+     */
+    Isa m_isa;
+
+    /**
+     * @brief Potential::interactionTable()
+     */
+    QVector<double> m_table;
+
+    /**
+     * @brief Extent of m_table along x, y and z
+     */
+    int m_shape[3];
+
+    /**
+     * @brief The electrons followed by the holes
+     */
+    QList<ChargeAgent*> m_carriers;
+
+    /**
+     * @brief x, y and z of the charges (carriers then charged defects), padded to a whole vector
+     */
+    QVector<int> m_source[3];
+
+    /**
+     * @brief Charge of each entry in m_source, 0 for padding
+     */
+    QVector<int> m_charge;
+
+    /**
+     * @brief x, y and z of each carrier's current site
+     */
+    QVector<int> m_current[3];
+
+    /**
+     * @brief x, y and z of each carrier's future site
+     */
+    QVector<int> m_future[3];
+
+    /**
+     * @brief Potentials at the current sites, by carrier
+     */
+    QVector<double> m_currentOut;
+
+    /**
+     * @brief Potentials at the future sites, by carrier
+     */
+    QVector<double> m_futureOut;
+
+    /**
+     * @brief The blocks of the last compute()
+     */
+    QVector<Block> m_blocks;
+
+    /**
+     * @brief Best instruction set this CPU supports
+     */
+    static Isa detect();
+
+    /**
+     * @brief Sum one block, then set the energy changes of its carriers
+     */
+    void sum(int begin, int end);
+
+    /**
+     * @brief Sum a share of the blocks, for WorkerPool::run()
+     */
+    static void sumBlocks(void *self, int begin, int end);
+};
+
+}
+#endif // VECTORCOULOMB_H
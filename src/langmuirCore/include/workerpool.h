@@ -0,0 +1,174 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QObject>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+
+namespace Langmuir
+{
+
+class World;
+class PinnedThread;
+
+/**
+ * @brief The threads that run the parallel parts of a step (SimulationParameters::maxThreads of them)
+ *
+ * Unlike QThreadPool, the pool owns its threads for the life of the World, and run() always hands
+ * worker k the k-th contiguous share of the work.  With SimulationParameters::threadPinning set,
+ * each worker is pinned to one CPU, filling one NUMA node before the next (compact) or taking
+ * the nodes in turn (scatter).  Memory is placed on the node of the thread that first writes
+ * it, so arrays zeroed with zero() (or allocated inside run()) end up split across the nodes the
+ * same way later run() calls split the work.  That covers the site arrays (SiteStore) only: the
+ * carriers are created by the main thread as they are injected, and so are VectorCoulomb's
+ * per-carrier arrays, so that memory sits on the main thread's node whatever the pinning.
+ *
+ * MPI ranks on the same host (MpiEngine::localRank()) start their workers that many CPUs further
+ * along, so they do not pin onto the same CPUs.  Pinning is only supported on Linux; elsewhere the
+ * workers float.
+ */
+class WorkerPool : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(WorkerPool)
+
+public:
+    /**
+     * @brief The work of one worker: the indices from begin to end (not included)
+     */
+    typedef void (*Function)(void *context, int begin, int end);
+
+    /**
+     * @brief Read the topology, start and pin the workers, then report where they run
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     */
+    WorkerPool(World &world, QObject *parent=0);
+
+    /**
+     * @brief Stop the workers
+     */
+    ~WorkerPool();
+
+    /**
+     * @brief The number of workers
+     */
+    int size() const;
+
+    /**
+     * @brief Call function on worker k for its share of 0 to count, and wait for all of them
+     * @param function the work
+     * @param context passed to function
+     * @param count the number of indices to share out
+     *
+     * With one worker, function runs on the calling thread.  Only call it from the thread that
+     * created the pool, and not from inside function.
+     */
+    void run(Function function, void *context, int count);
+
+    /**
+     * @brief Zero a new array on the workers, so its pages are placed where run() uses them
+     * @param data the array, not written to since it was allocated
+     * @param count the number of elements
+     * @param size the bytes per element
+     */
+    void zero(void *data, int count, int size);
+
+    /**
+     * @brief The CPU of a worker, or -1 if it floats
+     */
+    int cpu(int worker) const;
+
+    /**
+     * @brief The NUMA node of a worker, or -1 if it floats
+     */
+    int node(int worker) const;
+
+private:
+    friend class PinnedThread;
+
+    /**
+     * @brief Reference to World object
+     */
+    World &m_world;
+
+    /**
+     * @brief The threads, in worker order; empty with one worker
+     */
+    QVector<PinnedThread *> m_threads;
+
+    /**
+     * @brief The CPU of each worker, -1 if it floats
+     */
+    QVector<int> m_cpus;
+
+    /**
+     * @brief The NUMA node of each worker, -1 if it floats
+     */
+    QVector<int> m_nodes;
+
+    /**
+     * @brief Guards everything below
+     */
+    QMutex m_mutex;
+
+    /**
+     * @brief Wakes the workers when m_generation changes
+     */
+    QWaitCondition m_start;
+
+    /**
+     * @brief Wakes run() when m_pending reaches 0
+     */
+    QWaitCondition m_done;
+
+    /**
+     * @brief Counts the calls to run()
+     */
+    quint64 m_generation;
+
+    /**
+     * @brief The workers still busy with this generation
+     */
+    int m_pending;
+
+    /**
+     * @brief The work of this generation
+     */
+    Function m_function;
+
+    /**
+     * @brief Passed to m_function
+     */
+    void *m_context;
+
+    /**
+     * @brief The indices to share out in this generation
+     */
+    int m_count;
+
+    /**
+     * @brief True when the workers should stop
+     */
+    bool m_quit;
+
+    /**
+     * @brief Pick the CPU and node of each worker from SimulationParameters::threadPinning
+     */
+    void placeWorkers(int workers);
+
+    /**
+     * @brief The loop of one worker
+     */
+    void work(int worker);
+
+    /**
+     * @brief Fills zero() in on the workers
+     */
+    static void zeroShare(void *context, int begin, int end);
+};
+
+}
+#endif // WORKERPOOL_H
@@ -20,10 +20,17 @@
 
 #endif
 
+#include "stepkernels.h"
+
 namespace Langmuir
 {
 
 class Grid;
+class SiteStore;
+class WorkerPool;
+class RecombinationPairs;
+class SkipAhead;
+class CarrierSorter;
 class Agent;
 class Random;
 class Logger;
@@ -42,6 +49,12 @@ class ExcitonSourceAgent;
 class ElectronSourceAgent;
 class CheckPointer;
 class OpenClHelper;
+class OpenClEngine;
+class DomainEngine;
+class MpiEngine;
+class VectorCoulomb;
+class HopProposals;
+class TrapBasins;
 struct SimulationParameters;
 struct ConfigurationInfo;
 
@@ -66,6 +79,27 @@ public:
     World(SimulationParameters &parameters, int cores=-1, int gpuID=-1, QObject *parent = 0);
     World(SimulationParameters &parameters, ConfigurationInfo &configInfo, int cores=-1, int gpuID=-1, QObject *parent = 0);
 
+    /**
+     * @brief create a scratch world that shares the workers of another
+     * @param parameters the parameters of the scratch world
+     * @param host the world whose WorkerPool runs the parallel parts; it must outlive this one
+     * @param parent QObject this belongs to
+     *
+     * Used by Calibration, so timing a scratch world does not start (and pin) another set of threads.
+     * A scratch world takes no part in an MPI run: it keeps its own seed and carriers, and has no MpiEngine.
+     */
+    World(SimulationParameters &parameters, World &host, QObject *parent = 0);
+
+    /**
+     * @brief create a world to simulate in
+     * @param fileName the input file name
+     * @param overrides key = value lines applied after the [Parameters] section of the input file
+     * @param parent QObject this belongs to
+     *
+     * Used to pass parameters given on the command line.
+     */
+    World(const QString& fileName, const QStringList& overrides, int cores=-1, int gpuID=-1, QObject *parent = 0);
+
     /**
      * @brief destroys the entire World, and everything in it...including you.
      */
@@ -91,6 +125,31 @@ public:
      */
     Grid& holeGrid();
 
+    /**
+     * @brief get the WorkerPool, the threads that run the parallel parts of a step
+     */
+    WorkerPool& workerPool();
+
+    /**
+     * @brief get the SiteStore, the site data behind both Grids
+     */
+    SiteStore& siteStore();
+
+    /**
+     * @brief get the RecombinationPairs, the electrons with a hole in recombination range
+     */
+    RecombinationPairs& recombinationPairs();
+
+    /**
+     * @brief get the SkipAhead, the carriers left alone until their next hop
+     */
+    SkipAhead& skipAhead();
+
+    /**
+     * @brief get the CarrierSorter, which puts the carriers back in the order of their sites
+     */
+    CarrierSorter& carrierSorter();
+
     /**
      * @brief get the Potential, a calculator used for...calculating the potential.
      */
@@ -116,6 +175,46 @@ public:
      */
     OpenClHelper& opencl();
 
+    /**
+     * @brief get the OpenClEngine, which runs whole steps on the device if SimulationParameters::openclEngine is on
+     */
+    OpenClEngine& openclEngine();
+
+    /**
+     * @brief get the DomainEngine, which runs whole steps on the host threads if SimulationParameters::domainSlabs is on
+     */
+    DomainEngine& domainEngine();
+
+    /**
+     * @brief get the MpiEngine, which runs whole steps across the MPI ranks if there is more than one
+     */
+    MpiEngine& mpiEngine();
+
+    /**
+     * @brief get the VectorCoulomb, used for calculating Coulomb interactions on the CPU
+     */
+    VectorCoulomb& vectorCoulomb();
+
+    /**
+     * @brief get the HopProposals, used for proposing hops in proportion to their coupling
+     */
+    HopProposals& hopProposals();
+
+    /**
+     * @brief get the TrapBasins, the clusters of traps carriers can jump out of
+     */
+    TrapBasins& trapBasins();
+
+    /**
+     * @brief get the StepKernels, the versions of the step functions chosen for the parameters
+     */
+    StepKernels& stepKernels();
+
+    /**
+     * @brief choose the StepKernels again, after a switch such as SimulationParameters::coulombCarriers changed
+     */
+    void chooseStepKernels();
+
     /**
      * @brief get a list of all SourceAgents
      */
@@ -368,11 +467,15 @@ public:
 
     /**
      * @brief check if the maximum number of electrons has been reached
+     *
+     * In MPI runs, counts the electrons of all ranks (see MpiEngine::atMaxElectrons()).
      */
     bool atMaxElectrons();
 
     /**
      * @brief check if the maximum number of holes has been reached
+     *
+     * In MPI runs, counts the holes of all ranks (see MpiEngine::atMaxHoles()).
      */
     bool atMaxHoles();
 
@@ -497,6 +600,36 @@ private:
      */
     Grid *m_holeGrid;
 
+    /**
+     * @brief pointer to WorkerPool, created before the site arrays it places
+     */
+    WorkerPool *m_workerPool;
+
+    /**
+     * @brief the World this scratch World shares its WorkerPool with, or NULL if it owns its own
+     */
+    World *m_host;
+
+    /**
+     * @brief pointer to SiteStore, shared by m_electronGrid and m_holeGrid
+     */
+    SiteStore *m_siteStore;
+
+    /**
+     * @brief pointer to RecombinationPairs, kept up to date by m_electronGrid and m_holeGrid
+     */
+    RecombinationPairs *m_recombinationPairs;
+
+    /**
+     * @brief pointer to SkipAhead, woken by m_electronGrid and m_holeGrid
+     */
+    SkipAhead *m_skipAhead;
+
+    /**
+     * @brief pointer to CarrierSorter, which reorders m_electrons and m_holes
+     */
+    CarrierSorter *m_carrierSorter;
+
     /**
      * @brief pointer to Random, used for generating random numbers
      */
@@ -522,6 +655,41 @@ private:
      */
     OpenClHelper *m_ocl;
 
+    /**
+     * @brief pointer to OpenClEngine, NULL unless SimulationParameters::openclEngine is on
+     */
+    OpenClEngine *m_engine;
+
+    /**
+     * @brief pointer to DomainEngine, NULL unless SimulationParameters::domainSlabs is on
+     */
+    DomainEngine *m_domainEngine;
+
+    /**
+     * @brief pointer to MpiEngine, NULL unless langmuir runs on more than one MPI rank
+     */
+    MpiEngine *m_mpiEngine;
+
+    /**
+     * @brief pointer to VectorCoulomb, used for CPU coulomb sums
+     */
+    VectorCoulomb *m_vector;
+
+    /**
+     * @brief pointer to HopProposals, used by ChargeAgent::chooseFuture()
+     */
+    HopProposals *m_hopProposals;
+
+    /**
+     * @brief pointer to TrapBasins, used by ChargeAgent::trapBasinStep() and Grid
+     */
+    TrapBasins *m_trapBasins;
+
+    /**
+     * @brief the versions of the step functions in use
+     */
+    StepKernels m_stepKernels;
+
     /**
      * @brief list of electrons
      */
@@ -670,7 +838,7 @@ private:
      * code.
      */
     void initialize(const QString& fileName = "", SimulationParameters *pparameters = NULL, ConfigurationInfo *pconfigInfo = NULL,
-        int cores = -1, int gpuID = -1);
+        int cores = -1, int gpuID = -1, const QStringList& overrides = QStringList());
 };
 
 }
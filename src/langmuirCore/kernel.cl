@@ -1,4 +1,18 @@
+// With LANGMUIR_SINGLE ( opencl.precision = single ) only table2 and scatter are built, in float, so the
+// device does not need cl_khr_fp64; the double kernels below are left out.
+#ifndef LANGMUIR_SINGLE
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+// The size of the local arrays is set when the program is built (see OpenClHelper::buildKernels), so
+// that it matches work.size ( 1D kernels ) and work.x * work.y * work.z ( 3D kernels ) on any device.
+#ifndef LOCAL_SIZE_1D
+#define LOCAL_SIZE_1D 1024
+#endif
+
+#ifndef LOCAL_SIZE_3D
+#define LOCAL_SIZE_3D 64
+#endif
 
 // The kernel calculates the coulomb potential at every point on a 3D rectangular grid of size ( Wx * Wy * Wz ).
 // The calculation is performed using a (larger) computational grid of size ( Sx * Sy * Sz ) * ( Wx * Wy * Wz ) = ( Gx * Gy * Gz ).
@@ -52,6 +66,7 @@
 // item in the work group sums up q / r terms ( only the ones its responsible for ).  Finally, the first work item in each group
 // sums up all the other work items q / r sums for the given work group and writes the answer to the global memory 'o'.
 
+#ifndef LANGMUIR_SINGLE
 // coulomb1 calcules the coulomb interaction EVERYWHERE
 __kernel void coulomb1( __global double *o, __global int *s, __global int *q, int n, int c2, double prefactor )
 {
@@ -67,9 +82,9 @@ __kernel void coulomb1( __global double *o, __global int *s, __global int *q, in
 
     // let 'this work item' know about the local memory for the work group it belongs to
     // ... to be accessed using the index 'j'
-    __local int    slocal[64];
-    __local int    qlocal[64];
-    __local double vlocal[64];
+    __local int    slocal[LOCAL_SIZE_3D];
+    __local int    qlocal[LOCAL_SIZE_3D];
+    __local double vlocal[LOCAL_SIZE_3D];
 
     // have 'this work item' set its own initial potential to zero
     vlocal[j] = 0;
@@ -150,9 +165,9 @@ __kernel void gauss1( __global double *o, __global int *s, __global int *q, int
 
     // let 'this work item' know about the local memory for the work group it belongs to
     // ... to be accessed using the index 'j'
-    __local int    slocal[64];
-    __local int    qlocal[64];
-    __local double vlocal[64];
+    __local int    slocal[LOCAL_SIZE_3D];
+    __local int    qlocal[LOCAL_SIZE_3D];
+    __local double vlocal[LOCAL_SIZE_3D];
 
     // have 'this work item' set its own initial potential to zero
     vlocal[j] = 0;
@@ -219,11 +234,10 @@ __kernel void gauss1( __global double *o, __global int *s, __global int *q, int
     }
 }
 
-__kernel void coulomb2( __global double *o, __global int *s, __global int *q, int n, int c2, __global int *w, int xsize, int ysize, double prefactor )
+__kernel void coulomb2( __global double *o, __global int *s, __global int *q, int n, int c2, __global int *w, int xsize, int ysize, double prefactor, int woffset, int ooffset )
 {
-    // each worker of work group loads the same charge and site, using the "work group id"
-    int qi = q[ get_group_id(0) ];
-    int si = w[ get_group_id(0) ];
+    // each worker of work group loads the same site, using the "work group id"
+    int si = w[ woffset + get_group_id(0) ];
 
     // extract position from site using the grid dimensions
     int zi = ( si ) / ( xsize * ysize );
@@ -231,9 +245,9 @@ __kernel void coulomb2( __global double *o, __global int *s, __global int *q, in
     int xi = ( si ) % ( xsize );
 
     // allocate local memory for this work group
-    __local int    slocal[1024];
-    __local int    qlocal[1024];
-    __local double vlocal[1024];
+    __local int    slocal[LOCAL_SIZE_1D];
+    __local int    qlocal[LOCAL_SIZE_1D];
+    __local double vlocal[LOCAL_SIZE_1D];
 
     // each worker sets a different index of the local memory to zero and waits
     vlocal[ get_local_id(0) ] = 0;
@@ -288,16 +302,14 @@ __kernel void coulomb2( __global double *o, __global int *s, __global int *q, in
         {
             v = v + vlocal[l];
         }
-        //o[si] = v;
-        o[ get_group_id(0) ] = prefactor * v;
+        o[ ooffset + get_group_id(0) ] = prefactor * v;
     }
 }
 
-__kernel void gauss2( __global double *o, __global int *s, __global int *q, int n, int c2, __global int *w, int xsize, int ysize, double prefactor, double erffactor )
+__kernel void gauss2( __global double *o, __global int *s, __global int *q, int n, int c2, __global int *w, int xsize, int ysize, double prefactor, double erffactor, int woffset, int ooffset )
 {
-    // each worker of work group loads the same charge and site, using the "work group id"
-    int qi = q[ get_group_id(0) ];
-    int si = w[ get_group_id(0) ];
+    // each worker of work group loads the same site, using the "work group id"
+    int si = w[ woffset + get_group_id(0) ];
 
     // extract position from site using the grid dimensions
     int zi = ( si ) / ( xsize * ysize );
@@ -305,9 +317,9 @@ __kernel void gauss2( __global double *o, __global int *s, __global int *q, int
     int xi = ( si ) % ( xsize );
 
     // allocate local memory for this work group
-    __local int    slocal[1024];
-    __local int    qlocal[1024];
-    __local double vlocal[1024];
+    __local int    slocal[LOCAL_SIZE_1D];
+    __local int    qlocal[LOCAL_SIZE_1D];
+    __local double vlocal[LOCAL_SIZE_1D];
 
     // each worker sets a different index of the local memory to zero and waits
     vlocal[ get_local_id(0) ] = 0;
@@ -364,7 +376,382 @@ __kernel void gauss2( __global double *o, __global int *s, __global int *q, int
             v = v + vlocal[l];
         }
 
-        o[ get_group_id(0) ] = prefactor * v;
+        o[ ooffset + get_group_id(0) ] = prefactor * v;
+    }
+}
+#endif
+
+// table2 is coulomb2 / gauss2 with the interaction read from a table instead of computed.  The
+// host fills table[ ( dx * ty + dy ) * tz + dz ] with prefactor * erf( erffactor * r ) / r (or
+// prefactor / r) for 0 < r < cutoff and 0 otherwise, so one kernel serves both and the inner loop
+// has no sqrt or erf.  The table is __constant when it fits (see OpenClHelper::buildKernels).
+//
+// With LANGMUIR_SINGLE the table, the sums and the output are float, and the sums are compensated
+// (Kahan) so that the error does not grow with the number of charges.
+#ifndef TABLE_SPACE
+#define TABLE_SPACE __global
+#endif
+
+#ifdef LANGMUIR_SINGLE
+typedef float real;
+#define ACCUMULATE( sum, c, x ) { real y_ = ( x ) - c; real t_ = sum + y_; c = ( t_ - sum ) - y_; sum = t_; }
+#else
+typedef double real;
+#define ACCUMULATE( sum, c, x ) { sum = sum + ( x ); }
+#endif
+
+__kernel void table2( __global real *o, __global int *s, __global int *q, int n, TABLE_SPACE real *table, __global int *w, int xsize, int ysize, int tx, int ty, int tz, int woffset, int ooffset )
+{
+    // each worker of work group loads the same site, using the "work group id"
+    int si = w[ woffset + get_group_id(0) ];
+
+    // extract position from site using the grid dimensions
+    int zi = ( si ) / ( xsize * ysize );
+    int yi = ( si ) / ( xsize ) - ( zi * ysize );
+    int xi = ( si ) % ( xsize );
+
+    // allocate local memory for this work group
+    __local int  slocal[LOCAL_SIZE_1D];
+    __local int  qlocal[LOCAL_SIZE_1D];
+    __local real vlocal[LOCAL_SIZE_1D];
+#ifdef LANGMUIR_SINGLE
+    __local real clocal[LOCAL_SIZE_1D];
+#endif
+
+    // each worker keeps its own sum (and compensation) while it works
+    real v = 0;
+    real c = 0;
+
+    // calculate how many pieces we can divide the total list of charges/positions into
+    int num_loads = n / ( get_local_size(0) ) + 1;
+
+    // start loading chunks of charges to calculate on
+    for ( int load_number = 0; load_number < num_loads; load_number++ )
+    {
+        // each worker loads a different charge
+        int load_id = get_local_size(0) * load_number + get_local_id(0);
+        if ( load_id < n ) //number of charges
+        {
+            slocal[ get_local_id(0) ] = s[load_id];
+            qlocal[ get_local_id(0) ] = q[load_id];
+        }
+        else
+        {
+            slocal[ get_local_id(0) ] = -1;
+            qlocal[ get_local_id(0) ] = -1;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // each worker looks up a different interaction
+        int sj = slocal[ get_local_id(0) ];
+        if ( sj >= 0 )
+        {
+        int zj = ( sj ) / ( xsize * ysize );
+        int yj = ( sj ) / ( xsize ) - ( zj * ysize );
+        int xj = ( sj ) % ( xsize );
+        int dx = abs( xi - xj );
+        int dy = abs( yi - yj );
+        int dz = abs( zi - zj );
+
+        // beyond the table is beyond the cutoff
+        if ( dx < tx && dy < ty && dz < tz )
+        {
+            ACCUMULATE( v, c, qlocal[ get_local_id(0) ] * table[ ( dx * ty + dy ) * tz + dz ] );
+        }
+
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    vlocal[ get_local_id(0) ] = v;
+#ifdef LANGMUIR_SINGLE
+    clocal[ get_local_id(0) ] = c;
+#endif
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if ( get_local_id(0) == 0 )
+    {
+        v = 0;
+        c = 0;
+        for ( int l = 0; l <  get_local_size(0); l++ )
+        {
+            ACCUMULATE( v, c, vlocal[l] );
+#ifdef LANGMUIR_SINGLE
+            // each worker's sum is v - c
+            ACCUMULATE( v, c, -clocal[l] );
+#endif
+        }
+
+        o[ ooffset + get_group_id(0) ] = v - c;
+    }
+}
+
+// scatter writes the carriers that changed since the last launch into their slots; the slots
+// start after the charged defects at 'offset'.  Each slot appears at most once in 'slots'.
+__kernel void scatter( __global int *s, __global int *q, __global int *slots, __global int *sites, __global int *charges, int n, int offset )
+{
+    int i = get_global_id(0);
+    if ( i < n )
+    {
+        s[ offset + slots[i] ] = sites[i];
+        q[ offset + slots[i] ] = charges[i];
+    }
+}
+
+#ifndef LANGMUIR_SINGLE
+// The engine kernels run a whole Monte Carlo step on the device (see OpenClEngine).  They use the same layout as Kernel2:
+// s[ d + i ] and q[ d + i ] are the site and charge of slot i ( site -1 for a free slot ) after d charged defects, and f[i] is the
+// proposed site.  Sites are kept per species: occ[ sp * volume + site ] is 0 if empty, 1 for a carrier and 2 for a defect, where
+// sp is 0 for electrons and 1 for holes.  A proposed move onto a drain is stored as ENGINE_DRAIN_LEFT or ENGINE_DRAIN_RIGHT.
+//
+// counters[] holds the drain and source attempts / successes ( electron left, electron right, hole left, hole right ), the
+// number of electrons and holes, and the top of the free slot stack.
+#define ENGINE_DRAIN_LEFT  -2
+#define ENGINE_DRAIN_RIGHT -3
+#define ENGINE_DRAINS       0
+#define ENGINE_SOURCES      8
+#define ENGINE_CARRIERS    16
+#define ENGINE_FREE        18
+
+// counter based random numbers; each ( step, stream, index ) maps to its own number, so no generator state is stored
+ulong engine_mix( ulong z )
+{
+    z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9UL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebUL;
+    return z ^ ( z >> 31 );
+}
+
+double engine_random( ulong seed, int step, int stream, int index )
+{
+    ulong z = engine_mix( seed + 0x9e3779b97f4a7c15UL * ( ulong )( step + 1 ) );
+    z = engine_mix( z ^ ( ( ( ulong )stream << 32 ) | ( uint )index ) );
+    return ( z >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+// engine_choose proposes a random neighbor ( or drain ) for every carrier; hopping.range = 1
+__kernel void engine_choose( __global int *s, __global int *f, int d, int slots, int xsize, int ysize, int zsize, ulong seed, int step )
+{
+    int i = get_global_id(0);
+    if ( i >= slots )
+    {
+        return;
+    }
+
+    int si = s[ d + i ];
+    if ( si < 0 )
+    {
+        f[i] = si;
+        return;
+    }
+
+    int zi = ( si ) / ( xsize * ysize );
+    int yi = ( si ) / ( xsize ) - ( zi * ysize );
+    int xi = ( si ) % ( xsize );
+
+    int neighbors[8];
+    int m = 0;
+    if ( xi > 0 )         neighbors[m++] = si - 1;
+    if ( xi < xsize - 1 ) neighbors[m++] = si + 1;
+    if ( yi > 0 )         neighbors[m++] = si - xsize;
+    if ( yi < ysize - 1 ) neighbors[m++] = si + xsize;
+    if ( zi > 0 )         neighbors[m++] = si - xsize * ysize;
+    if ( zi < zsize - 1 ) neighbors[m++] = si + xsize * ysize;
+    if ( xi == 0 )        neighbors[m++] = ENGINE_DRAIN_LEFT;
+    if ( xi == xsize - 1 ) neighbors[m++] = ENGINE_DRAIN_RIGHT;
+
+    int k = ( int )( engine_random( seed, step, 0, i ) * m );
+    f[i] = neighbors[ min( k, m - 1 ) ];
+}
+
+// engine_decide applies the Metropolis criterion ( or the drain rate ) to every proposal; accepted moves onto a site claim it,
+// and the lowest slot wins when several carriers claim the same site.  o holds coulomb2 / gauss2 output for the current
+// sites followed by the future sites, and is only read if coulomb is non-zero.
+__kernel void engine_decide( __global int *s, __global int *q, __global int *f, __global int *claim, __global int *occ,
+                             __global double *v, __global double *o, __global double *coupling, __global double *drain,
+                             __global int *lifetime, __global int *pathlength, __global uint *counters,
+                             int d, int slots, int xsize, int ysize, int zsize, int coulomb, double self, double binding,
+                             double inverseKT, ulong seed, int step )
+{
+    int i = get_global_id(0);
+    if ( i >= slots )
+    {
+        return;
+    }
+
+    int si = s[ d + i ];
+    if ( si < 0 )
+    {
+        return;
+    }
+
+    int qi = q[ d + i ];
+    int sp = qi > 0 ? 1 : 0;
+    int fi = f[i];
+    int volume = xsize * ysize * zsize;
+    double u = engine_random( seed, step, 1, i );
+
+    lifetime[i] += 1;
+
+    // drains accept at their rate
+    if ( fi < 0 )
+    {
+        int c = 2 * sp + ( fi == ENGINE_DRAIN_LEFT ? 0 : 1 );
+        atomic_inc( &counters[ ENGINE_DRAINS + 2 * c ] );
+        if ( drain[c] > u )
+        {
+            atomic_inc( &counters[ ENGINE_DRAINS + 2 * c + 1 ] );
+            pathlength[i] += 1;
+        }
+        else
+        {
+            f[i] = si;
+        }
+        return;
+    }
+
+    // only empty sites can be moved to
+    if ( occ[ sp * volume + fi ] != 0 )
+    {
+        f[i] = si;
+        return;
+    }
+
+    double pd = ( v[ sp * volume + fi ] - v[ sp * volume + si ] ) * qi;
+    if ( coulomb )
+    {
+        // remove the self interaction, and bind to a carrier of the other species on the same site ( see bindingPotential )
+        int other = ( 1 - sp ) * volume;
+        double bound = self - qi * binding;
+        double p1 = o[i];
+        double p2 = o[ slots + i ] - self * qi;
+        if ( occ[ other + si ] == 1 ) p1 += bound;
+        if ( occ[ other + fi ] == 1 ) p2 += bound;
+        pd += qi * ( p2 - p1 );
+    }
+
+    int zi = ( si ) / ( xsize * ysize );
+    int yi = ( si ) / ( xsize ) - ( zi * ysize );
+    int xi = ( si ) % ( xsize );
+    int zf = ( fi ) / ( xsize * ysize );
+    int yf = ( fi ) / ( xsize ) - ( zf * ysize );
+    int xf = ( fi ) % ( xsize );
+    double c = coupling[ abs( xi - xf ) * 4 + abs( yi - yf ) * 2 + abs( zi - zf ) ];
+
+    double p = pd > 0 ? c * exp( -pd * inverseKT ) : c;
+    if ( p > u )
+    {
+        pathlength[i] += 1;
+        atomic_min( &claim[ sp * volume + fi ], i );
+    }
+    else
+    {
+        f[i] = si;
+    }
+}
+
+// engine_complete moves the carriers that won their claim and removes the ones accepted by a drain
+__kernel void engine_complete( __global int *s, __global int *q, __global int *f, __global int *claim, __global int *occ,
+                               __global int *alive, __global int *freelist, __global uint *counters, int d, int slots, int volume )
+{
+    int i = get_global_id(0);
+    if ( i >= slots )
+    {
+        return;
+    }
+
+    int si = s[ d + i ];
+    int fi = f[i];
+    if ( si < 0 || fi == si )
+    {
+        return;
+    }
+
+    int sp = q[ d + i ] > 0 ? 1 : 0;
+    if ( fi < 0 )
+    {
+        occ[ sp * volume + si ] = 0;
+        s[ d + i ] = -1;
+        q[ d + i ] = 0;
+        f[i] = -1;
+        alive[i] = 0;
+        freelist[ atomic_inc( &counters[ ENGINE_FREE ] ) ] = i;
+        atomic_dec( &counters[ ENGINE_CARRIERS + sp ] );
+        return;
+    }
+
+    // claimed sites were empty at the start of the step, so no site is both left and entered here
+    if ( claim[ sp * volume + fi ] == i )
+    {
+        occ[ sp * volume + si ] = 0;
+        occ[ sp * volume + fi ] = 1;
+        s[ d + i ] = fi;
+    }
+    else
+    {
+        f[i] = si;
+    }
+}
+
+// engine_release clears the claims, which all sit on sites occupied after engine_complete
+__kernel void engine_release( __global int *s, __global int *q, __global int *claim, int d, int slots, int volume )
+{
+    int i = get_global_id(0);
+    if ( i >= slots )
+    {
+        return;
+    }
+
+    int si = s[ d + i ];
+    if ( si >= 0 )
+    {
+        claim[ ( q[ d + i ] > 0 ? volume : 0 ) + si ] = INT_MAX;
+    }
+}
+
+// engine_inject runs the four sources in turn ( electron left, electron right, hole left, hole right ) on one work item
+__kernel void engine_inject( __global int *s, __global int *q, __global int *f, __global int *occ, __global int *alive,
+                             __global int *lifetime, __global int *pathlength, __global int *freelist, __global uint *counters,
+                             __global double *source, int d, int xsize, int ysize, int zsize, int maxElectrons, int maxHoles,
+                             ulong seed, int step )
+{
+    if ( get_global_id(0) != 0 )
+    {
+        return;
+    }
+
+    int volume = xsize * ysize * zsize;
+    int area = ysize * zsize;
+    for ( int k = 0; k < 4; k++ )
+    {
+        int sp = k / 2;
+        int x = ( k % 2 == 0 ) ? 0 : xsize - 1;
+        int c = ENGINE_SOURCES + 2 * k;
+        counters[c] += 1;
+
+        // a random site on the face
+        int a = min( ( int )( engine_random( seed, step, 2, 2 * k ) * area ), area - 1 );
+        int site = x + xsize * ( a % ysize ) + xsize * ysize * ( a / ysize );
+
+        int limit = ( sp == 0 ) ? maxElectrons : maxHoles;
+        if ( counters[ ENGINE_CARRIERS + sp ] >= limit || source[k] <= 0 || occ[ sp * volume + site ] != 0 )
+        {
+            continue;
+        }
+        if ( !( source[k] > engine_random( seed, step, 2, 2 * k + 1 ) ) )
+        {
+            continue;
+        }
+
+        counters[ ENGINE_FREE ] -= 1;
+        int i = freelist[ counters[ ENGINE_FREE ] ];
+        s[ d + i ] = site;
+        q[ d + i ] = ( sp == 0 ) ? -1 : 1;
+        f[i] = site;
+        alive[i] = 0;
+        lifetime[i] = 0;
+        pathlength[i] = 0;
+        occ[ sp * volume + site ] = 1;
+        counters[ ENGINE_CARRIERS + sp ] += 1;
+        counters[ c + 1 ] += 1;
     }
 }
 
@@ -392,3 +779,4 @@ __kernel void image( __write_only image2d_t img, __global double *o, int layer,
     }
     write_imagef(img, coord, val);
 }
+#endif
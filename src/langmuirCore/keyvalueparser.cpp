@@ -20,7 +20,14 @@ KeyValueParser::KeyValueParser(World &world, QObject *parent) :
     registerVariable("grid.z", m_parameters.gridZ);
     registerVariable("grid.y", m_parameters.gridY);
     registerVariable("grid.x", m_parameters.gridX);
+    registerVariable("grid.layout", m_parameters.gridLayout);
+    registerVariable("grid.tile", m_parameters.gridTile);
+    registerVariable("grid.precision", m_parameters.gridPrecision);
+    registerVariable("grid.storage", m_parameters.gridStorage);
+    registerVariable("grid.page", m_parameters.gridPage);
     registerVariable("hopping.range", m_parameters.hoppingRange);
+    registerVariable("hopping.proposal", m_parameters.hoppingProposal);
+    registerVariable("hopping.skip", m_parameters.hoppingSkip);
 
     registerVariable("output.is.on", m_parameters.outputIsOn);
     registerVariable("iterations.print", m_parameters.iterationsPrint);
@@ -54,6 +61,10 @@ KeyValueParser::KeyValueParser(World &world, QObject *parent) :
     registerVariable("trap.potential", m_parameters.trapPotential);
     registerVariable("gaussian.stdev", m_parameters.gaussianStdev);
     registerVariable("seed.percentage", m_parameters.seedPercentage);
+    registerVariable("trap.accelerate", m_parameters.trapAccelerate);
+    registerVariable("trap.basin.size", m_parameters.trapBasinSize);
+    registerVariable("trap.basin.steps", m_parameters.trapBasinSteps);
+    registerVariable("trap.basin.clearance", m_parameters.trapBasinClearance);
 
     registerVariable("voltage.right", m_parameters.voltageRight);
     registerVariable("voltage.left", m_parameters.voltageLeft);
@@ -91,7 +102,19 @@ KeyValueParser::KeyValueParser(World &world, QObject *parent) :
     registerVariable("work.size", m_parameters.workSize);
     registerVariable("opencl.threshold", m_parameters.openclThreshold);
     registerVariable("opencl.device.id", m_parameters.openclDeviceID);
+    registerVariable("opencl.platform", m_parameters.openclPlatform);
+    registerVariable("opencl.device.type", m_parameters.openclDeviceType);
+    registerVariable("opencl.pipeline", m_parameters.openclPipeline);
+    registerVariable("opencl.precision", m_parameters.openclPrecision);
+    registerVariable("opencl.calibrate", m_parameters.openclCalibrate);
+    registerVariable("opencl.calibrate.work", m_parameters.openclCalibrateWork);
+    registerVariable("opencl.cache", m_parameters.openclCache);
+    registerVariable("opencl.engine", m_parameters.openclEngine);
     registerVariable("max.threads", m_parameters.maxThreads);
+    registerVariable("threads.pinning", m_parameters.threadPinning);
+    registerVariable("cpu.simd", m_parameters.cpuSimd);
+    registerVariable("domain.slabs", m_parameters.domainSlabs);
+    registerVariable("carrier.sort", m_parameters.carrierSort);
 
     registerVariable("boltzmann.constant", m_parameters.boltzmannConstant, Variable::Constant);
     registerVariable("dielectric.constant", m_parameters.dielectricConstant, Variable::Constant);
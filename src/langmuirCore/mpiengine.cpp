@@ -0,0 +1,568 @@
+#include "mpiengine.h"
+#include "chargeagent.h"
+#include "sourceagent.h"
+#include "fluxagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "sitestore.h"
+#include "writer.h"
+#include "world.h"
+#include "rand.h"
+
+#include <climits>
+
+#ifdef LANGMUIR_MPI
+#include <mpi.h>
+#endif
+
+namespace Langmuir
+{
+
+// filled in by MpiEngine::initialize()
+static int s_localRank = 0;
+static int s_localSize = 1;
+
+#ifdef LANGMUIR_MPI
+static bool mpiIsRunning()
+{
+    int initialized = 0;
+    int finalized = 0;
+    MPI_Initialized(&initialized);
+    MPI_Finalized(&finalized);
+    return initialized && !finalized;
+}
+#endif
+
+void MpiEngine::initialize(int *argc, char ***argv)
+{
+#ifdef LANGMUIR_MPI
+    MPI_Init(argc, argv);
+
+    // the ranks that share a host split its cores and GPUs (see World::initialize)
+    MPI_Comm local;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank(), MPI_INFO_NULL, &local);
+    MPI_Comm_rank(local, &s_localRank);
+    MPI_Comm_size(local, &s_localSize);
+    MPI_Comm_free(&local);
+#else
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+#endif
+}
+
+void MpiEngine::finalize()
+{
+#ifdef LANGMUIR_MPI
+    if (mpiIsRunning())
+    {
+        MPI_Finalize();
+    }
+#endif
+}
+
+int MpiEngine::rank()
+{
+    int value = 0;
+#ifdef LANGMUIR_MPI
+    if (mpiIsRunning())
+    {
+        MPI_Comm_rank(MPI_COMM_WORLD, &value);
+    }
+#endif
+    return value;
+}
+
+int MpiEngine::size()
+{
+    int value = 1;
+#ifdef LANGMUIR_MPI
+    if (mpiIsRunning())
+    {
+        MPI_Comm_size(MPI_COMM_WORLD, &value);
+    }
+#endif
+    return value;
+}
+
+int MpiEngine::localRank()
+{
+    return s_localRank;
+}
+
+int MpiEngine::localSize()
+{
+    return s_localSize;
+}
+
+quint64 MpiEngine::broadcastSeed(quint64 seed)
+{
+#ifdef LANGMUIR_MPI
+    if (size() > 1)
+    {
+        unsigned long long value = seed;
+        MPI_Bcast(&value, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+        seed = value;
+    }
+#endif
+    return seed;
+}
+
+MpiEngine::MpiEngine(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_rank(rank()), m_size(size()), m_numElectrons(0), m_numHoles(0),
+      m_reserve(0)
+{
+    const SimulationParameters& par = m_world.parameters();
+    if (par.simulationType != "transistor")
+    {
+        qFatal("langmuir: MPI runs only support simulation.type = transistor");
+    }
+    if (par.openclEngine || par.domainSlabs > 0 || par.hoppingSkip > 0 || par.trapAccelerate ||
+        par.carrierSort > 0)
+    {
+        qFatal("langmuir: MPI runs can not use opencl.engine, domain.slabs, hopping.skip, trap.accelerate or carrier.sort");
+    }
+    if (par.outputIdsOnDelete)
+    {
+        qFatal("langmuir: MPI runs can not use output.ids.on.delete");
+    }
+
+    int sizeX = m_world.electronGrid().xSize();
+    m_xBegin = int(qint64(m_rank) * sizeX / m_size);
+    m_xEnd = int(qint64(m_rank + 1) * sizeX / m_size);
+    m_halo = par.hoppingRange;
+    if (par.coulombCarriers)
+    {
+        m_halo = qMax(m_halo, int(par.electrostaticCutoff));
+    }
+    if (sizeX / m_size < qMax(2 * par.hoppingRange, m_halo))
+    {
+        qFatal("langmuir: grid.x / MPI ranks must be at least 2 * hopping.range and the halo (%d)", m_halo);
+    }
+
+    // every rank drew the same numbers so far; split the stream from here on
+    Random& random = m_world.randomNumberGenerator();
+    quint64 seed = (quint64(random.integer(0, INT_MAX)) << 32) ^ quint64(random.integer(1, INT_MAX));
+    random.seed(seed + Q_UINT64_C(0x9E3779B97F4A7C15) * quint64(m_rank));
+
+    // keep the carriers of the slab
+    QList<ChargeAgent*> charges = m_world.electrons() + m_world.holes();
+    foreach (ChargeAgent *charge, charges)
+    {
+        int x = charge->getGrid().getIndexX(charge->getCurrentSite());
+        if (x >= m_xBegin && x < m_xEnd)
+        {
+            m_owned.push_back(charge);
+        }
+        else
+        {
+            discard(charge);
+        }
+    }
+    compact(false);
+    countCarriers();
+
+    // with paged storage, forget the sites no carrier of this rank or ghost can reach
+    if (par.gridStorage == "paged")
+    {
+        m_world.siteStore().keepOnly(qMax(0, m_xBegin - m_halo), qMin(sizeX, m_xEnd + m_halo));
+    }
+    else if (m_rank == 0)
+    {
+        qDebug("langmuir: with grid.storage = dense, every MPI rank stores the whole grid");
+    }
+
+    m_reported.fill(0, 2 * m_world.fluxes().size());
+    qDebug("langmuir: MPI rank %d of %d owns x = %d to %d (%d carriers, %.2f bytes per site)",
+           m_rank, m_size, m_xBegin, m_xEnd - 1, m_owned.size(), m_world.siteStore().bytesPerSite());
+
+    // until the first step, rank 0 holds every carrier, as between steps
+    gather();
+}
+
+void MpiEngine::performIterations(int nIterations)
+{
+    release();
+    for (int i = 0; i < nIterations; i++)
+    {
+        step();
+    }
+    reduceFluxes();
+    gather();
+}
+
+bool MpiEngine::atMaxElectrons() const
+{
+    return m_numElectrons + m_reserve >= m_world.maxElectronAgents();
+}
+
+bool MpiEngine::atMaxHoles() const
+{
+    return m_numHoles + m_reserve >= m_world.maxHoleAgents();
+}
+
+const QVector<ChargeAgent*>& MpiEngine::owned() const
+{
+    return m_owned;
+}
+
+int MpiEngine::xBegin() const
+{
+    return m_xBegin;
+}
+
+int MpiEngine::xEnd() const
+{
+    return m_xEnd;
+}
+
+int MpiEngine::halo() const
+{
+    return m_halo;
+}
+
+void MpiEngine::step()
+{
+    //Store fluxAgent states
+    foreach (FluxAgent* flux, m_world.fluxes())
+    {
+        flux->storeLast();
+    }
+
+    // Even ranks, then odd ranks; the sources inject once everyone has moved
+    for (int phase = 0; phase < 2; phase++)
+    {
+        if (m_rank % 2 == phase)
+        {
+            move();
+        }
+        if (phase == 1)
+        {
+            m_owned += m_arrived;
+            m_arrived.clear();
+            inject();
+        }
+
+        // the carriers an even rank hands over have moved this step, so they sit out the odd sub-step
+        exchange(phase == 0 ? m_arrived : m_owned);
+    }
+
+    m_world.parameters().currentStep += 1;
+}
+
+void MpiEngine::move()
+{
+    bool coulomb = m_world.parameters().coulombCarriers;
+    bool removed = false;
+
+    int kept = 0;
+    for (int i = 0; i < m_owned.size(); i++)
+    {
+        ChargeAgent *charge = m_owned[i];
+        charge->chooseFuture();
+        if (coulomb)
+        {
+            charge->coulombCPU();
+        }
+        charge->decideFuture();
+        charge->completeTick(false);
+
+        if (charge->removed())
+        {
+            removed = true;
+            continue;
+        }
+        int x = charge->getGrid().getIndexX(charge->getCurrentSite());
+        if (x < m_xBegin || x >= m_xEnd)
+        {
+            m_leaving.push_back(charge);
+            continue;
+        }
+        m_owned[kept] = charge;
+        kept++;
+    }
+    m_owned.resize(kept);
+
+    // Delete the carriers that left through a drain
+    if (removed)
+    {
+        compact(m_world.parameters().outputIsOn && m_world.parameters().outputIdsOnDelete);
+    }
+}
+
+void MpiEngine::inject()
+{
+    int electrons = m_world.electrons().size();
+    int holes = m_world.holes().size();
+
+    // the caps count the carriers of every rank; each source adds at most one, so the end
+    // without priority this step leaves room for the other end's
+    countCarriers();
+    bool even = (m_world.parameters().currentStep % 2 == 0);
+    if (m_rank == 0)
+    {
+        m_reserve = even ? 0 : 1;
+        m_world.electronSourceAgentLeft().tryToInject();
+        m_world.holeSourceAgentLeft().tryToInject();
+    }
+    if (m_rank == m_size - 1)
+    {
+        m_reserve = even ? 1 : 0;
+        m_world.electronSourceAgentRight().tryToInject();
+        m_world.holeSourceAgentRight().tryToInject();
+    }
+    m_reserve = 0;
+
+    // the sources append to the lists
+    for (int i = electrons; i < m_world.electrons().size(); i++)
+    {
+        m_owned.push_back(m_world.electrons()[i]);
+    }
+    for (int i = holes; i < m_world.holes().size(); i++)
+    {
+        m_owned.push_back(m_world.holes()[i]);
+    }
+}
+
+void MpiEngine::exchange(QVector<ChargeAgent*>& arrivals)
+{
+    QVector<int> toLeft;
+    QVector<int> toRight;
+    QVector<int> fromLeft;
+    QVector<int> fromRight;
+
+    // Hand over the carriers that hopped into a neighbor's slab
+    foreach (ChargeAgent *charge, m_leaving)
+    {
+        int x = charge->getGrid().getIndexX(charge->getCurrentSite());
+        pack(x < m_xBegin ? toLeft : toRight, charge);
+        discard(charge);
+    }
+    m_leaving.clear();
+
+    // The old ghosts go first, as a carrier handed over may sit on one of their sites
+    foreach (ChargeAgent *charge, m_ghosts)
+    {
+        discard(charge);
+    }
+    m_ghosts.clear();
+    compact(false);
+
+    shift(toRight, fromLeft, toLeft, fromRight);
+    unpack(fromLeft, arrivals);
+    unpack(fromRight, arrivals);
+
+    // Send the carriers within the halo as ghosts
+    toLeft.clear();
+    toRight.clear();
+    foreach (ChargeAgent *charge, m_owned + m_arrived)
+    {
+        int x = charge->getGrid().getIndexX(charge->getCurrentSite());
+        if (m_rank > 0 && x < m_xBegin + m_halo)
+        {
+            pack(toLeft, charge);
+        }
+        if (m_rank < m_size - 1 && x >= m_xEnd - m_halo)
+        {
+            pack(toRight, charge);
+        }
+    }
+    shift(toRight, fromLeft, toLeft, fromRight);
+    unpack(fromLeft, m_ghosts);
+    unpack(fromRight, m_ghosts);
+}
+
+void MpiEngine::reduceFluxes()
+{
+    QList<FluxAgent*>& fluxes = m_world.fluxes();
+    int n = 2 * fluxes.size();
+    QVector<unsigned long> delta(n, 0);
+    for (int i = 0; i < fluxes.size(); i++)
+    {
+        delta[2 * i] = fluxes[i]->attempts() - m_reported[2 * i];
+        delta[2 * i + 1] = fluxes[i]->successes() - m_reported[2 * i + 1];
+    }
+
+#ifdef LANGMUIR_MPI
+    // each rank only counted its own sources and drains; rank 0 gets everyone's
+    QVector<unsigned long> total(n, 0);
+    MPI_Reduce(delta.data(), total.data(), n, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (m_rank == 0)
+    {
+        for (int i = 0; i < fluxes.size(); i++)
+        {
+            fluxes[i]->addCounts(total[2 * i] - delta[2 * i], total[2 * i + 1] - delta[2 * i + 1]);
+        }
+    }
+#endif
+
+    for (int i = 0; i < fluxes.size(); i++)
+    {
+        m_reported[2 * i] = fluxes[i]->attempts();
+        m_reported[2 * i + 1] = fluxes[i]->successes();
+    }
+}
+
+void MpiEngine::countCarriers()
+{
+    int owned[2] = { 0, 0 };
+    foreach (ChargeAgent *charge, m_owned)
+    {
+        owned[charge->charge() < 0 ? 0 : 1] += 1;
+    }
+    int total[2] = { owned[0], owned[1] };
+#ifdef LANGMUIR_MPI
+    MPI_Allreduce(owned, total, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    m_numElectrons = total[0];
+    m_numHoles = total[1];
+}
+
+void MpiEngine::gather()
+{
+    // the ghosts are copies of the neighbors' carriers, which rank 0 is about to get anyway
+    foreach (ChargeAgent *charge, m_ghosts)
+    {
+        discard(charge);
+    }
+    m_ghosts.clear();
+    compact(false);
+
+    QVector<int> message;
+    if (m_rank != 0)
+    {
+        foreach (ChargeAgent *charge, m_owned)
+        {
+            pack(message, charge);
+        }
+    }
+
+#ifdef LANGMUIR_MPI
+    int count = message.size();
+    QVector<int> counts(m_size, 0);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    QVector<int> offsets(m_size, 0);
+    int total = 0;
+    for (int r = 0; r < m_size; r++)
+    {
+        offsets[r] = total;
+        total += counts[r];
+    }
+    QVector<int> all(qMax(total, 1), 0);
+    MPI_Gatherv(message.data(), count, MPI_INT, all.data(), counts.data(), offsets.data(), MPI_INT,
+                0, MPI_COMM_WORLD);
+    if (m_rank == 0)
+    {
+        all.resize(total);
+        unpack(all, m_visitors);
+    }
+#endif
+}
+
+void MpiEngine::release()
+{
+    foreach (ChargeAgent *charge, m_visitors)
+    {
+        discard(charge);
+    }
+    m_visitors.clear();
+    compact(false);
+    exchange(m_owned);
+}
+
+void MpiEngine::discard(ChargeAgent *charge)
+{
+    // completeTick() takes a removed carrier off its Grid
+    charge->setRemoved(true);
+    charge->completeTick(false);
+}
+
+void MpiEngine::compact(bool report)
+{
+    QList<ChargeAgent*>* lists[2] = { &m_world.electrons(), &m_world.holes() };
+    for (int l = 0; l < 2; l++)
+    {
+        QList<ChargeAgent*>& charges = *lists[l];
+        QList<ChargeAgent*> kept;
+        kept.reserve(charges.size());
+        foreach (ChargeAgent *charge, charges)
+        {
+            if (charge->removed())
+            {
+                if (report)
+                {
+                    m_world.logger().reportCarrier(*charge);
+                }
+                delete charge;
+            }
+            else
+            {
+                kept.push_back(charge);
+            }
+        }
+        charges = kept;
+    }
+}
+
+void MpiEngine::pack(QVector<int>& message, ChargeAgent *charge)
+{
+    message.push_back(charge->charge());
+    message.push_back(charge->getCurrentSite());
+    message.push_back(charge->lifetime());
+    message.push_back(charge->pathlength());
+}
+
+void MpiEngine::unpack(const QVector<int>& message, QVector<ChargeAgent*>& list)
+{
+    for (int i = 0; i + 3 < message.size(); i += 4)
+    {
+        ChargeAgent *charge;
+        if (message[i] < 0)
+        {
+            charge = new ElectronAgent(m_world, message[i + 1]);
+            m_world.electrons().push_back(charge);
+        }
+        else
+        {
+            charge = new HoleAgent(m_world, message[i + 1]);
+            m_world.holes().push_back(charge);
+        }
+        charge->setLifetime(message[i + 2]);
+        charge->setPathlength(message[i + 3]);
+        list.push_back(charge);
+    }
+}
+
+void MpiEngine::shift(const QVector<int>& toRight, QVector<int>& fromLeft,
+                      const QVector<int>& toLeft, QVector<int>& fromRight)
+{
+    fromLeft.clear();
+    fromRight.clear();
+#ifdef LANGMUIR_MPI
+    int left = m_rank > 0 ? m_rank - 1 : MPI_PROC_NULL;
+    int right = m_rank < m_size - 1 ? m_rank + 1 : MPI_PROC_NULL;
+
+    // the sizes first, then the carriers
+    int sendRight = toRight.size();
+    int sendLeft = toLeft.size();
+    int receiveLeft = 0;
+    int receiveRight = 0;
+    MPI_Sendrecv(&sendRight, 1, MPI_INT, right, 0, &receiveLeft, 1, MPI_INT, left, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&sendLeft, 1, MPI_INT, left, 1, &receiveRight, 1, MPI_INT, right, 1,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+    fromLeft.resize(receiveLeft);
+    fromRight.resize(receiveRight);
+    MPI_Sendrecv(const_cast<int*>(toRight.constData()), sendRight, MPI_INT, right, 2,
+                 fromLeft.data(), receiveLeft, MPI_INT, left, 2,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(const_cast<int*>(toLeft.constData()), sendLeft, MPI_INT, left, 3,
+                 fromRight.data(), receiveRight, MPI_INT, right, 3,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+#else
+    Q_UNUSED(toRight);
+    Q_UNUSED(toLeft);
+#endif
+}
+
+}
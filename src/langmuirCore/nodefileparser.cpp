@@ -321,6 +321,11 @@ const QStringList& NodeFileParser::cpus()
     return m_names;
 }
 
+const QString& NodeFileParser::gpuFile()
+{
+    return m_gpufile;
+}
+
 const QString& NodeFileParser::hostName()
 {
     if (m_names.contains(m_hostName)) {
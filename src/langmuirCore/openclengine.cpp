@@ -0,0 +1,463 @@
+#include "openclengine.h"
+#include "openclhelper.h"
+#include "chargeagent.h"
+#include "sourceagent.h"
+#include "drainagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <climits>
+#include <cmath>
+
+namespace Langmuir
+{
+
+#ifdef LANGMUIR_OPEN_CL
+// keep in sync with the ENGINE_ defines in kernel.cl
+static const int ENGINE_DRAINS = 0;
+static const int ENGINE_SOURCES = 8;
+static const int ENGINE_CARRIERS = 16;
+static const int ENGINE_FREE = 18;
+static const int ENGINE_COUNTERS = 19;
+#endif //LANGMUIR_OPEN_CL
+
+OpenClEngine::OpenClEngine(World &world, QObject *parent):
+    QObject(parent), m_world(world)
+{
+#ifdef LANGMUIR_OPEN_CL
+    SimulationParameters& par = m_world.parameters();
+    try
+    {
+        cl::Program& program = m_world.opencl().program();
+        m_queue = cl::CommandQueue(m_world.opencl().context(), m_world.opencl().device());
+
+        m_chooseK = cl::Kernel(program, "engine_choose");
+        m_decideK = cl::Kernel(program, "engine_decide");
+        m_completeK = cl::Kernel(program, "engine_complete");
+        m_releaseK = cl::Kernel(program, "engine_release");
+        m_injectK = cl::Kernel(program, "engine_inject");
+        if (par.coulombGaussianSigma > 0)
+        {
+            m_coulombK = cl::Kernel(program, "gauss2");
+            m_offsetArg = 10;
+        }
+        else
+        {
+            m_coulombK = cl::Kernel(program, "coulomb2");
+            m_offsetArg = 9;
+        }
+
+        m_volume = m_world.electronGrid().volume();
+        m_slots = m_world.maxElectronAgents() + m_world.maxHoleAgents();
+
+        // charged defects never move, so they go in front of the slots once
+        if (par.defectsCharge != 0)
+        {
+            foreach (int site, m_world.defectSiteIDs())
+            {
+                m_sHost.push_back(site);
+                m_qHost.push_back(par.defectsCharge);
+            }
+        }
+        m_numDefects = m_sHost.size();
+        m_sHost.resize(m_numDefects + m_slots);
+        m_qHost.resize(m_numDefects + m_slots);
+        m_lifetimeHost.resize(m_slots);
+        m_pathlengthHost.resize(m_slots);
+        m_aliveHost.resize(m_slots);
+        m_freeHost.resize(m_slots);
+        m_occHost.resize(2 * m_volume);
+        m_vHost.resize(2 * m_volume);
+        m_countersHost.resize(ENGINE_COUNTERS);
+
+        size_t sSize = m_sHost.size() * sizeof(int);
+        size_t cSize = m_slots * sizeof(int);
+        size_t gSize = 2 * m_volume * sizeof(int);
+        m_sDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, sSize);
+        m_qDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, sSize);
+        m_fDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, cSize);
+        m_oDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, 2 * m_slots * sizeof(double));
+        m_claimDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, gSize);
+        m_occDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, gSize);
+        m_vDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_ONLY, 2 * m_volume * sizeof(double));
+        m_couplingDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_ONLY, 8 * sizeof(double));
+        m_drainDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_ONLY, 4 * sizeof(double));
+        m_sourceDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_ONLY, 4 * sizeof(double));
+        m_lifetimeDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, cSize);
+        m_pathlengthDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, cSize);
+        m_aliveDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, cSize);
+        m_freeDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, cSize);
+        m_countersDevice = cl::Buffer(m_world.opencl().context(), CL_MEM_READ_WRITE, ENGINE_COUNTERS * sizeof(cl_uint));
+
+        // no site is claimed between steps
+        QVector<int> claim(2 * m_volume, INT_MAX);
+        m_queue.enqueueWriteBuffer(m_claimDevice, CL_TRUE, 0, gSize, &claim[0]);
+
+        // the coupling only depends on |dx|, |dy| and |dz|, which are 0 or 1 for hopping.range = 1
+        QVector<double> coupling(8);
+        for (int dx = 0; dx < 2; dx++)
+        {
+            for (int dy = 0; dy < 2; dy++)
+            {
+                for (int dz = 0; dz < 2; dz++)
+                {
+                    coupling[dx * 4 + dy * 2 + dz] = m_world.couplingConstants()[dx][dy][dz];
+                }
+            }
+        }
+        m_queue.enqueueWriteBuffer(m_couplingDevice, CL_TRUE, 0, 8 * sizeof(double), &coupling[0]);
+
+        // one draw from the host generator, so random.seed still picks the run
+        Random& random = m_world.randomNumberGenerator();
+        m_seed = (cl_ulong(random.integer(0, INT_MAX)) << 32) ^ cl_ulong(random.integer(0, INT_MAX));
+
+        // preset kernel arguments that dont change
+        int cutoff2 = par.electrostaticCutoff * par.electrostaticCutoff;
+
+        m_coulombK.setArg(0, m_oDevice);
+        m_coulombK.setArg(1, m_sDevice);
+        m_coulombK.setArg(2, m_qDevice);
+        m_coulombK.setArg(3, m_numDefects + m_slots);
+        m_coulombK.setArg(4, cutoff2);
+        m_coulombK.setArg(6, par.gridX);
+        m_coulombK.setArg(7, par.gridY);
+        m_coulombK.setArg(8, par.electrostaticPrefactor);
+        if (par.coulombGaussianSigma > 0)
+        {
+            m_coulombK.setArg(9, 1.0 / (sqrt(2.0) * par.coulombGaussianSigma));
+        }
+
+        m_chooseK.setArg(0, m_sDevice);
+        m_chooseK.setArg(1, m_fDevice);
+        m_chooseK.setArg(2, m_numDefects);
+        m_chooseK.setArg(3, m_slots);
+        m_chooseK.setArg(4, par.gridX);
+        m_chooseK.setArg(5, par.gridY);
+        m_chooseK.setArg(6, par.gridZ);
+        m_chooseK.setArg(7, m_seed);
+
+        m_decideK.setArg(0, m_sDevice);
+        m_decideK.setArg(1, m_qDevice);
+        m_decideK.setArg(2, m_fDevice);
+        m_decideK.setArg(3, m_claimDevice);
+        m_decideK.setArg(4, m_occDevice);
+        m_decideK.setArg(5, m_vDevice);
+        m_decideK.setArg(6, m_oDevice);
+        m_decideK.setArg(7, m_couplingDevice);
+        m_decideK.setArg(8, m_drainDevice);
+        m_decideK.setArg(9, m_lifetimeDevice);
+        m_decideK.setArg(10, m_pathlengthDevice);
+        m_decideK.setArg(11, m_countersDevice);
+        m_decideK.setArg(12, m_numDefects);
+        m_decideK.setArg(13, m_slots);
+        m_decideK.setArg(14, par.gridX);
+        m_decideK.setArg(15, par.gridY);
+        m_decideK.setArg(16, par.gridZ);
+        m_decideK.setArg(17, par.coulombCarriers ? 1 : 0);
+        m_decideK.setArg(18, m_world.sI()[1][0][0]);
+        m_decideK.setArg(19, par.excitonBinding);
+        m_decideK.setArg(20, par.inverseKT);
+        m_decideK.setArg(21, m_seed);
+
+        m_completeK.setArg(0, m_sDevice);
+        m_completeK.setArg(1, m_qDevice);
+        m_completeK.setArg(2, m_fDevice);
+        m_completeK.setArg(3, m_claimDevice);
+        m_completeK.setArg(4, m_occDevice);
+        m_completeK.setArg(5, m_aliveDevice);
+        m_completeK.setArg(6, m_freeDevice);
+        m_completeK.setArg(7, m_countersDevice);
+        m_completeK.setArg(8, m_numDefects);
+        m_completeK.setArg(9, m_slots);
+        m_completeK.setArg(10, m_volume);
+
+        m_releaseK.setArg(0, m_sDevice);
+        m_releaseK.setArg(1, m_qDevice);
+        m_releaseK.setArg(2, m_claimDevice);
+        m_releaseK.setArg(3, m_numDefects);
+        m_releaseK.setArg(4, m_slots);
+        m_releaseK.setArg(5, m_volume);
+
+        m_injectK.setArg(0, m_sDevice);
+        m_injectK.setArg(1, m_qDevice);
+        m_injectK.setArg(2, m_fDevice);
+        m_injectK.setArg(3, m_occDevice);
+        m_injectK.setArg(4, m_aliveDevice);
+        m_injectK.setArg(5, m_lifetimeDevice);
+        m_injectK.setArg(6, m_pathlengthDevice);
+        m_injectK.setArg(7, m_freeDevice);
+        m_injectK.setArg(8, m_countersDevice);
+        m_injectK.setArg(9, m_sourceDevice);
+        m_injectK.setArg(10, m_numDefects);
+        m_injectK.setArg(11, par.gridX);
+        m_injectK.setArg(12, par.gridY);
+        m_injectK.setArg(13, par.gridZ);
+        m_injectK.setArg(14, m_world.maxElectronAgents());
+        m_injectK.setArg(15, m_world.maxHoleAgents());
+        m_injectK.setArg(16, m_seed);
+
+        m_queue.finish();
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+        qFatal("langmuir: Fatal OpenCl fatal error when creating the engine");
+    }
+#endif //LANGMUIR_OPEN_CL
+}
+
+OpenClEngine::~OpenClEngine()
+{
+#ifdef LANGMUIR_OPEN_CL
+    try
+    {
+        if (m_queue() != NULL)
+        {
+            m_queue.finish();
+        }
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+    }
+#endif //LANGMUIR_OPEN_CL
+}
+
+void OpenClEngine::performIterations(int nIterations)
+{
+#ifdef LANGMUIR_OPEN_CL
+    if (nIterations <= 0)
+    {
+        return;
+    }
+    try
+    {
+        upload();
+        for (int i = 0; i < nIterations; i++)
+        {
+            enqueueStep(m_world.parameters().currentStep + i);
+        }
+        download();
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+        qFatal("langmuir: Fatal OpenCl fatal error when running the engine");
+        return;
+    }
+    m_world.parameters().currentStep += nIterations;
+#else
+    Q_UNUSED(nIterations);
+#endif //LANGMUIR_OPEN_CL
+}
+
+#ifdef LANGMUIR_OPEN_CL
+//! occupancy code of a site, as used by the engine kernels
+static int occupancy(Grid& grid, int site)
+{
+    switch (grid.agentType(site))
+    {
+    case Agent::Empty:
+        return 0;
+    case Agent::Defect:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+void OpenClEngine::upload()
+{
+    // electrons take the first slots, then holes, both in list order
+    QList<ChargeAgent*> charges = m_world.electrons() + m_world.holes();
+    if (charges.size() > m_slots)
+    {
+        qFatal("langmuir: more carriers (%d) than engine slots (%d)", charges.size(), m_slots);
+    }
+    for (int i = 0; i < m_slots; i++)
+    {
+        bool used = i < charges.size();
+        m_sHost[m_numDefects + i] = used ? charges.at(i)->getCurrentSite() : -1;
+        m_qHost[m_numDefects + i] = used ? charges.at(i)->charge() : 0;
+        m_lifetimeHost[i] = used ? charges.at(i)->lifetime() : 0;
+        m_pathlengthHost[i] = used ? charges.at(i)->pathlength() : 0;
+        m_aliveHost[i] = used ? 1 : 0;
+    }
+
+    // the lowest free slot is on top of the stack
+    int top = 0;
+    for (int i = m_slots - 1; i >= charges.size(); i--)
+    {
+        m_freeHost[top++] = i;
+    }
+
+    for (int site = 0; site < m_volume; site++)
+    {
+        m_occHost[site] = occupancy(m_world.electronGrid(), site);
+        m_occHost[m_volume + site] = occupancy(m_world.holeGrid(), site);
+        m_vHost[site] = m_world.electronGrid().potential(site);
+        m_vHost[m_volume + site] = m_world.holeGrid().potential(site);
+    }
+
+    m_countersHost.fill(0);
+    m_countersHost[ENGINE_CARRIERS + 0] = m_world.numElectronAgents();
+    m_countersHost[ENGINE_CARRIERS + 1] = m_world.numHoleAgents();
+    m_countersHost[ENGINE_FREE] = top;
+
+    double drain[4] = {
+        m_world.electronDrainAgentLeft().rate(), m_world.electronDrainAgentRight().rate(),
+        m_world.holeDrainAgentLeft().rate(), m_world.holeDrainAgentRight().rate() };
+    double source[4] = {
+        m_world.electronSourceAgentLeft().rate(), m_world.electronSourceAgentRight().rate(),
+        m_world.holeSourceAgentLeft().rate(), m_world.holeSourceAgentRight().rate() };
+
+    size_t sSize = m_sHost.size() * sizeof(int);
+    size_t cSize = m_slots * sizeof(int);
+    size_t gSize = 2 * m_volume * sizeof(int);
+    m_queue.enqueueWriteBuffer(m_sDevice, CL_FALSE, 0, sSize, &m_sHost[0]);
+    m_queue.enqueueWriteBuffer(m_qDevice, CL_FALSE, 0, sSize, &m_qHost[0]);
+    m_queue.enqueueWriteBuffer(m_lifetimeDevice, CL_FALSE, 0, cSize, &m_lifetimeHost[0]);
+    m_queue.enqueueWriteBuffer(m_pathlengthDevice, CL_FALSE, 0, cSize, &m_pathlengthHost[0]);
+    m_queue.enqueueWriteBuffer(m_aliveDevice, CL_FALSE, 0, cSize, &m_aliveHost[0]);
+    m_queue.enqueueWriteBuffer(m_freeDevice, CL_FALSE, 0, cSize, &m_freeHost[0]);
+    m_queue.enqueueWriteBuffer(m_occDevice, CL_FALSE, 0, gSize, &m_occHost[0]);
+    m_queue.enqueueWriteBuffer(m_vDevice, CL_FALSE, 0, 2 * m_volume * sizeof(double), &m_vHost[0]);
+    m_queue.enqueueWriteBuffer(m_countersDevice, CL_FALSE, 0, ENGINE_COUNTERS * sizeof(cl_uint), &m_countersHost[0]);
+    m_queue.enqueueWriteBuffer(m_drainDevice, CL_FALSE, 0, 4 * sizeof(double), drain);
+
+    // the last write blocks, so the stack arrays above are safe to leave
+    m_queue.enqueueWriteBuffer(m_sourceDevice, CL_TRUE, 0, 4 * sizeof(double), source);
+}
+
+void OpenClEngine::enqueueStep(int step)
+{
+    SimulationParameters& par = m_world.parameters();
+    cl::NDRange slots(m_slots);
+
+    m_chooseK.setArg(8, step);
+    m_queue.enqueueNDRangeKernel(m_chooseK, cl::NullRange, slots, cl::NullRange);
+
+    // potentials at the current and proposed sites, one work group per slot
+    if (par.coulombCarriers)
+    {
+        cl::NDRange gSize(m_slots * par.workSize);
+        cl::NDRange wSize(par.workSize);
+
+        m_coulombK.setArg(5, m_sDevice);
+        m_coulombK.setArg(m_offsetArg, m_numDefects);
+        m_coulombK.setArg(m_offsetArg + 1, 0);
+        m_queue.enqueueNDRangeKernel(m_coulombK, cl::NullRange, gSize, wSize);
+
+        m_coulombK.setArg(5, m_fDevice);
+        m_coulombK.setArg(m_offsetArg, 0);
+        m_coulombK.setArg(m_offsetArg + 1, m_slots);
+        m_queue.enqueueNDRangeKernel(m_coulombK, cl::NullRange, gSize, wSize);
+    }
+
+    m_decideK.setArg(22, step);
+    m_queue.enqueueNDRangeKernel(m_decideK, cl::NullRange, slots, cl::NullRange);
+    m_queue.enqueueNDRangeKernel(m_completeK, cl::NullRange, slots, cl::NullRange);
+    m_queue.enqueueNDRangeKernel(m_releaseK, cl::NullRange, slots, cl::NullRange);
+
+    m_injectK.setArg(17, step);
+    m_queue.enqueueNDRangeKernel(m_injectK, cl::NullRange, cl::NDRange(1), cl::NullRange);
+}
+
+void OpenClEngine::download()
+{
+    size_t sSize = m_sHost.size() * sizeof(int);
+    size_t cSize = m_slots * sizeof(int);
+    m_queue.enqueueReadBuffer(m_sDevice, CL_FALSE, 0, sSize, &m_sHost[0]);
+    m_queue.enqueueReadBuffer(m_qDevice, CL_FALSE, 0, sSize, &m_qHost[0]);
+    m_queue.enqueueReadBuffer(m_lifetimeDevice, CL_FALSE, 0, cSize, &m_lifetimeHost[0]);
+    m_queue.enqueueReadBuffer(m_pathlengthDevice, CL_FALSE, 0, cSize, &m_pathlengthHost[0]);
+    m_queue.enqueueReadBuffer(m_aliveDevice, CL_FALSE, 0, cSize, &m_aliveHost[0]);
+    m_queue.enqueueReadBuffer(m_countersDevice, CL_FALSE, 0, ENGINE_COUNTERS * sizeof(cl_uint), &m_countersHost[0]);
+    m_queue.finish();
+
+    // the slot each host carrier was uploaded to
+    QList<ChargeAgent*>& electrons = m_world.electrons();
+    QList<ChargeAgent*>& holes = m_world.holes();
+    QVector<ChargeAgent*> uploaded(m_slots, NULL);
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        uploaded[i] = electrons[i];
+    }
+    for (int i = 0; i < holes.size(); i++)
+    {
+        uploaded[electrons.size() + i] = holes[i];
+    }
+
+    // clear the grids first, carriers may have moved onto sites others left
+    foreach (ChargeAgent *charge, uploaded)
+    {
+        if (charge)
+        {
+            charge->getGrid().unregisterAgent(charge);
+        }
+    }
+    electrons.clear();
+    holes.clear();
+
+    for (int i = 0; i < m_slots; i++)
+    {
+        int site = m_sHost[m_numDefects + i];
+        ChargeAgent *charge = uploaded[i];
+
+        // drained (the slot may have been reused by a source since)
+        if (charge && (site < 0 || m_aliveHost[i] == 0))
+        {
+            delete charge;
+            charge = NULL;
+        }
+        if (site < 0)
+        {
+            continue;
+        }
+
+        if (charge)
+        {
+            charge->setCurrentSite(site);
+            charge->setFutureSite(site);
+            charge->getGrid().registerAgent(charge);
+            m_world.opencl().moveCarrier(charge->getOpenCLID(), site);
+        }
+        else if (m_qHost[m_numDefects + i] < 0)
+        {
+            charge = new ElectronAgent(m_world, site);
+        }
+        else
+        {
+            charge = new HoleAgent(m_world, site);
+        }
+        charge->setLifetime(m_lifetimeHost[i]);
+        charge->setPathlength(m_pathlengthHost[i]);
+
+        if (charge->charge() < 0)
+        {
+            electrons.push_back(charge);
+        }
+        else
+        {
+            holes.push_back(charge);
+        }
+    }
+
+    // attempts and successes of the whole batch
+    FluxAgent *drains[4] = {
+        &m_world.electronDrainAgentLeft(), &m_world.electronDrainAgentRight(),
+        &m_world.holeDrainAgentLeft(), &m_world.holeDrainAgentRight() };
+    FluxAgent *sources[4] = {
+        &m_world.electronSourceAgentLeft(), &m_world.electronSourceAgentRight(),
+        &m_world.holeSourceAgentLeft(), &m_world.holeSourceAgentRight() };
+    for (int k = 0; k < 4; k++)
+    {
+        drains[k]->addCounts(m_countersHost[ENGINE_DRAINS + 2 * k], m_countersHost[ENGINE_DRAINS + 2 * k + 1]);
+        sources[k]->addCounts(m_countersHost[ENGINE_SOURCES + 2 * k], m_countersHost[ENGINE_SOURCES + 2 * k + 1]);
+    }
+}
+#endif //LANGMUIR_OPEN_CL
+
+}
@@ -1,60 +1,772 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QTextStream>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QMap>
 #include "openclhelper.h"
 #include "chargeagent.h"
 #include "parameters.h"
 #include "cubicgrid.h"
 #include "potential.h"
+#include "workerpool.h"
 #include "world.h"
 
+#include <cstdlib>
+
 namespace Langmuir
 {
 
 OpenClHelper::OpenClHelper(World &world, QObject *parent):
     QObject(parent), m_world(world)
 {
+#ifdef LANGMUIR_OPEN_CL
+    m_slotsUsed = 0;
+    m_numDefects = 0;
+    m_offset = 0;
+    m_stage = 0;
+    m_prefetched = NULL;
+    m_currentSlots = 0;
+    m_initialized = false;
+    m_single = (m_world.parameters().openclPrecision.toLower() == "single");
+    m_hostGauss = false;
+    growSlots(qMax(m_world.maxChargeAgents(), 1));
+#endif //LANGMUIR_OPEN_CL
 }
 
-void OpenClHelper::initializeOpenCL(int gpuID)
+OpenClHelper::~OpenClHelper()
 {
-    //can't use openCL yet
-    m_world.parameters().okCL = false;
+#ifdef LANGMUIR_OPEN_CL
+    try
+    {
+        if (m_queue() != NULL)
+        {
+            m_queue.finish();
+        }
+        if (m_futureQueue() != NULL)
+        {
+            m_futureQueue.finish();
+        }
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+    }
+#endif //LANGMUIR_OPEN_CL
+}
 
 #ifdef LANGMUIR_OPEN_CL
+//! map opencl.device.type to the OpenCL enum
+static cl_device_type deviceType(const QString& name)
+{
+    QString type = name.toLower();
+    if (type == "cpu") return CL_DEVICE_TYPE_CPU;
+    if (type == "accelerator") return CL_DEVICE_TYPE_ACCELERATOR;
+    if (type == "default") return CL_DEVICE_TYPE_DEFAULT;
+    if (type == "all") return CL_DEVICE_TYPE_ALL;
+    return CL_DEVICE_TYPE_GPU;
+}
+
+//! map the OpenCL enum to a short name
+static QString deviceTypeName(cl_device_type type)
+{
+    if (type & CL_DEVICE_TYPE_GPU) return "gpu";
+    if (type & CL_DEVICE_TYPE_CPU) return "cpu";
+    if (type & CL_DEVICE_TYPE_ACCELERATOR) return "accelerator";
+    return "default";
+}
+
+//! true if Kernel2 looks the interactions up (table2) instead of computing them
+static bool useTable(const SimulationParameters& par)
+{
+    return par.openclPrecision.toLower() != "double";
+}
+
+//! true if table2 works in float
+static bool useSingle(const SimulationParameters& par)
+{
+    return par.openclPrecision.toLower() == "single";
+}
+
+void OpenClHelper::listDevices(const std::vector<cl::Platform>& platforms)
+{
+    for (unsigned int i = 0; i < platforms.size(); i++)
+    {
+        qDebug("langmuir: opencl.platform %d: %s (%s) %s", i,
+               platforms[i].getInfo<CL_PLATFORM_NAME>().c_str(),
+               platforms[i].getInfo<CL_PLATFORM_VENDOR>().c_str(),
+               platforms[i].getInfo<CL_PLATFORM_VERSION>().c_str());
+
+        std::vector<cl::Device> devices;
+        try
+        {
+            platforms[i].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+        }
+        catch(cl::Error& error)
+        {
+            qDebug("langmuir:     no devices (%s: %d)", error.what(), error.err());
+            continue;
+        }
+
+        // opencl.device.id counts devices of the chosen opencl.device.type
+        QMap<QString, int> count;
+        for (unsigned int j = 0; j < devices.size(); j++)
+        {
+            QString type = deviceTypeName(devices[j].getInfo<CL_DEVICE_TYPE>());
+            bool fp64 = QString(devices[j].getInfo<CL_DEVICE_EXTENSIONS>().c_str()).contains("cl_khr_fp64");
+            qDebug("langmuir:     %s %d (all %d): %s, %d compute units, max work group %d, %d KB local memory%s",
+                   qPrintable(type), count[type], j,
+                   QString(devices[j].getInfo<CL_DEVICE_NAME>().c_str()).trimmed().toLatin1().constData(),
+                   int(devices[j].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()),
+                   int(devices[j].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()),
+                   int(devices[j].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 1024),
+                   fp64 ? "" : ", no double precision");
+            count[type] += 1;
+        }
+    }
+}
+
+void OpenClHelper::setWorkSizes(size_t kernelMax)
+{
+    SimulationParameters& par = m_world.parameters();
+
+    // each work item keeps a site, a charge and a potential in local memory
+    size_t perItem = 2 * sizeof(cl_int) + sizeof(cl_double);
+    size_t maxGroup = m_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    size_t maxLocal = m_device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / perItem;
+    std::vector<size_t> maxItems = m_device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+    size_t limit = qMin(qMin(maxGroup, maxLocal), kernelMax);
+
+    // 1D kernels
+    size_t workSize = qMin(size_t(qMax(par.workSize, 1)), qMin(limit, maxItems.at(0)));
+    if (int(workSize) != par.workSize)
+    {
+        qDebug("langmuir: work.size reduced from %d to %d for this device", par.workSize, int(workSize));
+        par.workSize = workSize;
+    }
+
+    // 3D kernels, halve the largest dimension until the group fits
+    size_t w[3] = { size_t(qMax(par.workX, 1)), size_t(qMax(par.workY, 1)), size_t(qMax(par.workZ, 1)) };
+    while (w[0] * w[1] * w[2] > limit || w[0] > maxItems.at(0) || w[1] > maxItems.at(1) || w[2] > maxItems.at(2))
+    {
+        int largest = 0;
+        if (w[1] > w[largest]) largest = 1;
+        if (w[2] > w[largest]) largest = 2;
+        if (w[largest] == 1) break;
+        w[largest] /= 2;
+    }
+    if (int(w[0]) != par.workX || int(w[1]) != par.workY || int(w[2]) != par.workZ)
+    {
+        qDebug("langmuir: work.x/y/z reduced from %d/%d/%d to %d/%d/%d for this device",
+               par.workX, par.workY, par.workZ, int(w[0]), int(w[1]), int(w[2]));
+        par.workX = w[0];
+        par.workY = w[1];
+        par.workZ = w[2];
+    }
+}
+
+void OpenClHelper::buildKernels(const QByteArray& lines)
+{
+    SimulationParameters& par = m_world.parameters();
+
+    // the local arrays in the kernels are sized at compile time
+    QString options = QString("-DLOCAL_SIZE_1D=%1 -DLOCAL_SIZE_3D=%2")
+            .arg(par.workSize).arg(par.workX * par.workY * par.workZ);
+
+    // the interaction table goes in constant memory if the device has room for it
+    if (useTable(par))
+    {
+        QVector<double> table;
+        int shape[3];
+        m_world.potential().interactionTable(table, shape);
+        size_t tableSize = table.size() * (useSingle(par) ? sizeof(cl_float) : sizeof(cl_double));
+        if (tableSize <= m_device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>())
+        {
+            options += " -DTABLE_SPACE=__constant";
+        }
+        if (useSingle(par))
+        {
+            options += " -DLANGMUIR_SINGLE";
+        }
+    }
+
+    std::vector<cl::Device> devices;
+    devices.push_back(m_device);
+
+    // a binary built earlier for the same source, options, device and driver skips the compiler
+    QString cacheFile;
+    if (par.openclCache)
+    {
+        cacheFile = QString("%1/%2.bin").arg(cacheDirectory()).arg(cacheKey(lines, options));
+    }
+
+    cl::Program program;
+    if (!cacheFile.isEmpty() && loadBinary(cacheFile, options, program))
+    {
+        qDebug("langmuir: using cached kernels: %s", qPrintable(cacheFile));
+    }
+    else
+    {
+        cl::Program::Sources source(1, std::make_pair(lines.constData(), size_t(lines.size())));
+        program = cl::Program(m_context, source);
+        try
+        {
+            program.build(devices, options.toLatin1().constData());
+        }
+        catch(cl::Error& error)
+        {
+            qDebug("langmuir: kernel build log:\n%s",
+                   program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
+            throw;
+        }
+        if (!cacheFile.isEmpty())
+        {
+            saveBinary(cacheFile, program);
+        }
+    }
+
+    m_program = program;
+    if (!m_single)
+    {
+        m_coulomb1K = cl::Kernel(program, "coulomb1");
+        m_coulomb2K = cl::Kernel(program, "coulomb2");
+        m_guass1K = cl::Kernel(program, "gauss1");
+        m_guass2K = cl::Kernel(program, "gauss2");
+    }
+    m_table2K = cl::Kernel(program, "table2");
+    m_scatterK = cl::Kernel(program, "scatter");
+}
+
+QString OpenClHelper::cacheDirectory()
+{
+    char * LANGMUIR_KERNEL_CACHE = getenv("LANGMUIR_KERNEL_CACHE");
+    if (LANGMUIR_KERNEL_CACHE != NULL)
+    {
+        return QString(LANGMUIR_KERNEL_CACHE);
+    }
+    return QDir::homePath() + "/.langmuir/kernels";
+}
+
+QString OpenClHelper::cacheKey(const QByteArray& lines, const QString& options)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(lines);
+    hash.addData(options.toLatin1());
+    hash.addData(m_platform.getInfo<CL_PLATFORM_NAME>().c_str());
+    hash.addData(m_platform.getInfo<CL_PLATFORM_VERSION>().c_str());
+    hash.addData(m_device.getInfo<CL_DEVICE_NAME>().c_str());
+    hash.addData(m_device.getInfo<CL_DEVICE_VERSION>().c_str());
+    hash.addData(m_device.getInfo<CL_DRIVER_VERSION>().c_str());
+    return QString(hash.result().toHex());
+}
+
+bool OpenClHelper::loadBinary(const QString& fileName, const QString& options, cl::Program& program)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    QByteArray binary = file.readAll();
+    file.close();
+    if (binary.isEmpty())
+    {
+        return false;
+    }
+
+    std::vector<cl::Device> devices;
+    devices.push_back(m_device);
+    cl::Program::Binaries binaries(1, std::make_pair((const void*)binary.constData(), size_t(binary.size())));
+
+    // a stale or corrupt binary is not an error, the source is built instead
     try
-    {   
-        //obtain platforms
-        std::vector<cl::Platform> platforms;
-        cl::Platform::get(&platforms);
-        m_platform = platforms.at(0);
+    {
+        program = cl::Program(m_context, devices, binaries);
+        program.build(devices, options.toLatin1().constData());
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: ignoring cached kernels %s (%s: %d)", qPrintable(fileName), error.what(), error.err());
+        return false;
+    }
+    return true;
+}
 
-        //obtain all devices
-        std::vector<cl::Device> all_devices;
-        m_platform.getDevices(CL_DEVICE_TYPE_GPU, &all_devices);
+void OpenClHelper::saveBinary(const QString& fileName, cl::Program& program)
+{
+    std::vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+    if (sizes.size() != 1 || sizes[0] == 0)
+    {
+        return;
+    }
+    QByteArray binary(int(sizes[0]), 0);
+    char *data = binary.data();
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(char*), &data, NULL) != CL_SUCCESS)
+    {
+        return;
+    }
 
-        //choose a single device
-        if (gpuID < 0) {
-            gpuID = 0;
+    // many jobs may start at once, so write a private file and move it into place
+    QFileInfo info(fileName);
+    if (!QDir().mkpath(info.absolutePath()))
+    {
+        qDebug("langmuir: can not create kernel cache: %s", qPrintable(info.absolutePath()));
+        return;
+    }
+    QString temporary = QString("%1.%2").arg(fileName).arg(QCoreApplication::applicationPid());
+    QFile file(temporary);
+    if (!file.open(QIODevice::WriteOnly) || file.write(binary) != binary.size())
+    {
+        qDebug("langmuir: can not write kernel cache: %s", qPrintable(temporary));
+        file.remove();
+        return;
+    }
+    file.close();
+    if (!QFile::rename(temporary, fileName))
+    {
+        // another job got there first
+        QFile::remove(temporary);
+    }
+}
+
+size_t OpenClHelper::kernelWorkGroupSize()
+{
+    size_t size = m_table2K.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+    if (!m_single)
+    {
+        size = qMin(size, m_coulomb1K.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device));
+        size = qMin(size, m_coulomb2K.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device));
+        size = qMin(size, m_guass1K.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device));
+        size = qMin(size, m_guass2K.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device));
+    }
+    return size;
+}
+
+size_t OpenClHelper::outputSize() const
+{
+    return m_single ? sizeof(cl_float) : sizeof(cl_double);
+}
+
+void *OpenClHelper::outputHost(int index)
+{
+    if (m_single)
+    {
+        return &m_oSingle[index];
+    }
+    return &m_oHost[index];
+}
+
+void OpenClHelper::growSlots(int capacity)
+{
+    int old = m_slotSite.size();
+    if (capacity <= old)
+    {
+        return;
+    }
+    m_slotSite.resize(capacity);
+    m_slotCharge.resize(capacity);
+    m_changeIndex.resize(capacity);
+    m_fHost.resize(capacity);
+    for (int i = old; i < capacity; i++)
+    {
+        m_slotSite[i] = -1;
+        m_slotCharge[i] = 0;
+        m_changeIndex[i] = -1;
+        m_fHost[i] = 0;
+        m_freeSlots.push(i);
+    }
+
+    // the device buffers are too small now, so start over with a full upload
+    m_fullUpload = true;
+}
+
+void OpenClHelper::recordChange(int slot)
+{
+    // everything goes up anyway
+    if (m_fullUpload)
+    {
+        return;
+    }
+    if (m_changeIndex[slot] < 0)
+    {
+        m_changeIndex[slot] = m_changeSlot.size();
+        m_changeSlot.push_back(slot);
+    }
+}
+
+void OpenClHelper::uploadCarriers()
+{
+    SimulationParameters& par = m_world.parameters();
+
+    //nothing may still be reading into the host vectors that are about to be resized
+    m_queue.finish();
+    m_futureQueue.finish();
+    m_sourcesReady = cl::Event();
+    m_prefetched = NULL;
+
+    //charged defects never move, so they go in front of the slots once
+    m_sHost.clear();
+    m_qHost.clear();
+    if (par.defectsCharge != 0)
+    {
+        foreach (int site, m_world.defectSiteIDs())
+        {
+            m_sHost.push_back(m_world.electronGrid().canonicalSite(site));
+            m_qHost.push_back(par.defectsCharge);
         }
-        if (gpuID >= all_devices.size()) {
-            qFatal("langmuir: invalid gpu: %d (max gpus=%d)", gpuID, int(all_devices.size()));
+    }
+    m_numDefects = m_sHost.size();
+    m_sHost += m_slotSite;
+    m_qHost += m_slotCharge;
+
+    //the output holds the current and future results by slot, or every site for Kernel1
+    int slots = m_slotSite.size();
+    m_offset = slots;
+    int outputs = qMax(m_world.electronGrid().volume(), 2 * slots);
+    if (m_single)
+    {
+        m_oSingle.resize(outputs);
+    }
+    else
+    {
+        m_oHost.resize(outputs);
+    }
+
+    //calculate memory sizes
+    size_t sSize = m_sHost.size() * sizeof(int);
+    size_t qSize = m_qHost.size() * sizeof(int);
+    size_t oSize = outputs * outputSize();
+    size_t cSize = slots * sizeof(int);
+
+    //initialize Device Memory
+    m_sDevice = cl::Buffer(m_context, CL_MEM_READ_WRITE, sSize);
+    m_qDevice = cl::Buffer(m_context, CL_MEM_READ_WRITE, qSize);
+    m_oDevice = cl::Buffer(m_context, CL_MEM_READ_WRITE, oSize);
+    m_fDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY , cSize);
+    m_cSlotDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY, cSize);
+    m_cSiteDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY, cSize);
+    m_cChargeDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY, cSize);
+
+    //upload defects and slots
+    m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
+    m_queue.enqueueWriteBuffer(m_qDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
+
+    //point the kernels at the new buffers
+    if (!m_single)
+    {
+        m_coulomb1K.setArg(0, m_oDevice);
+        m_coulomb1K.setArg(1, m_sDevice);
+        m_coulomb1K.setArg(2, m_qDevice);
+
+        m_guass1K.setArg(0, m_oDevice);
+        m_guass1K.setArg(1, m_sDevice);
+        m_guass1K.setArg(2, m_qDevice);
+
+        m_coulomb2K.setArg(0, m_oDevice);
+        m_coulomb2K.setArg(1, m_sDevice);
+        m_coulomb2K.setArg(2, m_qDevice);
+
+        m_guass2K.setArg(0, m_oDevice);
+        m_guass2K.setArg(1, m_sDevice);
+        m_guass2K.setArg(2, m_qDevice);
+    }
+
+    m_table2K.setArg(0, m_oDevice);
+    m_table2K.setArg(1, m_sDevice);
+    m_table2K.setArg(2, m_qDevice);
+
+    m_scatterK.setArg(0, m_sDevice);
+    m_scatterK.setArg(1, m_qDevice);
+    m_scatterK.setArg(2, m_cSlotDevice);
+    m_scatterK.setArg(3, m_cSiteDevice);
+    m_scatterK.setArg(4, m_cChargeDevice);
+    m_scatterK.setArg(6, m_numDefects);
+
+    //nothing is pending now
+    for (int i = 0; i < m_changeSlot.size(); i++)
+    {
+        m_changeIndex[m_changeSlot[i]] = -1;
+    }
+    m_changeSlot.resize(0);
+    m_fullUpload = false;
+}
+
+void OpenClHelper::uploadTable()
+{
+    SimulationParameters& par = m_world.parameters();
+
+    //the coulomb or the gaussian interaction, by distance
+    QVector<double> table;
+    int shape[3];
+    m_world.potential().interactionTable(table, shape);
+
+    if (useSingle(par))
+    {
+        QVector<float> single(table.size());
+        for (int i = 0; i < table.size(); i++)
+        {
+            single[i] = table[i];
         }
-        std::vector<cl::Device> devices;
-        devices.push_back(all_devices.at(gpuID));
-        m_device = devices.at(0);
+        size_t tSize = single.size() * sizeof(float);
+        m_tableDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY, tSize);
+        m_queue.enqueueWriteBuffer(m_tableDevice, CL_TRUE, 0, tSize, &single[0]);
+    }
+    else
+    {
+        size_t tSize = table.size() * sizeof(double);
+        m_tableDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY, tSize);
+        m_queue.enqueueWriteBuffer(m_tableDevice, CL_TRUE, 0, tSize, &table[0]);
+    }
 
-        qDebug("langmuir: gpuID=%d", gpuID);
+    //w and the offsets are set for each launch
+    m_table2K.setArg(4, m_tableDevice);
+    m_table2K.setArg(6, par.gridX);
+    m_table2K.setArg(7, par.gridY);
+    m_table2K.setArg(8, shape[0]);
+    m_table2K.setArg(9, shape[1]);
+    m_table2K.setArg(10, shape[2]);
+}
 
-        //save gpu id used
-        m_world.parameters().openclDeviceID = gpuID;
+void OpenClHelper::flushCarriers()
+{
+    if (m_fullUpload)
+    {
+        uploadCarriers();
+        return;
+    }
+
+    int count = m_changeSlot.size();
+    if (count == 0)
+    {
+        return;
+    }
 
+    QVector<int>& slots = m_stageSlot[m_stage];
+    QVector<int>& sites = m_stageSite[m_stage];
+    QVector<int>& charges = m_stageCharge[m_stage];
+    m_stage = 1 - m_stage;
+
+    slots.resize(count);
+    sites.resize(count);
+    charges.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        int slot = m_changeSlot[i];
+        slots[i] = slot;
+        sites[i] = m_slotSite[slot];
+        charges[i] = m_slotCharge[slot];
+        m_changeIndex[slot] = -1;
+    }
+    m_changeSlot.resize(0);
+
+    //only the changed slots cross the bus, the queue is in order so the writes need not block
+    size_t cSize = count * sizeof(int);
+    m_queue.enqueueWriteBuffer(m_cSlotDevice, CL_FALSE, 0, cSize, &slots[0]);
+    m_queue.enqueueWriteBuffer(m_cSiteDevice, CL_FALSE, 0, cSize, &sites[0]);
+    m_queue.enqueueWriteBuffer(m_cChargeDevice, CL_FALSE, 0, cSize, &charges[0]);
+
+    m_scatterK.setArg(5, count);
+    m_queue.enqueueNDRangeKernel(m_scatterK, cl::NullRange, cl::NDRange(count), cl::NullRange,
+                                 NULL, &m_sourcesReady);
+}
+
+void OpenClHelper::runKernel1(cl::Kernel& kernel)
+{
+    initializeDevice();
+
+    //the output below overwrites any prefetched current sites
+    m_prefetched = NULL;
+    flushCarriers();
+    kernel.setArg(3, m_numDefects + m_slotsUsed);
+
+    //calculate memory sizes (the output is for every site, not every charge)
+    size_t oSize = m_world.electronGrid().volume()*sizeof(double);
+
+    //calculate ranges
+    cl::NDRange zSize = cl::NDRange(0, 0, 0);
+
+    cl::NDRange gSize = cl::NDRange(
+        m_world.parameters().gridX * m_world.parameters().workX,
+        m_world.parameters().gridY * m_world.parameters().workY,
+        m_world.parameters().gridZ * m_world.parameters().workZ);
+
+    cl::NDRange wSize = cl::NDRange(
+        m_world.parameters().workX,
+        m_world.parameters().workY,
+        m_world.parameters().workZ);
+
+    //call kernel
+    m_queue.enqueueNDRangeKernel(kernel, zSize, gSize, wSize);
+
+    //read from GPU
+    m_queue.enqueueReadBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
+    m_queue.finish();
+}
+
+void OpenClHelper::runHostKernel1(bool gauss)
+{
+    initializeDevice();
+
+    //the output below overwrites any prefetched current sites, so let the reads finish first
+    m_queue.finish();
+    m_futureQueue.finish();
+    m_prefetched = NULL;
+
+    m_hostGauss = gauss;
+    m_world.workerPool().run(OpenClHelper::sumSites, this, m_world.electronGrid().volume());
+}
+
+void OpenClHelper::sumSites(void *self, int begin, int end)
+{
+    OpenClHelper& helper = *static_cast<OpenClHelper *>(self);
+    Potential& potential = helper.m_world.potential();
+    Grid& grid = helper.m_world.electronGrid();
+    bool defects = (helper.m_world.parameters().defectsCharge != 0);
+    for (int site = begin; site < end; site++)
+    {
+        double v = 0;
+        if (helper.m_hostGauss)
+        {
+            v += potential.gaussE(site) + potential.gaussH(site);
+            if (defects)
+            {
+                v += potential.gaussD(site);
+            }
+        }
+        else
+        {
+            v += potential.coulombE(site) + potential.coulombH(site);
+            if (defects)
+            {
+                v += potential.coulombD(site);
+            }
+        }
+        helper.m_oSingle[grid.canonicalSite(site)] = float(v);
+    }
+}
+
+void OpenClHelper::runKernel2(cl::Kernel& kernel, int offsetArg)
+{
+    //a prefetch is only good if no carrier was added, moved or removed since
+    if (m_prefetched != &kernel || m_fullUpload || !m_changeSlot.isEmpty())
+    {
+        enqueueCurrent(kernel, offsetArg);
+    }
+    m_prefetched = NULL;
+
+    if (m_currentSlots == 0)
+    {
+        return;
+    }
+
+    enqueueFuture(kernel, offsetArg);
+
+    //the two queues run side by side, wait for both
+    m_queue.flush();
+    m_futureQueue.flush();
+    m_currentReady.wait();
+    m_futureReady.wait();
+}
+
+void OpenClHelper::enqueueCurrent(cl::Kernel& kernel, int offsetArg)
+{
+    initializeDevice();
+    flushCarriers();
+
+    m_currentSlots = m_slotsUsed;
+    if (m_currentSlots == 0)
+    {
+        return;
+    }
+
+    //sum over the defects and the slots in use
+    kernel.setArg(3, m_numDefects + m_currentSlots);
+
+    //calculate ranges
+    cl::NDRange zSize = cl::NDRange(0);
+
+    cl::NDRange gSize = cl::NDRange(
+        m_currentSlots * m_world.parameters().workSize);
+
+    cl::NDRange wSize = cl::NDRange(m_world.parameters().workSize);
+
+    //current sites, read straight from the slots
+    kernel.setArg(5, m_sDevice);
+    kernel.setArg(offsetArg, m_numDefects);
+    kernel.setArg(offsetArg + 1, 0);
+    m_queue.enqueueNDRangeKernel(kernel, zSize, gSize, wSize);
+
+    //read from GPU
+    m_queue.enqueueReadBuffer(m_oDevice, CL_FALSE, 0, m_currentSlots*outputSize(), outputHost(0),
+                              NULL, &m_currentReady);
+}
+
+void OpenClHelper::enqueueFuture(cl::Kernel& kernel, int offsetArg)
+{
+    //future sites are new every step, so they are uploaded for every slot in use
+    //(the kernels take x, y and z from canonical site IDs)
+    Grid &grid = m_world.electronGrid();
+    foreach (ChargeAgent *charge, m_world.electrons())
+    {
+        m_fHost[charge->getOpenCLID()] = grid.canonicalSite(charge->getFutureSite());
+    }
+    foreach (ChargeAgent *charge, m_world.holes())
+    {
+        m_fHost[charge->getOpenCLID()] = grid.canonicalSite(charge->getFutureSite());
+    }
+
+    //the sources must be up to date (they are written on the other queue)
+    std::vector<cl::Event> wait;
+    if (m_sourcesReady() != NULL)
+    {
+        wait.push_back(m_sourcesReady);
+    }
+    m_futureQueue.enqueueWriteBuffer(m_fDevice, CL_FALSE, 0, m_currentSlots*sizeof(int), &m_fHost[0],
+                                     wait.empty() ? NULL : &wait);
+
+    kernel.setArg(3, m_numDefects + m_currentSlots);
+
+    //calculate ranges
+    cl::NDRange zSize = cl::NDRange(0);
+
+    cl::NDRange gSize = cl::NDRange(
+        m_currentSlots * m_world.parameters().workSize);
+
+    cl::NDRange wSize = cl::NDRange(m_world.parameters().workSize);
+
+    //future sites
+    kernel.setArg(5, m_fDevice);
+    kernel.setArg(offsetArg, 0);
+    kernel.setArg(offsetArg + 1, m_offset);
+    m_futureQueue.enqueueNDRangeKernel(kernel, zSize, gSize, wSize);
+
+    //read from GPU
+    m_futureQueue.enqueueReadBuffer(m_oDevice, CL_FALSE, m_offset*outputSize(),
+                                    m_currentSlots*outputSize(), outputHost(m_offset),
+                                    NULL, &m_futureReady);
+}
+void OpenClHelper::initializeDevice()
+{
+    if (m_initialized)
+    {
+        return;
+    }
+
+    try
+    {
         //obtain context
+        std::vector<cl::Device> devices;
+        devices.push_back(m_device);
         cl_context_properties contextProperties[3] = {
-            CL_CONTEXT_PLATFORM,(cl_context_properties)platforms[0](), 0
+            CL_CONTEXT_PLATFORM,(cl_context_properties)m_platform(), 0
         };
         m_context = cl::Context(devices, contextProperties);
 
-        //obtain command queue
+        //obtain command queues
         m_queue = cl::CommandQueue(m_context, m_device);
+        m_futureQueue = cl::CommandQueue(m_context, m_device);
         m_queue.finish();
 
         //obtain kernel source
@@ -67,39 +779,21 @@ void OpenClHelper::initializeOpenCL(int gpuID)
         QByteArray lines = file.readAll();
         file.close();
 
-        //create program
-        cl::Program::Sources source(1, std::make_pair(lines, lines.size()));
-        cl::Program program(m_context, source);
-        program.build(devices);
+        //create program and kernels, the work groups were sized for the device already
+        buildKernels(lines);
 
-        //create kernels
-        m_coulomb1K = cl::Kernel(program, "coulomb1");
-        m_coulomb2K = cl::Kernel(program, "coulomb2");
-        m_guass1K = cl::Kernel(program, "gauss1");
-        m_guass2K = cl::Kernel(program, "gauss2");
+        //the compiled kernels may not fit the device maximum, if so rebuild smaller
+        size_t kernelMax = kernelWorkGroupSize();
+        if (size_t(m_world.parameters().workSize) > kernelMax ||
+            size_t(m_world.parameters().workX * m_world.parameters().workY * m_world.parameters().workZ) > kernelMax)
+        {
+            setWorkSizes(kernelMax);
+            buildKernels(lines);
+        }
 
-        //initialize Host Memory
-        m_sHost.clear();
-        m_qHost.clear();
-        m_oHost.clear();
-        m_sHost.resize(m_world.electronGrid().volume());
-        m_qHost.resize(m_world.electronGrid().volume());
-        m_oHost.resize(m_world.electronGrid().volume());
-
-        //calculate memory sizes
-        size_t sSize = m_sHost.size() * sizeof(int);
-        size_t qSize = m_qHost.size() * sizeof(int);
-        size_t oSize = m_oHost.size() * sizeof(double);
-
-        //initialize Device Memory
-        m_sDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY , sSize);
-        m_qDevice = cl::Buffer(m_context, CL_MEM_READ_ONLY , qSize);
-        m_oDevice = cl::Buffer(m_context, CL_MEM_READ_WRITE, oSize);
-
-        //upload initial data
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
-        m_queue.enqueueWriteBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
+        //create device buffers and upload the defects and carriers
+        m_fullUpload = true;
+        uploadCarriers();
 
         //preset kernel arguments that dont change
         int cutoff2 = m_world.parameters().electrostaticCutoff *
@@ -111,44 +805,102 @@ void OpenClHelper::initializeOpenCL(int gpuID)
             erffactor = 1.0 / erffactor;
         }
 
-        // coulomb kernel 1
-        m_coulomb1K.setArg(0, m_oDevice);
-        m_coulomb1K.setArg(1, m_sDevice);
-        m_coulomb1K.setArg(2, m_qDevice);
-        m_coulomb1K.setArg(4, cutoff2);
-        m_coulomb1K.setArg(5, m_world.parameters().electrostaticPrefactor);
-
-        // gauss kernel 1
-        m_guass1K.setArg(0, m_oDevice);
-        m_guass1K.setArg(1, m_sDevice);
-        m_guass1K.setArg(2, m_qDevice);
-        m_guass1K.setArg(4, cutoff2);
-        m_guass1K.setArg(5, m_world.parameters().electrostaticPrefactor);
-        m_guass1K.setArg(6, erffactor);
+        if (!m_single)
+        {
+            // coulomb kernel 1
+            m_coulomb1K.setArg(4, cutoff2);
+            m_coulomb1K.setArg(5, m_world.parameters().electrostaticPrefactor);
+
+            // gauss kernel 1
+            m_guass1K.setArg(4, cutoff2);
+            m_guass1K.setArg(5, m_world.parameters().electrostaticPrefactor);
+            m_guass1K.setArg(6, erffactor);
+
+            // coulomb kernel 2 (w and the offsets are set for each launch)
+            m_coulomb2K.setArg(4, cutoff2);
+            m_coulomb2K.setArg(6, m_world.parameters().gridX);
+            m_coulomb2K.setArg(7, m_world.parameters().gridY);
+            m_coulomb2K.setArg(8, m_world.parameters().electrostaticPrefactor);
+
+            // gauss kernel 2 (w and the offsets are set for each launch)
+            m_guass2K.setArg(4, cutoff2);
+            m_guass2K.setArg(6, m_world.parameters().gridX);
+            m_guass2K.setArg(7, m_world.parameters().gridY);
+            m_guass2K.setArg(8, m_world.parameters().electrostaticPrefactor);
+            m_guass2K.setArg(9, erffactor);
+        }
 
-        // coulomb kernel 2
-        m_coulomb2K.setArg(0, m_oDevice);
-        m_coulomb2K.setArg(1, m_sDevice);
-        m_coulomb2K.setArg(2, m_qDevice);
-        m_coulomb2K.setArg(4, cutoff2);
-        m_coulomb2K.setArg(5, m_sDevice);
-        m_coulomb2K.setArg(6, m_world.parameters().gridX);
-        m_coulomb2K.setArg(7, m_world.parameters().gridY);
-        m_coulomb2K.setArg(8, m_world.parameters().electrostaticPrefactor);
-
-        // gauss kernel 2
-        m_guass2K.setArg(0, m_oDevice);
-        m_guass2K.setArg(1, m_sDevice);
-        m_guass2K.setArg(2, m_qDevice);
-        m_guass2K.setArg(4, cutoff2);
-        m_guass2K.setArg(5, m_sDevice);
-        m_guass2K.setArg(6, m_world.parameters().gridX);
-        m_guass2K.setArg(7, m_world.parameters().gridY);
-        m_guass2K.setArg(8, m_world.parameters().electrostaticPrefactor);
-        m_guass2K.setArg(9, erffactor);
+        // table kernel 2
+        uploadTable();
 
         //force queues to finish
         m_queue.finish();
+        m_initialized = true;
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s (%d)", error.what(), error.err());
+        m_world.parameters().okCL = false;
+        qFatal("langmuir: OpenCL errors when creating the context and kernels");
+    }
+}
+
+#endif //LANGMUIR_OPEN_CL
+
+void OpenClHelper::initializeOpenCL(int gpuID)
+{
+    //can't use openCL yet
+    m_world.parameters().okCL = false;
+
+#ifdef LANGMUIR_OPEN_CL
+    try
+    {   
+        //obtain platforms
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        if (platforms.empty())
+        {
+            throw cl::Error(CL_INVALID_PLATFORM, "clGetPlatformIDs");
+        }
+        listDevices(platforms);
+
+        //choose a platform
+        int platformID = m_world.parameters().openclPlatform;
+        if (platformID >= int(platforms.size())) {
+            qFatal("langmuir: invalid opencl.platform: %d (max platforms=%d)", platformID, int(platforms.size()));
+        }
+        m_platform = platforms.at(platformID);
+
+        //obtain all devices of the requested type
+        std::vector<cl::Device> all_devices;
+        m_platform.getDevices(deviceType(m_world.parameters().openclDeviceType), &all_devices);
+
+        //choose a single device, --gpu (or the gpufile) overrides opencl.device.id
+        if (gpuID < 0) {
+            gpuID = m_world.parameters().openclDeviceID;
+        }
+        if (gpuID >= int(all_devices.size())) {
+            qFatal("langmuir: invalid %s device: %d (max devices=%d)",
+                   qPrintable(m_world.parameters().openclDeviceType), gpuID, int(all_devices.size()));
+        }
+        std::vector<cl::Device> devices;
+        devices.push_back(all_devices.at(gpuID));
+        m_device = devices.at(0);
+
+        qDebug("langmuir: using opencl.platform=%d opencl.device.type=%s opencl.device.id=%d",
+               platformID, qPrintable(m_world.parameters().openclDeviceType), gpuID);
+
+        //save device id used
+        m_world.parameters().openclDeviceID = gpuID;
+
+        //the kernels need double precision, unless only the float ones are built
+        if (!m_single && !QString(m_device.getInfo<CL_DEVICE_EXTENSIONS>().c_str()).contains("cl_khr_fp64"))
+        {
+            throw cl::Error(CL_INVALID_DEVICE, "device does not support cl_khr_fp64");
+        }
+
+        //the context, program and buffers are only made once a kernel is needed (see initializeDevice)
+        setWorkSizes();
 
         //should be ok to use OpenCL
         m_world.parameters().okCL = true;
@@ -202,67 +954,14 @@ void OpenClHelper::launchCoulombKernel1()
 #ifdef LANGMUIR_OPEN_CL
     try
     {
-        int totalCharges = 0;
-
-        //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
-        {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
-        }
-        totalCharges += m_world.electrons().size();
-
-        //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        if (m_single)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            runHostKernel1(false);
         }
-        totalCharges += m_world.holes().size();
-
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
+        else
         {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
+            runKernel1(m_coulomb1K);
         }
-        m_offset = totalCharges;
-        m_coulomb1K.setArg(3, totalCharges);
-
-        //calculate memory sizes
-        size_t sSize = totalCharges*sizeof(int);
-        size_t qSize = totalCharges*sizeof(int);
-        size_t oSize = totalCharges*sizeof(double);
-
-        //calculate ranges
-        cl::NDRange zSize = cl::NDRange(0, 0, 0);
-
-        cl::NDRange gSize = cl::NDRange(
-            m_world.parameters().gridX * m_world.parameters().workX,
-            m_world.parameters().gridY * m_world.parameters().workY,
-            m_world.parameters().gridZ * m_world.parameters().workZ);
-
-        cl::NDRange wSize = cl::NDRange(
-            m_world.parameters().workX,
-            m_world.parameters().workY,
-            m_world.parameters().workZ);
-
-        //write to GPU
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
-        m_queue.enqueueWriteBuffer(m_qDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
-
-        //call kernel
-        m_queue.enqueueNDRangeKernel(m_coulomb1K, zSize, gSize, wSize);
-
-        //read from GPU
-        m_queue.enqueueReadBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
-        m_queue.finish();
     }
     catch(cl::Error& error)
     {
@@ -278,67 +977,14 @@ void OpenClHelper::launchGaussKernel1()
 #ifdef LANGMUIR_OPEN_CL
     try
     {
-        int totalCharges = 0;
-
-        //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        if (m_single)
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            runHostKernel1(true);
         }
-        totalCharges += m_world.electrons().size();
-
-        //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        else
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            runKernel1(m_guass1K);
         }
-        totalCharges += m_world.holes().size();
-
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
-        }
-        m_offset = totalCharges;
-        m_guass1K.setArg(3, totalCharges);
-
-        //calculate memory sizes
-        size_t sSize = totalCharges*sizeof(int);
-        size_t qSize = totalCharges*sizeof(int);
-        size_t oSize = totalCharges*sizeof(double);
-
-        //calculate ranges
-        cl::NDRange zSize = cl::NDRange(0, 0, 0);
-
-        cl::NDRange gSize = cl::NDRange(
-            m_world.parameters().gridX * m_world.parameters().workX,
-            m_world.parameters().gridY * m_world.parameters().workY,
-            m_world.parameters().gridZ * m_world.parameters().workZ);
-
-        cl::NDRange wSize = cl::NDRange(
-            m_world.parameters().workX,
-            m_world.parameters().workY,
-            m_world.parameters().workZ);
-
-        //write to GPU
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
-        m_queue.enqueueWriteBuffer(m_qDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
-
-        //call kernel
-        m_queue.enqueueNDRangeKernel(m_guass1K, zSize, gSize, wSize);
-
-        //read from GPU
-        m_queue.enqueueReadBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
-        m_queue.finish();
     }
     catch(cl::Error& error)
     {
@@ -354,78 +1000,14 @@ void OpenClHelper::launchCoulombKernel2()
 #ifdef LANGMUIR_OPEN_CL
     try
     {
-        int totalCharges = 0;
-
-        //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
-        {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
-        }
-        totalCharges += m_world.electrons().size();
-
-        //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
-        {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
-        }
-        totalCharges += m_world.holes().size();
-
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
-        }
-        m_offset = totalCharges;
-        m_coulomb2K.setArg(3, totalCharges);
-
-        //copy electrons (future)
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        if (useTable(m_world.parameters()))
         {
-            m_sHost[i + totalCharges] = m_world.electrons()[i]->getFutureSite();
-            m_qHost[i + totalCharges] = m_world.electrons()[i]->charge();
+            runKernel2(m_table2K, 11);
         }
-        totalCharges += m_world.electrons().size();
-
-        //copy holes (future)
-        for(int i = 0; i < m_world.holes().size(); i++)
+        else
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getFutureSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
+            runKernel2(m_coulomb2K, 9);
         }
-        totalCharges += m_world.holes().size();
-
-        //calculate memory sizes
-        size_t sSize = totalCharges*sizeof(int);
-        size_t qSize = totalCharges*sizeof(int);
-        size_t oSize = totalCharges*sizeof(double);
-
-        //calculate ranges
-        cl::NDRange zSize = cl::NDRange(0);
-
-        cl::NDRange gSize = cl::NDRange(
-            totalCharges * m_world.parameters().workSize);
-
-        cl::NDRange wSize = cl::NDRange(m_world.parameters().workSize);
-
-        //write to GPU
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
-        m_queue.enqueueWriteBuffer(m_qDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
-
-        //call kernel
-        m_queue.enqueueNDRangeKernel(m_coulomb2K, zSize, gSize, wSize);
-
-        //read from GPU
-        m_queue.enqueueReadBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
-        m_queue.finish();
     }
     catch(cl::Error& error)
     {
@@ -441,83 +1023,69 @@ void OpenClHelper::launchGaussKernel2()
 #ifdef LANGMUIR_OPEN_CL
     try
     {
-        int totalCharges = 0;
-
-        //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        if (useTable(m_world.parameters()))
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            runKernel2(m_table2K, 11);
         }
-        totalCharges += m_world.electrons().size();
-
-        //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        else
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            runKernel2(m_guass2K, 10);
         }
-        totalCharges += m_world.holes().size();
-
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
-        }
-        m_offset = totalCharges;
-        m_guass2K.setArg(3, totalCharges);
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+        qFatal("langmuir: Fatal OpenCl fatal error when calling gauss2");
+        return;
+    }
+#endif //LANGMUIR_OPEN_CL
+}
 
-        //copy electrons (future)
-        for(int i = 0; i < m_world.electrons().size(); i++)
+void OpenClHelper::prefetchCoulombKernel2()
+{
+#ifdef LANGMUIR_OPEN_CL
+    try
+    {
+        cl::Kernel *kernel = &m_coulomb2K;
+        int offsetArg = 9;
+        if (useTable(m_world.parameters()))
         {
-            m_sHost[i + totalCharges] = m_world.electrons()[i]->getFutureSite();
-            m_qHost[i + totalCharges] = m_world.electrons()[i]->charge();
+            kernel = &m_table2K;
+            offsetArg = 11;
         }
-        totalCharges += m_world.electrons().size();
+        enqueueCurrent(*kernel, offsetArg);
+        m_queue.flush();
+        m_prefetched = kernel;
+    }
+    catch(cl::Error& error)
+    {
+        qDebug("langmuir: %s(%d)", error.what(), error.err());
+        qFatal("langmuir: Fatal OpenCl fatal error when prefetching coulomb2");
+        return;
+    }
+#endif //LANGMUIR_OPEN_CL
+}
 
-        //copy holes (future)
-        for(int i = 0; i < m_world.holes().size(); i++)
+void OpenClHelper::prefetchGaussKernel2()
+{
+#ifdef LANGMUIR_OPEN_CL
+    try
+    {
+        cl::Kernel *kernel = &m_guass2K;
+        int offsetArg = 10;
+        if (useTable(m_world.parameters()))
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getFutureSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
+            kernel = &m_table2K;
+            offsetArg = 11;
         }
-        totalCharges += m_world.holes().size();
-
-        //calculate memory sizes
-        size_t sSize = totalCharges*sizeof(int);
-        size_t qSize = totalCharges*sizeof(int);
-        size_t oSize = totalCharges*sizeof(double);
-
-        //calculate ranges
-        cl::NDRange zSize = cl::NDRange(0);
-
-        cl::NDRange gSize = cl::NDRange(
-            totalCharges * m_world.parameters().workSize);
-
-        cl::NDRange wSize = cl::NDRange(m_world.parameters().workSize);
-
-        //write to GPU
-        m_queue.enqueueWriteBuffer(m_sDevice, CL_TRUE, 0, sSize, &m_sHost[0]);
-        m_queue.enqueueWriteBuffer(m_qDevice, CL_TRUE, 0, qSize, &m_qHost[0]);
-
-        //call kernel
-        m_queue.enqueueNDRangeKernel(m_guass2K, zSize, gSize, wSize);
-
-        //read from GPU
-        m_queue.enqueueReadBuffer(m_oDevice, CL_TRUE, 0, oSize, &m_oHost[0]);
-        m_queue.finish();
+        enqueueCurrent(*kernel, offsetArg);
+        m_queue.flush();
+        m_prefetched = kernel;
     }
     catch(cl::Error& error)
     {
         qDebug("langmuir: %s(%d)", error.what(), error.err());
-        qFatal("langmuir: Fatal OpenCl fatal error when calling gauss2");
+        qFatal("langmuir: Fatal OpenCl fatal error when prefetching gauss2");
         return;
     }
 #endif //LANGMUIR_OPEN_CL
@@ -537,16 +1105,83 @@ void OpenClHelper::compareHostAndDeviceForAllCarriers()
 #endif //LANGMUIR_OPEN_CL
 }
 
-void OpenClHelper::copySiteAndChargeToHostVector(int index, int site, int charge)
+int OpenClHelper::addCarrier(int site, int charge)
+{
+#ifdef LANGMUIR_OPEN_CL
+    if (m_freeSlots.empty())
+    {
+        growSlots(2 * m_slotSite.size());
+    }
+    int slot = m_freeSlots.top();
+    m_freeSlots.pop();
+    m_slotSite[slot] = m_world.electronGrid().canonicalSite(site);
+    m_slotCharge[slot] = charge;
+    m_slotsUsed = qMax(m_slotsUsed, slot + 1);
+    recordChange(slot);
+    return slot;
+#else
+    Q_UNUSED(site);
+    Q_UNUSED(charge);
+    return 0;
+#endif //LANGMUIR_OPEN_CL
+}
+
+void OpenClHelper::moveCarrier(int slot, int site)
+{
+#ifdef LANGMUIR_OPEN_CL
+    m_slotSite[slot] = m_world.electronGrid().canonicalSite(site);
+    recordChange(slot);
+#else
+    Q_UNUSED(slot);
+    Q_UNUSED(site);
+#endif //LANGMUIR_OPEN_CL
+}
+
+void OpenClHelper::removeCarrier(int slot)
 {
 #ifdef LANGMUIR_OPEN_CL
-    m_sHost[index] = site; m_qHost[index] = charge;
+    m_slotSite[slot] = -1;
+    m_slotCharge[slot] = 0;
+    m_freeSlots.push(slot);
+    recordChange(slot);
+
+    //keep the kernels from looking at free slots at the end
+    while (m_slotsUsed > 0 && m_slotSite[m_slotsUsed - 1] < 0)
+    {
+        m_slotsUsed--;
+    }
+#else
+    Q_UNUSED(slot);
 #endif //LANGMUIR_OPEN_CL
 }
 
+#ifdef LANGMUIR_OPEN_CL
+cl::Context& OpenClHelper::context()
+{
+    initializeDevice();
+    return m_context;
+}
+
+cl::Device& OpenClHelper::device()
+{
+    initializeDevice();
+    return m_device;
+}
+
+cl::Program& OpenClHelper::program()
+{
+    initializeDevice();
+    return m_program;
+}
+#endif //LANGMUIR_OPEN_CL
+
 double OpenClHelper::getOutputHost(int index) const
 {
 #ifdef LANGMUIR_OPEN_CL
+    if (m_single)
+    {
+        return m_oSingle[index];
+    }
     return m_oHost[index];
 #else
     return 0;
@@ -556,6 +1191,10 @@ double OpenClHelper::getOutputHost(int index) const
 double OpenClHelper::getOutputHostFuture(int index) const
 {
 #ifdef LANGMUIR_OPEN_CL
+    if (m_single)
+    {
+        return m_oSingle[index+m_offset];
+    }
     return m_oHost[index+m_offset];
 #else
     return 0;
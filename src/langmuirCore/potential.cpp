@@ -2,6 +2,7 @@
 #include "parameters.h"
 #include "chargeagent.h"
 #include "cubicgrid.h"
+#include "sitestore.h"
 #include "world.h"
 #include "rand.h"
 #include <cmath>
@@ -17,11 +18,8 @@ Potential::Potential(World &world, QObject *parent)
 void Potential::setPotentialZero()
 {
     qDebug("langmuir: setting potential to zero");
-    for(int i = 0; i < m_world.electronGrid().volume(); i++)
-    {
-        m_world.electronGrid().setPotential(i, 0);
-        m_world.holeGrid().setPotential(i, 0);
-    }
+    // the electron and hole grids share their potentials (see SiteStore)
+    m_world.siteStore().clearPotentials();
 }
 
 void Potential::setPotentialLinear()
@@ -33,19 +31,7 @@ void Potential::setPotentialLinear()
     double b  = VL;
 
     qDebug("langmuir: adding a linear potential with slope %.3g V/nm", m);
-    for(int i = 0; i < m_world.electronGrid().xSize(); i++)
-    {
-        for(int j = 0; j < m_world.electronGrid().ySize(); j++)
-        {
-            for(int k = 0; k < m_world.electronGrid().zSize(); k++)
-            {
-                int s = m_world.electronGrid().getIndexS(i, j, k);
-                double v = m *(i + 0.5)+ b;
-                m_world.electronGrid().addToPotential(s, v);
-                m_world.holeGrid().addToPotential(s, v);
-            }
-        }
-    }
+    m_world.siteStore().addPotentialSlopes(m, b, 0);
 }
 
 void Potential::setPotentialGate()
@@ -56,19 +42,7 @@ void Potential::setPotentialGate()
     }
 
     qDebug("langmuir: adding gate potential with slope %.3g", m_world.parameters().slopeZ);
-    for(int i = 0; i < m_world.electronGrid().xSize(); i++)
-    {
-        for(int j = 0; j < m_world.electronGrid().ySize(); j++)
-        {
-            for(int k = 0; k < m_world.electronGrid().zSize(); k++)
-            {
-                int s = m_world.electronGrid().getIndexS(i, j, k);
-                double v = m_world.parameters().slopeZ *(k + 0.5);
-                m_world.electronGrid().addToPotential(s, v);
-                m_world.holeGrid().addToPotential(s, v);
-            }
-        }
-    }
+    m_world.siteStore().addPotentialSlopes(0, 0, m_world.parameters().slopeZ);
 }
 
 void Potential::setPotentialTraps(const QList<int> &trapIDs,
@@ -238,8 +212,7 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
     {
         int s = traps.at(i);
         double v = potentials.at(i);
-        m_world.electronGrid().addToPotential(s,v);
-        m_world.holeGrid().addToPotential(s,v);
+        m_world.siteStore().addToPotential(s, v);
     }
 }
 
@@ -323,6 +296,36 @@ void Potential::precalculateArrays()
     }
 }
 
+void Potential::interactionTable(QVector<double>& table, int shape[3])
+{
+    SimulationParameters& par = m_world.parameters();
+    boost::multi_array<double, 3>& R1 = m_world.R1();
+    boost::multi_array<double, 3>& iR = m_world.iR();
+    boost::multi_array<double, 3>& eR = m_world.eR();
+
+    // no distance on the grid reaches the grid size
+    shape[0] = qMin(par.electrostaticCutoff, par.gridX);
+    shape[1] = qMin(par.electrostaticCutoff, par.gridY);
+    shape[2] = qMin(par.electrostaticCutoff, par.gridZ);
+
+    // note : eR[dx][dy][dz] = 1.0 if sigma was 0
+    table.fill(0.0, shape[0] * shape[1] * shape[2]);
+    for (int dx = 0; dx < shape[0]; dx++)
+    {
+        for (int dy = 0; dy < shape[1]; dy++)
+        {
+            for (int dz = 0; dz < shape[2]; dz++)
+            {
+                if (R1[dx][dy][dz] < par.electrostaticCutoff)
+                {
+                    table[(dx * shape[1] + dy) * shape[2] + dz] =
+                            par.electrostaticPrefactor * iR[dx][dy][dz] * eR[dx][dy][dz];
+                }
+            }
+        }
+    }
+}
+
 void Potential::updateCouplingConstants()
 {
     //These values are used for moving between sites
@@ -0,0 +1,129 @@
+#include "recombinationpairs.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+namespace Langmuir
+{
+
+RecombinationPairs::RecombinationPairs(World &world, QObject *parent)
+    : QObject(parent), m_world(world)
+{
+    m_on = (m_world.parameters().simulationType == "solarcell" &&
+            m_world.parameters().recombinationRate > 0);
+}
+
+bool RecombinationPairs::isOn() const
+{
+    return m_on;
+}
+
+QVector<int> RecombinationPairs::sitesInRange(Agent *agent)
+{
+    const SimulationParameters& par = m_world.parameters();
+    if (par.recombinationRange == 0)
+    {
+        return QVector<int>();
+    }
+    if (par.recombinationRange == par.hoppingRange)
+    {
+        return agent->getNeighbors();
+    }
+    return m_world.electronGrid().neighborsSite(agent->getCurrentSite(), par.recombinationRange);
+}
+
+void RecombinationPairs::carrierArrived(Agent *agent)
+{
+    if (!m_on)
+    {
+        return;
+    }
+
+    int site = agent->getCurrentSite();
+    QVector<int> sites = sitesInRange(agent);
+    sites.push_back(site);
+
+    if (agent->getType() == Agent::Electron)
+    {
+        Grid& holes = m_world.holeGrid();
+        int count = 0;
+        foreach (int other, sites)
+        {
+            if (holes.agentType(other) == Agent::Hole)
+            {
+                count++;
+            }
+        }
+        if (count > 0)
+        {
+            m_holesInRange[site] = count;
+        }
+    }
+    else
+    {
+        // the ranges are symmetric, so the electrons in range of the hole are the ones it is in range of
+        Grid& electrons = m_world.electronGrid();
+        foreach (int other, sites)
+        {
+            if (electrons.agentType(other) == Agent::Electron)
+            {
+                m_holesInRange[other] += 1;
+            }
+        }
+    }
+}
+
+void RecombinationPairs::carrierLeft(Agent *agent)
+{
+    if (!m_on)
+    {
+        return;
+    }
+
+    int site = agent->getCurrentSite();
+    if (agent->getType() == Agent::Electron)
+    {
+        m_holesInRange.remove(site);
+        return;
+    }
+
+    QVector<int> sites = sitesInRange(agent);
+    sites.push_back(site);
+    foreach (int other, sites)
+    {
+        QMap<int, int>::iterator it = m_holesInRange.find(other);
+        if (it != m_holesInRange.end() && --it.value() == 0)
+        {
+            m_holesInRange.erase(it);
+        }
+    }
+}
+
+QList<ChargeAgent *> RecombinationPairs::electrons()
+{
+    QList<ChargeAgent *> electrons;
+    electrons.reserve(m_holesInRange.size());
+    Grid& grid = m_world.electronGrid();
+    QMap<int, int>::const_iterator it = m_holesInRange.constBegin();
+    for (; it != m_holesInRange.constEnd(); ++it)
+    {
+        electrons.push_back(static_cast<ChargeAgent *>(grid.agentAddress(it.key())));
+    }
+
+    // the map is in site order; shuffle it so the lower site does not always win a contested hole
+    Random& random = m_world.randomNumberGenerator();
+    for (int i = electrons.size() - 1; i > 0; i--)
+    {
+        electrons.swap(i, random.integer(0, i));
+    }
+    return electrons;
+}
+
+int RecombinationPairs::size() const
+{
+    return m_holesInRange.size();
+}
+
+}
@@ -1,9 +1,18 @@
 #include "simulation.h"
 #include "openclhelper.h"
+#include "openclengine.h"
+#include "domainengine.h"
+#include "mpiengine.h"
+#include "vectorcoulomb.h"
 #include "parameters.h"
 #include "chargeagent.h"
 #include "sourceagent.h"
 #include "drainagent.h"
+#include "recombinationpairs.h"
+#include "trapbasins.h"
+#include "skipahead.h"
+#include "carriersorter.h"
+#include "workerpool.h"
 #include "potential.h"
 #include "cubicgrid.h"
 #include "checkpointer.h"
@@ -11,10 +20,6 @@
 #include "world.h"
 #include "rand.h"
 
-#ifdef LANGMUIR_USING_QT5
-#include <QtConcurrent/QtConcurrent>
-#endif
-
 namespace Langmuir
 {
 
@@ -28,133 +33,41 @@ Simulation::~Simulation()
 
 void Simulation::performIterations(int nIterations)
 {
-    // Do some parallel stuff if using Coulomb interactions
-    if (m_world.parameters().coulombCarriers)
+    // Run the whole batch on the device
+    if (m_world.parameters().openclEngine && m_world.parameters().okCL)
     {
-        for(int i = 0; i < nIterations; ++i)
+        //Store fluxAgent states, the counts since cover the batch
+        foreach (FluxAgent* flux, m_world.fluxes())
         {
-            //Store fluxAgent states
-            foreach (FluxAgent* flux, m_world.fluxes())
-            {
-                flux->storeLast();
-            }
-
-            QList<ChargeAgent*> &electrons = m_world.electrons();
-            QList<ChargeAgent*> &holes = m_world.holes();
-
-            // Select future sites in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->chooseFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->chooseFuture();
-            }
-
-            // Calculate the coulomb interactions in parallel some way or another
-            if (m_world.parameters().useOpenCL && m_world.numChargeAgents() > m_world.parameters().openclThreshold)
-            {
-                // Use OpenCL if there are a lot of charges
-                if (m_world.parameters().coulombGaussianSigma > 0)
-                {
-                    m_world.opencl().launchGaussKernel2();
-                }
-                else
-                {
-                    m_world.opencl().launchCoulombKernel2();
-                }
-
-                // Turn this on to check the GPU vs CPU
-                // TRUST THE GPU - if it gives the wrong answer it is most likely
-                // the information passed to it is wrong some how, or something was
-                // changed in the CPU version. There is like a 99.9999% chance
-                // something is messed up on the CPU side - I have spent days/hours
-                // being tormented by some sublte bug, and it always turns out to
-                // be something wrong with the CPU functions
-                // m_world.opencl().compareHostAndDeviceForAllCarriers();
-
-                QFutureSynchronizer<void> sync;
-                sync.addFuture(QtConcurrent::map(electrons, Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
-                sync.addFuture(QtConcurrent::map(holes, Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
-                sync.waitForFinished();
-            }
-            else
-            {
-                // Use multi threaded CPU if there are not many charges or when we can not use OpenCL
-                QFutureSynchronizer<void> sync;
-                sync.addFuture(QtConcurrent::map(electrons, Simulation::chargeAgentCoulombInteractionQtConcurrentCPU));
-                sync.addFuture(QtConcurrent::map(holes, Simulation::chargeAgentCoulombInteractionQtConcurrentCPU));
-                sync.waitForFinished();
-            }
-
-            // Decide future in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->decideFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->decideFuture();
-            }
-
-            // Recombine holes and electrons
-            performRecombinations();
+            flux->storeLast();
+        }
 
-            // Now we are done with the charge movement, move them to the next tick!
-            nextTick();
+        m_world.openclEngine().performIterations(nIterations);
+    }
 
-            // Perform charge injection at the source
-            performInjections();
+    // Run the batch on the host threads, one slab of the grid per task
+    else if (m_world.parameters().domainSlabs > 0)
+    {
+        m_world.domainEngine().performIterations(nIterations);
+    }
 
-            m_world.parameters().currentStep += 1;
-        }
+    // Run the batch across the MPI ranks, one slab of the grid per rank
+    else if (MpiEngine::size() > 1)
+    {
+        m_world.mpiEngine().performIterations(nIterations);
     }
 
-    // Skip the parallel stuff if no Coulomb interactions
+    // Run the step chosen for these parameters (see StepKernels)
     else
     {
+        StepKernels::Step step = m_world.stepKernels().step;
+        CarrierSorter& sorter = m_world.carrierSorter();
         for(int i = 0; i < nIterations; ++i)
         {
-            //Store fluxAgent states
-            foreach (FluxAgent* flux, m_world.fluxes())
-            {
-                flux->storeLast();
-            }
-
-            QList<ChargeAgent*> &electrons = m_world.electrons();
-            QList<ChargeAgent*> &holes = m_world.holes();
+            (this->*step)();
 
-            // Select future sites in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->chooseFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->chooseFuture();
-            }
-
-            // Decide future in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->decideFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->decideFuture();
-            }
-
-            // Recombine holes and electrons
-            performRecombinations();
-
-            // Now we are done with the charge movement, move them to the next tick!
-            nextTick();
-
-            // Perform charge injection at the source
-            performInjections();
-
-            m_world.parameters().currentStep += 1;
+            // Put the carriers back in site order now and then (between steps)
+            sorter.sortIfDue();
         }
     }
 
@@ -216,13 +129,150 @@ void Simulation::performIterations(int nIterations)
     }
 }
 
+StepKernels::Step Simulation::chooseStep(const SimulationParameters& par)
+{
+    bool solarcell = par.simulationType == "solarcell";
+    if (par.coulombCarriers)
+    {
+        return solarcell ? &Simulation::step<true, true> : &Simulation::step<true, false>;
+    }
+    return solarcell ? &Simulation::step<false, true> : &Simulation::step<false, false>;
+}
+
+template <bool Coulomb, bool SolarCell>
+void Simulation::step()
+{
+    //Store fluxAgent states
+    foreach (FluxAgent* flux, m_world.fluxes())
+    {
+        flux->storeLast();
+    }
+
+    QList<ChargeAgent*> &electrons = m_world.electrons();
+    QList<ChargeAgent*> &holes = m_world.holes();
+
+    // Select future sites in serial (because random number generator is being used)
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        electrons.at(i)->chooseFuture();
+    }
+    for (int i = 0; i < holes.size(); i++)
+    {
+        holes.at(i)->chooseFuture();
+    }
+
+    // Do some parallel stuff if using Coulomb interactions
+    if (Coulomb)
+    {
+        // Calculate the coulomb interactions in parallel some way or another
+        if (m_world.parameters().useOpenCL && m_world.numChargeAgents() > m_world.parameters().openclThreshold)
+        {
+            // Use OpenCL if there are a lot of charges
+            if (m_world.parameters().coulombGaussianSigma > 0)
+            {
+                m_world.opencl().launchGaussKernel2();
+            }
+            else
+            {
+                m_world.opencl().launchCoulombKernel2();
+            }
+
+            // Turn this on to check the GPU vs CPU
+            // TRUST THE GPU - if it gives the wrong answer it is most likely
+            // the information passed to it is wrong some how, or something was
+            // changed in the CPU version. There is like a 99.9999% chance
+            // something is messed up on the CPU side - I have spent days/hours
+            // being tormented by some sublte bug, and it always turns out to
+            // be something wrong with the CPU functions
+            // m_world.opencl().compareHostAndDeviceForAllCarriers();
+
+            m_world.workerPool().run(Simulation::coulombGPU, this, electrons.size() + holes.size());
+        }
+        else if (m_world.vectorCoulomb().isOn())
+        {
+            // Use the vectorized CPU sums if there are not many charges or when we can not use OpenCL
+            m_world.vectorCoulomb().compute();
+        }
+        else
+        {
+            // Use multi threaded CPU if there are not many charges or when we can not use OpenCL
+            m_world.workerPool().run(Simulation::coulombCPU, this, electrons.size() + holes.size());
+        }
+    }
+
+    // Decide future in serial (because random number generator is being used)
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        electrons.at(i)->decideFuture();
+    }
+    for (int i = 0; i < holes.size(); i++)
+    {
+        holes.at(i)->decideFuture();
+    }
+
+    // Let lone carriers stuck in trap basins skip ahead (also serial)
+    if (m_world.trapBasins().isOn())
+    {
+        for (int i = 0; i < electrons.size(); i++)
+        {
+            electrons.at(i)->trapBasinStep();
+        }
+        for (int i = 0; i < holes.size(); i++)
+        {
+            holes.at(i)->trapBasinStep();
+        }
+    }
+
+    // Let parked carriers whose hop is due take it, and park the ones unlikely to move (also serial)
+    if (m_world.skipAhead().isOn())
+    {
+        m_world.skipAhead().wakeDue(m_world.parameters().currentStep);
+        for (int i = 0; i < electrons.size(); i++)
+        {
+            electrons.at(i)->skipAheadStep();
+        }
+        for (int i = 0; i < holes.size(); i++)
+        {
+            holes.at(i)->skipAheadStep();
+        }
+    }
+
+    // Recombine holes and electrons
+    performRecombinations<SolarCell>();
+
+    // Now we are done with the charge movement, move them to the next tick!
+    nextTick();
+
+    // Perform charge injection at the source
+    performInjections<SolarCell>();
+
+    // The current sites are final now; start their potentials on the device for the
+    // next step so only the future sites are left to wait for
+    if (Coulomb && m_world.parameters().useOpenCL && m_world.parameters().openclPipeline &&
+        m_world.numChargeAgents() > m_world.parameters().openclThreshold)
+    {
+        if (m_world.parameters().coulombGaussianSigma > 0)
+        {
+            m_world.opencl().prefetchGaussKernel2();
+        }
+        else
+        {
+            m_world.opencl().prefetchCoulombKernel2();
+        }
+    }
+
+    m_world.parameters().currentStep += 1;
+}
+
+template <bool SolarCell>
 void Simulation::performRecombinations()
 {
-    if (m_world.parameters().simulationType == "solarcell")
+    if (SolarCell)
     {
-        if (m_world.parameters().recombinationRate > 0)
+        // only electrons with a hole in range can recombine; the rest would find no partner
+        if (m_world.recombinationPairs().isOn() && m_world.recombinationPairs().size() > 0)
         {
-            foreach (ChargeAgent *charge, m_world.electrons())
+            foreach (ChargeAgent *charge, m_world.recombinationPairs().electrons())
             {
                 m_world.recombinationAgent().tryToAccept(charge);
             }
@@ -230,9 +280,10 @@ void Simulation::performRecombinations()
     }
 }
 
+template <bool SolarCell>
 void Simulation::performInjections()
 {
-    if (m_world.parameters().simulationType == "solarcell")
+    if (SolarCell)
     {
         m_world.excitonSourceAgent().tryToInject();
 
@@ -258,23 +309,23 @@ void Simulation::balanceCharges()
         if (m_world.parameters().voltageRight >
             m_world.parameters().voltageLeft)
         {
-            m_world.electronSourceAgentLeft().tryToInject();
+            m_world.electronSourceAgentLeft().injectFree();
         }
         else
         if (m_world.parameters().voltageLeft >
             m_world.parameters().voltageRight)
         {
-            m_world.electronSourceAgentRight().tryToInject();
+            m_world.electronSourceAgentRight().injectFree();
         }
         else
         {
             if (m_world.randomNumberGenerator().random() > 0.5)
             {
-                m_world.electronSourceAgentLeft().tryToInject();
+                m_world.electronSourceAgentLeft().injectFree();
             }
             else
             {
-                m_world.electronSourceAgentRight().tryToInject();
+                m_world.electronSourceAgentRight().injectFree();
             }
         }
         tries += 1;
@@ -290,23 +341,23 @@ void Simulation::balanceCharges()
         if (m_world.parameters().voltageRight >
             m_world.parameters().voltageLeft)
         {
-            m_world.holeSourceAgentRight().tryToInject();
+            m_world.holeSourceAgentRight().injectFree();
         }
         else
         if (m_world.parameters().voltageLeft >
             m_world.parameters().voltageRight)
         {
-            m_world.holeSourceAgentLeft().tryToInject();
+            m_world.holeSourceAgentLeft().injectFree();
         }
         else
         {
             if (m_world.randomNumberGenerator().random() > 0.5)
             {
-                m_world.holeSourceAgentRight().tryToInject();
+                m_world.holeSourceAgentRight().injectFree();
             }
             else
             {
-                m_world.holeSourceAgentLeft().tryToInject();
+                m_world.holeSourceAgentLeft().injectFree();
             }
         }
         tries += 1;
@@ -358,11 +409,23 @@ void Simulation::nextTick()
     QList<ChargeAgent*> &electrons = m_world.electrons();
     QList<ChargeAgent*> &holes = m_world.holes();
 
+    // Sorted lists would let the carrier first in Morton order win every contested site,
+    // so the sorter moves the carriers that hop in a random order; only the removal is left
+    bool ticked = m_world.carrierSorter().isOn();
+    if (ticked)
+    {
+        m_world.carrierSorter().completeTicks(electrons);
+        m_world.carrierSorter().completeTicks(holes);
+    }
+
     if ( m_world.parameters().outputIdsOnDelete )
     {
         for(int i = 0; i < electrons.size(); ++i)
         {
-            electrons[i]->completeTick();
+            if (!ticked)
+            {
+                electrons[i]->completeTick();
+            }
             // Check if the charge was removed - then we should delete it
             if(electrons[i]->removed())
             {
@@ -374,7 +437,10 @@ void Simulation::nextTick()
         }
         for(int i = 0; i < holes.size(); ++i)
         {
-            holes[i]->completeTick();
+            if (!ticked)
+            {
+                holes[i]->completeTick();
+            }
             // Check if the charge was removed - then we should delete it
             if(holes[i]->removed())
             {
@@ -390,7 +456,10 @@ void Simulation::nextTick()
     {
         for(int i = 0; i < electrons.size(); ++i)
         {
-            electrons[i]->completeTick();
+            if (!ticked)
+            {
+                electrons[i]->completeTick();
+            }
             // Check if the charge was removed - then we should delete it
             if(electrons[i]->removed())
             {
@@ -401,7 +470,10 @@ void Simulation::nextTick()
         }
         for(int i = 0; i < holes.size(); ++i)
         {
-            holes[i]->completeTick();
+            if (!ticked)
+            {
+                holes[i]->completeTick();
+            }
             // Check if the charge was removed - then we should delete it
             if(holes[i]->removed())
             {
@@ -413,14 +485,26 @@ void Simulation::nextTick()
     }
 }
 
-inline void Simulation::chargeAgentCoulombInteractionQtConcurrentCPU(ChargeAgent * chargeAgent)
+void Simulation::coulombCPU(void *self, int begin, int end)
 {
-    chargeAgent->coulombCPU();
+    World& world = static_cast<Simulation *>(self)->m_world;
+    QList<ChargeAgent*> &electrons = world.electrons();
+    QList<ChargeAgent*> &holes = world.holes();
+    for (int i = begin; i < end; i++)
+    {
+        (i < electrons.size() ? electrons.at(i) : holes.at(i - electrons.size()))->coulombCPU();
+    }
 }
 
-inline void Simulation::chargeAgentCoulombInteractionQtConcurrentGPU(ChargeAgent * chargeAgent)
+void Simulation::coulombGPU(void *self, int begin, int end)
 {
-    chargeAgent->coulombGPU();
+    World& world = static_cast<Simulation *>(self)->m_world;
+    QList<ChargeAgent*> &electrons = world.electrons();
+    QList<ChargeAgent*> &holes = world.holes();
+    for (int i = begin; i < end; i++)
+    {
+        (i < electrons.size() ? electrons.at(i) : holes.at(i - electrons.size()))->coulombGPU();
+    }
 }
 
 }
@@ -0,0 +1,403 @@
+#include "sitestore.h"
+#include "freesites.h"
+#include "workerpool.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+
+#include <algorithm>
+
+namespace Langmuir
+{
+
+// the code lives in the top 2 bits of a word, the carrier index in the rest
+static const int CODE_SHIFT = 30;
+static const quint32 INDEX_MASK = (quint32(1) << CODE_SHIFT) - 1;
+
+SiteStore::SiteStore(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_free(0), m_potentialDouble(0), m_potentialSingle(0),
+      m_slopeX(0), m_offset(0), m_slopeZ(0)
+{
+    const SimulationParameters& par = m_world.parameters();
+    m_volume = par.gridX * par.gridY * par.gridZ;
+    m_paged = (par.gridStorage == "paged");
+
+    m_pageShift = 0;
+    while ((1 << m_pageShift) < par.gridPage)
+    {
+        m_pageShift++;
+    }
+    int numPages = ((m_volume - 1) >> m_pageShift) + 1;
+    m_pages.fill(0, numPages);
+    m_pageCounts.fill(0, numPages);
+    if (!m_paged)
+    {
+        m_world.workerPool().run(SiteStore::allocatePages, this, numPages);
+    }
+
+    // only the exciton source draws from the whole grid; a paged store is too big to list
+    if (par.simulationType == "solarcell" && !m_paged)
+    {
+        m_free = new FreeSites(m_volume);
+        for (int site = 0; site < m_volume; site++)
+        {
+            m_free->insert(site, site);
+        }
+    }
+
+    m_single = (par.gridPrecision == "single");
+    if (m_paged)
+    {
+        // the potential is worked out when asked for
+    }
+    else if (m_single)
+    {
+        m_potentialSingle = new float[m_volume];
+        m_world.workerPool().zero(m_potentialSingle, m_volume, sizeof(float));
+    }
+    else
+    {
+        m_potentialDouble = new double[m_volume];
+        m_world.workerPool().zero(m_potentialDouble, m_volume, sizeof(double));
+    }
+}
+
+SiteStore::~SiteStore()
+{
+    for (int i = 0; i < m_pages.size(); i++)
+    {
+        delete [] m_pages[i];
+    }
+    delete m_free;
+    delete [] m_potentialDouble;
+    delete [] m_potentialSingle;
+}
+
+const quint32 *SiteStore::word(Layer layer, int site) const
+{
+    const quint32 *page = m_pages[site >> m_pageShift];
+    if (page == 0)
+    {
+        return 0;
+    }
+    return page + 2 * (site & ((1 << m_pageShift) - 1)) + layer;
+}
+
+void SiteStore::setWord(Layer layer, int site, quint32 value)
+{
+    int p = site >> m_pageShift;
+    if (m_pages[p] == 0)
+    {
+        if (value == 0)
+        {
+            return;
+        }
+        m_pages[p] = new quint32[2 << m_pageShift]();
+    }
+
+    // dense pages are never freed, so their counts are not kept (pages straddle the domain slabs)
+    quint32& old = m_pages[p][2 * (site & ((1 << m_pageShift) - 1)) + layer];
+    if (m_paged)
+    {
+        m_pageCounts[p] += (value != 0) - (old != 0);
+    }
+    old = value;
+
+    if (m_free != 0 && (&old)[layer == Electrons ? 1 : -1] == 0)
+    {
+        if (value == 0)
+        {
+            m_free->insert(site, site);
+        }
+        else
+        {
+            m_free->remove(site);
+        }
+    }
+
+    if (m_paged && m_pageCounts[p] == 0)
+    {
+        delete [] m_pages[p];
+        m_pages[p] = 0;
+    }
+}
+
+const FreeSites *SiteStore::freeSites() const
+{
+    return m_free;
+}
+
+Agent::Type SiteStore::agentType(Layer layer, int site) const
+{
+    const quint32 *w = word(layer, site);
+    switch (w ? *w >> CODE_SHIFT : quint32(EmptyCode))
+    {
+    case CarrierCode:
+        return layer == Electrons ? Agent::Electron : Agent::Hole;
+    case DefectCode:
+        return Agent::Defect;
+    default:
+        return Agent::Empty;
+    }
+}
+
+Agent *SiteStore::agentAddress(Layer layer, int site) const
+{
+    const quint32 *w = word(layer, site);
+    if (w == 0 || (*w >> CODE_SHIFT) != CarrierCode)
+    {
+        return 0;
+    }
+    return m_carriers[*w & INDEX_MASK];
+}
+
+quint32 SiteStore::addCarrier(Agent *agent)
+{
+    quint32 index;
+    if (m_freeCarriers.isEmpty())
+    {
+        if (quint32(m_carriers.size()) > INDEX_MASK)
+        {
+            qFatal("langmuir: can not store carrier; more than %u carriers", INDEX_MASK);
+        }
+        index = m_carriers.size();
+        m_carriers.push_back(agent);
+    }
+    else
+    {
+        index = m_freeCarriers.last();
+        m_freeCarriers.pop_back();
+        m_carriers[index] = agent;
+    }
+    return index;
+}
+
+void SiteStore::removeCarrier(quint32 index)
+{
+    m_carriers[index] = 0;
+    m_freeCarriers.push_back(index);
+}
+
+void SiteStore::setCarrier(Layer layer, int site, quint32 index)
+{
+    setWord(layer, site, (quint32(CarrierCode) << CODE_SHIFT) | index);
+}
+
+void SiteStore::moveCarrier(Layer layer, int from, int to)
+{
+    quint32 value = *word(layer, from);
+    setWord(layer, from, 0);
+    setWord(layer, to, value);
+}
+
+void SiteStore::setDefect(Layer layer, int site)
+{
+    setWord(layer, site, quint32(DefectCode) << CODE_SHIFT);
+}
+
+void SiteStore::clear(Layer layer, int site)
+{
+    const quint32 *w = word(layer, site);
+    if (w == 0)
+    {
+        return;
+    }
+    setWord(layer, site, 0);
+}
+
+double SiteStore::slopes(int site) const
+{
+    Grid& grid = m_world.electronGrid();
+    return m_slopeX * (grid.getIndexX(site) + 0.5) + m_offset + m_slopeZ * (grid.getIndexZ(site) + 0.5);
+}
+
+double SiteStore::potential(int site) const
+{
+    if (m_paged)
+    {
+        return slopes(site) + m_sparse.value(site, 0.0);
+    }
+    return m_single ? m_potentialSingle[site] : m_potentialDouble[site];
+}
+
+void SiteStore::setPotential(int site, double potential)
+{
+    if (m_paged)
+    {
+        m_sparse[site] = potential - slopes(site);
+    }
+    else if (m_single)
+    {
+        m_potentialSingle[site] = potential;
+    }
+    else
+    {
+        m_potentialDouble[site] = potential;
+    }
+}
+
+void SiteStore::addToPotential(int site, double potential)
+{
+    if (m_paged)
+    {
+        m_sparse[site] += potential;
+    }
+    else if (m_single)
+    {
+        m_potentialSingle[site] += potential;
+    }
+    else
+    {
+        m_potentialDouble[site] += potential;
+    }
+}
+
+void SiteStore::clearPotentials()
+{
+    m_slopeX = 0;
+    m_offset = 0;
+    m_slopeZ = 0;
+    m_sparse.clear();
+    if (m_potentialSingle != 0)
+    {
+        std::fill(m_potentialSingle, m_potentialSingle + m_volume, 0.0f);
+    }
+    if (m_potentialDouble != 0)
+    {
+        std::fill(m_potentialDouble, m_potentialDouble + m_volume, 0.0);
+    }
+}
+
+void SiteStore::addPotentialSlopes(double slopeX, double offset, double slopeZ)
+{
+    if (m_paged)
+    {
+        m_slopeX += slopeX;
+        m_offset += offset;
+        m_slopeZ += slopeZ;
+        return;
+    }
+
+    Grid& grid = m_world.electronGrid();
+    for (int site = 0; site < m_volume; site++)
+    {
+        addToPotential(site, slopeX * (grid.getIndexX(site) + 0.5) + offset +
+                             slopeZ * (grid.getIndexZ(site) + 0.5));
+    }
+}
+
+void SiteStore::keepOnly(int xBegin, int xEnd)
+{
+    if (!m_paged)
+    {
+        return;
+    }
+    Grid& grid = m_world.electronGrid();
+
+    QHash<int, double>::iterator it = m_sparse.begin();
+    while (it != m_sparse.end())
+    {
+        int x = grid.getIndexX(it.key());
+        if (x < xBegin || x >= xEnd)
+        {
+            it = m_sparse.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    int pageSites = 1 << m_pageShift;
+    for (int p = 0; p < m_pages.size(); p++)
+    {
+        for (int site = p * pageSites; site < qMin(m_volume, (p + 1) * pageSites) && m_pages[p] != 0; site++)
+        {
+            int x = grid.getIndexX(site);
+            if (x >= xBegin && x < xEnd)
+            {
+                continue;
+            }
+            for (int layer = Electrons; layer <= Holes; layer++)
+            {
+                const quint32 *w = word(Layer(layer), site);
+                if (w != 0 && (*w >> CODE_SHIFT) == CarrierCode)
+                {
+                    qFatal("langmuir: can not drop site %d; it holds a carrier", site);
+                }
+                setWord(Layer(layer), site, 0);
+            }
+        }
+    }
+}
+
+QVector<int> SiteStore::storedSites() const
+{
+    QVector<int> sites;
+    if (!m_paged)
+    {
+        return sites;
+    }
+    int pageSites = 1 << m_pageShift;
+    for (int p = 0; p < m_pages.size(); p++)
+    {
+        if (m_pages[p] == 0)
+        {
+            continue;
+        }
+        for (int site = p * pageSites; site < qMin(m_volume, (p + 1) * pageSites); site++)
+        {
+            if (*word(Electrons, site) != 0 || *word(Holes, site) != 0 || m_sparse.contains(site))
+            {
+                sites.push_back(site);
+            }
+        }
+    }
+    foreach (int site, m_sparse.keys())
+    {
+        if (m_pages[site >> m_pageShift] == 0)
+        {
+            sites.push_back(site);
+        }
+    }
+    qSort(sites);
+    return sites;
+}
+
+void SiteStore::allocatePages(void *self, int begin, int end)
+{
+    SiteStore *store = static_cast<SiteStore *>(self);
+    quint32 **pages = store->m_pages.data();
+    for (int i = begin; i < end; i++)
+    {
+        pages[i] = new quint32[2 << store->m_pageShift]();
+    }
+}
+
+double SiteStore::bytesPerSite() const
+{
+    double bytes = m_pages.size() * (sizeof(quint32 *) + sizeof(int));
+    foreach (quint32 *page, m_pages)
+    {
+        if (page != 0)
+        {
+            bytes += (2 << m_pageShift) * sizeof(quint32);
+        }
+    }
+    if (m_potentialDouble != 0)
+    {
+        bytes += double(m_volume) * sizeof(double);
+    }
+    if (m_potentialSingle != 0)
+    {
+        bytes += double(m_volume) * sizeof(float);
+    }
+    bytes += m_sparse.size() * (sizeof(int) + sizeof(double));
+    if (m_free != 0)
+    {
+        bytes += m_free->bytes();
+    }
+    return bytes / m_volume;
+}
+
+}
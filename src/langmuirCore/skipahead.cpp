@@ -0,0 +1,182 @@
+#include "skipahead.h"
+#include "chargeagent.h"
+#include "drainagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <cmath>
+
+namespace Langmuir
+{
+
+// longest wait drawn, so the wake step fits in SimulationParameters::currentStep
+static const double MAX_STEPS = 1 << 30;
+
+SkipAhead::SkipAhead(World &world, QObject *parent)
+    : QObject(parent), m_world(world)
+{
+    m_on = (m_world.parameters().hoppingSkip > 0);
+}
+
+bool SkipAhead::isOn() const
+{
+    return m_on;
+}
+
+int SkipAhead::parked() const
+{
+    return m_queue.size();
+}
+
+double SkipAhead::chances(ChargeAgent *charge, QVector<double>& chance)
+{
+    const SimulationParameters& par = m_world.parameters();
+    Grid& grid = charge->getGrid();
+    const QVector<int>& neighbors = charge->getNeighbors();
+    int site = charge->getCurrentSite();
+    int n = neighbors.size();
+
+    // the same odds as ChargeAgent::decideFuture(), proposal included
+    chance.fill(0.0, n);
+    double total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int other = neighbors[i];
+        switch (grid.agentType(other))
+        {
+        case Agent::Empty:
+        {
+            double pd = (grid.potential(other) - grid.potential(site)) * charge->charge();
+            double p = m_world.couplingConstants()[grid.xDistancei(site, other)]
+                                                  [grid.yDistancei(site, other)]
+                                                  [grid.zDistancei(site, other)];
+            if (pd > 0)
+            {
+                p *= exp(-pd * par.inverseKT);
+            }
+            chance[i] = qMin(1.0, p) / n;
+            break;
+        }
+        case Agent::Drain:
+        {
+            DrainAgent *drain = dynamic_cast<DrainAgent*>(grid.agentAddress(other));
+            if (!drain)
+            {
+                qFatal("langmuir: can not cast pointer to DrainAgent");
+            }
+            chance[i] = qMin(1.0, drain->rate()) / n;
+            break;
+        }
+        default:
+            break;
+        }
+        total += chance[i];
+    }
+    return total;
+}
+
+quint32 SkipAhead::steps(double chance)
+{
+    if (chance <= 0)
+    {
+        return quint32(MAX_STEPS);
+    }
+    double u = qMax(m_world.randomNumberGenerator().random(), 1e-300);
+    double steps = qMax(1.0, ceil(log(u) / log(1.0 - chance)));
+    return quint32(qMin(steps, MAX_STEPS));
+}
+
+int SkipAhead::pick(const QVector<double>& chance, double total)
+{
+    double r = m_world.randomNumberGenerator().random() * total;
+    int i = 0;
+    while (i < chance.size() - 1 && r >= chance[i])
+    {
+        r -= chance[i];
+        i++;
+    }
+    return i;
+}
+
+void SkipAhead::creditDrains(ChargeAgent *charge, double chance, quint32 steps)
+{
+    if (steps == 0 || chance >= 1)
+    {
+        return;
+    }
+    Grid& grid = charge->getGrid();
+    const QVector<int>& neighbors = charge->getNeighbors();
+    Random& rand = m_world.randomNumberGenerator();
+    foreach (int other, neighbors)
+    {
+        if (grid.agentType(other) != Agent::Drain)
+        {
+            continue;
+        }
+        DrainAgent *drain = dynamic_cast<DrainAgent*>(grid.agentAddress(other));
+        if (!drain)
+        {
+            qFatal("langmuir: can not cast pointer to DrainAgent");
+        }
+
+        // each step sat out proposed this drain and was turned down with this chance
+        double refused = (1.0 - qMin(1.0, drain->rate())) / neighbors.size() / (1.0 - chance);
+        double expected = refused * steps;
+        unsigned long int attempts = (unsigned long int)(floor(expected));
+        if (rand.chooseYes(expected - floor(expected)))
+        {
+            attempts += 1;
+        }
+        drain->addCounts(attempts, 0);
+    }
+}
+
+void SkipAhead::park(ChargeAgent *charge, quint32 step)
+{
+    m_queue.insert(step, charge);
+}
+
+void SkipAhead::unpark(ChargeAgent *charge, quint32 step)
+{
+    m_queue.remove(step, charge);
+}
+
+void SkipAhead::wakeDue(quint32 step)
+{
+    while (!m_queue.isEmpty() && m_queue.begin().key() <= step)
+    {
+        ChargeAgent *charge = m_queue.begin().value();
+        m_queue.erase(m_queue.begin());
+        charge->wake();
+    }
+}
+
+void SkipAhead::siteChanged(Grid &grid, int site)
+{
+    if (m_queue.isEmpty())
+    {
+        return;
+    }
+    foreach (int other, grid.neighborsSite(site, m_world.parameters().hoppingRange))
+    {
+        if (other >= grid.volume())
+        {
+            continue;
+        }
+        Agent::Type type = grid.agentType(other);
+        if (type != Agent::Electron && type != Agent::Hole)
+        {
+            continue;
+        }
+        ChargeAgent *charge = static_cast<ChargeAgent*>(grid.agentAddress(other));
+        if (charge->skipWakeStep() != 0)
+        {
+            unpark(charge, charge->skipWakeStep());
+            charge->wake();
+        }
+    }
+}
+
+}
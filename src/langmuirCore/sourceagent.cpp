@@ -1,33 +1,26 @@
 #include "sourceagent.h"
 #include "chargeagent.h"
+#include "freesites.h"
 #include "parameters.h"
 #include "potential.h"
 #include "world.h"
 #include "rand.h"
 
+#include <cmath>
+
 namespace Langmuir
 {
 
 SourceAgent::SourceAgent(World &world, Grid& grid, QObject *parent)
-    : FluxAgent(Agent::Source, world, grid, parent)
+    : FluxAgent(Agent::Source, world, grid, parent), m_freeSites(0)
 {
 }
 
-ElectronSourceAgent::ElectronSourceAgent(World &world, int site, QObject *parent)
-    : SourceAgent(world, world.electronGrid(), parent)
-{
-    initializeSite(site);
-    QString name;
-    QTextStream stream(&name);
-    stream << "e" << m_type << site;
-    stream.flush();
-    setObjectName(name);
-}
-
 ElectronSourceAgent::ElectronSourceAgent(World &world, Grid::CubeFace cubeFace, QObject *parent)
     : SourceAgent(world, world.electronGrid(), parent)
 {
     initializeSite(cubeFace);
+    m_freeSites = m_grid.freeSites(cubeFace);
     QString name;
     QTextStream stream(&name);
     stream << "e" << m_type << faceToLetter();
@@ -35,21 +28,11 @@ ElectronSourceAgent::ElectronSourceAgent(World &world, Grid::CubeFace cubeFace,
     setObjectName(name);
 }
 
-HoleSourceAgent::HoleSourceAgent(World &world, int site, QObject *parent)
-    : SourceAgent(world, world.holeGrid(), parent)
-{
-    initializeSite(site);
-    QString name;
-    QTextStream stream(&name);
-    stream << "h" << m_type << site;
-    stream.flush();
-    setObjectName(name);
-}
-
 HoleSourceAgent::HoleSourceAgent(World &world, Grid::CubeFace cubeFace, QObject *parent)
     : SourceAgent(world, world.holeGrid(), parent)
 {
     initializeSite(cubeFace);
+    m_freeSites = m_grid.freeSites(cubeFace);
     QString name;
     QTextStream stream(&name);
     stream << "h" << m_type << faceToLetter();
@@ -61,6 +44,7 @@ ExcitonSourceAgent::ExcitonSourceAgent(World &world, QObject *parent)
     : SourceAgent(world, world.electronGrid(), parent)
 {
     initializeSite(Grid::NoFace);
+    m_freeSites = m_world.siteStore().freeSites();
     QString name;
     QTextStream stream(&name);
     stream << "x" << m_type;
@@ -92,7 +76,54 @@ bool SourceAgent::tryToSeed(int site)
 bool SourceAgent::tryToInject()
 {
     m_attempts += 1;
-    int site = chooseSite();
+    int site;
+    if (m_freeSites != 0)
+    {
+        // chooseSite() would pick a free site with probability free / all, so decide that
+        // first, then draw only among the free sites; the odds of each site are unchanged
+        int free = m_freeSites->size();
+        if (free == 0 || !m_world.randomNumberGenerator().chooseYes(double(free) / m_freeSites->keys()))
+        {
+            return false;
+        }
+        site = m_freeSites->site(m_world.randomNumberGenerator().integer(0, free - 1));
+    }
+    else
+    {
+        site = chooseSite();
+    }
+    if(validToInject(site)&& shouldTransport(site))
+    {
+        inject(site);
+        m_successes += 1;
+        return true;
+    }
+    return false;
+}
+
+bool SourceAgent::injectFree()
+{
+    if (m_freeSites == 0)
+    {
+        return tryToInject();
+    }
+    m_attempts += 1;
+    int free = m_freeSites->size();
+    if (free == 0)
+    {
+        return false;
+    }
+
+    // count the tries tryToInject() would have wasted on occupied sites first, which are
+    // geometric on 0, 1, ... with success chance free / all
+    double chance = double(free) / m_freeSites->keys();
+    if (chance < 1)
+    {
+        double u = qMax(m_world.randomNumberGenerator().random(), 1e-300);
+        m_attempts += (unsigned long int)(qMin(floor(log(u) / log(1.0 - chance)), 1e15));
+    }
+
+    int site = m_freeSites->site(m_world.randomNumberGenerator().integer(0, free - 1));
     if(validToInject(site)&& shouldTransport(site))
     {
         inject(site);
@@ -203,13 +234,12 @@ void ExcitonSourceAgent::inject(int site)
 
 bool ElectronSourceAgent::validToInject(int site)
 {
-    if( m_world.numElectronAgents() >= m_world.maxElectronAgents() ||
+    if( m_world.atMaxElectrons() ||
         m_probability <= 0 ||
         site < 0 ||
         site >= m_grid.volume()||
         m_grid.agentType(site)!= Agent::Empty ||
-        m_grid.agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_grid.agentAddress(site)!= 0)
     {
         return false;
     }
@@ -218,13 +248,12 @@ bool ElectronSourceAgent::validToInject(int site)
 
 bool HoleSourceAgent::validToInject(int site)
 {
-    if( m_world.numHoleAgents() >= m_world.maxHoleAgents() ||
+    if( m_world.atMaxHoles() ||
         m_probability <= 0 ||
         site < 0 ||
         site >= m_grid.volume()||
         m_grid.agentType(site)!= Agent::Empty ||
-        m_grid.agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_grid.agentAddress(site)!= 0)
     {
         return false;
     }
@@ -233,16 +262,15 @@ bool HoleSourceAgent::validToInject(int site)
 
 bool ExcitonSourceAgent::validToInject(int site)
 {
-    if( m_world.numElectronAgents() >= m_world.maxElectronAgents() ||
-        m_world.numHoleAgents() >= m_world.maxHoleAgents() ||
+    if( m_world.atMaxElectrons() ||
+        m_world.atMaxHoles() ||
         m_probability <= 0 ||
         site < 0 ||
         site >= m_world.electronGrid().volume()||
         m_world.electronGrid().agentType(site)!= Agent::Empty ||
         m_world.holeGrid().agentType(site)!= Agent::Empty ||
         m_world.electronGrid().agentAddress(site)!= 0 ||
-        m_world.holeGrid().agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_world.holeGrid().agentAddress(site)!= 0)
     {
         return false;
     }
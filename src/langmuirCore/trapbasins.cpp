@@ -0,0 +1,404 @@
+#include "trapbasins.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <QSet>
+
+#include <cmath>
+
+namespace Langmuir
+{
+
+// longest sleep drawn, so the wake step fits in SimulationParameters::currentStep
+static const double MAX_STEPS = 1 << 30;
+
+TrapBasins::TrapBasins(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_asleep(0)
+{
+    m_on = m_world.parameters().trapAccelerate;
+}
+
+void TrapBasins::findBasins()
+{
+    if (!m_on)
+    {
+        return;
+    }
+    groupTraps();
+    m_solutions.resize(2 * m_sites.size());
+    m_sleepers.fill(NULL, m_sites.size());
+    for (int b = 0; b < m_halos.size(); b++)
+    {
+        foreach (int site, m_halos[b])
+        {
+            m_basinsNear[site].push_back(b);
+        }
+    }
+    qDebug("langmuir: %d trap basins of at most %d sites", m_sites.size(), m_world.parameters().trapBasinSize);
+}
+
+bool TrapBasins::isOn() const
+{
+    return m_on;
+}
+
+int TrapBasins::count() const
+{
+    return m_sites.size();
+}
+
+int TrapBasins::basin(int site) const
+{
+    return m_basinOfSite.value(site, -1);
+}
+
+const QVector<int>& TrapBasins::sites(int basin) const
+{
+    return m_sites.at(basin);
+}
+
+const QVector<int>& TrapBasins::exits(int basin) const
+{
+    return m_exits.at(basin);
+}
+
+void TrapBasins::groupTraps()
+{
+    const SimulationParameters& par = m_world.parameters();
+    Grid& grid = m_world.electronGrid();
+
+    QSet<int> traps;
+    foreach (int site, m_world.trapSiteIDs())
+    {
+        traps.insert(site);
+    }
+
+    QSet<int> seen;
+    foreach (int start, m_world.trapSiteIDs())
+    {
+        if (seen.contains(start))
+        {
+            continue;
+        }
+
+        // walk the cluster of traps joined to this one
+        QVector<int> cluster;
+        QVector<int> exits;
+        QSet<int> exitSet;
+        bool usable = true;
+        cluster.push_back(start);
+        seen.insert(start);
+        for (int i = 0; i < cluster.size(); i++)
+        {
+            bool canMove = false;
+            foreach (int other, grid.neighborsSite(cluster[i], par.hoppingRange))
+            {
+                if (other >= grid.volume())
+                {
+                    // next to a drain
+                    usable = false;
+                }
+                else if (traps.contains(other))
+                {
+                    canMove = true;
+                    if (!seen.contains(other))
+                    {
+                        seen.insert(other);
+                        cluster.push_back(other);
+                    }
+                }
+                else if (grid.agentType(other) != Agent::Defect)
+                {
+                    canMove = true;
+                    if (!exitSet.contains(other))
+                    {
+                        exitSet.insert(other);
+                        exits.push_back(other);
+                    }
+                }
+            }
+            usable = usable && canMove;
+        }
+
+        if (!usable || exits.isEmpty() || cluster.size() > par.trapBasinSize)
+        {
+            continue;
+        }
+
+        // the sites a charge could be on and still reach, or be reached from, the basin
+        QSet<int> haloSet;
+        QVector<int> halo;
+        int c = par.trapBasinClearance;
+        foreach (int site, cluster)
+        {
+            int x = grid.getIndexX(site);
+            int y = grid.getIndexY(site);
+            int z = grid.getIndexZ(site);
+            for (int k = qMax(0, z - c); k <= qMin(grid.zSize() - 1, z + c); k++)
+            {
+                for (int j = qMax(0, y - c); j <= qMin(grid.ySize() - 1, y + c); j++)
+                {
+                    for (int i = qMax(0, x - c); i <= qMin(grid.xSize() - 1, x + c); i++)
+                    {
+                        int other = grid.getIndexS(i, j, k);
+                        if (!haloSet.contains(other))
+                        {
+                            haloSet.insert(other);
+                            halo.push_back(other);
+                        }
+                    }
+                }
+            }
+        }
+
+        foreach (int site, cluster)
+        {
+            m_basinOfSite[site] = m_sites.size();
+        }
+        m_sites.push_back(cluster);
+        m_exits.push_back(exits);
+        m_halos.push_back(halo);
+    }
+}
+
+bool TrapBasins::isolated(int basin, ChargeAgent *charge)
+{
+    Grid& electrons = m_world.electronGrid();
+    Grid& holes = m_world.holeGrid();
+    bool chargedDefects = m_world.parameters().defectsCharge != 0;
+    foreach (int site, m_halos.at(basin))
+    {
+        Agent::Type type = electrons.agentType(site);
+        if ((type == Agent::Electron && electrons.agentAddress(site) != charge) ||
+            (type == Agent::Defect && chargedDefects))
+        {
+            return false;
+        }
+        if (holes.agentType(site) == Agent::Hole && holes.agentAddress(site) != charge)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TrapBasins::addSleeper(int basin, ChargeAgent *charge)
+{
+    m_sleepers[basin] = charge;
+    m_asleep += 1;
+}
+
+void TrapBasins::removeSleeper(int basin)
+{
+    if (m_sleepers[basin] != NULL)
+    {
+        m_sleepers[basin] = NULL;
+        m_asleep -= 1;
+    }
+}
+
+int TrapBasins::sleepers() const
+{
+    return m_asleep;
+}
+
+void TrapBasins::siteChanged(Grid &grid, int site)
+{
+    if (m_asleep == 0)
+    {
+        return;
+    }
+    QHash<int, QVector<int> >::const_iterator it = m_basinsNear.find(site);
+    if (it == m_basinsNear.end())
+    {
+        return;
+    }
+    foreach (int basin, it.value())
+    {
+        // a sleeper does not move, so only another charge (or a defect) changes its halo
+        ChargeAgent *charge = m_sleepers[basin];
+        if (charge != NULL && !(&charge->getGrid() == &grid && charge->getCurrentSite() == site))
+        {
+            removeSleeper(basin);
+            charge->wakeInBasin();
+        }
+    }
+}
+
+const TrapBasins::Solution& TrapBasins::solution(int basin, int charge)
+{
+    Solution& solution = m_solutions[2 * basin + (charge > 0 ? 1 : 0)];
+    if (solution.steps.isEmpty())
+    {
+        solve(basin, charge, solution);
+    }
+    return solution;
+}
+
+void TrapBasins::solve(int basin, int charge, Solution& solution)
+{
+    const SimulationParameters& par = m_world.parameters();
+    Grid& grid = m_world.electronGrid();
+    const QVector<int>& sites = m_sites.at(basin);
+    const QVector<int>& exits = m_exits.at(basin);
+    int k = sites.size();
+    int m = exits.size();
+    int cols = m + 2;
+
+    // a = I - Q; b = [1, chance of a hop inside, chance of leaving to each exit]
+    QVector<double> a(k * k, 0.0);
+    QVector<double> b(k * cols, 0.0);
+    for (int i = 0; i < k; i++)
+    {
+        int site = sites[i];
+        QVector<int> neighbors = grid.neighborsSite(site, par.hoppingRange);
+        b[i * cols] = 1.0;
+        foreach (int other, neighbors)
+        {
+            if (grid.agentType(other) == Agent::Defect)
+            {
+                continue;
+            }
+            double pd = (grid.potential(other) - grid.potential(site)) * charge;
+            double p = m_world.couplingConstants()[grid.xDistancei(site, other)]
+                                                  [grid.yDistancei(site, other)]
+                                                  [grid.zDistancei(site, other)] / neighbors.size();
+            if (pd > 0)
+            {
+                p *= exp(-pd * par.inverseKT);
+            }
+            a[i * k + i] += p;
+
+            int j = sites.indexOf(other);
+            if (j >= 0)
+            {
+                a[i * k + j] -= p;
+                b[i * cols + 1] += p;
+            }
+            else
+            {
+                b[i * cols + 2 + exits.indexOf(other)] += p;
+            }
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int col = 0; col < k; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < k; row++)
+        {
+            if (fabs(a[row * k + col]) > fabs(a[pivot * k + col]))
+            {
+                pivot = row;
+            }
+        }
+        if (pivot != col)
+        {
+            for (int j = 0; j < k; j++)
+            {
+                qSwap(a[col * k + j], a[pivot * k + j]);
+            }
+            for (int j = 0; j < cols; j++)
+            {
+                qSwap(b[col * cols + j], b[pivot * cols + j]);
+            }
+        }
+        for (int row = col + 1; row < k; row++)
+        {
+            double f = a[row * k + col] / a[col * k + col];
+            for (int j = col; j < k; j++)
+            {
+                a[row * k + j] -= f * a[col * k + j];
+            }
+            for (int j = 0; j < cols; j++)
+            {
+                b[row * cols + j] -= f * b[col * cols + j];
+            }
+        }
+    }
+    for (int row = k - 1; row >= 0; row--)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            double sum = b[row * cols + j];
+            for (int i = row + 1; i < k; i++)
+            {
+                sum -= a[row * k + i] * b[i * cols + j];
+            }
+            b[row * cols + j] = sum / a[row * k + row];
+        }
+    }
+
+    solution.steps.resize(k);
+    solution.hops.resize(k);
+    solution.exits.resize(k * m);
+    for (int i = 0; i < k; i++)
+    {
+        solution.steps[i] = b[i * cols];
+        solution.hops[i] = b[i * cols + 1];
+        for (int e = 0; e < m; e++)
+        {
+            solution.exits[i * m + e] = b[i * cols + 2 + e];
+        }
+    }
+}
+
+double TrapBasins::meanSteps(int basin, int site, int charge)
+{
+    return solution(basin, charge).steps.at(m_sites.at(basin).indexOf(site));
+}
+
+double TrapBasins::meanHops(int basin, int site, int charge)
+{
+    return solution(basin, charge).hops.at(m_sites.at(basin).indexOf(site));
+}
+
+QVector<double> TrapBasins::exitProbabilities(int basin, int site, int charge)
+{
+    int m = m_exits.at(basin).size();
+    return solution(basin, charge).exits.mid(m_sites.at(basin).indexOf(site) * m, m);
+}
+
+TrapBasins::Exit TrapBasins::sample(int basin, int site, int charge)
+{
+    Random& rand = m_world.randomNumberGenerator();
+    const Solution& sol = solution(basin, charge);
+    const QVector<int>& exits = m_exits.at(basin);
+    int s = m_sites.at(basin).indexOf(site);
+    int m = exits.size();
+    double mean = sol.steps[s];
+
+    // geometric on 1, 2, ... with this mean
+    double steps = 1;
+    if (mean > 1)
+    {
+        double u = qMax(rand.random(), 1e-300);
+        steps = qMax(1.0, ceil(log(u) / log(1.0 - 1.0 / mean)));
+    }
+    steps = qMin(steps, MAX_STEPS);
+
+    double total = 0;
+    for (int e = 0; e < m; e++)
+    {
+        total += sol.exits[s * m + e];
+    }
+    double r = rand.random() * total;
+    int e = 0;
+    while (e < m - 1 && r >= sol.exits[s * m + e])
+    {
+        r -= sol.exits[s * m + e];
+        e++;
+    }
+
+    Exit exit;
+    exit.steps = int(steps);
+    exit.site = exits[e];
+    exit.hops = int(qMin(sol.hops[s] * steps / qMax(mean, 1.0) + 0.5, MAX_STEPS));
+    return exit;
+}
+
+}
@@ -0,0 +1,353 @@
+#include "vectorcoulomb.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "potential.h"
+#include "cubicgrid.h"
+#include "workerpool.h"
+#include "world.h"
+
+#include <cstdlib>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LANGMUIR_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace Langmuir
+{
+
+// the charges are padded to a multiple of the widest vector (16 ints for avx512)
+static const int VECTOR = 16;
+
+// charges per tile, 16 KB of x, y, z and charge, so a tile stays in L1 while a block is summed against it
+static const int TILE = 1024;
+
+// carriers per block
+static const int BLOCK = 32;
+
+// padding sits this far away, beyond any cutoff
+static const int FAR = -(1 << 24);
+
+/**
+ * @brief A tile of charges to sum, and the table to sum them with
+ */
+struct Pairs
+{
+    const int *x;
+    const int *y;
+    const int *z;
+    const int *q;
+    int begin;
+    int end;
+    const double *table;
+    int tx;
+    int ty;
+    int tz;
+};
+
+typedef double (*SumFunction)(const Pairs& p, int xi, int yi, int zi);
+
+static double sumScalar(const Pairs& p, int xi, int yi, int zi)
+{
+    double v = 0;
+    for (int j = p.begin; j < p.end; j++)
+    {
+        int dx = abs(xi - p.x[j]);
+        int dy = abs(yi - p.y[j]);
+        int dz = abs(zi - p.z[j]);
+        if (dx < p.tx && dy < p.ty && dz < p.tz)
+        {
+            v += p.q[j] * p.table[(dx * p.ty + dy) * p.tz + dz];
+        }
+    }
+    return v;
+}
+
+#ifdef LANGMUIR_X86_SIMD
+__attribute__((target("avx2")))
+static double sumAVX2(const Pairs& p, int xi, int yi, int zi)
+{
+    const __m256i vx = _mm256_set1_epi32(xi);
+    const __m256i vy = _mm256_set1_epi32(yi);
+    const __m256i vz = _mm256_set1_epi32(zi);
+    const __m256i tx = _mm256_set1_epi32(p.tx);
+    const __m256i ty = _mm256_set1_epi32(p.ty);
+    const __m256i tz = _mm256_set1_epi32(p.tz);
+
+    __m256d v0 = _mm256_setzero_pd();
+    __m256d v1 = _mm256_setzero_pd();
+    for (int j = p.begin; j < p.end; j += 8)
+    {
+        __m256i dx = _mm256_abs_epi32(_mm256_sub_epi32(vx, _mm256_loadu_si256((const __m256i*)(p.x + j))));
+        __m256i dy = _mm256_abs_epi32(_mm256_sub_epi32(vy, _mm256_loadu_si256((const __m256i*)(p.y + j))));
+        __m256i dz = _mm256_abs_epi32(_mm256_sub_epi32(vz, _mm256_loadu_si256((const __m256i*)(p.z + j))));
+
+        // lanes outside the table are not gathered, and add 0
+        __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(tx, dx),
+                                          _mm256_and_si256(_mm256_cmpgt_epi32(ty, dy), _mm256_cmpgt_epi32(tz, dz)));
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dx, ty), dy), tz), dz);
+
+        // the gathers are 4 doubles wide, so each half of the 8 ints is done in turn
+        __m256d m0 = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(inside)));
+        __m256d m1 = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(inside, 1)));
+        __m256d t0 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p.table, _mm256_castsi256_si128(index), m0, 8);
+        __m256d t1 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p.table, _mm256_extracti128_si256(index, 1), m1, 8);
+
+        __m256d q0 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(p.q + j)));
+        __m256d q1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(p.q + j + 4)));
+        v0 = _mm256_add_pd(v0, _mm256_mul_pd(q0, t0));
+        v1 = _mm256_add_pd(v1, _mm256_mul_pd(q1, t1));
+    }
+
+    v0 = _mm256_add_pd(v0, v1);
+    __m128d v = _mm_add_pd(_mm256_castpd256_pd128(v0), _mm256_extractf128_pd(v0, 1));
+    v = _mm_add_sd(v, _mm_unpackhi_pd(v, v));
+    return _mm_cvtsd_f64(v);
+}
+
+__attribute__((target("avx512f")))
+static double sumAVX512(const Pairs& p, int xi, int yi, int zi)
+{
+    const __m512i vx = _mm512_set1_epi32(xi);
+    const __m512i vy = _mm512_set1_epi32(yi);
+    const __m512i vz = _mm512_set1_epi32(zi);
+    const __m512i tx = _mm512_set1_epi32(p.tx);
+    const __m512i ty = _mm512_set1_epi32(p.ty);
+    const __m512i tz = _mm512_set1_epi32(p.tz);
+
+    __m512d v0 = _mm512_setzero_pd();
+    __m512d v1 = _mm512_setzero_pd();
+    for (int j = p.begin; j < p.end; j += 16)
+    {
+        __m512i dx = _mm512_abs_epi32(_mm512_sub_epi32(vx, _mm512_loadu_si512(p.x + j)));
+        __m512i dy = _mm512_abs_epi32(_mm512_sub_epi32(vy, _mm512_loadu_si512(p.y + j)));
+        __m512i dz = _mm512_abs_epi32(_mm512_sub_epi32(vz, _mm512_loadu_si512(p.z + j)));
+
+        // lanes outside the table are not gathered, and add 0
+        __mmask16 inside = _mm512_cmplt_epi32_mask(dx, tx) & _mm512_cmplt_epi32_mask(dy, ty) &
+                           _mm512_cmplt_epi32_mask(dz, tz);
+        __m512i index = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_add_epi32(_mm512_mullo_epi32(dx, ty), dy), tz), dz);
+
+        // the gathers are 8 doubles wide, so each half of the 16 ints is done in turn
+        __m512d t0 = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), __mmask8(inside),
+                                              _mm512_castsi512_si256(index), p.table, 8);
+        __m512d t1 = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), __mmask8(inside >> 8),
+                                              _mm512_extracti64x4_epi64(index, 1), p.table, 8);
+
+        __m512i q = _mm512_loadu_si512(p.q + j);
+        v0 = _mm512_fmadd_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(q)), t0, v0);
+        v1 = _mm512_fmadd_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(q, 1)), t1, v1);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(v0, v1));
+}
+#endif // LANGMUIR_X86_SIMD
+
+//! the sum for an instruction set, or sumScalar if this build has no vector code
+static SumFunction sumFunction(VectorCoulomb::Isa isa)
+{
+#ifdef LANGMUIR_X86_SIMD
+    switch (isa)
+    {
+    case VectorCoulomb::AVX512: return sumAVX512;
+    case VectorCoulomb::AVX2: return sumAVX2;
+    default: break;
+    }
+#else
+    Q_UNUSED(isa);
+#endif // LANGMUIR_X86_SIMD
+    return sumScalar;
+}
+
+VectorCoulomb::VectorCoulomb(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_isa(Off)
+{
+    QString simd = m_world.parameters().cpuSimd.toLower();
+    if (simd == "off")
+    {
+        return;
+    }
+
+    Isa best = detect();
+    m_isa = best;
+    if (simd == "scalar")
+    {
+        m_isa = Scalar;
+    }
+    else if (simd == "avx2")
+    {
+        m_isa = qMin(AVX2, best);
+    }
+    else if (simd == "avx512")
+    {
+        m_isa = qMin(AVX512, best);
+    }
+    if (simd != "auto" && isaName() != simd)
+    {
+        qDebug("langmuir: cpu.simd = %s is not supported here", qPrintable(simd));
+    }
+    qDebug("langmuir: coulomb sums on the CPU use %s", qPrintable(isaName()));
+
+    m_world.potential().interactionTable(m_table, m_shape);
+}
+
+VectorCoulomb::Isa VectorCoulomb::detect()
+{
+#ifdef LANGMUIR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return AVX2;
+    }
+#endif // LANGMUIR_X86_SIMD
+    return Scalar;
+}
+
+bool VectorCoulomb::isOn() const
+{
+    return m_isa != Off;
+}
+
+QString VectorCoulomb::isaName() const
+{
+    switch (m_isa)
+    {
+    case AVX512: return "avx512";
+    case AVX2: return "avx2";
+    case Scalar: return "scalar";
+    default: break;
+    }
+    return "off";
+}
+
+void VectorCoulomb::compute()
+{
+    SimulationParameters& par = m_world.parameters();
+    Grid& grid = m_world.electronGrid();
+
+    m_carriers = m_world.electrons() + m_world.holes();
+    int numCarriers = m_carriers.size();
+    int numDefects = par.defectsCharge != 0 ? m_world.defectSiteIDs().size() : 0;
+    int numCharges = numCarriers + numDefects;
+    int padded = (numCharges + VECTOR - 1) / VECTOR * VECTOR;
+
+    for (int d = 0; d < 3; d++)
+    {
+        m_source[d].resize(padded);
+        m_current[d].resize(numCarriers);
+        m_future[d].resize(numCarriers);
+    }
+    m_charge.resize(padded);
+    m_currentOut.resize(numCarriers);
+    m_futureOut.resize(numCarriers);
+
+    // the divisions are done once per charge here, not once per pair
+    for (int i = 0; i < numCarriers; i++)
+    {
+        ChargeAgent *charge = m_carriers.at(i);
+        int site = charge->getCurrentSite();
+        int fSite = charge->getFutureSite();
+        m_current[0][i] = grid.getIndexX(site);
+        m_current[1][i] = grid.getIndexY(site);
+        m_current[2][i] = grid.getIndexZ(site);
+        m_future[0][i] = grid.getIndexX(fSite);
+        m_future[1][i] = grid.getIndexY(fSite);
+        m_future[2][i] = grid.getIndexZ(fSite);
+        m_source[0][i] = m_current[0][i];
+        m_source[1][i] = m_current[1][i];
+        m_source[2][i] = m_current[2][i];
+        m_charge[i] = charge->charge();
+    }
+    for (int i = 0; i < numDefects; i++)
+    {
+        int site = m_world.defectSiteIDs().at(i);
+        m_source[0][numCarriers + i] = grid.getIndexX(site);
+        m_source[1][numCarriers + i] = grid.getIndexY(site);
+        m_source[2][numCarriers + i] = grid.getIndexZ(site);
+        m_charge[numCarriers + i] = par.defectsCharge;
+    }
+    for (int i = numCharges; i < padded; i++)
+    {
+        m_source[0][i] = FAR;
+        m_source[1][i] = FAR;
+        m_source[2][i] = FAR;
+        m_charge[i] = 0;
+    }
+
+    m_blocks.resize(0);
+    for (int begin = 0; begin < numCarriers; begin += BLOCK)
+    {
+        Block block;
+        block.begin = begin;
+        block.end = qMin(begin + BLOCK, numCarriers);
+        m_blocks.push_back(block);
+    }
+    m_world.workerPool().run(VectorCoulomb::sumBlocks, this, m_blocks.size());
+}
+
+void VectorCoulomb::sum(int begin, int end)
+{
+    SumFunction function = sumFunction(m_isa);
+
+    Pairs pairs;
+    pairs.x = m_source[0].constData();
+    pairs.y = m_source[1].constData();
+    pairs.z = m_source[2].constData();
+    pairs.q = m_charge.constData();
+    pairs.table = m_table.constData();
+    pairs.tx = m_shape[0];
+    pairs.ty = m_shape[1];
+    pairs.tz = m_shape[2];
+
+    double current[BLOCK];
+    double future[BLOCK];
+    for (int i = begin; i < end; i++)
+    {
+        current[i - begin] = 0;
+        future[i - begin] = 0;
+    }
+
+    // every site of the block is summed against a tile before moving on to the next tile
+    int size = m_charge.size();
+    for (int tile = 0; tile < size; tile += TILE)
+    {
+        pairs.begin = tile;
+        pairs.end = qMin(tile + TILE, size);
+        for (int i = begin; i < end; i++)
+        {
+            current[i - begin] += function(pairs, m_current[0][i], m_current[1][i], m_current[2][i]);
+            future[i - begin] += function(pairs, m_future[0][i], m_future[1][i], m_future[2][i]);
+        }
+    }
+
+    for (int i = begin; i < end; i++)
+    {
+        m_currentOut[i] = current[i - begin];
+        m_futureOut[i] = future[i - begin];
+        m_carriers.at(i)->setCoulombPotentials(current[i - begin], future[i - begin]);
+    }
+}
+
+void VectorCoulomb::sumBlocks(void *self, int begin, int end)
+{
+    VectorCoulomb *vector = static_cast<VectorCoulomb *>(self);
+    for (int i = begin; i < end; i++)
+    {
+        vector->sum(vector->m_blocks[i].begin, vector->m_blocks[i].end);
+    }
+}
+
+double VectorCoulomb::getOutputCurrent(int index) const
+{
+    return m_currentOut[index];
+}
+
+double VectorCoulomb::getOutputFuture(int index) const
+{
+    return m_futureOut[index];
+}
+
+}
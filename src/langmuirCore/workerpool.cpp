@@ -0,0 +1,337 @@
+#include "workerpool.h"
+#include "mpiengine.h"
+#include "parameters.h"
+#include "world.h"
+
+#include <QThread>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QHash>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+namespace Langmuir
+{
+
+/**
+ * @brief A thread that runs WorkerPool::work() for one worker
+ */
+class PinnedThread : public QThread
+{
+public:
+    PinnedThread(WorkerPool *pool, int worker) : m_pool(pool), m_worker(worker)
+    {
+    }
+
+protected:
+    void run()
+    {
+        m_pool->work(m_worker);
+    }
+
+private:
+    WorkerPool *m_pool;
+    int m_worker;
+};
+
+/**
+ * @brief An array for WorkerPool::zero()
+ */
+struct ZeroJob
+{
+    char *data;
+    int size;
+};
+
+// a number from a sysfs file, or fallback if it can not be read
+static int readNumber(const QString& path, int fallback)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return fallback;
+    }
+    bool ok = false;
+    int value = QString(file.readAll()).trimmed().toInt(&ok);
+    return ok ? value : fallback;
+}
+
+// the NUMA node of a CPU, or its socket if the kernel has no NUMA support
+static int nodeOfCpu(int cpu)
+{
+    QString path = QString("/sys/devices/system/cpu/cpu%1").arg(cpu);
+    QStringList nodes = QDir(path).entryList(QStringList() << "node*", QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach (const QString& name, nodes)
+    {
+        bool ok = false;
+        int node = name.mid(4).toInt(&ok);
+        if (ok)
+        {
+            return node;
+        }
+    }
+    return readNumber(path + "/topology/physical_package_id", 0);
+}
+
+// the CPUs this process may run on
+static QList<int> allowedCpus()
+{
+    QList<int> cpus;
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+WorkerPool::WorkerPool(World &world, QObject *parent)
+    : QObject(parent), m_world(world), m_generation(0), m_pending(0), m_function(0), m_context(0),
+      m_count(0), m_quit(false)
+{
+    int workers = qMax(1, m_world.parameters().maxThreads);
+    m_cpus.fill(-1, workers);
+    m_nodes.fill(-1, workers);
+    if (workers == 1)
+    {
+        qDebug("langmuir: 1 worker, on the main thread");
+        return;
+    }
+
+    placeWorkers(workers);
+    for (int k = 0; k < workers; k++)
+    {
+        m_threads.push_back(new PinnedThread(this, k));
+        m_threads.back()->start();
+    }
+
+    // where the workers run, by node
+    if (m_cpus[0] < 0)
+    {
+        qDebug("langmuir: %d workers, not pinned", workers);
+        return;
+    }
+    QMap<int, QStringList> cpusOfNode;
+    for (int k = 0; k < workers; k++)
+    {
+        cpusOfNode[m_nodes[k]] << QString::number(m_cpus[k]);
+    }
+    qDebug("langmuir: %d workers, pinned %s", workers, qPrintable(m_world.parameters().threadPinning));
+    foreach (int node, cpusOfNode.keys())
+    {
+        qDebug("langmuir:     node %d: cpus %s", node, qPrintable(cpusOfNode[node].join(" ")));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_start.wakeAll();
+    m_mutex.unlock();
+    foreach (PinnedThread *thread, m_threads)
+    {
+        thread->wait();
+        delete thread;
+    }
+}
+
+int WorkerPool::size() const
+{
+    return m_cpus.size();
+}
+
+void WorkerPool::run(Function function, void *context, int count)
+{
+    if (m_threads.isEmpty())
+    {
+        if (count > 0)
+        {
+            function(context, 0, count);
+        }
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_function = function;
+    m_context = context;
+    m_count = count;
+    m_pending = m_threads.size();
+    m_generation += 1;
+    m_start.wakeAll();
+    while (m_pending > 0)
+    {
+        m_done.wait(&m_mutex);
+    }
+}
+
+void WorkerPool::zero(void *data, int count, int size)
+{
+    ZeroJob job;
+    job.data = static_cast<char *>(data);
+    job.size = size;
+    run(WorkerPool::zeroShare, &job, count);
+}
+
+int WorkerPool::cpu(int worker) const
+{
+    return m_cpus[worker];
+}
+
+int WorkerPool::node(int worker) const
+{
+    return m_nodes[worker];
+}
+
+void WorkerPool::placeWorkers(int workers)
+{
+    QString pinning = m_world.parameters().threadPinning;
+    if (pinning == "none")
+    {
+        return;
+    }
+#ifndef Q_OS_LINUX
+    qDebug("langmuir: threads.pinning = %s is only supported on Linux, the workers float", qPrintable(pinning));
+    return;
+#endif
+    QList<int> cpus = allowedCpus();
+    if (cpus.isEmpty())
+    {
+        qDebug("langmuir: can not read the CPUs of this process, the workers float");
+        return;
+    }
+
+    // each node's CPUs, one per physical core first, then the second hardware thread of each core...
+    QMap<int, QList<QPair<int, int> > > cpusOfNode;
+    QHash<qint64, int> threadsOfCore;
+    foreach (int cpu, cpus)
+    {
+        QString topology = QString("/sys/devices/system/cpu/cpu%1/topology/").arg(cpu);
+        qint64 core = (qint64(readNumber(topology + "physical_package_id", 0)) << 32) +
+                      readNumber(topology + "core_id", cpu);
+        int sibling = threadsOfCore.value(core, 0);
+        threadsOfCore[core] = sibling + 1;
+        cpusOfNode[nodeOfCpu(cpu)].push_back(qMakePair(sibling, cpu));
+    }
+
+    // ...then in the order the workers take them
+    QList<QPair<int, int> > order;
+    QList<int> nodes = cpusOfNode.keys();
+    foreach (int node, nodes)
+    {
+        qSort(cpusOfNode[node]);
+    }
+    if (pinning == "compact")
+    {
+        foreach (int node, nodes)
+        {
+            for (int i = 0; i < cpusOfNode[node].size(); i++)
+            {
+                order.push_back(qMakePair(cpusOfNode[node][i].second, node));
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; order.size() < cpus.size(); i++)
+        {
+            foreach (int node, nodes)
+            {
+                if (i < cpusOfNode[node].size())
+                {
+                    order.push_back(qMakePair(cpusOfNode[node][i].second, node));
+                }
+            }
+        }
+    }
+    qDebug("langmuir: %d cpus on %d NUMA nodes", cpus.size(), nodes.size());
+
+    // ranks on the same host take the next CPUs along
+    int offset = MpiEngine::localRank() * workers;
+    if (workers * MpiEngine::localSize() > order.size())
+    {
+        qDebug("langmuir: more workers than cpus, some cpus run two");
+    }
+    for (int k = 0; k < workers; k++)
+    {
+        m_cpus[k] = order[(offset + k) % order.size()].first;
+        m_nodes[k] = order[(offset + k) % order.size()].second;
+    }
+}
+
+void WorkerPool::work(int worker)
+{
+#ifdef Q_OS_LINUX
+    if (m_cpus[worker] >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[worker], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        {
+            qDebug("langmuir: can not pin worker %d to cpu %d", worker, m_cpus[worker]);
+        }
+    }
+#endif
+
+    quint64 seen = 0;
+    while (true)
+    {
+        m_mutex.lock();
+        while (!m_quit && m_generation == seen)
+        {
+            m_start.wait(&m_mutex);
+        }
+        if (m_quit)
+        {
+            m_mutex.unlock();
+            return;
+        }
+        seen = m_generation;
+        Function function = m_function;
+        void *context = m_context;
+        int count = m_count;
+        m_mutex.unlock();
+
+        // worker k always gets the k-th share
+        int workers = m_cpus.size();
+        int begin = int(qint64(worker) * count / workers);
+        int end = int(qint64(worker + 1) * count / workers);
+        if (begin < end)
+        {
+            function(context, begin, end);
+        }
+
+        m_mutex.lock();
+        m_pending -= 1;
+        if (m_pending == 0)
+        {
+            m_done.wakeAll();
+        }
+        m_mutex.unlock();
+    }
+}
+
+void WorkerPool::zeroShare(void *context, int begin, int end)
+{
+    ZeroJob& job = *static_cast<ZeroJob *>(context);
+    memset(job.data + qint64(begin) * job.size, 0, size_t(qint64(end - begin) * job.size));
+}
+
+}
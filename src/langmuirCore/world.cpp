@@ -1,10 +1,23 @@
 #include "parameters.h"
 #include "openclhelper.h"
+#include "openclengine.h"
+#include "domainengine.h"
+#include "mpiengine.h"
+#include "vectorcoulomb.h"
+#include "hopproposals.h"
+#include "trapbasins.h"
+#include "skipahead.h"
+#include "carriersorter.h"
+#include "simulation.h"
+#include "calibration.h"
 #include "chargeagent.h"
 #include "sourceagent.h"
 #include "drainagent.h"
 #include "potential.h"
 #include "cubicgrid.h"
+#include "sitestore.h"
+#include "workerpool.h"
+#include "recombinationpairs.h"
 #include "writer.h"
 #include "world.h"
 #include "rand.h"
@@ -33,11 +46,23 @@ World::World(const QString &fileName, int cores, int gpuID, QObject *parent)
       m_recombinationAgent(NULL),
       m_electronGrid(NULL),
       m_holeGrid(NULL),
+      m_workerPool(NULL),
+      m_host(NULL),
+      m_siteStore(NULL),
+      m_recombinationPairs(NULL),
+      m_skipAhead(NULL),
+      m_carrierSorter(NULL),
       m_rand(NULL),
       m_potential(NULL),
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_engine(NULL),
+      m_domainEngine(NULL),
+      m_mpiEngine(NULL),
+      m_vector(NULL),
+      m_hopProposals(NULL),
+      m_trapBasins(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -46,6 +71,47 @@ World::World(const QString &fileName, int cores, int gpuID, QObject *parent)
     initialize(fileName, NULL, NULL, cores, gpuID);
 }
 
+World::World(const QString &fileName, const QStringList &overrides, int cores, int gpuID, QObject *parent)
+    : QObject(parent),
+      m_keyValueParser(NULL),
+      m_checkPointer(NULL),
+      m_electronSourceAgentRight(NULL),
+      m_electronSourceAgentLeft(NULL),
+      m_holeSourceAgentRight(NULL),
+      m_holeSourceAgentLeft(NULL),
+      m_excitonSourceAgent(NULL),
+      m_electronDrainAgentRight(NULL),
+      m_electronDrainAgentLeft(NULL),
+      m_holeDrainAgentRight(NULL),
+      m_holeDrainAgentLeft(NULL),
+      m_recombinationAgent(NULL),
+      m_electronGrid(NULL),
+      m_holeGrid(NULL),
+      m_workerPool(NULL),
+      m_host(NULL),
+      m_siteStore(NULL),
+      m_recombinationPairs(NULL),
+      m_skipAhead(NULL),
+      m_carrierSorter(NULL),
+      m_rand(NULL),
+      m_potential(NULL),
+      m_parameters(NULL),
+      m_logger(NULL),
+      m_ocl(NULL),
+      m_engine(NULL),
+      m_domainEngine(NULL),
+      m_mpiEngine(NULL),
+      m_vector(NULL),
+      m_hopProposals(NULL),
+      m_trapBasins(NULL),
+      m_maxElectrons(0),
+      m_maxHoles(0),
+      m_maxDefects(0),
+      m_maxTraps(0)
+{
+    initialize(fileName, NULL, NULL, cores, gpuID, overrides);
+}
+
 World::World(SimulationParameters &parameters, int cores, int gpuID, QObject *parent)
     : QObject(parent),
       m_keyValueParser(NULL),
@@ -62,11 +128,23 @@ World::World(SimulationParameters &parameters, int cores, int gpuID, QObject *pa
       m_recombinationAgent(NULL),
       m_electronGrid(NULL),
       m_holeGrid(NULL),
+      m_workerPool(NULL),
+      m_host(NULL),
+      m_siteStore(NULL),
+      m_recombinationPairs(NULL),
+      m_skipAhead(NULL),
+      m_carrierSorter(NULL),
       m_rand(NULL),
       m_potential(NULL),
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_engine(NULL),
+      m_domainEngine(NULL),
+      m_mpiEngine(NULL),
+      m_vector(NULL),
+      m_hopProposals(NULL),
+      m_trapBasins(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -91,11 +169,23 @@ World::World(SimulationParameters &parameters, ConfigurationInfo &configInfo, in
       m_recombinationAgent(NULL),
       m_electronGrid(NULL),
       m_holeGrid(NULL),
+      m_workerPool(NULL),
+      m_host(NULL),
+      m_siteStore(NULL),
+      m_recombinationPairs(NULL),
+      m_skipAhead(NULL),
+      m_carrierSorter(NULL),
       m_rand(NULL),
       m_potential(NULL),
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_engine(NULL),
+      m_domainEngine(NULL),
+      m_mpiEngine(NULL),
+      m_vector(NULL),
+      m_hopProposals(NULL),
+      m_trapBasins(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -104,6 +194,47 @@ World::World(SimulationParameters &parameters, ConfigurationInfo &configInfo, in
     initialize("", &parameters, &configInfo, cores, gpuID);
 }
 
+World::World(SimulationParameters &parameters, World &host, QObject *parent)
+    : QObject(parent),
+      m_keyValueParser(NULL),
+      m_checkPointer(NULL),
+      m_electronSourceAgentRight(NULL),
+      m_electronSourceAgentLeft(NULL),
+      m_holeSourceAgentRight(NULL),
+      m_holeSourceAgentLeft(NULL),
+      m_excitonSourceAgent(NULL),
+      m_electronDrainAgentRight(NULL),
+      m_electronDrainAgentLeft(NULL),
+      m_holeDrainAgentRight(NULL),
+      m_holeDrainAgentLeft(NULL),
+      m_recombinationAgent(NULL),
+      m_electronGrid(NULL),
+      m_holeGrid(NULL),
+      m_workerPool(NULL),
+      m_host(&host),
+      m_siteStore(NULL),
+      m_recombinationPairs(NULL),
+      m_skipAhead(NULL),
+      m_carrierSorter(NULL),
+      m_rand(NULL),
+      m_potential(NULL),
+      m_parameters(NULL),
+      m_logger(NULL),
+      m_ocl(NULL),
+      m_engine(NULL),
+      m_domainEngine(NULL),
+      m_mpiEngine(NULL),
+      m_vector(NULL),
+      m_hopProposals(NULL),
+      m_trapBasins(NULL),
+      m_maxElectrons(0),
+      m_maxHoles(0),
+      m_maxDefects(0),
+      m_maxTraps(0)
+{
+    initialize("", &parameters, NULL, host.parameters().maxThreads);
+}
+
 World::~World()
 {
     for(int i = 0; i < m_sources.size(); i++)
@@ -134,7 +265,21 @@ World::~World()
     delete m_potential;
     delete m_electronGrid;
     delete m_holeGrid;
+    delete m_siteStore;
+    delete m_recombinationPairs;
+    delete m_skipAhead;
+    delete m_carrierSorter;
     delete m_logger;
+    delete m_engine;
+    delete m_domainEngine;
+    delete m_mpiEngine;
+    delete m_vector;
+    delete m_hopProposals;
+    delete m_trapBasins;
+    if (m_host == NULL)
+    {
+        delete m_workerPool;
+    }
     delete m_ocl;
     delete m_keyValueParser;
     delete m_checkPointer;
@@ -160,6 +305,31 @@ Grid& World::holeGrid()
     return *m_holeGrid;
 }
 
+WorkerPool& World::workerPool()
+{
+    return *m_workerPool;
+}
+
+SiteStore& World::siteStore()
+{
+    return *m_siteStore;
+}
+
+RecombinationPairs& World::recombinationPairs()
+{
+    return *m_recombinationPairs;
+}
+
+SkipAhead& World::skipAhead()
+{
+    return *m_skipAhead;
+}
+
+CarrierSorter& World::carrierSorter()
+{
+    return *m_carrierSorter;
+}
+
 Potential& World::potential()
 {
     return *m_potential;
@@ -185,6 +355,47 @@ OpenClHelper& World::opencl()
     return *m_ocl;
 }
 
+OpenClEngine& World::openclEngine()
+{
+    return *m_engine;
+}
+
+DomainEngine& World::domainEngine()
+{
+    return *m_domainEngine;
+}
+
+MpiEngine& World::mpiEngine()
+{
+    return *m_mpiEngine;
+}
+
+VectorCoulomb& World::vectorCoulomb()
+{
+    return *m_vector;
+}
+
+HopProposals& World::hopProposals()
+{
+    return *m_hopProposals;
+}
+
+TrapBasins& World::trapBasins()
+{
+    return *m_trapBasins;
+}
+
+StepKernels& World::stepKernels()
+{
+    return m_stepKernels;
+}
+
+void World::chooseStepKernels()
+{
+    m_stepKernels.step = Simulation::chooseStep(parameters());
+    m_stepKernels.coulombCPU = ChargeAgent::chooseCoulombCPU(parameters());
+}
+
 QList<SourceAgent*>& World::sources()
 {
     return m_sources;
@@ -466,11 +677,19 @@ double World::percentElectronAgents()
 
 bool World::atMaxElectrons()
 {
+    if (m_mpiEngine != NULL)
+    {
+        return m_mpiEngine->atMaxElectrons();
+    }
     return numElectronAgents() >= maxElectronAgents();
 }
 
 bool World::atMaxHoles()
 {
+    if (m_mpiEngine != NULL)
+    {
+        return m_mpiEngine->atMaxHoles();
+    }
     return numHoleAgents() >= maxHoleAgents();
 }
 
@@ -498,7 +717,7 @@ void World::alterMaxThreads(int cores)
     qDebug("langmuir: QThreadPool::maxThreadCount set to %d", threadPool.maxThreadCount());
 }
 
-void World::initialize(const QString &fileName, SimulationParameters *pparameters, ConfigurationInfo *pconfigInfo, int cores, int gpuID)
+void World::initialize(const QString &fileName, SimulationParameters *pparameters, ConfigurationInfo *pconfigInfo, int cores, int gpuID, const QStringList &overrides)
 {
     // check function arguments
     if (fileName.isEmpty()) {
@@ -554,7 +773,7 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
 
     // Parse the input file
     if (!fileName.isEmpty()) {
-        m_checkPointer->load(fileName, configInfo);
+        m_checkPointer->load(fileName, configInfo, overrides);
     }
     else {
         qDebug("langmuir: skipping input file");
@@ -568,28 +787,90 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     NodeFileParser nfparser;
     QString hostName = nfparser.hostName();
 
-    // Use nodefile if cores wasn't given
+    // Use nodefile if cores wasn't given; MPI ranks on the same host split its cores
     if (cores < 0) {
         cores = nfparser.numProc(hostName);
+        if (MpiEngine::localSize() > 1) {
+            cores = qMax(1, cores / MpiEngine::localSize());
+        }
     }
 
-    // Use gpufile if gpuID wasn't given
-    if (gpuID < 0) {
-        gpuID = nfparser.GPUid(hostName, 0);
+    // Use gpufile if gpuID wasn't given, otherwise opencl.device.id is used; MPI ranks take turns
+    if (gpuID < 0 && !nfparser.gpuFile().isEmpty()) {
+        gpuID = nfparser.GPUid(hostName, MpiEngine::localRank() % qMax(1, nfparser.numGPUs(hostName)));
     }
 
     // Change the number of threads
     alterMaxThreads(cores);
 
+    // Every MPI rank builds the same World from rank 0's seed, and only rank 0 writes output;
+    // a scratch World (Calibration) stays on its own rank
+    if (MpiEngine::size() > 1 && m_host == NULL)
+    {
+        quint64 seed = MpiEngine::broadcastSeed(m_rand->seed());
+        if (seed != m_rand->seed())
+        {
+            m_rand->seed(seed);
+        }
+        if (MpiEngine::rank() != 0)
+        {
+            m_parameters->outputIsOn = false;
+        }
+    }
+
     // Save the seed that has been used
     m_parameters->randomSeed = m_rand->seed();
     qDebug() << "langmuir: random.seed is" << parameters().randomSeed;
 
+    // Create the workers (before the site storage, so they can place it); a scratch World uses its host's
+    if (m_host != NULL)
+    {
+        m_workerPool = &m_host->workerPool();
+    }
+    else
+    {
+        m_workerPool = new WorkerPool(refWorld, this);
+    }
+
+    // Create the site storage both grids share
+    m_siteStore = new SiteStore(refWorld, this);
+    qDebug("langmuir: site storage uses %.2f bytes per site", m_siteStore->bytesPerSite());
+
+    // Create the electron-hole pair list the grids keep up to date
+    m_recombinationPairs = new RecombinationPairs(refWorld, this);
+
+    // Create the queue of parked carriers the grids wake
+    m_skipAhead = new SkipAhead(refWorld, this);
+
+    // Create the trap basins, whose sleepers the grids wake (found once the traps are placed)
+    m_trapBasins = new TrapBasins(refWorld, this);
+
+    // Create the sorter that keeps the carrier lists in site order
+    m_carrierSorter = new CarrierSorter(refWorld, this);
+
     // Create Electron Grid
-    m_electronGrid = new Grid(refWorld, this);
+    m_electronGrid = new Grid(refWorld, SiteStore::Electrons, this);
 
     // Create Hole Grid
-    m_holeGrid = new Grid(refWorld, this);
+    m_holeGrid = new Grid(refWorld, SiteStore::Holes, this);
+
+    // The input file stores canonical site IDs; switch them to grid.layout
+    for (int i = 0; i < configInfo.electrons.size(); i++)
+    {
+        configInfo.electrons[i] = m_electronGrid->siteFromCanonical(configInfo.electrons[i]);
+    }
+    for (int i = 0; i < configInfo.holes.size(); i++)
+    {
+        configInfo.holes[i] = m_holeGrid->siteFromCanonical(configInfo.holes[i]);
+    }
+    for (int i = 0; i < configInfo.defects.size(); i++)
+    {
+        configInfo.defects[i] = m_electronGrid->siteFromCanonical(configInfo.defects[i]);
+    }
+    for (int i = 0; i < configInfo.traps.size(); i++)
+    {
+        configInfo.traps[i] = m_electronGrid->siteFromCanonical(configInfo.traps[i]);
+    }
 
     // Calculate the max number of holes
     m_maxHoles = parameters().holePercentage*double(holeGrid().volume());
@@ -648,10 +929,51 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     // precalculate and store coupling constants
     potential().updateCouplingConstants();
 
+    // Create the hop proposal tables (they use the coupling constants)
+    m_hopProposals = new HopProposals(refWorld, this);
+
+    // Find the trap basins carriers can jump out of (they use the traps and coupling constants)
+    trapBasins().findBasins();
+
+    // Create the CPU coulomb sums (they use the arrays above)
+    m_vector = new VectorCoulomb(refWorld, this);
+
+    // Pick the versions of the step functions for these parameters, once
+    chooseStepKernels();
+
     // Initialize OpenCL
     opencl().initializeOpenCL(gpuID);
     opencl().toggleOpenCL(parameters().useOpenCL);
 
+    // Replace the guessed opencl.threshold (and work sizes) with measured ones
+    if (parameters().openclCalibrate && parameters().useOpenCL)
+    {
+        Calibration calibration(refWorld);
+        calibration.run();
+    }
+
+    // Create the device engine (it needs the kernels built above)
+    if (parameters().openclEngine)
+    {
+        if (!parameters().okCL)
+        {
+            qFatal("langmuir: OpenCL errors, yet opencl.engine=True");
+        }
+        m_engine = new OpenClEngine(refWorld, this);
+    }
+
+    // Create the slabs for running steps on the host threads
+    if (parameters().domainSlabs > 0)
+    {
+        m_domainEngine = new DomainEngine(refWorld, this);
+    }
+
+    // Split the slabs across the MPI ranks (last, as it draws from the generator)
+    if (MpiEngine::size() > 1 && m_host == NULL)
+    {
+        m_mpiEngine = new MpiEngine(refWorld, this);
+    }
+
     // Output parameters to terminal
     qDebug() << *m_keyValueParser;
 }
@@ -125,7 +125,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << &charge              << ' '
                          << charge.lifetime()    << ' '
                          << charge.pathlength()  << '\n';
@@ -144,7 +144,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << &charge              << ' '
                          << charge.lifetime()    << ' '
                          << charge.pathlength()  << '\n';
@@ -162,7 +162,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << i                    << '\n';
             }
         }
@@ -178,7 +178,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << -1                   << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << i                    << '\n';
             }
         }
@@ -215,7 +215,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << &charge              << ' '
                          << charge.lifetime()    << ' '
                          << charge.pathlength()  << '\n';
@@ -245,7 +245,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << &charge              << ' '
                          << charge.lifetime()    << ' '
                          << charge.pathlength()  << '\n';
@@ -274,7 +274,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << i                    << '\n';
             }
             for (int i = 0; i < m_world.maxDefects() - m_world.numDefects(); i++)
@@ -300,7 +300,7 @@ void XYZWriter::write()
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
                          << -1                   << ' '
-                         << site                 << ' '
+                         << grid.canonicalSite(site) << ' '
                          << i                    << '\n';
             }
         }
@@ -382,7 +382,7 @@ void CarrierWriter::write(ChargeAgent &charge)
 {
     Grid &grid = charge.getGrid();
     int site = charge.getCurrentSite();
-    m_stream << site << ' '
+    m_stream << grid.canonicalSite(site) << ' '
              << grid.getIndexX(site) << ' '
              << grid.getIndexY(site) << ' '
              << grid.getIndexZ(site) << ' '
@@ -402,7 +402,7 @@ void ExcitonWriter::write(ChargeAgent &charge1, ChargeAgent &charge2, bool recom
     Grid &grid2 = charge2.getGrid();
     int site2 = charge2.getCurrentSite();
 
-    m_stream << site1 << ' '
+    m_stream << grid1.canonicalSite(site1) << ' '
              << grid1.getIndexX(site1) << ' '
              << grid1.getIndexY(site1) << ' '
              << grid1.getIndexZ(site1) << ' '
@@ -410,7 +410,7 @@ void ExcitonWriter::write(ChargeAgent &charge1, ChargeAgent &charge2, bool recom
              << &charge1 << ' '
              << charge1.lifetime() << ' '
              << charge1.pathlength() << ' '
-             << site2 << ' '
+             << grid2.canonicalSite(site2) << ' '
              << grid2.getIndexX(site2) << ' '
              << grid2.getIndexY(site2) << ' '
              << grid2.getIndexZ(site2) << ' '
@@ -529,7 +529,7 @@ void Logger::saveGridPotential(const QString& name)
             for(int k = 0; k < m_world.electronGrid().zSize(); k++)
             {
                 int si = grid.getIndexS(i,j,k);
-                stream << si
+                stream << grid.canonicalSite(si)
                        << i
                        << j
                        << k
@@ -568,7 +568,8 @@ void Logger::saveCoulombEnergy(const QString& name)
         {
             for(int k = 0; k < grid.zSize(); k++)
             {
-                int si = grid.getIndexS(i,j,k);
+                // coulomb1 / gauss1 fill the output in canonical order
+                int si = grid.canonicalSite(grid.getIndexS(i,j,k));
                 stream << si << ' '
                        << i  << ' '
                        << j  << ' '
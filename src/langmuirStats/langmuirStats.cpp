@@ -0,0 +1,424 @@
+#include "simulation.h"
+#include "chargeagent.h"
+#include "fluxagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "clparser.h"
+#include "world.h"
+
+#include <QCoreApplication>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QPair>
+#include <QtAlgorithms>
+
+#include <boost/math/distributions/students_t.hpp>
+
+#include <cmath>
+
+using namespace Langmuir;
+
+/**
+ * @brief Observables measured over one run, keyed by name
+ *
+ * Scalars are drain/source currents (successes per step), mean carrier counts
+ * and mobility (pathlength / lifetime averaged over carriers).  The occupancy
+ * profile is stored as one scalar per x-bin.
+ */
+typedef QMap<QString, double> Observables;
+
+/**
+ * @brief Summary of one observable over all seeds
+ */
+struct Sample
+{
+    Sample() : n(0), mean(0), variance(0)
+    {
+    }
+
+    Sample(const QList<double>& values) : n(values.size()), mean(0), variance(0)
+    {
+        foreach (double value, values)
+        {
+            mean += value;
+        }
+        mean = n > 0 ? mean / n : 0;
+        foreach (double value, values)
+        {
+            variance += (value - mean) * (value - mean);
+        }
+        variance = n > 1 ? variance / (n - 1) : 0;
+    }
+
+    //! half width of the (1 - alpha) confidence interval of the mean
+    double halfWidth(double alpha) const
+    {
+        if (n < 2 || variance <= 0)
+        {
+            return 0;
+        }
+        boost::math::students_t dist(n - 1);
+        return boost::math::quantile(boost::math::complement(dist, alpha / 2)) * sqrt(variance / n);
+    }
+
+    int n;
+    double mean;
+    double variance;
+};
+
+/**
+ * @brief Welch's unequal variance t-test
+ */
+struct Welch
+{
+    Welch(const Sample& a, const Sample& b, double alpha)
+        : difference(b.mean - a.mean), halfWidth(0), p(1)
+    {
+        double va = a.variance / a.n;
+        double vb = b.variance / b.n;
+        double se2 = va + vb;
+        if (se2 <= 0)
+        {
+            // Both samples are constant; they either agree or they do not
+            p = (difference == 0) ? 1 : 0;
+            return;
+        }
+        double df = se2 * se2 / (va * va / (a.n - 1) + vb * vb / (b.n - 1));
+        boost::math::students_t dist(df);
+        double t = difference / sqrt(se2);
+        p = 2 * boost::math::cdf(boost::math::complement(dist, fabs(t)));
+        halfWidth = boost::math::quantile(boost::math::complement(dist, alpha / 2)) * sqrt(se2);
+    }
+
+    //! candidate mean - reference mean
+    double difference;
+    //! half width of the (1 - alpha) confidence interval of the difference
+    double halfWidth;
+    //! two sided p-value
+    double p;
+};
+
+/**
+ * @brief Read the [Parameters] section of an input deck
+ */
+static QStringList readParameters(const QString& fileName)
+{
+    QFile handle(fileName);
+    if (!handle.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        qFatal("langmuir: can not open file: %s", qPrintable(fileName));
+    }
+
+    QStringList lines;
+    bool inParameters = false;
+    QTextStream stream(&handle);
+    QString line = stream.readLine();
+    while (!line.isNull())
+    {
+        QString trimmed = line.trimmed();
+        if (trimmed.startsWith("["))
+        {
+            inParameters = (trimmed.toLower() == "[parameters]");
+        }
+        else if (trimmed.toLower() == "end")
+        {
+            inParameters = false;
+        }
+        else if (inParameters)
+        {
+            lines.push_back(trimmed);
+        }
+        line = stream.readLine();
+    }
+    return lines;
+}
+
+static void addProfile(World& world, QList<ChargeAgent*>& charges, QVector<double>& profile)
+{
+    int bins = profile.size();
+    foreach (ChargeAgent *charge, charges)
+    {
+        Grid& grid = charge->getGrid();
+        int x = grid.getIndexX(charge->getCurrentSite());
+        profile[qMin(x * bins / world.parameters().gridX, bins - 1)] += 1;
+    }
+}
+
+/**
+ * @brief Equilibrate, then measure the observables over a window of steps
+ *
+ * The deck's parameters are written to a temporary input file followed by the
+ * overrides; the KeyValueParser keeps the last value of a key.
+ */
+static Observables run(const QStringList& deck, const QStringList& overrides, int seed,
+                       int equilibrate, int steps, int bins, int cores)
+{
+    QStringList lines = deck;
+    lines << "output.is.on = false"
+          << "current.step = 0"
+          << overrides
+          << "random.seed = " + QString::number(seed);
+
+    QTemporaryFile input(QDir::tempPath() + "/langmuir-stats-XXXXXX.inp");
+    if (!input.open())
+    {
+        qFatal("langmuir: can not open temporary file");
+    }
+    {
+        QTextStream stream(&input);
+        stream << "[Parameters]\n";
+        foreach (QString line, lines)
+        {
+            stream << line << "\n";
+        }
+        stream << "end\n";
+        stream.flush();
+    }
+    input.flush();
+
+    World world(input.fileName(), cores);
+    Simulation simulation(world);
+
+    simulation.performIterations(equilibrate);
+
+    QList<unsigned long int> start;
+    foreach (FluxAgent *flux, world.fluxes())
+    {
+        start.push_back(flux->successes());
+    }
+
+    double electrons = 0;
+    double holes = 0;
+    QVector<double> profile(bins, 0.0);
+    for (int i = 0; i < steps; i++)
+    {
+        simulation.performIterations(1);
+        electrons += world.numElectronAgents();
+        holes += world.numHoleAgents();
+        addProfile(world, world.electrons(), profile);
+        addProfile(world, world.holes(), profile);
+    }
+
+    Observables observables;
+    for (int i = 0; i < world.fluxes().size(); i++)
+    {
+        FluxAgent *flux = world.fluxes().at(i);
+        observables[QString("current:%1").arg(flux->objectName())] =
+                double(flux->successes() - start.at(i)) / steps;
+    }
+    observables["carriers:electrons"] = electrons / steps;
+    observables["carriers:holes"] = holes / steps;
+
+    // Fraction of steps in which a carrier hopped, averaged over carriers alive at the end
+    double mobility = 0;
+    int count = 0;
+    QList<ChargeAgent*> charges = world.electrons() + world.holes();
+    foreach (ChargeAgent *charge, charges)
+    {
+        if (charge->lifetime() > 0)
+        {
+            mobility += double(charge->pathlength()) / double(charge->lifetime());
+            count++;
+        }
+    }
+    observables["mobility:pathlength/lifetime"] = count > 0 ? mobility / count : 0;
+
+    double binVolume = double(world.electronGrid().volume()) / bins;
+    for (int i = 0; i < bins; i++)
+    {
+        observables[QString("profile:%1").arg(i, 3, 10, QChar('0'))] = profile[i] / (steps * binVolume);
+    }
+
+    return observables;
+}
+
+static QMap<QString, QList<double> > runSeeds(const QString& name, const QStringList& deck,
+                                               const QStringList& overrides, int seeds, int firstSeed,
+                                               int equilibrate, int steps, int bins, int cores)
+{
+    QMap<QString, QList<double> > values;
+    for (int i = 0; i < seeds; i++)
+    {
+        qDebug("langmuir: %s seed %d of %d", qPrintable(name), i + 1, seeds);
+        Observables observables = run(deck, overrides, firstSeed + i, equilibrate, steps, bins, cores);
+        foreach (QString key, observables.keys())
+        {
+            values[key].push_back(observables[key]);
+        }
+    }
+    return values;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("compare steady-state observables of a candidate configuration against the reference");
+    clparser.add("-n", "cores", "the number of cores to use");
+    clparser.add("--reference", "reference", "key=value overrides for the reference, separated by ;");
+    clparser.add("--candidate", "candidate", "key=value overrides for the candidate, separated by ;");
+    clparser.add("--seeds", "seeds", "number of seeds per configuration (32)");
+    clparser.add("--first-seed", "first", "first random.seed (1)");
+    clparser.add("--equilibrate", "equilibrate", "steps discarded before measuring (2000)");
+    clparser.add("--steps", "steps", "steps measured (5000)");
+    clparser.add("--bins", "bins", "number of x-bins in the occupancy profile (16)");
+    clparser.add("--alpha", "alpha", "family-wise significance level, Holm corrected (0.01)");
+    clparser.add("--output", "output", "csv report to write");
+    clparser.addBool("--fast", "fast", "8 seeds, 500 + 500 steps; for gating performance work");
+    clparser.addPositional("input", "input file");
+    clparser.parse(args);
+
+    int cores = clparser.get<int>("cores", -1);
+    QString inputFile = clparser.get<QString>("input", "sim.inp");
+    QStringList reference = clparser.get<QString>("reference", "").split(";", QString::SkipEmptyParts);
+    QStringList candidate = clparser.get<QString>("candidate", "").split(";", QString::SkipEmptyParts);
+    bool fast = clparser.get<bool>("fast", false);
+    int seeds = clparser.get<int>("seeds", fast ? 8 : 32);
+    int firstSeed = clparser.get<int>("first", 1);
+    int equilibrate = clparser.get<int>("equilibrate", fast ? 500 : 2000);
+    int steps = clparser.get<int>("steps", fast ? 500 : 5000);
+    int bins = clparser.get<int>("bins", 16);
+    double alpha = clparser.get<float>("alpha", 0.01f);
+    QString output = clparser.get<QString>("output", "");
+
+    if (seeds < 2)
+    {
+        qFatal("langmuir: --seeds(%d) must be >= 2", seeds);
+    }
+    if (steps < 1 || bins < 1)
+    {
+        qFatal("langmuir: --steps(%d) and --bins(%d) must be >= 1", steps, bins);
+    }
+    if (alpha <= 0 || alpha >= 1)
+    {
+        qFatal("langmuir: --alpha(%f) must be between 0 and 1", alpha);
+    }
+
+    QStringList deck = readParameters(inputFile);
+
+    // Both configurations use the same seeds so the comparison is paired by
+    // construction, but the test itself does not assume pairing
+    QMap<QString, QList<double> > ref = runSeeds("reference", deck, reference, seeds, firstSeed,
+                                                  equilibrate, steps, bins, cores);
+    QMap<QString, QList<double> > can = runSeeds("candidate", deck, candidate, seeds, firstSeed,
+                                                  equilibrate, steps, bins, cores);
+
+    QTextStream report(stdout);
+    QFile handle;
+    QTextStream csv;
+    if (!output.isEmpty())
+    {
+        handle.setFileName(output);
+        if (!handle.open(QIODevice::WriteOnly | QIODevice::Text))
+        {
+            qFatal("langmuir: can not open file: %s", qPrintable(output));
+        }
+        csv.setDevice(&handle);
+        csv.setRealNumberPrecision(10);
+        csv << "observable,reference.mean,reference.ci,candidate.mean,candidate.ci,"
+               "difference,difference.ci,p,alpha,result\n";
+    }
+
+    // Holm over the families of tests: each scalar observable is one family and the
+    // profile bins together are another, whose p-value is the smallest bin p-value
+    // times the number of bins (Bonferroni within the profile)
+    int failed = 0;
+    int profileBins = 0;
+    QMap<QString, double> familyP;
+    foreach (QString key, ref.keys())
+    {
+        if (!can.contains(key))
+        {
+            qDebug("langmuir: %s is missing from the candidate", qPrintable(key));
+            failed++;
+            continue;
+        }
+        profileBins += key.startsWith("profile:") ? 1 : 0;
+    }
+    foreach (QString key, ref.keys())
+    {
+        if (!can.contains(key))
+        {
+            continue;
+        }
+        Welch test(Sample(ref[key]), Sample(can[key]), alpha);
+        bool profile = key.startsWith("profile:");
+        QString family = profile ? "profile" : key;
+        double p = profile ? qMin(1.0, test.p * profileBins) : test.p;
+        familyP[family] = familyP.contains(family) ? qMin(familyP[family], p) : p;
+    }
+
+    QList<QPair<double, QString> > order;
+    foreach (QString family, familyP.keys())
+    {
+        order.push_back(qMakePair(familyP[family], family));
+    }
+    qSort(order);
+
+    // family k (by p-value) is tested at alpha / (families - k), until one passes
+    int families = order.size();
+    QMap<QString, double> familyLevel;
+    QMap<QString, bool> familyDiffers;
+    bool rejecting = true;
+    for (int k = 0; k < families; k++)
+    {
+        double level = alpha / (families - k);
+        rejecting = rejecting && order[k].first < level;
+        familyLevel[order[k].second] = level;
+        familyDiffers[order[k].second] = rejecting;
+    }
+
+    foreach (QString key, ref.keys())
+    {
+        if (!can.contains(key))
+        {
+            continue;
+        }
+
+        // The corrected level of this test; the profile bins share the level of the profile
+        bool profile = key.startsWith("profile:");
+        QString family = profile ? "profile" : key;
+        double level = profile ? familyLevel[family] / profileBins : familyLevel[family];
+
+        Sample a(ref[key]);
+        Sample b(can[key]);
+        Welch test(a, b, level);
+        bool pass = !(familyDiffers[family] && test.p < level);
+        if (!pass)
+        {
+            failed++;
+        }
+
+        report << qSetFieldWidth(0) << left
+               << QString("%1 %2 ref %3 +/- %4  cand %5 +/- %6  diff %7 +/- %8  p %9  level %10")
+                  .arg(pass ? "PASS" : "FAIL")
+                  .arg(key, -32)
+                  .arg(a.mean, 12, 'g', 6).arg(a.halfWidth(level), -10, 'g', 3)
+                  .arg(b.mean, 12, 'g', 6).arg(b.halfWidth(level), -10, 'g', 3)
+                  .arg(test.difference, 12, 'g', 3).arg(test.halfWidth, -10, 'g', 3)
+                  .arg(test.p, -10, 'g', 3).arg(level, 0, 'g', 3)
+               << "\n";
+
+        if (!output.isEmpty())
+        {
+            csv << key << "," << a.mean << "," << a.halfWidth(level) << ","
+                << b.mean << "," << b.halfWidth(level) << ","
+                << test.difference << "," << test.halfWidth << ","
+                << test.p << "," << level << "," << (pass ? "PASS" : "FAIL") << "\n";
+        }
+    }
+    report.flush();
+
+    qDebug("langmuir: %d of %d observables differ (alpha = %g, %d seeds, %d steps)",
+           failed, ref.size(), alpha, seeds, steps);
+    qDebug("langmuir: Holm correction over %d families (the %d profile bins count as one): "
+           "levels from %g to %g", families, profileBins, families > 0 ? alpha / families : alpha, alpha);
+
+    return failed == 0 ? 0 : 1;
+}
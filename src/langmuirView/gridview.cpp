@@ -447,12 +447,14 @@ void GridViewGL::toggleCoulombStatus(int checkState)
     case Qt::Checked :
     {
         pWorld->parameters().coulombCarriers = true;
+        pWorld->chooseStepKernels();
         emit coulombStatusChanged(Qt::Checked);
         break;
     }
     default :
     {
         pWorld->parameters().coulombCarriers = false;
+        pWorld->chooseStepKernels();
         pWorld->opencl().toggleOpenCL(false);
         emit openCLStatusChanged(Qt::Unchecked);
         emit coulombStatusChanged(Qt::Unchecked);
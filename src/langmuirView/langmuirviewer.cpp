@@ -1289,6 +1289,7 @@ void LangmuirViewer::toggleCoulomb(bool on)
     }
 
     m_world->parameters().coulombCarriers = on;
+    m_world->chooseStepKernels();
 
     emit isUsingCoulomb(m_world->parameters().coulombCarriers);
 
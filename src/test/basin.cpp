@@ -0,0 +1,298 @@
+#include <QCoreApplication>
+#include <QDebug>
+
+#include "chargeagent.h"
+#include "trapbasins.h"
+#include "simulation.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "clparser.h"
+#include "world.h"
+
+#include <cmath>
+
+using namespace Langmuir;
+
+/**
+ * @brief Parameters for a small single layer device with clusters of traps and nothing else
+ */
+static SimulationParameters basinParameters(int seed, double trapPotential)
+{
+    SimulationParameters par;
+    par.outputIsOn = false;
+    par.randomSeed = seed;
+    par.gridX = 24;
+    par.gridY = 24;
+    par.gridZ = 1;
+    par.electronPercentage = 0;
+    par.holePercentage = 0;
+    par.coulombCarriers = false;
+    par.useOpenCL = false;
+    par.trapPercentage = 0.05;
+    par.trapPotential = trapPotential;
+    par.seedPercentage = 0.2;
+    par.trapAccelerate = true;
+    par.trapBasinSteps = 2;
+    return par;
+}
+
+/**
+ * @brief Walk one electron out of a basin step by step, many times, and compare with TrapBasins
+ * @return 0 on success, 1 on failure
+ */
+static int check(World& world, int basin, int trials)
+{
+    TrapBasins& basins = world.trapBasins();
+    Grid& grid = world.electronGrid();
+    int start = basins.sites(basin).first();
+    const QVector<int>& exits = basins.exits(basin);
+
+    double mean = basins.meanSteps(basin, start, -1);
+    QVector<double> chance = basins.exitProbabilities(basin, start, -1);
+
+    // brute force, with the same moves as Simulation::step()
+    double sum = 0;
+    double sum2 = 0;
+    double hops = 0;
+    QVector<int> counts(exits.size(), 0);
+    for (int t = 0; t < trials; t++)
+    {
+        ElectronAgent *electron = new ElectronAgent(world, start);
+        int steps = 0;
+        while (basins.basin(electron->getCurrentSite()) == basin)
+        {
+            electron->chooseFuture();
+            electron->decideFuture();
+            electron->completeTick();
+            steps++;
+        }
+        sum += steps;
+        sum2 += double(steps) * steps;
+        hops += electron->pathlength() - 1;
+        counts[exits.indexOf(electron->getCurrentSite())] += 1;
+        grid.unregisterAgent(electron);
+        delete electron;
+    }
+
+    double bruteMean = sum / trials;
+    double bruteStdev = sqrt(qMax(0.0, sum2 / trials - bruteMean * bruteMean));
+    double standardError = bruteStdev / sqrt(double(trials));
+
+    // total variation distance between the exit site distributions
+    double distance = 0;
+    for (int e = 0; e < exits.size(); e++)
+    {
+        distance += 0.5 * fabs(double(counts[e]) / trials - chance[e]);
+    }
+
+    // the exit time is drawn from a geometric distribution with the exact mean
+    double geometricStdev = sqrt(qMax(0.0, mean * (mean - 1)));
+
+    bool ok = fabs(bruteMean - mean) <= 5 * standardError &&
+              distance <= 2 * sqrt(double(exits.size()) / trials);
+
+    qDebug("langmuir: %s basin %d: %d sites, %d exits, %d trials",
+           ok ? "PASS" : "FAIL", basin, basins.sites(basin).size(), exits.size(), trials);
+    qDebug("langmuir:     exit steps   chain %.2f brute %.2f +- %.2f (%+.2f%%)",
+           mean, bruteMean, standardError, 100 * (bruteMean - mean) / mean);
+    qDebug("langmuir:     exit stdev   geometric %.2f brute %.2f (%+.2f%%)",
+           geometricStdev, bruteStdev, 100 * (geometricStdev - bruteStdev) / qMax(bruteStdev, 1e-300));
+    qDebug("langmuir:     hops inside  brute %.2f per exit", hops / trials);
+    qDebug("langmuir:     exit sites   total variation distance %.4f", distance);
+
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Run one electron out of a basin with Simulation and trap.accelerate, many times, and compare with TrapBasins
+ * @return 0 on success, 1 on failure
+ *
+ * The electron falls asleep and leaves on the drawn step, so this checks the lifetime and path
+ * length it is given against the exact means of the chain, and the exit sites against their chances.
+ */
+static int simulate(World& world, Simulation& sim, int basin, int trials)
+{
+    TrapBasins& basins = world.trapBasins();
+    Grid& grid = world.electronGrid();
+    int start = basins.sites(basin).first();
+    const QVector<int>& exits = basins.exits(basin);
+
+    double mean = basins.meanSteps(basin, start, -1);
+    double meanHops = basins.meanHops(basin, start, -1);
+    QVector<double> chance = basins.exitProbabilities(basin, start, -1);
+
+    double sum = 0;
+    double sum2 = 0;
+    double hops = 0;
+    double hops2 = 0;
+    int slept = 0;
+    QVector<int> counts(exits.size(), 0);
+    for (int t = 0; t < trials; t++)
+    {
+        ElectronAgent *electron = new ElectronAgent(world, start);
+        world.electrons().push_back(electron);
+        bool asleep = false;
+        while (basins.basin(electron->getCurrentSite()) == basin)
+        {
+            sim.performIterations(1);
+            asleep = asleep || electron->basinWakeStep() != 0;
+        }
+        double steps = electron->lifetime();
+        double inside = electron->pathlength() - 1;
+        sum += steps;
+        sum2 += steps * steps;
+        hops += inside;
+        hops2 += inside * inside;
+        slept += asleep ? 1 : 0;
+        counts[exits.indexOf(electron->getCurrentSite())] += 1;
+        world.electrons().removeOne(electron);
+        grid.unregisterAgent(electron);
+        delete electron;
+    }
+
+    double simMean = sum / trials;
+    double standardError = sqrt(qMax(0.0, sum2 / trials - simMean * simMean) / trials);
+    double simHops = hops / trials;
+    double hopsError = sqrt(qMax(0.0, hops2 / trials - simHops * simHops) / trials);
+
+    double distance = 0;
+    for (int e = 0; e < exits.size(); e++)
+    {
+        distance += 0.5 * fabs(double(counts[e]) / trials - chance[e]);
+    }
+
+    // the drawn hops are rounded to whole hops
+    bool ok = slept > 0 &&
+              fabs(simMean - mean) <= 5 * standardError &&
+              fabs(simHops - meanHops) <= 5 * hopsError + 0.5 &&
+              distance <= 2 * sqrt(double(exits.size()) / trials);
+
+    qDebug("langmuir: %s basin %d with trap.accelerate: %d trials, %d slept",
+           ok ? "PASS" : "FAIL", basin, trials, slept);
+    qDebug("langmuir:     lifetime     chain %.2f simulation %.2f +- %.2f (%+.2f%%)",
+           mean, simMean, standardError, 100 * (simMean - mean) / mean);
+    qDebug("langmuir:     hops inside  chain %.2f simulation %.2f +- %.2f",
+           meanHops, simHops, hopsError);
+    qDebug("langmuir:     exit sites   total variation distance %.4f", distance);
+
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Wake an electron asleep in a basin halfway through its sleep by placing another next to it
+ * @return 0 on success, 1 on failure
+ *
+ * Checks that Grid wakes it, and that its path length is given the hops of the steps it slept.
+ */
+static int wakeEarly(World& world, Simulation& sim, int basin, int trials)
+{
+    TrapBasins& basins = world.trapBasins();
+    Grid& grid = world.electronGrid();
+    int start = basins.sites(basin).first();
+    int other = basins.exits(basin).first();
+
+    int wakes = 0;
+    int missed = 0;
+    double credited = 0;
+    double expected = 0;
+    for (int t = 0; t < trials; t++)
+    {
+        ElectronAgent *electron = new ElectronAgent(world, start);
+        world.electrons().push_back(electron);
+        while (basins.basin(electron->getCurrentSite()) == basin && electron->basinWakeStep() == 0)
+        {
+            sim.performIterations(1);
+        }
+
+        // fell asleep in the step just run
+        quint32 sleep = world.parameters().currentStep - 1;
+        quint32 wake = electron->basinWakeStep();
+        if (wake != 0 && wake - sleep > 2)
+        {
+            int site = electron->getCurrentSite();
+            double rate = basins.meanHops(basin, site, -1) / basins.meanSteps(basin, site, -1);
+            sim.performIterations((wake - sleep) / 2);
+            int before = electron->pathlength();
+
+            ElectronAgent *visitor = new ElectronAgent(world, other);
+            wakes += 1;
+            if (electron->basinWakeStep() != 0 || basins.sleepers() != 0)
+            {
+                missed += 1;
+            }
+            credited += electron->pathlength() - before;
+            expected += rate * (world.parameters().currentStep - sleep);
+            grid.unregisterAgent(visitor);
+            delete visitor;
+        }
+        world.electrons().removeOne(electron);
+        grid.unregisterAgent(electron);
+        delete electron;
+    }
+
+    // within rounding, up to a hop per wake
+    bool ok = wakes > 0 && missed == 0 && fabs(credited - expected) <= wakes;
+
+    qDebug("langmuir: %s basin %d woken early: %d wakes, %d missed", ok ? "PASS" : "FAIL", basin, wakes, missed);
+    qDebug("langmuir:     hops credited %.0f expected %.2f", credited, expected);
+
+    return ok ? 0 : 1;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("compare the trap basin exit times and sites with step by step walks and trap.accelerate runs");
+    clparser.add("--seed", "seed", "random.seed (1)");
+    clparser.add("--trials", "trials", "walks out of each basin (4000)");
+    clparser.add("--basins", "basins", "basins of 2 or more sites to check (3)");
+    clparser.parse(args);
+
+    int seed = clparser.get<int>("seed", 1);
+    int trials = clparser.get<int>("trials", 4000);
+    int numBasins = clparser.get<int>("basins", 3);
+
+    int failed = 0;
+    int checked = 0;
+
+    // a shallow and a deeper trap, both shallow enough to walk out of step by step, and a deep
+    // one only run with trap.accelerate
+    double potentials[] = { 0.05, 0.10, 0.20 };
+    for (int i = 0; i < 3; i++)
+    {
+        SimulationParameters par = basinParameters(seed + i, potentials[i]);
+        World world(par, 1);
+        Simulation sim(world);
+        TrapBasins& basins = world.trapBasins();
+        qDebug("langmuir: trap.potential = %.2f", potentials[i]);
+
+        int found = 0;
+        for (int b = 0; b < basins.count() && found < numBasins; b++)
+        {
+            if (basins.sites(b).size() < 2)
+            {
+                continue;
+            }
+            if (potentials[i] < 0.15)
+            {
+                failed += check(world, b, trials);
+                checked += 1;
+            }
+            failed += simulate(world, sim, b, trials / 4);
+            failed += wakeEarly(world, sim, b, trials / 16);
+            checked += 2;
+            found += 1;
+        }
+        if (found == 0)
+        {
+            qDebug("langmuir: FAIL no basin of 2 or more sites");
+            failed += 1;
+        }
+    }
+
+    qDebug("langmuir: %d of %d checks failed", failed, checked);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+#include <QCoreApplication>
+#include <QDebug>
+
+#include "openclhelper.h"
+#include "vectorcoulomb.h"
+#include "chargeagent.h"
+#include "parameters.h"
+#include "potential.h"
+#include "cubicgrid.h"
+#include "clparser.h"
+#include "world.h"
+#include "rand.h"
+
+#include <cmath>
+
+using namespace Langmuir;
+
+// ctest treats this exit code as a skipped test
+static const int SKIPPED = 77;
+
+/**
+ * @brief Largest absolute and relative difference seen so far
+ */
+struct Error
+{
+    Error() : absolute(0), scale(0), count(0)
+    {
+    }
+
+    void add(double cpu, double gpu)
+    {
+        absolute = qMax(absolute, fabs(gpu - cpu));
+        scale = qMax(scale, fabs(cpu));
+        count++;
+    }
+
+    //! max error relative to the largest CPU value
+    double relative() const
+    {
+        return scale > 0 ? absolute / scale : absolute;
+    }
+
+    double absolute;
+    double scale;
+    int count;
+};
+
+/**
+ * @brief One randomized world to check
+ */
+struct Case
+{
+    int x;
+    int y;
+    int z;
+    int cutoff;
+    double sigma;
+    int defectsCharge;
+    double electrons;
+    double holes;
+    const char *layout;
+};
+
+static double cpuPotential(World& world, int site)
+{
+    Potential& potential = world.potential();
+    double v = 0;
+    if (world.parameters().coulombGaussianSigma > 0)
+    {
+        v += potential.gaussE(site) + potential.gaussH(site);
+        if (world.parameters().defectsCharge != 0)
+        {
+            v += potential.gaussD(site);
+        }
+    }
+    else
+    {
+        v += potential.coulombE(site) + potential.coulombH(site);
+        if (world.parameters().defectsCharge != 0)
+        {
+            v += potential.coulombD(site);
+        }
+    }
+    return v;
+}
+
+/**
+ * @brief Parameters for a case, with the carriers seeded and OpenCL off
+ */
+static SimulationParameters caseParameters(const Case& c, int seed)
+{
+    SimulationParameters par;
+    par.outputIsOn = false;
+    par.randomSeed = seed;
+    par.gridX = c.x;
+    par.gridY = c.y;
+    par.gridZ = c.z;
+    par.coulombCarriers = true;
+    par.coulombGaussianSigma = c.sigma;
+    par.electrostaticCutoff = c.cutoff;
+    par.electronPercentage = c.electrons;
+    par.holePercentage = c.holes;
+    par.defectPercentage = c.defectsCharge != 0 ? 0.02 : 0.0;
+    par.defectsCharge = c.defectsCharge;
+    par.seedCharges = 1.0;
+    par.useOpenCL = false;
+    par.gridLayout = c.layout;
+    return par;
+}
+
+/**
+ * @brief Give every carrier a random future site inside the grid
+ */
+static void randomFutures(World& world, const QList<ChargeAgent*>& charges)
+{
+    Random& random = world.randomNumberGenerator();
+    int volume = world.electronGrid().volume();
+    foreach (ChargeAgent *charge, charges)
+    {
+        charge->setFutureSite(random.integer(0, volume - 1));
+    }
+}
+
+/**
+ * @brief Compare the VectorCoulomb sums (current and future sites) against the Potential sums
+ * @param simd cpu.simd to ask for
+ * @return -1 if the CPU does not have that instruction set, 0 on success, 1 on failure
+ */
+static int checkVector(const Case& c, const QString& simd, int seed, double tolerance)
+{
+    SimulationParameters par = caseParameters(c, seed);
+    par.cpuSimd = simd;
+
+    World world(par, 1);
+    if (world.vectorCoulomb().isaName() != simd)
+    {
+        return -1;
+    }
+
+    QList<ChargeAgent*> charges = world.electrons() + world.holes();
+    randomFutures(world, charges);
+    world.vectorCoulomb().compute();
+
+    // the outputs are in the order of electrons followed by holes
+    Error current;
+    Error future;
+    for (int i = 0; i < charges.size(); i++)
+    {
+        current.add(cpuPotential(world, charges[i]->getCurrentSite()), world.vectorCoulomb().getOutputCurrent(i));
+        future.add(cpuPotential(world, charges[i]->getFutureSite()), world.vectorCoulomb().getOutputFuture(i));
+    }
+
+    bool ok = current.relative() <= tolerance && future.relative() <= tolerance;
+    qDebug("langmuir: %s %dx%dx%d cutoff=%d sigma=%g defects.charge=%d e=%d h=%d layout=%s cpu.simd=%s",
+           ok ? "PASS" : "FAIL", c.x, c.y, c.z, c.cutoff, c.sigma, c.defectsCharge,
+           world.numElectronAgents(), world.numHoleAgents(), c.layout, qPrintable(simd));
+    qDebug("langmuir:     %-8s current max=%.3e rel=%.3e (%d sites)", "vector",
+           current.absolute, current.relative(), current.count);
+    qDebug("langmuir:     %-8s future  max=%.3e rel=%.3e (%d sites)", "vector",
+           future.absolute, future.relative(), future.count);
+
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Compare coulomb2/gauss2/table2 (current and future sites) and
+ * coulomb1/gauss1 (every site) against the Potential sums
+ * @param precision opencl.precision, which chooses the Kernel2
+ * @return -1 if OpenCL is not available, 0 on success, 1 on failure
+ */
+static int check(const Case& c, const QString& precision, int seed, int platform, const QString& deviceType,
+                 int gpuID, int samples, double tolerance)
+{
+    SimulationParameters par = caseParameters(c, seed);
+    par.openclPrecision = precision;
+    par.openclPlatform = platform;
+    par.openclDeviceType = deviceType;
+
+    World world(par, 1, gpuID);
+    if (!world.parameters().okCL)
+    {
+        return -1;
+    }
+
+    QString name = QString("%1x%2x%3 cutoff=%4 sigma=%5 defects.charge=%6 e=%7 h=%8 layout=%9")
+            .arg(c.x).arg(c.y).arg(c.z).arg(c.cutoff).arg(c.sigma).arg(c.defectsCharge)
+            .arg(world.numElectronAgents()).arg(world.numHoleAgents()).arg(c.layout)
+            + QString(" precision=%1").arg(precision);
+
+    QList<ChargeAgent*> charges = world.electrons() + world.holes();
+    randomFutures(world, charges);
+    Random& random = world.randomNumberGenerator();
+    Grid& grid = world.electronGrid();
+    int volume = grid.volume();
+
+    // Kernel 2
+    if (c.sigma > 0)
+    {
+        world.opencl().launchGaussKernel2();
+    }
+    else
+    {
+        world.opencl().launchCoulombKernel2();
+    }
+
+    Error current;
+    Error future;
+    foreach (ChargeAgent *charge, charges)
+    {
+        int id = charge->getOpenCLID();
+        current.add(cpuPotential(world, charge->getCurrentSite()), world.opencl().getOutputHost(id));
+        future.add(cpuPotential(world, charge->getFutureSite()), world.opencl().getOutputHostFuture(id));
+    }
+
+    // Kernel 2 again, with the current sites prefetched as in opencl.pipeline mode
+    if (c.sigma > 0)
+    {
+        world.opencl().prefetchGaussKernel2();
+        world.opencl().launchGaussKernel2();
+    }
+    else
+    {
+        world.opencl().prefetchCoulombKernel2();
+        world.opencl().launchCoulombKernel2();
+    }
+
+    Error pipeline;
+    foreach (ChargeAgent *charge, charges)
+    {
+        int id = charge->getOpenCLID();
+        pipeline.add(cpuPotential(world, charge->getCurrentSite()), world.opencl().getOutputHost(id));
+        pipeline.add(cpuPotential(world, charge->getFutureSite()), world.opencl().getOutputHostFuture(id));
+    }
+
+    // Kernel 1, which fills the output in canonical site order
+    if (c.sigma > 0)
+    {
+        world.opencl().launchGaussKernel1();
+    }
+    else
+    {
+        world.opencl().launchCoulombKernel1();
+    }
+
+    Error everywhere;
+    if (samples <= 0 || samples >= volume)
+    {
+        for (int site = 0; site < volume; site++)
+        {
+            everywhere.add(cpuPotential(world, site), world.opencl().getOutputHost(grid.canonicalSite(site)));
+        }
+    }
+    else
+    {
+        for (int i = 0; i < samples; i++)
+        {
+            int site = random.integer(0, volume - 1);
+            everywhere.add(cpuPotential(world, site), world.opencl().getOutputHost(grid.canonicalSite(site)));
+        }
+    }
+
+    bool ok = current.relative() <= tolerance &&
+              future.relative() <= tolerance &&
+              pipeline.relative() <= tolerance &&
+              everywhere.relative() <= tolerance;
+
+    const char *kernel2 = precision != "double" ? "table2" : c.sigma > 0 ? "gauss2" : "coulomb2";
+    const char *kernel1 = c.sigma > 0 ? "gauss1" : "coulomb1";
+    qDebug("langmuir: %s %s", ok ? "PASS" : "FAIL", qPrintable(name));
+    qDebug("langmuir:     %-8s current max=%.3e rel=%.3e (%d sites)", kernel2,
+           current.absolute, current.relative(), current.count);
+    qDebug("langmuir:     %-8s future  max=%.3e rel=%.3e (%d sites)", kernel2,
+           future.absolute, future.relative(), future.count);
+    qDebug("langmuir:     %-8s prefetch max=%.3e rel=%.3e (%d sites)", kernel2,
+           pipeline.absolute, pipeline.relative(), pipeline.count);
+    qDebug("langmuir:     %-8s grid    max=%.3e rel=%.3e (%d sites)", kernel1,
+           everywhere.absolute, everywhere.relative(), everywhere.count);
+
+    return ok ? 0 : 1;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("compare the vectorized CPU sums and the OpenCL coulomb kernels to the Potential sums");
+    clparser.add("--gpu", "gpu", "index of device to use");
+    clparser.add("--platform", "platform", "index of OpenCL platform to use (0)");
+    clparser.add("--device-type", "type", "type of OpenCL device to use (all)");
+    clparser.add("--seed", "seed", "first random.seed (1)");
+    clparser.add("--samples", "samples", "sites checked for coulomb1/gauss1, 0 for all (2000)");
+    clparser.add("--tolerance", "tolerance", "max error relative to the largest potential (1e-6)");
+    clparser.add("--single-tolerance", "single", "max relative error of opencl.precision = single (1e-5)");
+    clparser.parse(args);
+
+    int gpuID = clparser.get<int>("gpu", -1);
+    int platform = clparser.get<int>("platform", 0);
+    QString deviceType = clparser.get<QString>("type", "all");
+    int seed = clparser.get<int>("seed", 1);
+    int samples = clparser.get<int>("samples", 2000);
+    double tolerance = clparser.get<float>("tolerance", 1e-6f);
+    double singleTolerance = clparser.get<float>("single", 1e-5f);
+
+    // x, y, z, cutoff, sigma, defects.charge, electron.percentage, hole.percentage, grid.layout
+    Case cases[] = {
+        { 32, 32, 4,  8, 0.0,  0, 0.010, 0.000, "linear" },
+        { 32, 32, 4,  8, 1.0,  0, 0.010, 0.000, "linear" },
+        { 32, 32, 4, 16, 0.0, -1, 0.010, 0.010, "linear" },
+        { 32, 32, 4, 16, 1.0, -1, 0.010, 0.010, "linear" },
+        { 64, 16, 1, 10, 0.0,  1, 0.050, 0.020, "linear" },
+        { 64, 16, 4, 10, 2.0,  1, 0.050, 0.020, "linear" },
+        { 20, 20, 8, 50, 0.0,  0, 0.100, 0.100, "linear" },
+        { 20, 20, 8, 50, 1.5, -1, 0.100, 0.100, "linear" },
+        { 60, 20, 1, 10, 0.0, -1, 0.050, 0.020, "tiled"  },
+        { 20, 12, 9, 50, 1.5,  1, 0.100, 0.100, "tiled"  }
+    };
+    int numCases = sizeof(cases) / sizeof(Case);
+
+    // the CPU sums need no device, so they are checked first, for each cpu.simd this CPU has
+    QStringList isas = QStringList() << "scalar" << "avx2" << "avx512";
+
+    int failed = 0;
+    int checked = 0;
+    for (int i = 0; i < numCases; i++)
+    {
+        foreach (QString simd, isas)
+        {
+            int result = checkVector(cases[i], simd, seed + i, tolerance);
+            if (result >= 0)
+            {
+                failed += result;
+                checked += 1;
+            }
+        }
+    }
+
+    // every case is run with each opencl.precision; float sums get their own tolerance
+    QStringList precisions = QStringList() << "double" << "table" << "single";
+
+    for (int i = 0; i < numCases; i++)
+    {
+        foreach (QString precision, precisions)
+        {
+            int result = check(cases[i], precision, seed + i, platform, deviceType, gpuID, samples,
+                               precision == "single" ? singleTolerance : tolerance);
+            if (result < 0)
+            {
+                // the CPU sums passed on their own; only skip if nothing was checked at all
+                qDebug("langmuir: OpenCL is not available; skipping the kernels");
+                qDebug("langmuir: %d of %d cases failed", failed, checked);
+                if (failed > 0)
+                {
+                    return 1;
+                }
+                return checked > 0 ? 0 : SKIPPED;
+            }
+            failed += result;
+            checked += 1;
+        }
+    }
+
+    qDebug("langmuir: %d of %d cases failed", failed, checked);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+#include <QCoreApplication>
+#include <QDebug>
+
+#include "sourceagent.h"
+#include "drainagent.h"
+#include "simulation.h"
+#include "parameters.h"
+#include "clparser.h"
+#include "world.h"
+
+#include <cmath>
+
+using namespace Langmuir;
+
+// ctest treats this exit code as a skipped test
+static const int SKIPPED = 77;
+
+/**
+ * @brief Parameters for a small transistor with a current flowing left to right
+ */
+static SimulationParameters engineParameters(int seed, bool coulomb, bool engine)
+{
+    SimulationParameters par;
+    par.outputIsOn = false;
+    par.randomSeed = seed;
+    par.gridX = 32;
+    par.gridY = 16;
+    par.gridZ = 2;
+    par.electronPercentage = 0.02;
+    par.holePercentage = 0;
+    par.voltageRight = 1.0;
+    par.coulombCarriers = coulomb;
+    par.electrostaticCutoff = 5;
+    par.trapPercentage = 0.05;
+    par.seedCharges = 1.0;
+    par.useOpenCL = engine;
+    par.openclEngine = engine;
+    return par;
+}
+
+/**
+ * @brief Mean and standard error of the batch values of one observable
+ */
+struct Sample
+{
+    Sample() : sum(0), sum2(0), count(0)
+    {
+    }
+
+    void add(double value)
+    {
+        sum += value;
+        sum2 += value * value;
+        count++;
+    }
+
+    double mean() const
+    {
+        return count > 0 ? sum / count : 0;
+    }
+
+    double error() const
+    {
+        if (count < 2)
+        {
+            return 0;
+        }
+        double m = mean();
+        return sqrt(qMax(0.0, (sum2 / count - m * m) / (count - 1)));
+    }
+
+    double sum;
+    double sum2;
+    int count;
+};
+
+/**
+ * @brief The observables of one run, one value per batch
+ */
+struct Run
+{
+    Sample current;
+    Sample electrons;
+    Sample injected;
+};
+
+/**
+ * @brief Warm the deck up, then measure the drain current, injection and carrier count of each batch
+ */
+static Run run(World& world, int warmup, int batches, int steps)
+{
+    Simulation sim(world);
+    sim.performIterations(warmup * steps);
+
+    Run result;
+    for (int b = 0; b < batches; b++)
+    {
+        unsigned long int drained = world.electronDrainAgentRight().successes();
+        unsigned long int sourced = world.electronSourceAgentLeft().successes();
+        sim.performIterations(steps);
+        result.current.add(double(world.electronDrainAgentRight().successes() - drained) / steps);
+        result.injected.add(double(world.electronSourceAgentLeft().successes() - sourced) / steps);
+        result.electrons.add(world.numElectronAgents());
+    }
+    return result;
+}
+
+/**
+ * @brief Compare one observable of the engine run with the host run
+ * @return 0 on success, 1 on failure
+ *
+ * The engine resolves moves at once, so besides the noise it may be off by up to tolerance of the host mean.
+ */
+static int compare(const char *name, const Sample& host, const Sample& device, double sigmas, double tolerance)
+{
+    double difference = device.mean() - host.mean();
+    double error = sqrt(host.error() * host.error() + device.error() * device.error());
+    double allowed = sigmas * error + tolerance * fabs(host.mean());
+    bool ok = fabs(difference) <= allowed;
+    qDebug("langmuir:     %-10s host %.4f +- %.4f engine %.4f +- %.4f (%+.2f%%, allowed %.4f) %s",
+           name, host.mean(), host.error(), device.mean(), device.error(),
+           host.mean() != 0 ? 100 * difference / host.mean() : 0.0, allowed, ok ? "" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Run the deck with opencl.engine off and on and compare the batch means
+ * @return -1 if OpenCL is not available, 0 on success, 1 on failure
+ */
+static int check(int seed, bool coulomb, int platform, const QString& deviceType, int gpuID,
+                 int warmup, int batches, int steps, double sigmas, double tolerance)
+{
+    SimulationParameters hostPar = engineParameters(seed, coulomb, false);
+    hostPar.openclPlatform = platform;
+    hostPar.openclDeviceType = deviceType;
+    World host(hostPar, 1, gpuID);
+    if (!host.parameters().okCL)
+    {
+        return -1;
+    }
+    Run hostRun = run(host, warmup, batches, steps);
+
+    // a different seed, so the runs are independent
+    SimulationParameters devicePar = engineParameters(seed + 1000, coulomb, true);
+    devicePar.openclPlatform = platform;
+    devicePar.openclDeviceType = deviceType;
+    World device(devicePar, 1, gpuID);
+    Run deviceRun = run(device, warmup, batches, steps);
+
+    int failed = 0;
+    failed += compare("current", hostRun.current, deviceRun.current, sigmas, tolerance);
+    failed += compare("injected", hostRun.injected, deviceRun.injected, sigmas, tolerance);
+    failed += compare("electrons", hostRun.electrons, deviceRun.electrons, sigmas, tolerance);
+
+    qDebug("langmuir: %s %dx%dx%d coulomb.carriers=%d: %d batches of %d steps",
+           failed == 0 ? "PASS" : "FAIL", hostPar.gridX, hostPar.gridY, hostPar.gridZ,
+           int(coulomb), batches, steps);
+
+    return failed == 0 ? 0 : 1;
+}
+
+int main (int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("compare the drain current and carrier count of opencl.engine runs with the host step");
+    clparser.add("--gpu", "gpu", "index of device to use");
+    clparser.add("--platform", "platform", "index of OpenCL platform to use (0)");
+    clparser.add("--device-type", "type", "type of OpenCL device to use (all)");
+    clparser.add("--seed", "seed", "random.seed (1)");
+    clparser.add("--warmup", "warmup", "batches run before measuring (20)");
+    clparser.add("--batches", "batches", "batches measured (60)");
+    clparser.add("--steps", "steps", "steps per batch (50)");
+    clparser.add("--sigmas", "sigmas", "standard errors the means may differ by (5)");
+    clparser.add("--tolerance", "tolerance", "further difference allowed, relative to the host mean (0.05)");
+    clparser.parse(args);
+
+    int gpuID = clparser.get<int>("gpu", -1);
+    int platform = clparser.get<int>("platform", 0);
+    QString deviceType = clparser.get<QString>("type", "all");
+    int seed = clparser.get<int>("seed", 1);
+    int warmup = clparser.get<int>("warmup", 20);
+    int batches = clparser.get<int>("batches", 60);
+    int steps = clparser.get<int>("steps", 50);
+    double sigmas = clparser.get<float>("sigmas", 5.0f);
+    double tolerance = clparser.get<float>("tolerance", 0.05f);
+
+    int failed = 0;
+    int checked = 0;
+    for (int coulomb = 0; coulomb < 2; coulomb++)
+    {
+        int result = check(seed + coulomb, coulomb != 0, platform, deviceType, gpuID,
+                           warmup, batches, steps, sigmas, tolerance);
+        if (result < 0)
+        {
+            qDebug("langmuir: OpenCL is not available; skipping the engine");
+            return SKIPPED;
+        }
+        failed += result;
+        checked += 1;
+    }
+
+    qDebug("langmuir: %d of %d runs failed", failed, checked);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <QSet>
+
+#include "chargeagent.h"
+#include "sourceagent.h"
+#include "drainagent.h"
+#include "simulation.h"
+#include "mpiengine.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "sitestore.h"
+#include "clparser.h"
+#include "world.h"
+
+#include <mpi.h>
+
+using namespace Langmuir;
+
+/**
+ * @brief Parameters for a small transistor with a current flowing left to right
+ */
+static SimulationParameters mpiParameters(int seed, bool coulomb, bool closed)
+{
+    SimulationParameters par;
+    par.outputIsOn = false;
+    par.randomSeed = seed;
+    par.gridX = 48;
+    par.gridY = 16;
+    par.gridZ = 2;
+    par.gridStorage = "paged";
+    par.electronPercentage = 0.02;
+    par.holePercentage = 0;
+    par.voltageRight = 1.0;
+    par.coulombCarriers = coulomb;
+    par.electrostaticCutoff = 5;
+    par.useOpenCL = false;
+    par.trapPercentage = 0.05;
+    par.defectPercentage = 0.01;
+    if (closed)
+    {
+        par.sourceRate = 0;
+        par.drainRate = 0;
+    }
+    return par;
+}
+
+/**
+ * @brief Sum an int over the ranks, on every rank
+ */
+static int sum(int value)
+{
+    int total = 0;
+    MPI_Allreduce(&value, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    return total;
+}
+
+/**
+ * @brief The electrons that came in minus the ones that went out, on rank 0 after a batch
+ */
+static int netInjected(World& world)
+{
+    return int(world.electronSourceAgentLeft().successes()) +
+           int(world.electronSourceAgentRight().successes()) -
+           int(world.electronDrainAgentLeft().successes()) -
+           int(world.electronDrainAgentRight().successes());
+}
+
+/**
+ * @brief Check that every carrier is owned by exactly one rank, inside its slab
+ * @return the number of failed checks on this rank
+ */
+static int checkOwners(World& world, int batch)
+{
+    MpiEngine& engine = world.mpiEngine();
+    Grid& grid = world.electronGrid();
+
+    int outside = 0;
+    QVector<int> sites;
+    foreach (ChargeAgent *charge, engine.owned())
+    {
+        int x = grid.getIndexX(charge->getCurrentSite());
+        if (x < engine.xBegin() || x >= engine.xEnd())
+        {
+            outside += 1;
+        }
+        sites.push_back(charge->getCurrentSite());
+    }
+
+    // gather the owned sites on rank 0
+    int size = MpiEngine::size();
+    int count = sites.size();
+    QVector<int> counts(size, 0);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    QVector<int> offsets(size, 0);
+    int total = 0;
+    for (int r = 0; r < size; r++)
+    {
+        offsets[r] = total;
+        total += counts[r];
+    }
+    QVector<int> all(qMax(total, 1), 0);
+    MPI_Gatherv(sites.data(), count, MPI_INT, all.data(), counts.data(), offsets.data(), MPI_INT,
+                0, MPI_COMM_WORLD);
+
+    int failed = 0;
+    if (MpiEngine::rank() == 0)
+    {
+        QSet<int> unique;
+        for (int i = 0; i < total; i++)
+        {
+            unique.insert(all[i]);
+        }
+        int duplicates = total - unique.size();
+        if (duplicates > 0)
+        {
+            qDebug("langmuir: FAIL batch %d: %d sites owned twice", batch, duplicates);
+            failed += 1;
+        }
+    }
+    outside = sum(outside);
+    if (outside > 0 && MpiEngine::rank() == 0)
+    {
+        qDebug("langmuir: FAIL batch %d: %d carriers outside their slab", batch, outside);
+        failed += 1;
+    }
+    return failed;
+}
+
+/**
+ * @brief Check that a rank only stores the sites of its slab and halo, and the carriers it holds
+ * @return the number of failed checks on this rank
+ */
+static int checkWindow(World& world, int batch)
+{
+    MpiEngine& engine = world.mpiEngine();
+    Grid& grid = world.electronGrid();
+    int begin = engine.xBegin() - engine.halo();
+    int end = engine.xEnd() + engine.halo();
+
+    // rank 0 also holds the other ranks' carriers between batches
+    QSet<int> carriers;
+    foreach (ChargeAgent *charge, world.electrons() + world.holes())
+    {
+        carriers.insert(charge->getCurrentSite());
+    }
+
+    int outside = 0;
+    int stored = 0;
+    foreach (int site, world.siteStore().storedSites())
+    {
+        if (carriers.contains(site))
+        {
+            continue;
+        }
+        int x = grid.getIndexX(site);
+        if (x < begin || x >= end)
+        {
+            outside += 1;
+        }
+        stored += 1;
+    }
+
+    int failed = 0;
+    if (outside > 0)
+    {
+        qDebug("langmuir: FAIL batch %d rank %d: %d sites stored outside x = %d to %d",
+               batch, MpiEngine::rank(), outside, begin, end - 1);
+        failed += 1;
+    }
+    int whole = world.trapSiteIDs().size() + world.defectSiteIDs().size();
+    if (end - begin < grid.xSize() && stored >= whole)
+    {
+        qDebug("langmuir: FAIL batch %d rank %d: %d sites stored, as many as the %d traps and defects of the device",
+               batch, MpiEngine::rank(), stored, whole);
+        failed += 1;
+    }
+    return failed;
+}
+
+/**
+ * @brief Run a few batches with no sources or drains, and check every carrier aged once per step
+ * @return the number of failed checks, on every rank
+ */
+static int checkLifetimes(int seed, bool coulomb, int batches, int steps)
+{
+    SimulationParameters par = mpiParameters(seed, coulomb, true);
+    World world(par, 1);
+    Simulation sim(world);
+
+    // rank 0 holds every carrier between batches
+    qint64 initial = 0;
+    foreach (ChargeAgent *charge, world.electrons())
+    {
+        initial += charge->lifetime();
+    }
+    int count = world.electrons().size();
+
+    int failed = 0;
+    for (int b = 1; b <= batches; b++)
+    {
+        sim.performIterations(steps);
+        if (MpiEngine::rank() != 0)
+        {
+            continue;
+        }
+        qint64 total = 0;
+        foreach (ChargeAgent *charge, world.electrons())
+        {
+            total += charge->lifetime();
+        }
+        qint64 expected = initial + qint64(count) * steps * b;
+        if (world.electrons().size() != count || total != expected)
+        {
+            qDebug("langmuir: FAIL batch %d: %d electrons aged %lld steps in all, expected %d aged %lld",
+                   b, world.electrons().size(), total, count, expected);
+            failed += 1;
+        }
+    }
+    failed = sum(failed);
+
+    if (MpiEngine::rank() == 0)
+    {
+        qDebug("langmuir: %s lifetimes with coulomb.carriers = %s, %d electrons, %d steps",
+               failed == 0 ? "PASS" : "FAIL", coulomb ? "true" : "false", count, batches * steps);
+    }
+    return failed;
+}
+
+/**
+ * @brief Run a few batches and check the carriers after each
+ * @return the number of failed checks, on every rank
+ */
+static int check(int seed, bool coulomb, int batches, int steps)
+{
+    SimulationParameters par = mpiParameters(seed, coulomb, false);
+    World world(par, 1);
+    Simulation sim(world);
+
+    int initial = sum(world.mpiEngine().owned().size());
+    if (MpiEngine::rank() == 0)
+    {
+        qDebug("langmuir: coulomb.carriers = %s, %d ranks, %d electrons",
+               coulomb ? "true" : "false", MpiEngine::size(), initial);
+    }
+
+    int failed = checkOwners(world, 0) + checkWindow(world, 0);
+    for (int b = 1; b <= batches; b++)
+    {
+        sim.performIterations(steps);
+        failed += checkOwners(world, b);
+        failed += checkWindow(world, b);
+
+        // the flux counts are summed on rank 0
+        int owned = sum(world.mpiEngine().owned().size());
+        if (MpiEngine::rank() == 0 && owned != initial + netInjected(world))
+        {
+            qDebug("langmuir: FAIL batch %d: %d electrons, expected %d + %d",
+                   b, owned, initial, netInjected(world));
+            failed += 1;
+        }
+
+        // rank 0 holds every carrier for the output, ghosts left out, and the cap holds across ranks
+        if (MpiEngine::rank() == 0 && world.electrons().size() != owned)
+        {
+            qDebug("langmuir: FAIL batch %d: rank 0 holds %d electrons, the ranks own %d",
+                   b, world.electrons().size(), owned);
+            failed += 1;
+        }
+        if (MpiEngine::rank() == 0 && owned > world.maxElectronAgents())
+        {
+            qDebug("langmuir: FAIL batch %d: %d electrons, more than the %d allowed",
+                   b, owned, world.maxElectronAgents());
+            failed += 1;
+        }
+    }
+    failed = sum(failed);
+
+    if (MpiEngine::rank() == 0)
+    {
+        qDebug("langmuir: %s after %d steps, %d in and %d out", failed == 0 ? "PASS" : "FAIL",
+               batches * steps, int(world.electronSourceAgentLeft().successes()),
+               int(world.electronDrainAgentRight().successes()));
+    }
+    return failed;
+}
+
+int main (int argc, char *argv[])
+{
+    MpiEngine::initialize(&argc, &argv);
+
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    CommandLineParser clparser;
+    clparser.setDescription("check that carriers are kept and handed over correctly across MPI ranks");
+    clparser.add("--seed", "seed", "random.seed (1)");
+    clparser.add("--batches", "batches", "batches of steps (10)");
+    clparser.add("--steps", "steps", "steps per batch (50)");
+    clparser.parse(args);
+
+    int seed = clparser.get<int>("seed", 1);
+    int batches = clparser.get<int>("batches", 10);
+    int steps = clparser.get<int>("steps", 50);
+
+    if (MpiEngine::size() < 2)
+    {
+        qDebug("langmuir: FAIL run with 2 or more MPI ranks");
+        MpiEngine::finalize();
+        return 1;
+    }
+
+    int failed = 0;
+    failed += check(seed, false, batches, steps);
+    failed += check(seed + 1, true, batches, steps);
+    failed += checkLifetimes(seed + 2, false, batches, steps);
+    failed += checkLifetimes(seed + 3, true, batches, steps);
+
+    if (MpiEngine::rank() == 0)
+    {
+        qDebug("langmuir: %d checks failed", failed);
+    }
+    MpiEngine::finalize();
+    return failed == 0 ? 0 : 1;
+}